@@ -0,0 +1,118 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BUS_STATS_H
+#define _BUS_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct can_frame;
+struct canopen_msg;
+
+#define BS_N_NODES 128
+#define BS_N_TYPES 16
+#define BS_N_BUCKETS 128
+#define BS_BUCKET_LENGTH 100000000ULL /* ns */
+#define BS_EPOCH_SHIFT 18
+#define BS_UPDATE_INTERVAL 60000000000ULL /* ns */
+
+/* Live traffic counters for the bus. Counters may be updated from any thread
+ * with native 32-bit atomics. They are read by one thread, which widens them
+ * to 64 bits and which must call bs_update() at least every
+ * BS_UPDATE_INTERVAL.
+ *
+ * Frames are counted per node and per object type, where node 0 holds frames
+ * that are not addressed to a node and type 0 holds frames with an unknown
+ * COB-ID.
+ *
+ * For bus load, the bits put on the bus are summed into buckets of
+ * BS_BUCKET_LENGTH. Each bucket holds the number of the period that it
+ * belongs to above BS_EPOCH_SHIFT, so that a stale bucket can be claimed and
+ * added to with a single compare-and-swap. Period numbers wrap around after
+ * 2^(32 - BS_EPOCH_SHIFT) periods, so bs_update() also marks stale buckets as
+ * recently stale, before they could be mistaken for current ones.
+ */
+
+enum bs_direction {
+	BS_RX = 0,
+	BS_TX,
+};
+
+/* raw is added to atomically; last_raw and total belong to the reader */
+struct bs_value {
+	uint32_t raw;
+	uint32_t last_raw;
+	uint64_t total;
+};
+
+struct bs_cell {
+	struct bs_value frames;
+	struct bs_value bytes;
+};
+
+struct bs_counter {
+	uint64_t frames;
+	uint64_t bytes;
+};
+
+struct bus_stats {
+	unsigned int bitrate;
+	struct bs_cell node[2][BS_N_NODES][BS_N_TYPES];
+	struct bs_value n_errors[2];
+	struct bs_value n_unknown;
+	struct bs_value n_dropped;
+	uint32_t buckets[BS_N_BUCKETS];
+};
+
+void bs_init(struct bus_stats* self, unsigned int bitrate);
+
+/* Fold the counters into their 64-bit totals and retire stale buckets. now
+ * is on the monotonic clock.
+ */
+void bs_update(struct bus_stats* self, uint64_t now);
+
+/* Count a frame that was received or sent at the given time on the monotonic
+ * clock. msg may be NULL if the frame has not been classified.
+ */
+void bs_count(struct bus_stats* self, enum bs_direction direction,
+	      const struct can_frame* cf, const struct canopen_msg* msg,
+	      uint64_t now);
+
+/* A received frame that was not handled, e.g. because it came from a node
+ * that is not managed.
+ */
+void bs_count_dropped(struct bus_stats* self);
+
+/* Sending a frame failed */
+void bs_count_error(struct bus_stats* self, enum bs_direction direction);
+
+uint64_t bs_get_value(const struct bs_value* value);
+
+void bs_get_total(const struct bus_stats* self, enum bs_direction direction,
+		  struct bs_counter* total);
+void bs_get_node_total(const struct bus_stats* self,
+		       enum bs_direction direction, int nodeid,
+		       struct bs_counter* total);
+
+/* Fraction of the bit rate used over the complete periods within the last
+ * window nanoseconds. The window is at most BS_N_BUCKETS - 1 periods long.
+ */
+double bs_get_load(const struct bus_stats* self, uint64_t window,
+		   uint64_t now);
+
+void bs_print_json(const struct bus_stats* self, FILE* out, uint64_t now);
+
+#endif /* _BUS_STATS_H */
@@ -0,0 +1,180 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_RPC_H
+#define _CANOPEN_RPC_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+/* Binary request/reply protocol for services on the same host as the master
+ *
+ * The master listens on the Unix stream socket named by rpc_path in the
+ * [master] section of the configuration. Every message starts with a
+ * co_rpc_header and is followed by the fixed layout for its type and, for SDO
+ * data, a variable sized tail. All fields are in host byte order and every
+ * message is padded to a multiple of CO_RPC_ALIGN bytes, which is included in
+ * its size, so that messages can be used in place in a receive buffer.
+ *
+ * Requests carry an id that is chosen by the client and is copied into the
+ * reply. Any number of requests may be in flight; replies to SDO requests on
+ * different nodes may arrive in a different order than the requests were
+ * sent.
+ *
+ * A connection may hold one subscription. Events are sent as CO_RPC_EVENT
+ * messages with the id of the subscribe request. When a client does not keep
+ * up, events are dropped rather than queued and the number of events that
+ * were dropped is reported with the next one that is sent.
+ */
+
+#define CO_RPC_ALIGN 8
+#define CO_RPC_MESSAGE_MAX 65536
+#define CO_RPC_SDO_DATA_MAX (CO_RPC_MESSAGE_MAX - sizeof(struct co_rpc_sdo_req))
+
+#define co_rpc_align(size) \
+	(((size) + CO_RPC_ALIGN - 1) & ~(size_t)(CO_RPC_ALIGN - 1))
+
+enum co_rpc_type {
+	CO_RPC_SDO_UPLOAD = 1,
+	CO_RPC_SDO_DOWNLOAD,
+	CO_RPC_RPDO,
+	CO_RPC_SUBSCRIBE,
+	CO_RPC_EVENT,
+};
+
+enum co_rpc_flags {
+	/* No reply is sent unless the request fails */
+	CO_RPC_NO_REPLY = 1,
+};
+
+enum co_rpc_status {
+	CO_RPC_OK = 0,
+	CO_RPC_SDO_LOCAL_ABORT,
+	CO_RPC_SDO_REMOTE_ABORT,
+	CO_RPC_CANCELLED,
+	CO_RPC_NOMEM,
+	CO_RPC_BUSY,
+	CO_RPC_INVALID,
+	CO_RPC_SEND_FAILED,
+	CO_RPC_TOO_LARGE,
+};
+
+enum co_rpc_topic {
+	CO_RPC_PDO = 1 << 0,
+	CO_RPC_EMCY = 1 << 1,
+	CO_RPC_NMT = 1 << 2,
+	CO_RPC_ALL = (1 << 3) - 1,
+};
+
+struct co_rpc_header {
+	uint32_t size;
+	uint16_t type;
+	uint16_t flags;
+	uint32_t id;
+	uint32_t status;
+};
+
+/* CO_RPC_SDO_UPLOAD and CO_RPC_SDO_DOWNLOAD, the latter followed by size
+ * bytes of data.
+ */
+struct co_rpc_sdo_req {
+	struct co_rpc_header header;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t nodeid;
+	uint32_t size;
+	uint8_t data[];
+};
+
+/* Reply to either SDO request. The data of an upload follows. */
+struct co_rpc_sdo_reply {
+	struct co_rpc_header header;
+	uint32_t abort_code;
+	uint32_t size;
+	uint8_t data[];
+};
+
+/* CO_RPC_RPDO, n is 1 to 4. The reply is a bare header. */
+struct co_rpc_rpdo {
+	struct co_rpc_header header;
+	uint8_t data[8];
+	uint8_t nodeid;
+	uint8_t n;
+	uint8_t size;
+	uint8_t reserved[5];
+};
+
+/* CO_RPC_SUBSCRIBE replaces the subscription of the connection. Bit n of
+ * nodes selects node n and no bits selects all nodes. No topics ends the
+ * subscription. The reply is a bare header.
+ */
+struct co_rpc_subscribe {
+	struct co_rpc_header header;
+	uint32_t topics;
+	uint32_t reserved;
+	uint8_t nodes[16];
+};
+
+/* CO_RPC_EVENT carries a received TPDO, EMCY or heartbeat frame */
+struct co_rpc_event {
+	struct co_rpc_header header;
+	uint64_t timestamp; /* ns, monotonic */
+	uint32_t n_dropped;
+	uint16_t cob_id;
+	uint8_t size;
+	uint8_t topic;
+	uint8_t data[8];
+};
+
+struct co_rpc;
+
+struct co_rpc* co_rpc_open(const char* path);
+void co_rpc_close(struct co_rpc* self);
+int co_rpc_get_fd(const struct co_rpc* self);
+
+/* Requests are buffered until co_rpc_flush() or co_rpc_receive() is called,
+ * so that many can be sent at once. They return the id of the request, or -1
+ * on failure.
+ */
+int co_rpc_sdo_upload(struct co_rpc* self, int nodeid, int index,
+		      int subindex);
+int co_rpc_sdo_download(struct co_rpc* self, int nodeid, int index,
+			int subindex, const void* data, size_t size);
+int co_rpc_send_rpdo(struct co_rpc* self, int nodeid, int n, const void* data,
+		     size_t size, enum co_rpc_flags flags);
+int co_rpc_subscribe(struct co_rpc* self, unsigned int topics,
+		     const int* nodes, size_t n_nodes);
+
+int co_rpc_flush(struct co_rpc* self);
+
+/* Flush pending requests and wait for the next reply or event for at most
+ * timeout ms, or forever if timeout is negative. The message stays valid
+ * while other requests are made and flushed, until the next receive, blocking
+ * transfer or co_rpc_close(). NULL is returned with errno set to ETIMEDOUT on
+ * timeout.
+ */
+const struct co_rpc_header* co_rpc_receive(struct co_rpc* self, int timeout);
+
+/* Blocking SDO transfers. These wait for their own reply and may only be used
+ * while no other requests are in flight and there is no subscription. The
+ * abort code is stored in abort_code if it is not NULL.
+ */
+ssize_t co_rpc_sdo_read(struct co_rpc* self, int nodeid, int index,
+			int subindex, void* buffer, size_t size,
+			uint32_t* abort_code);
+int co_rpc_sdo_write(struct co_rpc* self, int nodeid, int index, int subindex,
+		     const void* data, size_t size, uint32_t* abort_code);
+
+#endif /* _CANOPEN_RPC_H */
@@ -16,6 +16,8 @@
 #ifndef CANOPEN_DUMP_H_
 #define CANOPEN_DUMP_H_
 
+#include <stdint.h>
+
 #define CO_DUMP_FILTER_SHIFT 8
 #define CO_DUMP_PDO_FILTER_SHIFT 16
 #define CO_DUMP_FILTER_MASK 0x00ffff00
@@ -24,6 +26,9 @@ enum co_dump_options {
 	CO_DUMP_TCP = 1,
 	CO_DUMP_TIMESTAMP = 1 << 1,
 	CO_DUMP_FILE = 1 << 2,
+	CO_DUMP_PCAPNG = 1 << 3,
+	CO_DUMP_JSON = 1 << 4,
+	CO_DUMP_CSV = 1 << 5,
 
 	CO_DUMP_FILTER_NMT = 1 << (CO_DUMP_FILTER_SHIFT + 0),
 	CO_DUMP_FILTER_SYNC = 1 << (CO_DUMP_FILTER_SHIFT + 1),
@@ -41,6 +46,37 @@ enum co_dump_options {
 			   | CO_DUMP_FILTER_PDO3 | CO_DUMP_FILTER_PDO4,
 };
 
+/* Selects which frames are shown. Times are in microseconds since the epoch
+ * and 0 means unbounded. nodes is a bitmap of node ids where no bits set
+ * means all nodes. cob is a COB-ID or -1 for all.
+ *
+ * Compact trace files are indexed, so only the blocks that may contain
+ * matching frames are read.
+ */
+struct co_dump_query {
+	uint64_t from;
+	uint64_t to;
+	uint8_t nodes[16];
+	int32_t cob;
+};
+
+/* Instead of printing frames, gather bus statistics in a single pass and
+ * print a report at the end. Files are split into chunks that are analysed
+ * in parallel. A live bus is analysed until the process is interrupted.
+ *
+ * bitrate is used to turn bits per second into bus load and n_threads = 0
+ * means one thread per CPU.
+ */
+struct co_dump_analysis {
+	unsigned int bitrate;
+	unsigned int n_threads;
+};
+
 int co_dump(const char* addr, enum co_dump_options options);
+int co_dump_query(const char* addr, enum co_dump_options options,
+		  const struct co_dump_query* query);
+int co_dump_analyze(const char* addr, enum co_dump_options options,
+		    const struct co_dump_query* query,
+		    const struct co_dump_analysis* analysis);
 
 #endif /*  CANOPEN_DUMP_H_ */
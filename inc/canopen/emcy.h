@@ -40,7 +40,7 @@ static inline uint64_t emcy_get_manufacturer_error(const struct can_frame* frame
 	uint64_t tmp = 0;
 	uint64_t result = 0;
 
-	memcpy(&tmp, &frame->data[4], 5);
+	memcpy(&tmp, &frame->data[3], 5);
 
 	byteorder(&result, &tmp, sizeof(result));
 
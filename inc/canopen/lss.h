@@ -0,0 +1,152 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CANOPEN_LSS_H
+#define _CANOPEN_LSS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+
+/* Layer Setting Services (CiA 305) */
+
+#define LSS_COB_MASTER 0x7e5
+#define LSS_COB_SLAVE 0x7e4
+
+#define LSS_NODEID_UNCONFIGURED 0xff
+
+#define LSS_FASTSCAN_CONFIRM 0x80
+
+enum lss_mode {
+	LSS_MODE_WAITING = 0,
+	LSS_MODE_CONFIGURATION = 1,
+};
+
+enum lss_cs {
+	LSS_CS_SWITCH_GLOBAL = 0x04,
+	LSS_CS_CONFIGURE_NODEID = 0x11,
+	LSS_CS_CONFIGURE_BIT_TIMING = 0x13,
+	LSS_CS_ACTIVATE_BIT_TIMING = 0x15,
+	LSS_CS_STORE_CONFIGURATION = 0x17,
+	LSS_CS_SWITCH_SELECTIVE_VENDOR = 0x40,
+	LSS_CS_SWITCH_SELECTIVE_PRODUCT = 0x41,
+	LSS_CS_SWITCH_SELECTIVE_REVISION = 0x42,
+	LSS_CS_SWITCH_SELECTIVE_SERIAL = 0x43,
+	LSS_CS_SWITCH_SELECTIVE_RESPONSE = 0x44,
+	LSS_CS_IDENTIFY_SLAVE = 0x4f,
+	LSS_CS_IDENTIFY_NON_CONFIGURED = 0x4c,
+	LSS_CS_IDENTIFY_NON_CONFIGURED_RESPONSE = 0x50,
+	LSS_CS_FASTSCAN = 0x51,
+	LSS_CS_INQUIRE_VENDOR = 0x5a,
+	LSS_CS_INQUIRE_PRODUCT = 0x5b,
+	LSS_CS_INQUIRE_REVISION = 0x5c,
+	LSS_CS_INQUIRE_SERIAL = 0x5d,
+	LSS_CS_INQUIRE_NODEID = 0x5e,
+};
+
+/* The identity is the content of object 0x1018, sub-indices 1 to 4 */
+struct lss_identity {
+	uint32_t vendor;
+	uint32_t product;
+	uint32_t revision;
+	uint32_t serial;
+};
+
+static inline uint32_t* lss_identity_at(struct lss_identity* id, int sub)
+{
+	switch (sub) {
+	case 0: return &id->vendor;
+	case 1: return &id->product;
+	case 2: return &id->revision;
+	case 3: return &id->serial;
+	}
+	return NULL;
+}
+
+static inline void lss_clear_frame(struct can_frame* frame, uint32_t cob)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame->can_id = cob;
+	frame->can_dlc = 8;
+}
+
+static inline enum lss_cs lss_get_cs(const struct can_frame* frame)
+{
+	return (enum lss_cs)frame->data[0];
+}
+
+static inline void lss_set_cs(struct can_frame* frame, enum lss_cs cs)
+{
+	frame->data[0] = cs;
+}
+
+static inline uint32_t lss_get_u32(const struct can_frame* frame)
+{
+	return (uint32_t)frame->data[1]
+	     | (uint32_t)frame->data[2] << 8
+	     | (uint32_t)frame->data[3] << 16
+	     | (uint32_t)frame->data[4] << 24;
+}
+
+static inline void lss_set_u32(struct can_frame* frame, uint32_t value)
+{
+	frame->data[1] = value;
+	frame->data[2] = value >> 8;
+	frame->data[3] = value >> 16;
+	frame->data[4] = value >> 24;
+}
+
+static inline void lss_set_fastscan(struct can_frame* frame, uint32_t id,
+				    int bit_checked, int sub, int next)
+{
+	lss_set_cs(frame, LSS_CS_FASTSCAN);
+	lss_set_u32(frame, id);
+	frame->data[5] = bit_checked;
+	frame->data[6] = sub;
+	frame->data[7] = next;
+}
+
+enum lss_slave_state {
+	LSS_SLAVE_WAITING = 0,
+	LSS_SLAVE_CONFIGURATION,
+};
+
+/* An LSS slave is a machine that eats frames from the LSS master and spits
+ * out replies. It is used by vnode and in tests.
+ *
+ * nodeid is the active node id and pending_nodeid is the one that has been
+ * configured by the master. The pending node id becomes active when an
+ * unconfigured slave is switched back into the waiting state, in which case
+ * the owner must reset communication.
+ */
+struct lss_slave {
+	struct lss_identity identity;
+	enum lss_slave_state state;
+	int nodeid;
+	int pending_nodeid;
+	int fastscan_sub;
+	int selective_sub;
+};
+
+void lss_slave_init(struct lss_slave* self, const struct lss_identity* id,
+		    int nodeid);
+
+/* Returns 1 if a reply has been written into out, otherwise 0.
+ */
+int lss_slave_feed(struct lss_slave* self, const struct can_frame* in,
+		   struct can_frame* out);
+
+#endif /* _CANOPEN_LSS_H */
@@ -21,6 +21,7 @@
 #include "canopen.h"
 #include "canopen-driver.h"
 #include "type-macros.h"
+#include "pdo-filter.h"
 
 enum co_master_driver_type {
 	CO_MASTER_DRIVER_NONE = 0,
@@ -39,7 +40,6 @@ struct co_drv {
 	void* context;
 	co_free_fn free_fn;
 
-	co_pdo_fn pdo1_fn, pdo2_fn, pdo3_fn, pdo4_fn;
 	co_emcy_fn emcy_fn;
 	co_start_fn start_fn;
 
@@ -48,10 +48,26 @@ struct co_drv {
 	char iface[256];
 };
 
-struct co_master_node {
+/* The fields that are touched for every received frame are kept in a compact
+ * array of cache line sized entries, separate from the rest of the node data.
+ */
+struct co_master_node_hot {
 	enum co_master_driver_type driver_type;
+	uint32_t ntimeouts;
+
+	uint8_t is_initialized;
+	uint8_t is_loading;
+	uint8_t is_supervised;
+	uint8_t pdo_filter_mask;
 
 	void* driver;
+
+	co_pdo_fn pdo_fn[4];
+
+	uint64_t last_heartbeat; /* ns, monotonic */
+} __attribute__((aligned(64)));
+
+struct co_master_node {
 	void* master_iface;
 
 	struct co_drv ndrv;
@@ -61,20 +77,18 @@ struct co_master_node {
 
 	uint32_t vendor_id, product_code, revision_number;
 
-	struct mloop_timer* heartbeat_timer;
-	struct mloop_timer* ping_timer;
+	uint64_t ping_deadline; /* ns, monotonic */
+	uint64_t n_missed_heartbeats;
 
 	char name[64];
 	char hw_version[64];
 	char sw_version[64];
 
-	int is_loading;
-	int is_initialized;
-
-	uint32_t ntimeouts;
+	struct pdo_filter pdo_filter[4];
 };
 
 extern struct co_master_node co_master_node_[];
+extern struct co_master_node_hot co_master_node_hot_[];
 
 static inline int co_master_get_node_id(const struct co_master_node* node)
 {
@@ -88,6 +102,18 @@ static inline struct co_master_node* co_master_get_node(int nodeid)
 	return &co_master_node_[nodeid];
 }
 
+static inline struct co_master_node_hot* co_master_get_node_hot(int nodeid)
+{
+	assert(CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX);
+	return &co_master_node_hot_[nodeid];
+}
+
+static inline struct co_master_node_hot*
+co_master_node_hot(const struct co_master_node* node)
+{
+	return &co_master_node_hot_[co_master_get_node_id(node)];
+}
+
 int co_master_run(void);
 
 int co_drv_load(struct co_drv* drv, const char* name);
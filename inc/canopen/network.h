@@ -18,9 +18,14 @@
 
 #include <stdint.h>
 
+#include "canopen/lss.h"
+
 struct can_frame;
 struct sock;
 
+typedef void (*co_net_lss_fn)(int nodeid, const struct lss_identity* id,
+			      void* context);
+
 /* Reset the network and see which nodes respond to the reset signal.
  *
  * nodes_seen must be an array of length 128; prior values are not cleared.
@@ -49,6 +54,17 @@ int co_net_probe(const struct sock* sock, char* nodes_seen, int start, int end,
 int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 		     int end, int timeout);
 
+/* Send a heartbeat request (RTR) and an SDO upload request for 0x1000 to each
+ * expected node in the range that has not been seen yet, without waiting for
+ * replies.
+ *
+ * nodes_seen and expected must be arrays of length 128.
+ * start/stop is an inclusive range of node ids to probe
+ * Returns the number of nodes probed.
+ */
+int co_net_probe_parallel(const struct sock* sock, const char* nodes_seen,
+			  const char* expected, int start, int end);
+
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid);
 int co_net__request_device_type(const struct sock* sock, int nodeid);
 
@@ -58,5 +74,53 @@ int co_net__wait_for_bootup(const struct sock* sock, char* nodes_seen,
 int co_net__wait_for_sdo(const struct sock* sock, char* nodes_seen, int start,
 			 int end, int timeout);
 
+/* Wait for heartbeats or SDO responses until every node marked in expected has
+ * been seen, until no such frame has been received for idle_timeout ms, or
+ * until timeout ms have passed in total.
+ *
+ * nodes_seen and expected must be arrays of length 128; prior values in
+ * nodes_seen are not cleared.
+ * Returns the number of expected nodes that are still missing.
+ */
+int co_net__wait_for_nodes(const struct sock* sock, char* nodes_seen,
+			   const char* expected, int start, int end,
+			   int idle_timeout, int timeout);
+
+int co_net_lss_switch_global(const struct sock* sock, enum lss_mode mode);
+
+/* Configure the node id of the slave that is in the LSS configuration state.
+ *
+ * timeout is in ms.
+ * Returns the error code from the slave (0 on success) or -1 if the slave did
+ * not respond.
+ */
+int co_net_lss_configure_nodeid(const struct sock* sock, int nodeid,
+				int timeout);
+
+/* Find one unconfigured LSS slave by binary search over its identity and
+ * switch it into the LSS configuration state.
+ *
+ * Parts of the identity that are already known can be given in id with their
+ * bits set in known (bit 0 is vendor, bit 3 is serial) so that they are only
+ * verified instead of being searched for.
+ * timeout is in ms and is applied to each step of the search.
+ * Returns 1 if a slave was found, 0 if there were no unconfigured slaves and
+ * -1 if the slave was lost during the search.
+ */
+int co_net_lss_fastscan(const struct sock* sock, struct lss_identity* id,
+			unsigned int known, int timeout);
+
+/* Assign free node ids in the range to all unconfigured LSS slaves.
+ *
+ * nodes_seen must be an array of length 128. Node ids that are marked in it
+ * are not assigned and assigned node ids are marked.
+ * on_assigned is called for each assigned node unless it is NULL.
+ * timeout is in ms.
+ * Returns the number of nodes that were assigned.
+ */
+int co_net_lss_commission(const struct sock* sock, char* nodes_seen,
+			  int start, int end, int timeout,
+			  co_net_lss_fn on_assigned, void* context);
+
 #endif /* CANOPEN_NETWORK_H_ */
 
@@ -53,6 +53,11 @@ struct sdo_async {
 	int index, subindex;
 	int is_toggled;
 	size_t pos;
+	size_t size;
+	size_t offset;
+	sdo_async_fn on_data;
+	int is_waiting_for_data;
+	int is_data_requested;
 	enum sdo_req_status status;
 	enum sdo_abort_code abort_code;
 	enum sdo_async_quirks_flags quirks;
@@ -70,6 +75,10 @@ struct sdo_async_info {
 	sdo_async_fn on_done;
 	void* context;
 	sdo_async_free_fn free_fn;
+
+	/* Streaming, see sdo_async_append() */
+	size_t stream_size;
+	sdo_async_fn on_data;
 };
 
 int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid);
@@ -80,5 +89,19 @@ int sdo_async_stop(struct sdo_async* self);
 
 int sdo_async_feed(struct sdo_async* self, const struct can_frame* frame);
 
+/* A download of stream_size bytes may be started with only the first part of
+ * its data. on_data is called when less than SDO_ASYNC_STREAM_CHUNK bytes are
+ * left to send and more is then given with sdo_async_append(). Segments wait
+ * for data with the timeout running. stream_size must be too large for an
+ * expediated transfer.
+ *
+ * An upload with on_data set calls it whenever at least SDO_ASYNC_STREAM_CHUNK
+ * bytes have been received and clears the buffer afterwards. The remainder is
+ * in the buffer when on_done is called.
+ */
+#define SDO_ASYNC_STREAM_CHUNK 1024
+
+int sdo_async_append(struct sdo_async* self, const void* data, size_t size);
+
 #endif /* SDO_ASYNC_H_ */
 
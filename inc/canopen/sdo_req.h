@@ -22,6 +22,7 @@
 #include "vector.h"
 #include "canopen/sdo.h"
 #include "arc.h"
+#include "metrics.h"
 
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req_enums.h"
@@ -40,6 +41,10 @@ struct sdo_req_info {
 	const void* dl_data;
 	size_t dl_size;
 	void* context;
+
+	/* Streaming, see sdo_req_append() */
+	sdo_req_fn on_data;
+	size_t stream_size;
 };
 
 struct sdo_req_queue;
@@ -53,14 +58,29 @@ struct sdo_req {
 	enum sdo_req_status status;
 	enum sdo_abort_code abort_code;
 	sdo_req_fn on_done;
+	sdo_req_fn on_data;
+	size_t stream_size;
 	struct sdo_req_queue* parent;
 	void* context;
 	sdo_req_free_fn context_free_fn;
 	int is_size_indicated;
+	uint64_t start_time; /* ns, monotonic */
 };
 
 TAILQ_HEAD(sdo_req_list, sdo_req);
 
+/* Latency is measured from when a request is queued until it is done.
+ *
+ * Requests finish on the default loop, which also serves the metrics, so the
+ * statistics are only ever touched from that thread.
+ */
+struct sdo_req_stats {
+	uint64_t n_requests;
+	uint64_t n_timeouts;
+	uint64_t n_aborts;
+	struct metrics_histogram latency;
+};
+
 struct sdo_req_queue {
 	pthread_mutex_t mutex;
 	size_t size;
@@ -69,6 +89,7 @@ struct sdo_req_queue {
 	struct sdo_async sdo_client;
 	struct mloop_idle* idle;
 	int nodeid;
+	struct sdo_req_stats stats;
 };
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
@@ -88,6 +109,17 @@ void sdo_req_free(struct sdo_req* self);
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue);
 void sdo_req_wait(struct sdo_req* self);
 
+/* A download of stream_size bytes may be started with only the first dl_size
+ * bytes of its data. on_data is called on the default main loop when more is
+ * wanted and it is then given with sdo_req_append(), also on the default main
+ * loop.
+ *
+ * An upload with on_data set passes its data on in pieces of at least
+ * SDO_ASYNC_STREAM_CHUNK bytes. Each piece is in data when on_data is called
+ * and the remainder is there when on_done is called.
+ */
+int sdo_req_append(struct sdo_req* self, const void* data, size_t size);
+
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req);
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self);
 
@@ -28,9 +28,27 @@ struct canopen_info {
 	char name[64];
 	char hw_version[64];
 	char sw_version[64];
+	uint32_t rx_frames;
+	uint32_t rx_bytes;
+	uint32_t tx_frames;
+	uint32_t tx_bytes;
+};
+
+/* Bus load is in units of 0.01 % */
+struct canopen_bus_info {
+	uint32_t bitrate;
+	uint32_t load_1s;
+	uint32_t load_10s;
+	uint32_t rx_frames;
+	uint32_t tx_frames;
+	uint32_t rx_errors;
+	uint32_t tx_errors;
+	uint32_t rx_unknown;
+	uint32_t rx_dropped;
 };
 
 extern struct canopen_info* canopen_info_;
+extern struct canopen_bus_info* canopen_bus_info_;
 
 static inline struct canopen_info* canopen_info_get(int nodeid)
 {
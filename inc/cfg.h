@@ -27,11 +27,19 @@
 	X(uint, job_queue_length, 256) \
 	X(uint, sdo_queue_length, 1024) \
 	X(uint, rest_port, 9191) \
+	X(uint, rest_keepalive_timeout, 5000 /* ms */) \
+	X(uint, rest_max_requests, 100) \
+	X(bool, use_rest_thread, 0) \
+	X(uint, event_interval, 100 /* ms */) \
+	X(string, rpc_path, "") \
 	X(bool, be_strict, 0) \
 	X(bool, use_tcp, 0) \
+	X(uint, bitrate, 125000 /* bit/s */) \
 	X(uint, heartbeat_period, 0 /* ms */) \
 	X(uint, heartbeat_timeout, 0 /* ms */) \
 	X(uint, n_timeouts_max, 2) \
+	/* Timeouts are detected up to one sweep late. 0 is raised to 1 ms. */ \
+	X(uint, heartbeat_sweep_interval, 50 /* ms */) \
 	X(uint, range_start, 0) \
 	X(uint, range_stop, 0) \
 	X(uint, sync_interval, 0 /* us */) \
@@ -39,6 +47,19 @@
 	X(string, trace_dump_path, "/var/log/canopen") \
 	X(bool, enable_bootup_trace, 0) \
 	X(bool, enable_incident_trace, 0) \
+	X(string, incident_triggers, "") \
+	X(bool, use_compact_trace, 0) \
+	X(bool, compress_trace, 0) \
+	X(bool, enable_trace_capture, 0) \
+	X(string, trace_capture_path, "/var/log/canopen/capture") \
+	X(uint, trace_capture_segment_size, 16777216 /* bytes */) \
+	X(uint, trace_capture_segments, 16) \
+	X(uint, trace_capture_rotate_interval, 600 /* s */) \
+	X(bool, enable_fast_discovery, 0) \
+	X(uint, discovery_timeout, 1000 /* ms */) \
+	X(string, discovery_cache_path, "/var/cache/canopen/nodes") \
+	X(bool, enable_lss, 0) \
+	X(uint, lss_timeout, 10 /* ms */) \
 
 #define CFG__NODE_PARAMETERS \
 	X(bool, has_zero_guard_status, 0) \
@@ -48,6 +69,10 @@
 	X(uint, heartbeat_timeout, 1000 /* ms */) \
 	X(uint, n_timeouts_max, 0) \
 	X(bool, enable_node_guarding, 1) \
+	X(string, tpdo1_filter, "") \
+	X(string, tpdo2_filter, "") \
+	X(string, tpdo3_filter, "") \
+	X(string, tpdo4_filter, "") \
 
 #define CFG__DEFINE_bool(name) int name
 #define CFG__DEFINE_uint(name) uint64_t name
@@ -40,6 +40,14 @@
 #define co_atomic_add_fetch(ptr, value) \
 	__atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST)
 
+#define co_atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+
+#define co_atomic_store_release(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+
+#define co_atomic_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define co_atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+
 #else
 
 #define co_atomic_cas(ptr, expected, desired) \
@@ -63,6 +71,12 @@
 #define co_atomic_sub_fetch(ptr, value) __sync_sub_and_fetch(ptr, value)
 #define co_atomic_add_fetch(ptr, value) __sync_add_and_fetch(ptr, value)
 
+#define co_atomic_load_acquire(ptr) co_atomic_load(ptr)
+#define co_atomic_store_release(ptr, value) co_atomic_store(ptr, value)
+
+#define co_atomic_fence_acquire() __sync_synchronize()
+#define co_atomic_fence_release() __sync_synchronize()
+
 #endif /* HAVE_NEW_ATOMICS */
 
 #undef HAVE_NEW_ATOMICS
@@ -43,6 +43,8 @@
 
 #define __atomic_add_fetch(ptr, value, ...) \
 	__sync_add_and_fetch(ptr, value)
+
+#define __atomic_thread_fence(...) __sync_synchronize()
 #endif
 
 #endif /* ATOMIC_COMPAT_H_ */
@@ -58,6 +58,33 @@ typedef void (*mloop_free_fn)(void*);
 
 extern int mloop_errno;
 
+/* Defined if mloop_get_stats() is available.
+ */
+#define MLOOP_HAVE_STATS 1
+
+/* Defined if mloop_socket_set_event() takes effect on a socket that has
+ * already been started.
+ */
+#define MLOOP_HAVE_LIVE_SET_EVENT 1
+
+/* Run time statistics of a main loop and of the global thread pool. Times are
+ * in nanoseconds and counters are cumulative.
+ */
+struct mloop_stats {
+	uint64_t n_iterations;
+	uint64_t busy_time;
+	uint64_t n_callbacks;
+	uint64_t callback_time;
+	uint64_t max_callback_time;
+	unsigned long n_pending_jobs;
+
+	int n_workers;
+	int n_busy_workers;
+	unsigned long n_queued_work;
+	uint64_t n_work_done;
+	uint64_t work_time;
+};
+
 /* Create a new mloop to be run in a thread
  */
 struct mloop* mloop_new(void);
@@ -127,6 +154,10 @@ void mloop_exit(struct mloop* self);
  */
 int mloop_get_pollfd(const struct mloop* self);
 
+/* Get run time statistics. This may be called from any thread.
+ */
+void mloop_get_stats(const struct mloop* self, struct mloop_stats* stats);
+
 /* Create a new timer.
  */
 struct mloop_timer* mloop_timer_new(struct mloop* self);
@@ -268,7 +299,8 @@ mloop_socket_get_event(const struct mloop_socket* socket);
  * MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_PRI
  *
  * This can be set to any combination of IN, PRI and OUT but you will always
- * receive events for ERR and HUP.
+ * receive events for ERR and HUP. If the socket has been started, the change
+ * takes effect immediately.
  */
 void mloop_socket_set_event(struct mloop_socket* socket,
 			    enum mloop_socket_event event);
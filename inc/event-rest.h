@@ -0,0 +1,125 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef EVENT_REST_H_
+#define EVENT_REST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "canopen.h"
+
+#define EVENT_REST_SUBSCRIBERS_MAX 16
+#define EVENT_REST_KEEPALIVE 15000 /* ms */
+
+/* Every node has a slot for each of its TPDOs, its EMCY and its NMT state */
+#define EVENT_REST_KEYS_PER_NODE 8
+#define EVENT_REST_KEYS (128 * EVENT_REST_KEYS_PER_NODE)
+
+/* Push subscriptions for PDO, EMCY and NMT state events
+ *
+ * Clients subscribe with GET /events and receive Server-Sent Events on the
+ * REST port. The subscription is narrowed down with query parameters:
+ *   node=<id>[,<id>...]    Only events from these nodes (default: all).
+ *   topics=<topic>[,...]   Any of pdo, emcy and nmt (default: all).
+ *   interval=<ms>          Send at most one batch of events per interval. It
+ *                          can be made longer but not shorter than the one
+ *                          set with event_rest_set_interval().
+ *
+ * Frames are published from the receive path into a table of slots for each
+ * subscriber, one slot per node and event. A slot only holds the latest
+ * frame, so that events that arrive faster than they can be sent are
+ * coalesced instead of queued; the number of frames that were replaced is
+ * reported with each event. Slots that have changed are passed on through a
+ * single-producer, single-consumer ring of keys that is drained on the REST
+ * main loop. Since a key is only put into the ring when its slot was not
+ * already pending, the ring can never overflow, and the receive path never
+ * waits for a subscriber.
+ */
+
+enum event_rest_topic {
+	EVENT_REST_PDO = 1 << 0,
+	EVENT_REST_EMCY = 1 << 1,
+	EVENT_REST_NMT = 1 << 2,
+	EVENT_REST_ALL = (1 << 3) - 1,
+};
+
+struct event_rest_slot {
+	uint32_t seq;
+	int is_pending;
+	uint32_t n_coalesced;
+	uint8_t size;
+	uint8_t data[8];
+};
+
+struct event_rest_event {
+	int key;
+	uint32_t n_coalesced;
+	uint8_t size;
+	uint8_t data[8];
+};
+
+struct rest_client;
+struct http_req;
+struct mloop_timer;
+
+struct event_rest_sub {
+	int ref;
+	struct rest_client* client;
+	unsigned int topics;
+	char nodes[128];
+	uint64_t interval; /* ms */
+	uint64_t last_flush; /* ms */
+	uint64_t last_sent; /* ms */
+	int is_notified;
+	int is_closed;
+	struct mloop_timer* timer;
+
+	uint32_t head, tail;
+	uint16_t ring[EVENT_REST_KEYS];
+	struct event_rest_slot slot[EVENT_REST_KEYS];
+};
+
+void event_rest_service(struct rest_client* client, const void* content);
+
+/* Set the default and shortest interval between batches of events */
+void event_rest_set_interval(unsigned int interval);
+
+/* Called on the receive path of the default main loop for every frame */
+void event_rest_publish(const struct canopen_msg* msg,
+			const struct can_frame* cf);
+
+struct event_rest_sub* event_rest__sub_new(struct rest_client* client);
+void event_rest__sub_ref(struct event_rest_sub* self);
+void event_rest__sub_unref(struct event_rest_sub* self);
+int event_rest__parse_query(struct event_rest_sub* self, struct http_req* req);
+
+/* Returns the slot key for the frame or -1 if it is not published */
+int event_rest__key(const struct canopen_msg* msg, const struct can_frame* cf,
+		    enum event_rest_topic* topic);
+
+/* Returns 1 if the slot was not pending before, so that the consumer needs to
+ * be told about it.
+ */
+int event_rest__push(struct event_rest_sub* self, int key,
+		     const struct can_frame* cf);
+
+/* Returns 1 if an event was taken and 0 if none are pending */
+int event_rest__pop(struct event_rest_sub* self, struct event_rest_event* ev);
+
+void event_rest__print(FILE* output, const struct event_rest_event* ev);
+
+#endif /* EVENT_REST_H_ */
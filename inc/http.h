@@ -19,6 +19,9 @@
 #define URL_INDEX_MAX 32
 #define URL_QUERY_INDEX_MAX 32
 
+/* Requests with a longer head than this are rejected */
+#define HTTP_HEAD_MAX 8192
+
 #include <stddef.h>
 
 enum http_method {
@@ -27,25 +30,71 @@ enum http_method {
 	HTTP_OPTIONS = 4,
 };
 
+enum http_parse_status {
+	HTTP_PARSE_TOO_LARGE = -2,
+	HTTP_PARSE_ERROR = -1,
+	HTTP_PARSE_INCOMPLETE = 0,
+	HTTP_PARSE_DONE = 1,
+};
+
 struct http_url_query {
 	char* key;
 	char* value;
 };
 
+/* All strings point into the buffer that the request was parsed from.
+ */
 struct http_req {
 	enum http_method method;
 	size_t header_length;
 	size_t content_length;
 	char* content_type;
+	int has_connection_close;
+	char* if_none_match;
+	int accepts_gzip;
+	int accepts_octet_stream;
 	size_t url_index;
 	char* url[URL_INDEX_MAX];
 	size_t url_query_index;
 	struct http_url_query url_query[URL_QUERY_INDEX_MAX];
 };
 
-int http_req_parse(struct http_req* req, const char* head);
-void http_req_free(struct http_req* req);
+/* Offsets are kept instead of pointers while parsing because the buffer may
+ * be moved when more input is appended to it.
+ */
+struct http_parser {
+	int state;
+	size_t pos;
+	size_t start;
+	int header;
+	size_t url[URL_INDEX_MAX];
+	size_t url_index;
+	size_t query_key[URL_QUERY_INDEX_MAX];
+	size_t query_value[URL_QUERY_INDEX_MAX];
+	size_t url_query_index;
+	size_t content_type;
+	size_t if_none_match;
+};
+
+void http_parser_init(struct http_parser* self);
+
+/* Parse the request head at the front of buffer, resuming where the last call
+ * left off so that only bytes which have been added since are scanned.
+ *
+ * Delimiters are overwritten with NUL as they are found, so the buffer must
+ * not be modified between calls, except by appending to it. Once
+ * HTTP_PARSE_DONE is returned, req refers to strings inside buffer. If the
+ * buffer is moved after that, calling this again updates req.
+ */
+enum http_parse_status http_parser_feed(struct http_parser* self,
+					struct http_req* req,
+					char* buffer, size_t size);
+
+int http_req_parse(struct http_req* req, char* buffer, size_t size);
 
 const char* http_req_query(struct http_req* req, const char* key);
 
+/* Returns 1 if the entity tag is listed in If-None-Match */
+int http_req_etag_matches(const struct http_req* req, const char* etag);
+
 #endif /* CANOPEN_HTTP_H_ */
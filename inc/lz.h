@@ -0,0 +1,39 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+/* A small LZ77 block codec using the LZ4 block format: sequences of literals
+ * and back-references of at least 4 bytes within a 64 KiB window. It favours
+ * speed over ratio, which suits trace files that are written from a worker
+ * thread and read back through canopen-dump.
+ */
+
+/* Returns the compressed size or 0 if the result would not fit in dst.
+ */
+size_t lz_compress(void* dst, size_t dst_size, const void* src,
+		   size_t src_size);
+
+/* Returns the decompressed size or -1 if the input is corrupt or does not fit
+ * in dst.
+ */
+ssize_t lz_decompress(void* dst, size_t dst_size, const void* src,
+		      size_t src_size);
+
+#endif /* _LZ_H */
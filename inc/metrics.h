@@ -0,0 +1,54 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Helpers for printing metrics in the Prometheus text exposition format.
+ *
+ * Labels are passed pre-formatted, e.g. "node=\"3\"", or NULL if there are
+ * none.
+ */
+
+#define METRICS_N_BUCKETS 12
+
+/* A latency histogram with fixed buckets from 1 ms to 2 s. Buckets are not
+ * cumulative in memory; that is done when printing. A histogram belongs to one
+ * thread, which both observes values and prints it, so it needs no atomics.
+ */
+struct metrics_histogram {
+	uint64_t bucket[METRICS_N_BUCKETS];
+	uint64_t sum; /* ns */
+};
+
+void metrics_histogram_observe(struct metrics_histogram* self, uint64_t ns);
+
+void metrics_print_type(FILE* out, const char* name, const char* type,
+			const char* help);
+
+void metrics_print(FILE* out, const char* name, const char* labels,
+		   uint64_t value);
+void metrics_print_real(FILE* out, const char* name, const char* labels,
+			double value);
+void metrics_print_seconds(FILE* out, const char* name, const char* labels,
+			   uint64_t ns);
+
+void metrics_print_histogram(FILE* out, const char* name, const char* labels,
+			     const struct metrics_histogram* hist);
+
+#endif /* _METRICS_H */
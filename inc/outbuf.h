@@ -0,0 +1,168 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _OUTBUF_H_INCLUDED
+#define _OUTBUF_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define OUTBUF_SIZE (1 << 16)
+
+/* A large output buffer with hand-rolled formatting of the things that are
+ * printed for every frame. Everything is written to the stream in one call
+ * when the buffer fills up or is flushed.
+ */
+struct outbuf {
+	FILE* stream;
+	size_t index;
+	char data[OUTBUF_SIZE];
+};
+
+static inline void outbuf_init(struct outbuf* self, FILE* stream)
+{
+	self->stream = stream;
+	self->index = 0;
+}
+
+static inline int outbuf_flush(struct outbuf* self)
+{
+	size_t size = self->index;
+	self->index = 0;
+
+	if (size > 0 && fwrite(self->data, 1, size, self->stream) != size)
+		return -1;
+
+	return fflush(self->stream);
+}
+
+/* Returns a pointer to at least size bytes; size must not exceed OUTBUF_SIZE */
+static inline char* outbuf_reserve(struct outbuf* self, size_t size)
+{
+	if (OUTBUF_SIZE - self->index < size)
+		outbuf_flush(self);
+
+	return &self->data[self->index];
+}
+
+static inline void outbuf_commit(struct outbuf* self, const char* end)
+{
+	self->index = end - self->data;
+}
+
+static inline void outbuf_write(struct outbuf* self, const void* data,
+				size_t size)
+{
+	char* p = outbuf_reserve(self, size);
+	memcpy(p, data, size);
+	outbuf_commit(self, p + size);
+}
+
+static inline void outbuf_puts(struct outbuf* self, const char* str)
+{
+	outbuf_write(self, str, strlen(str));
+}
+
+static inline void outbuf_putc(struct outbuf* self, char c)
+{
+	char* p = outbuf_reserve(self, 1);
+	*p++ = c;
+	outbuf_commit(self, p);
+}
+
+/* Unsigned decimal, zero padded to at least width digits */
+static inline void outbuf_put_uint(struct outbuf* self, uint64_t value,
+				   int width)
+{
+	char digits[20];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (n < width && n < (int)sizeof(digits))
+		digits[n++] = '0';
+
+	char* p = outbuf_reserve(self, n);
+	while (n > 0)
+		*p++ = digits[--n];
+
+	outbuf_commit(self, p);
+}
+
+static inline void outbuf_put_int(struct outbuf* self, int64_t value)
+{
+	if (value < 0) {
+		outbuf_putc(self, '-');
+		outbuf_put_uint(self, -(uint64_t)value, 0);
+	} else {
+		outbuf_put_uint(self, value, 0);
+	}
+}
+
+/* Upper case hex of a byte string, like hexdump() */
+static inline void outbuf_put_hex(struct outbuf* self, const void* data,
+				  size_t size)
+{
+	static const char map[] = "0123456789ABCDEF";
+	const uint8_t* src = data;
+
+	char* p = outbuf_reserve(self, size * 2);
+
+	for (size_t i = 0; i < size; ++i) {
+		*p++ = map[src[i] >> 4];
+		*p++ = map[src[i] & 15];
+	}
+
+	outbuf_commit(self, p);
+}
+
+/* For everything that isn't on a hot path. Output longer than the buffer is
+ * truncated.
+ */
+__attribute__((format(printf, 2, 3)))
+static inline void outbuf_printf(struct outbuf* self, const char* fmt, ...)
+{
+	va_list ap;
+
+	for (int i = 0; i < 2; ++i) {
+		size_t available = OUTBUF_SIZE - self->index;
+
+		va_start(ap, fmt);
+		int n = vsnprintf(&self->data[self->index], available, fmt, ap);
+		va_end(ap);
+
+		if (n < 0)
+			return;
+
+		if ((size_t)n < available) {
+			self->index += n;
+			return;
+		}
+
+		if (self->index == 0) {
+			self->index = OUTBUF_SIZE - 1;
+			return;
+		}
+
+		outbuf_flush(self);
+	}
+}
+
+#endif /* _OUTBUF_H_INCLUDED */
@@ -0,0 +1,58 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PCAPNG_H
+#define _PCAPNG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace-buffer.h"
+
+/* Just enough of pcapng to exchange SocketCAN traces with Wireshark.
+ *
+ * Frames are written as enhanced packet blocks on a single interface with
+ * LINKTYPE_CAN_SOCKETCAN and nanosecond timestamps. The reader accepts either
+ * byte order, any number of sections and interfaces and any timestamp
+ * resolution, and skips blocks and interfaces that do not carry CAN frames.
+ */
+
+#define PCAPNG_LINKTYPE_CAN_SOCKETCAN 227
+
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 1
+#define PCAPNG_BLOCK_EPB 6
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+struct pcapng_writer {
+	FILE* stream;
+};
+
+int pcapng_writer_init(struct pcapng_writer* self, FILE* stream);
+int pcapng_write_frame(struct pcapng_writer* self, uint64_t timestamp_ns,
+		       const struct can_frame* cf);
+
+/* Returns 1 if the stream starts with a pcapng section header. The stream is
+ * rewound.
+ */
+int pcapng_is_pcapng(FILE* stream);
+
+typedef void (*pcapng_frame_fn)(const struct tb_frame* frame, void* context);
+
+/* Timestamps are converted to microseconds */
+int pcapng_read(FILE* stream, pcapng_frame_fn fn, void* context);
+
+#endif /* _PCAPNG_H */
@@ -0,0 +1,66 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PDO_FILTER_H
+#define _PDO_FILTER_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define PDO_FILTER_FIELDS_MAX 8
+
+struct pdo_filter_field {
+	uint8_t offset;
+	uint8_t size;
+	uint8_t is_signed;
+	uint64_t deadband;
+};
+
+/* A PDO filter remembers the last payload that was delivered to the driver
+ * and suppresses new payloads that do not differ from it in any of the masked
+ * bits and whose fields stay within their deadbands.
+ *
+ * The filter is configured with a specification string of space or comma
+ * separated tokens:
+ *   changed             Suppress identical payloads (the default).
+ *   mask=<hex>          Only compare the given bits, byte 0 first.
+ *   <u|s><bits>@<offset>:<deadband>
+ *                       Little-endian integer field at byte offset with a
+ *                       deadband, e.g. s16@2:10. Bytes covered by fields are
+ *                       excluded from the mask.
+ *
+ * Payloads of a different length than the last one are always delivered.
+ */
+struct pdo_filter {
+	int is_enabled;
+	int has_last;
+	size_t last_size;
+	uint8_t last[8];
+	uint8_t mask[8];
+	unsigned int n_fields;
+	struct pdo_filter_field field[PDO_FILTER_FIELDS_MAX];
+	uint64_t n_delivered;
+	uint64_t n_suppressed;
+};
+
+int pdo_filter_init(struct pdo_filter* self, const char* spec);
+void pdo_filter_reset(struct pdo_filter* self);
+
+/* Returns 1 if the payload should be delivered and 0 if it should be
+ * suppressed.
+ */
+int pdo_filter_check(struct pdo_filter* self, const void* data, size_t size);
+
+#endif /* _PDO_FILTER_H */
@@ -17,15 +17,32 @@
 #define CANOPEN_REST_H_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/queue.h>
+#include <mloop.h>
 #include "http.h"
 #include "vector.h"
 
+#define REST_STREAM_CHUNK 4096
+
+/* Replies such as "304 Not Modified" have no body, and they must not carry a
+ * Content-Length since it would describe the content that was not sent.
+ */
+#define REST_NO_CONTENT_LENGTH (-2)
+
 struct rest_reply_data {
 	const char* status_code;
 	const char* content_type;
+	/* -1 means chunked, see also REST_NO_CONTENT_LENGTH */
 	ssize_t content_length;
 	const void* content;
+
+	/* Optional headers, left out when NULL */
+	const char* etag;
+	const char* content_encoding;
+	const char* cache_control;
+	const char* vary;
 };
 
 enum rest_client_state {
@@ -33,15 +50,48 @@ enum rest_client_state {
 	REST_CLIENT_CONTENT,
 	REST_CLIENT_SERVICING,
 	REST_CLIENT_DISCONNECTED,
-	REST_CLIENT_DONE
+	REST_CLIENT_DONE,
+	REST_CLIENT_CLOSING
 };
 
+struct mloop_socket;
+struct mloop_timer;
+
+typedef void (*rest_read_fn)(void* context, const void* data, size_t size);
+
+/* Services may run on another thread than the connection. The fields that they
+ * read while the connection is changing them (state, is_last_request,
+ * content_read and output_pending) are accessed atomically.
+ */
 struct rest_client {
 	int ref;
 	enum rest_client_state state;
 	struct vector buffer;
+	struct http_parser parser;
 	struct http_req req;
 	FILE* output;
+	struct mloop_socket* socket;
+	struct mloop_timer* idle_timer;
+	uint64_t last_active;
+	unsigned int n_requests;
+	int is_last_request;
+	int is_processing;
+	int is_shut_down;
+	int events;
+
+	/* Content that is streamed to the service, see rest_client_read() */
+	int is_streaming;
+	int is_reading;
+	rest_read_fn read_fn;
+	void* read_context;
+	size_t content_read;
+	struct vector content_chunk;
+
+	/* Written through output from any thread, sent on the REST thread */
+	pthread_mutex_t output_lock;
+	struct vector output_buffer;
+	size_t output_pending;
+	int is_output_broken;
 };
 
 typedef void (*rest_fn)(struct rest_client* client, const void* content);
@@ -51,19 +101,74 @@ struct rest_service {
 	enum http_method method;
 	const char* path;
 	rest_fn fn;
+	int is_streaming;
 };
 
 int rest_init(int port);
 void rest_cleanup();
 
+/* Same as rest_init() but connections are handled by a main loop on a thread
+ * of its own, so that slow clients cannot hold up the default main loop.
+ * Services are still called on the default main loop.
+ */
+int rest_init_threaded(int port);
+
+/* Connections are kept open for at most max_requests requests (0 means no
+ * limit) and closed after being idle for timeout ms (0 means never).
+ */
+void rest_set_keepalive(unsigned int timeout, unsigned int max_requests);
+
+/* The main loop on which connections are handled */
+struct mloop* rest_get_mloop(void);
+
 int rest_register_service(enum http_method method, const char* path,
 			  rest_fn fn);
-void rest_reply(FILE* output, struct rest_reply_data* data);
-void rest_reply_header(FILE* output, struct rest_reply_data* data);
+
+/* Same as rest_register_service() except that PUT requests with
+ * application/octet-stream content are passed on as soon as their head has
+ * arrived, with NULL content. The content is then read with rest_client_read().
+ */
+int rest_register_streaming_service(enum http_method method, const char* path,
+				    rest_fn fn);
+void rest_reply(struct rest_client* client, struct rest_reply_data* data);
+void rest_reply_header(struct rest_client* client,
+		       struct rest_reply_data* data);
+
+/* Write a chunk of a response whose header was written with a negative
+ * content length. A chunk of size 0 ends the response.
+ */
+void rest_reply_chunk(struct rest_client* client, const void* data,
+		      size_t size);
 
 void rest_client_ref(struct rest_client* self);
 int rest_client_unref(struct rest_client* self);
 
+/* Must be called by services when the response has been written. Requests
+ * that have been pipelined behind it are processed after this.
+ */
+void rest_client_done(struct rest_client* self);
+
+/* Give up on the current request without sending a response. The connection
+ * is closed because responses to pipelined requests would be out of step.
+ */
+void rest_client_abort(struct rest_client* self);
+
+/* Read the next piece of the content of a streaming request. fn is called on
+ * the default main loop with up to REST_STREAM_CHUNK bytes once they have
+ * arrived, with size 0 when all of the content has been read or with NULL data
+ * if the connection is lost. Only one read may be pending at a time.
+ */
+void rest_client_read(struct rest_client* self, rest_read_fn fn,
+		      void* context);
+
+/* True while the client has so much output waiting to be sent that pipelined
+ * requests are held back. May be called from any thread.
+ */
+int rest_client_is_congested(const struct rest_client* self);
+
+/* True once the connection has been lost. May be called from any thread. */
+int rest_client_is_disconnected(const struct rest_client* self);
+
 int rest__service_is_match(const struct rest_service* service,
 			   const struct http_req* req);
 struct rest_service* rest__find_service(const struct http_req* req);
@@ -71,5 +176,9 @@ void rest__init_service_list(void);
 
 int rest__open_server(int port);
 int rest__read(struct vector* buffer, int fd);
+int rest__read_reserved(struct vector* buffer, int fd);
+void rest__consume(struct vector* buffer, size_t size);
+void rest__set_socket_event(struct mloop_socket* socket,
+			    enum mloop_socket_event events);
 
 #endif /* CANOPEN_REST_H_ */
@@ -0,0 +1,68 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RPC_H_
+#define RPC_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/can.h>
+
+#include "canopen-rpc.h"
+#include "canopen.h"
+
+/* Server side of the binary protocol in canopen-rpc.h
+ *
+ * Everything runs on the default main loop: requests are read and answered
+ * there, SDO requests complete there and frames are published from the
+ * receive path there. Replies that are made while handling a batch of input
+ * are sent together once the batch has been handled; the rest are sent at the
+ * end of the main loop iteration.
+ */
+
+/* Input is not read while a client has this much output pending */
+#define RPC_OUTPUT_HIGH 262144
+
+/* A client that leaves this much unread is disconnected */
+#define RPC_OUTPUT_MAX 4194304
+
+int rpc_init(const char* path);
+void rpc_cleanup(void);
+
+/* Called on the receive path of the default main loop for every frame */
+void rpc_publish(const struct canopen_msg* msg, const struct can_frame* cf,
+		 uint64_t now);
+
+/* Wraps a connected socket, see co_rpc_open() */
+struct co_rpc* co_rpc__new(int fd);
+
+/* Returns the size of the message at the start of data, 0 if it has not been
+ * received in full or -1 if it is malformed.
+ */
+static inline ssize_t rpc__message_size(const void* data, size_t available)
+{
+	const struct co_rpc_header* header = data;
+
+	if (available < sizeof(*header))
+		return 0;
+
+	if (header->size < sizeof(*header) || header->size > CO_RPC_MESSAGE_MAX
+	 || header->size % CO_RPC_ALIGN != 0)
+		return -1;
+
+	return available < header->size ? 0 : (ssize_t)header->size;
+}
+
+#endif /* RPC_H_ */
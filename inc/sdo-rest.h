@@ -1,6 +1,54 @@
 #ifndef SDO_REST_H_
 #define SDO_REST_H_
 
+#include <stddef.h>
+#include "canopen.h"
+#include "canopen/types.h"
+
+struct rest_client;
+
+#define SDO_REST_BULK_MAX_OPS 1024
+
 void sdo_rest_service(struct rest_client* client, const void* content);
+void sdo_rest_bulk_service(struct rest_client* client, const void* content);
+
+/* Builds the documents for the EDS database, which must have been loaded */
+int sdo_rest_init(void);
+
+/* Frees the documents that have been built from the EDS database */
+void sdo_rest_cleanup(void);
+
+struct sdo_rest_bulk;
+
+struct sdo_rest_bulk_op {
+	struct sdo_rest_bulk* bulk;
+	int nodeid, index, subindex;
+	const char* value;
+	const char* type;
+	enum canopen_type data_type;
+	char literal[32];
+	size_t next;
+};
+
+struct sdo_rest_bulk {
+	struct rest_client* client;
+	char* body;
+	struct sdo_rest_bulk_op* ops;
+	size_t n_ops;
+	size_t n_in_flight;
+	int is_first_result;
+	size_t next[CANOPEN_NODEID_MAX + 1];
+};
+
+/* The parsers below return a pointer past what they have consumed or NULL on
+ * error. Strings are unescaped in place.
+ */
+char* sdo_rest__json_string(char* str, const char** dst);
+char* sdo_rest__json_literal(char* str, char* dst, size_t size);
+char* sdo_rest__json_int(char* str, int* dst);
+char* sdo_rest__json_value(char* str, struct sdo_rest_bulk_op* op);
+
+/* Parse a list of operations into self->ops. Returns -1 on error. */
+int sdo_rest__bulk_parse(struct sdo_rest_bulk* self, char* str);
 
 #endif /* SDO_REST_H_ */
@@ -18,8 +18,12 @@
 
 #include <unistd.h>
 
+#define SOCK_BATCH_MAX 64
+
 struct can_frame;
 struct tracebuffer;
+struct bus_stats;
+struct tb_frame;
 
 enum sock_type {
 	SOCK_TYPE_UNSPEC = 0,
@@ -31,6 +35,7 @@ struct sock {
 	enum sock_type type;
 	int fd;
 	struct tracebuffer* tb;
+	struct bus_stats* stats;
 };
 
 static inline void sock_init(struct sock* sock, enum sock_type type, int fd,
@@ -39,6 +44,13 @@ static inline void sock_init(struct sock* sock, enum sock_type type, int fd,
 	sock->type = type;
 	sock->fd = fd;
 	sock->tb = tb;
+	sock->stats = NULL;
+}
+
+/* Count transmitted frames and send errors */
+static inline void sock_set_stats(struct sock* sock, struct bus_stats* stats)
+{
+	sock->stats = stats;
 }
 
 int sock_open(struct sock* sock, enum sock_type type, const char* addr,
@@ -47,9 +59,21 @@ int sock_open(struct sock* sock, enum sock_type type, const char* addr,
 ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags);
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout);
 
+/* Send up to n frames, returning how many were sent. CAN sockets send them
+ * with a single system call. Frames may be modified.
+ */
+ssize_t sock_send_batch(const struct sock* sock, struct can_frame* frames,
+			size_t n);
+
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags);
 int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout);
 
+/* Receive up to n frames, blocking until there is at least one. Frames carry
+ * the kernel's receive time if SO_TIMESTAMP is enabled on the socket.
+ */
+ssize_t sock_recv_batch(const struct sock* sock, struct tb_frame* frames,
+			size_t n);
+
 static inline int sock_close(struct sock* sock)
 {
 	return close(sock->fd);
@@ -22,22 +22,69 @@
 
 #include "socketcan.h"
 
+struct tb_capture;
+
 struct tb_frame {
 	uint64_t timestamp;
 	struct can_frame cf;
 };
 
+struct tb_slot {
+	uint32_t seq;
+	struct tb_frame frame;
+};
+
+/* Any number of threads may append to the trace buffer at the same time as
+ * it is being dumped. Each frame reserves a slot by incrementing head and
+ * then publishes it through the slot's sequence number, which is even while
+ * the slot is being written. Appending never waits for a reader or another
+ * writer.
+ *
+ * head and the sequence numbers are 32 bits wide so that they are native
+ * atomics on every target. They wrap around and are only ever compared as
+ * differences, which holds as long as a reader is not more than 2^31 frames
+ * behind.
+ */
 struct tracebuffer {
 	size_t length;
-	size_t index;
-	size_t count;
-	int is_blocked;
-	struct tb_frame* data;
+	uint32_t head;
+	struct tb_slot* slots;
+	struct tb_capture* capture;
 };
 
+/* A size smaller than one frame creates a trace buffer that only forwards
+ * frames to its capture.
+ */
 int tb_init(struct tracebuffer* self, size_t size);
 void tb_destroy(struct tracebuffer* self);
 void tb_append(struct tracebuffer* self, const struct can_frame* frame);
+
+/* Also append all frames to a continuous capture */
+void tb_set_capture(struct tracebuffer* self, struct tb_capture* capture);
+
+/* Copy the frames that are currently in the buffer, oldest first, into dst,
+ * which must have room for self->length frames.
+ *
+ * Returns the number of frames copied.
+ */
+size_t tb_snapshot(struct tracebuffer* self, struct tb_frame* dst);
+
+/* Frames are numbered in the order in which they are appended, starting at 0
+ * and wrapping around at 2^32. This is the number of the next frame.
+ */
+uint32_t tb_get_head(struct tracebuffer* self);
+
+/* Copy the frames numbered [from, to) that are still in the buffer into dst,
+ * oldest first. Returns the number of frames copied, which is at most
+ * self->length.
+ */
+size_t tb_copy(struct tracebuffer* self, uint32_t from, uint32_t to,
+	       struct tb_frame* dst);
+
 void tb_dump(struct tracebuffer* self, FILE* stream);
 
+/* Dump in the compact format from trace-format.h. flags are TF_COMPRESS or 0.
+ */
+int tb_dump_compact(struct tracebuffer* self, FILE* stream, int flags);
+
 #endif /* _TRACE_BUFFER_H */
@@ -0,0 +1,84 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_CAPTURE_H
+#define _TRACE_CAPTURE_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+#include "trace-buffer.h"
+
+#define TB_CAPTURE_MAGIC 0x54504143 /* "CAPT" */
+#define TB_CAPTURE_VERSION 2
+#define TB_CAPTURE_EMPTY UINT32_MAX
+
+/* Each segment file starts with this header and is followed by n_slots
+ * struct tb_slot. A slot at index i holds a valid frame if its sequence number
+ * is 2 * (generation * n_slots + i) + 1, modulo 2^32.
+ */
+struct tb_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t n_slots;
+	uint64_t start_time;
+	uint32_t generation;
+	uint8_t reserved[36];
+};
+
+struct tb_capture_segment {
+	struct tb_capture_header* header;
+	struct tb_slot* slots;
+	size_t size;
+};
+
+/* A continuous capture into a fixed set of memory mapped segment files that
+ * are reused round robin. Frames are appended in the same way as in the trace
+ * buffer, with one position counter spanning all the segments, so appending
+ * never blocks and the kernel takes care of writing the pages back.
+ *
+ * As in the trace buffer, the position counter is 32 bits wide and wraps
+ * around, and so do the generations, which are compared as differences. The
+ * number of segments is rounded down to a power of two so that they stay in
+ * round robin order across the wrap.
+ *
+ * A segment is rotated out when it is full or when tb_capture_rotate() is
+ * called. After a restart, the capture continues after the newest segment.
+ */
+struct tb_capture {
+	uint32_t head;
+	size_t n_slots;
+	unsigned int slot_shift;
+	size_t n_segments;
+	struct tb_capture_segment* segments;
+};
+
+typedef void (*tb_capture_fn)(const struct tb_frame* frame, void* context);
+
+int tb_capture_init(struct tb_capture* self, const char* path,
+		    size_t segment_size, size_t n_segments);
+void tb_capture_destroy(struct tb_capture* self);
+
+void tb_capture_append(struct tb_capture* self, uint64_t timestamp,
+		       const struct can_frame* frame);
+
+/* Start a new segment unless the current one is empty */
+void tb_capture_rotate(struct tb_capture* self);
+
+/* Call fn for every frame in the capture at path, oldest first.
+ */
+int tb_capture_read(const char* path, tb_capture_fn fn, void* context);
+
+#endif /* _TRACE_CAPTURE_H */
@@ -0,0 +1,208 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_FORMAT_H
+#define _TRACE_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stddef.h>
+
+#include "trace-buffer.h"
+
+/* Compact trace file format
+ *
+ * A file starts with a struct tf_file_header and is followed by blocks, each
+ * of which is a struct tf_block_header followed by stored_size bytes. If
+ * stored_size is less than raw_size, the block is compressed with lz.
+ * All integers in the file are little endian.
+ *
+ * Each frame within a block is encoded as:
+ *   varint   Time since the previous frame in the block in us (the first
+ *            frame is at first_timestamp).
+ *   u16      Bits 0-10: id, bits 11-14: dlc, bit 15: flags byte follows.
+ *   [u8]     TF_FLAG_*.
+ *   [u32]    The full id if TF_FLAG_EFF is set.
+ *   [varint] How long before the previous frame this frame was received in
+ *            us, if TF_FLAG_EARLY is set. The next frame's time is still
+ *            relative to the previous frame.
+ *   u8[dlc]  Payload, unless it's an RTR frame.
+ *
+ * Blocks can be decoded independently of each other.
+ *
+ * Since version 2, each block header has a bitmap of the nodes that appear in
+ * the block (see tf_frame_node()), and a complete file ends with an index of
+ * all the blocks: n_blocks struct tf_index_entry followed by a struct
+ * tf_index_trailer. Files without the index, e.g. because the writer did not
+ * finish, can still be read by walking the block headers.
+ *
+ * Version 3 adds TF_FLAG_EARLY. Frames from different threads are not
+ * strictly ordered by time, and earlier versions raised the timestamp of such
+ * a frame to that of the previous one.
+ */
+
+#define TF_MAGIC 0x52544f43 /* "COTR" */
+#define TF_INDEX_MAGIC 0x58444943 /* "CIDX" */
+#define TF_VERSION 3
+#define TF_BLOCK_SIZE 65536
+
+enum tf_file_flags {
+	TF_COMPRESS = 1,
+};
+
+enum tf_frame_flags {
+	TF_FLAG_RTR = 1,
+	TF_FLAG_EFF = 2,
+	TF_FLAG_ERR = 4,
+	TF_FLAG_EARLY = 8,
+};
+
+struct tf_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t block_size;
+	uint32_t reserved;
+};
+
+struct tf_block_header {
+	uint32_t n_frames;
+	uint32_t raw_size;
+	uint32_t stored_size;
+	uint32_t reserved;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	/* Version 2 */
+	uint8_t nodes[16];
+};
+
+#define TF_BLOCK_HEADER_V1_SIZE offsetof(struct tf_block_header, nodes)
+
+struct tf_index_entry {
+	uint64_t offset;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	uint8_t nodes[16];
+};
+
+struct tf_index_trailer {
+	uint32_t magic;
+	uint32_t n_blocks;
+	uint64_t offset;
+};
+
+/* Selects frames when reading. A frame matches if it is within [from, to],
+ * belongs to one of the nodes in the bitmap and has the given COB-ID.
+ * to = 0 means no upper limit, has_nodes = 0 means all nodes and cob = -1
+ * means all COB-IDs.
+ */
+struct tf_query {
+	uint64_t from;
+	uint64_t to;
+	int has_nodes;
+	uint8_t nodes[16];
+	int32_t cob;
+};
+
+struct tf_writer {
+	FILE* stream;
+	int flags;
+	uint8_t* raw;
+	uint8_t* stored;
+	struct tf_block_header block;
+	uint64_t offset;
+	struct tf_index_entry* index;
+	size_t n_blocks;
+};
+
+int tf_writer_init(struct tf_writer* self, FILE* stream, int flags);
+int tf_writer_append(struct tf_writer* self, const struct tb_frame* frame);
+
+/* Writes the last block and the index and frees the writer. The stream is not
+ * closed.
+ */
+int tf_writer_finish(struct tf_writer* self);
+
+typedef void (*tf_frame_fn)(const struct tb_frame* frame, void* context);
+
+/* The node that a frame belongs to, or 0 if it does not belong to any node.
+ * NMT commands belong to the node that they are addressed to. A block that
+ * contains an NMT command to all nodes has every node in its bitmap, and such
+ * a command matches any set of nodes in a query.
+ */
+int tf_frame_node(const struct can_frame* cf);
+
+void tf_query_init(struct tf_query* query);
+int tf_query_match(const struct tf_query* query, const struct tb_frame* frame);
+
+/* Parse the command line arguments of the trace tools. Times are local time,
+ * e.g. 2018-03-01T12:00:00.5, or seconds since the epoch and are stored as
+ * microseconds. A node id from 1 to 127 is added to a bitmap like
+ * tf_query.nodes and a COB-ID is given in hex. -1 is returned if the argument
+ * is not valid.
+ */
+int tf_parse_time(uint64_t* dst, const char* arg);
+int tf_parse_node(uint8_t* nodes, const char* arg);
+int tf_parse_cob(int32_t* dst, const char* arg);
+
+/* Returns 1 if the stream starts with a compact trace header. The stream is
+ * rewound.
+ */
+int tf_is_compact(FILE* stream);
+
+/* Read all the frames in a stream. query may be NULL. */
+int tf_read(FILE* stream, const struct tf_query* query, tf_frame_fn fn,
+	    void* context);
+
+/* Map the file and only decode the blocks that may contain matching frames.
+ * The index is used to find the first block if there is one.
+ */
+int tf_read_file(const char* path, const struct tf_query* query,
+		 tf_frame_fn fn, void* context);
+
+/* A mapped compact trace file. The index is read into memory when the file
+ * is opened, or built by walking the blocks if the file has none.
+ */
+struct tf_file {
+	const uint8_t* data;
+	size_t size;
+	int version;
+	const struct tf_index_entry* index;
+	size_t n_blocks;
+	struct tf_index_entry* built_index;
+	int is_sorted;
+};
+
+int tf_file_open(struct tf_file* self, const char* path);
+void tf_file_close(struct tf_file* self);
+
+/* Returns the first block that ends at or after the given time. The index is
+ * binary searched if block end times never decrease; otherwise, it is scanned.
+ */
+size_t tf_file_find(const struct tf_file* self, uint64_t from);
+
+/* Read blocks [first, last). Different ranges of the same file may be read
+ * concurrently.
+ */
+int tf_file_read(const struct tf_file* self, size_t first, size_t last,
+		 const struct tf_query* query, tf_frame_fn fn, void* context);
+
+/* Decode a single block that has been read into memory */
+int tf_decode_block(const struct tf_block_header* header, const void* data,
+		    const struct tf_query* query, tf_frame_fn fn,
+		    void* context);
+
+#endif /* _TRACE_FORMAT_H */
@@ -0,0 +1,85 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_REPLAY_H
+#define _TRACE_REPLAY_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "trace-buffer.h"
+#include "trace-format.h"
+#include "sock.h"
+
+/* Re-emits recorded frames onto a socket.
+ *
+ * Each frame is given a deadline relative to the first frame: start + (t -
+ * t0) / speed on the monotonic clock, and the replay sleeps until that
+ * absolute deadline. Time spent sending or reading the file therefore does
+ * not accumulate as drift. Frames whose deadlines have already passed are
+ * sent together in a single batch, and with speed = 0 all frames are sent in
+ * batches of SOCK_BATCH_MAX as fast as the socket accepts them.
+ */
+
+struct tr_options {
+	double speed;
+	struct tf_query query;
+};
+
+struct tr_stats {
+	uint64_t n_frames;
+	uint64_t n_batches;
+	uint64_t duration; /* ns */
+	uint64_t max_lag; /* ns behind the deadline, worst case */
+};
+
+struct trace_replay {
+	const struct sock* sock;
+	struct tr_options options;
+	int is_started;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	uint64_t start;
+	uint64_t deadline;
+	struct can_frame batch[SOCK_BATCH_MAX];
+	size_t batch_size;
+	struct tr_stats stats;
+	int rc;
+};
+
+void tr_options_init(struct tr_options* options);
+
+void tr_init(struct trace_replay* self, const struct sock* sock,
+	     const struct tr_options* options);
+
+/* Schedules a single frame. Frames must be passed in the order that they were
+ * recorded. Returns -1 if sending has failed.
+ */
+int tr_frame(struct trace_replay* self, const struct tb_frame* frame);
+
+/* Sends the remaining frames and returns -1 if anything could not be sent */
+int tr_finish(struct trace_replay* self, struct tr_stats* stats);
+
+/* Replays a raw trace buffer dump, a compact trace file, a pcapng file or a
+ * trace capture directory.
+ */
+int tr_replay_file(const struct sock* sock, const char* path,
+		   const struct tr_options* options, struct tr_stats* stats);
+
+/* Opens a socket to addr and replays the file at path onto it */
+int tr_replay(const char* path, enum sock_type type, const char* addr,
+	      const struct tr_options* options, struct tr_stats* stats);
+
+#endif /* _TRACE_REPLAY_H */
@@ -0,0 +1,145 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_STATS_H
+#define _TRACE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "trace-buffer.h"
+
+#define TS_N_COBS 2048
+#define TS_N_NODES 128
+#define TS_LATENCY_BUCKETS 25
+#define TS_LOAD_SECONDS_MAX (7 * 24 * 3600)
+
+/* Inter-arrival statistics for a recurring event. The mean and variance are
+ * kept with Welford's method so that partial results can be merged exactly.
+ */
+struct ts_interval {
+	uint64_t count;
+	uint64_t first;
+	uint64_t last;
+	uint64_t n_intervals;
+	uint64_t min;
+	uint64_t max;
+	double mean;
+	double m2;
+};
+
+struct ts_sdo_event {
+	uint64_t timestamp;
+	uint8_t is_response;
+	uint8_t cs;
+};
+
+enum ts_sdo_state {
+	TS_SDO_IDLE = 0,
+	TS_SDO_DL_EXPEDIATED,
+	TS_SDO_DL_SEGMENT,
+	TS_SDO_DL_LAST,
+	TS_SDO_UPLOAD,
+	TS_SDO_N_STATES
+};
+
+enum ts_sdo_outcome {
+	TS_SDO_NONE = 0,
+	TS_SDO_COMPLETED,
+	TS_SDO_ABORTED,
+};
+
+/* What the frames before the first initiate request of a chunk do to a
+ * transaction that is in a given state at the start of the chunk.
+ */
+struct ts_sdo_path {
+	int state;
+	int outcome;
+	uint64_t timestamp;
+};
+
+/* SDO transactions of one node. Latency is measured from the initiate request
+ * until the response that completes the transaction, in log2 microsecond
+ * buckets.
+ *
+ * Frames that are seen before the first initiate request of a chunk are run
+ * through the state machine from every state, so that a transaction that
+ * started in the previous chunk can be completed when the chunks are merged.
+ */
+struct ts_sdo {
+	int state;
+	uint64_t start;
+	int has_started;
+	uint64_t count;
+	uint64_t aborts;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t histogram[TS_LATENCY_BUCKETS];
+	int has_prefix;
+	struct ts_sdo_path prefix[TS_SDO_N_STATES];
+};
+
+struct ts_node {
+	struct ts_interval heartbeat;
+	uint64_t bootups;
+	uint64_t emcy;
+	struct ts_sdo sdo;
+};
+
+/* Statistics from a single pass over a trace. Frames must be added in time
+ * order, and partial statistics of consecutive chunks can be merged with
+ * ts_merge().
+ */
+struct trace_stats {
+	uint64_t n_frames;
+	uint64_t n_extended;
+	uint64_t n_errors;
+	uint64_t n_bits;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+
+	/* Bits on the bus per second, for at most TS_LOAD_SECONDS_MAX */
+	uint64_t load_start;
+	size_t load_length;
+	uint64_t* load;
+	uint64_t load_skipped;
+
+	struct ts_interval cob[TS_N_COBS];
+	struct ts_node node[TS_N_NODES];
+};
+
+/* Number of bits that a frame occupies on the bus, including stuff bits and
+ * the inter-frame space. Error frames count as 0.
+ */
+unsigned int ts_frame_bits(const struct can_frame* cf);
+
+void ts_interval_add(struct ts_interval* self, uint64_t timestamp);
+void ts_interval_merge(struct ts_interval* self,
+		       const struct ts_interval* other);
+double ts_interval_stddev(const struct ts_interval* self);
+
+struct trace_stats* ts_new(void);
+void ts_free(struct trace_stats* self);
+
+int ts_add(struct trace_stats* self, const struct tb_frame* frame);
+
+/* Merge other into self. other must cover a later part of the trace. */
+int ts_merge(struct trace_stats* self, const struct trace_stats* other);
+
+void ts_print(const struct trace_stats* self, FILE* stream,
+	      unsigned int bitrate);
+
+#endif /* _TRACE_STATS_H */
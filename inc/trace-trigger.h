@@ -0,0 +1,115 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_TRIGGER_H
+#define _TRACE_TRIGGER_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "socketcan.h"
+
+#define TT_TRIGGERS_MAX 16
+#define TT_SPEC_MAX 1024
+#define TT_RATE_PERIOD 100000000ULL /* ns */
+
+#define TT_DEFAULT_PRE 1000 /* ms */
+#define TT_DEFAULT_POST 1000 /* ms */
+#define TT_DEFAULT_HOLDOFF 10000 /* ms */
+
+/* Trigger engine for incident traces
+ *
+ * Triggers are configured with a specification string where triggers are
+ * separated by semicolons and each trigger is a space or comma separated list
+ * of tokens. The first token selects the kind of trigger:
+ *   cob=<hex>             A frame with the given COB-ID.
+ *   emcy[=<hex>]          An EMCY with the given error code, or any EMCY that
+ *                         is not an error reset.
+ *   sdo-abort[=<hex>]     An SDO abort with the given code, or any abort,
+ *                         in either direction.
+ *   heartbeat-loss        A node has timed out (see tt_event()).
+ *   rate=<frames/s>       The number of frames received within a period of
+ *                         TT_RATE_PERIOD exceeds the given rate.
+ * The following tokens are optional:
+ *   node=<id>             Only fire for this node.
+ *   pre=<ms>              How much of the trace before the trigger to keep.
+ *   post=<ms>             How much of the trace after the trigger to keep.
+ *                         If more frames arrive in that time than the trace
+ *                         buffer holds, the first ones are lost.
+ *   holdoff=<ms>          Don't fire again until this much time has passed.
+ *
+ * e.g. "emcy pre=5000; sdo-abort=06020000 node=5; rate=4000 post=2000"
+ *
+ * Frames are checked on the receive path, so the common case is kept cheap:
+ * only the COB-IDs that some trigger is interested in are looked at more
+ * closely, which is a single bit test per frame.
+ */
+
+enum tt_type {
+	TT_COB = 0,
+	TT_EMCY,
+	TT_SDO_ABORT,
+	TT_HEARTBEAT_LOSS,
+	TT_RATE,
+};
+
+struct tt_trigger {
+	enum tt_type type;
+	int has_value;
+	uint32_t value;
+	int nodeid;
+	uint64_t pre; /* ms */
+	uint64_t post; /* ms */
+	uint64_t holdoff; /* ms */
+	int has_fired;
+	uint64_t last_fired; /* ns */
+	uint64_t n_fired;
+};
+
+struct trace_trigger;
+
+/* nodeid is 0 if the trigger is not about a specific node */
+typedef void (*tt_fire_fn)(struct trace_trigger* self,
+			   const struct tt_trigger* trigger, int nodeid,
+			   void* context);
+
+struct trace_trigger {
+	unsigned int n_triggers;
+	struct tt_trigger trigger[TT_TRIGGERS_MAX];
+	uint8_t cob_mask[CAN_SFF_MASK / 8 + 1];
+	uint32_t rate_limit;
+	uint64_t rate_period;
+	uint32_t rate_count;
+	tt_fire_fn fn;
+	void* context;
+};
+
+/* Returns -1 if the specification is invalid or longer than TT_SPEC_MAX */
+int tt_init(struct trace_trigger* self, const char* spec, tt_fire_fn fn,
+	    void* context);
+
+const char* tt_type_to_string(enum tt_type type);
+
+/* Check a received frame. now is on the monotonic clock in ns. A trigger
+ * engine must only be used from one thread.
+ */
+void tt_check(struct trace_trigger* self, const struct can_frame* cf,
+	      uint64_t now);
+
+/* Report an event that is not a frame, i.e. TT_HEARTBEAT_LOSS */
+void tt_event(struct trace_trigger* self, enum tt_type type, int nodeid,
+	      uint64_t now);
+
+#endif /* _TRACE_TRIGGER_H */
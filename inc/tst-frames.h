@@ -0,0 +1,57 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TST_FRAMES_H
+#define _TST_FRAMES_H
+
+#include <stdlib.h>
+
+#include "trace-buffer.h"
+
+/* Collects the frames that a reader passes to its callback, for use with
+ * tst_collect_frame(). Frames beyond size are counted but not stored.
+ */
+struct tst_frame_list {
+	size_t n;
+	size_t size;
+	struct tb_frame* frames;
+};
+
+static inline int tst_frame_list_init(struct tst_frame_list* list,
+				      size_t size)
+{
+	list->n = 0;
+	list->size = size;
+	list->frames = malloc(size * sizeof(*list->frames));
+	return list->frames ? 0 : -1;
+}
+
+static inline void tst_frame_list_destroy(struct tst_frame_list* list)
+{
+	free(list->frames);
+}
+
+static inline void tst_collect_frame(const struct tb_frame* frame,
+				     void* context)
+{
+	struct tst_frame_list* list = context;
+
+	if (list->n < list->size)
+		list->frames[list->n] = *frame;
+
+	list->n++;
+}
+
+#endif /* _TST_FRAMES_H */
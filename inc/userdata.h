@@ -24,6 +24,7 @@ struct userdata { };
 #define userdata_set_missing(...)
 #define userdata_clear_missing(...)
 #define userdata_check_missing(...)
+#define userdata_get_required(...)
 #else
 #include <stdint.h>
 
@@ -45,6 +46,8 @@ void userdata_set_missing(struct userdata* self, unsigned int id);
 void userdata_clear_missing(struct userdata* self, unsigned int id);
 
 void userdata_check_missing(struct userdata* self);
+
+void userdata_get_required(const struct userdata* self, char* nodes);
 #endif
 
 #endif /* CANOPEN_USERDATA_ */
@@ -16,12 +16,22 @@
 #ifndef CANOPEN_VNODE_H_
 #define CANOPEN_VNODE_H_
 
+#include <stdint.h>
+
 #include "sock.h"
 
 struct vnode;
 
 struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 			   const char* config_path, int nodeid);
+/* Create a node without a node id. It only responds to LSS until the LSS
+ * master assigns it one. The identity is read from the [lss] section of the
+ * config file, but the serial number is given here.
+ */
+struct vnode* co_vnode_new_unconfigured(enum sock_type type, const char* iface,
+					const char* config_path,
+					uint32_t serial);
+
 void co_vnode_destroy(struct vnode* self);
 
 #endif /* CANOPEN_VNODE_H_ */
@@ -0,0 +1,292 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <linux/can.h>
+
+#include "bus-stats.h"
+#include "canopen.h"
+#include "trace-stats.h"
+#include "co_atomic.h"
+
+#define BS_BITS_MASK ((1U << BS_EPOCH_SHIFT) - 1)
+#define BS_EPOCH_MASK ((1U << (32 - BS_EPOCH_SHIFT)) - 1)
+
+void bs_init(struct bus_stats* self, unsigned int bitrate)
+{
+	memset(self, 0, sizeof(*self));
+	self->bitrate = bitrate;
+}
+
+static inline int bs__type_index(enum canopen_object object)
+{
+	return object ? __builtin_ctz(object) + 1 : 0;
+}
+
+static inline uint32_t bs__epoch(uint64_t now)
+{
+	return (now / BS_BUCKET_LENGTH) & BS_EPOCH_MASK;
+}
+
+static inline void bs__add(struct bs_value* value, uint32_t n)
+{
+	co_atomic_add_fetch(&value->raw, n);
+}
+
+static void bs__fold(struct bs_value* value)
+{
+	uint32_t raw = co_atomic_load(&value->raw);
+
+	value->total += (uint32_t)(raw - value->last_raw);
+	value->last_raw = raw;
+}
+
+uint64_t bs_get_value(const struct bs_value* value)
+{
+	return value->total
+	     + (uint32_t)(co_atomic_load(&value->raw) - value->last_raw);
+}
+
+static void bs__add_bits(struct bus_stats* self, unsigned int bits,
+			 uint64_t now)
+{
+	uint32_t epoch = bs__epoch(now);
+	uint32_t* bucket = &self->buckets[epoch % BS_N_BUCKETS];
+
+	while (1) {
+		uint32_t old = co_atomic_load(bucket);
+		uint32_t sum = old >> BS_EPOCH_SHIFT == epoch
+			     ? (old & BS_BITS_MASK) + bits : bits;
+
+		if (sum > BS_BITS_MASK)
+			sum = BS_BITS_MASK;
+
+		if (co_atomic_cas(bucket, old, (epoch << BS_EPOCH_SHIFT) | sum))
+			break;
+	}
+}
+
+/* A bucket that is older than the ring is given the oldest period number that
+ * it could hold without being current, unless a writer claims it first.
+ * Buckets that appear to be slightly ahead belong to writers that read the
+ * clock after the caller did.
+ */
+static void bs__retire_buckets(struct bus_stats* self, uint64_t now)
+{
+	uint32_t epoch = bs__epoch(now);
+
+	for (int i = 0; i < BS_N_BUCKETS; ++i) {
+		uint32_t old = co_atomic_load(&self->buckets[i]);
+		uint32_t age = (epoch - (old >> BS_EPOCH_SHIFT)) & BS_EPOCH_MASK;
+
+		if (age < BS_N_BUCKETS || age > BS_EPOCH_MASK - BS_N_BUCKETS)
+			continue;
+
+		uint32_t stale = (epoch - BS_N_BUCKETS - age % BS_N_BUCKETS)
+			       & BS_EPOCH_MASK;
+
+		co_atomic_cas(&self->buckets[i], old, stale << BS_EPOCH_SHIFT);
+	}
+}
+
+void bs_update(struct bus_stats* self, uint64_t now)
+{
+	for (int d = BS_RX; d <= BS_TX; ++d) {
+		for (int i = 0; i < BS_N_NODES; ++i)
+			for (int t = 0; t < BS_N_TYPES; ++t) {
+				bs__fold(&self->node[d][i][t].frames);
+				bs__fold(&self->node[d][i][t].bytes);
+			}
+
+		bs__fold(&self->n_errors[d]);
+	}
+
+	bs__fold(&self->n_unknown);
+	bs__fold(&self->n_dropped);
+
+	bs__retire_buckets(self, now);
+}
+
+void bs_count(struct bus_stats* self, enum bs_direction direction,
+	      const struct can_frame* cf, const struct canopen_msg* msg,
+	      uint64_t now)
+{
+	struct canopen_msg classified = { 0 };
+
+	if (cf->can_id & CAN_ERR_FLAG) {
+		bs__add(&self->n_errors[direction], 1);
+		return;
+	}
+
+	if (!msg) {
+		msg = &classified;
+		if (cf->can_id & CAN_EFF_FLAG
+		 || canopen_get_object_type(&classified, cf) < 0)
+			memset(&classified, 0, sizeof(classified));
+	}
+
+	int type = bs__type_index(msg->object);
+	int nodeid = 0 <= msg->id && msg->id < BS_N_NODES ? msg->id : 0;
+
+	if (type == 0 && direction == BS_RX)
+		bs__add(&self->n_unknown, 1);
+
+	struct bs_cell* cell = &self->node[direction][nodeid][type];
+	bs__add(&cell->frames, 1);
+
+	if (!(cf->can_id & CAN_RTR_FLAG))
+		bs__add(&cell->bytes, cf->can_dlc);
+
+	bs__add_bits(self, ts_frame_bits(cf), now);
+}
+
+void bs_count_dropped(struct bus_stats* self)
+{
+	bs__add(&self->n_dropped, 1);
+}
+
+void bs_count_error(struct bus_stats* self, enum bs_direction direction)
+{
+	bs__add(&self->n_errors[direction], 1);
+}
+
+void bs_get_node_total(const struct bus_stats* self,
+		       enum bs_direction direction, int nodeid,
+		       struct bs_counter* total)
+{
+	memset(total, 0, sizeof(*total));
+
+	for (int i = 0; i < BS_N_TYPES; ++i) {
+		const struct bs_cell* cell = &self->node[direction][nodeid][i];
+		total->frames += bs_get_value(&cell->frames);
+		total->bytes += bs_get_value(&cell->bytes);
+	}
+}
+
+void bs_get_total(const struct bus_stats* self, enum bs_direction direction,
+		  struct bs_counter* total)
+{
+	memset(total, 0, sizeof(*total));
+
+	for (int i = 0; i < BS_N_NODES; ++i) {
+		struct bs_counter node;
+		bs_get_node_total(self, direction, i, &node);
+		total->frames += node.frames;
+		total->bytes += node.bytes;
+	}
+}
+
+double bs_get_load(const struct bus_stats* self, uint64_t window,
+		   uint64_t now)
+{
+	uint64_t n_buckets = window / BS_BUCKET_LENGTH;
+	uint32_t epoch = bs__epoch(now);
+	uint64_t bits = 0;
+
+	if (n_buckets == 0 || self->bitrate == 0)
+		return 0.0;
+
+	if (n_buckets > BS_N_BUCKETS - 1)
+		n_buckets = BS_N_BUCKETS - 1;
+
+	/* The current period is still being filled in, so it is left out */
+	for (uint64_t i = 1; i <= n_buckets; ++i) {
+		uint32_t e = (epoch - i) & BS_EPOCH_MASK;
+		uint32_t value = co_atomic_load(&self->buckets[e % BS_N_BUCKETS]);
+
+		if (value >> BS_EPOCH_SHIFT == e)
+			bits += value & BS_BITS_MASK;
+	}
+
+	double seconds = n_buckets * BS_BUCKET_LENGTH / 1e9;
+	return bits / (seconds * self->bitrate);
+}
+
+static void bs__print_types(const struct bus_stats* self, FILE* out,
+			    enum bs_direction direction, int nodeid)
+{
+	int is_first = 1;
+
+	for (int i = 0; i < BS_N_TYPES; ++i) {
+		const struct bs_cell* cell = &self->node[direction][nodeid][i];
+		uint64_t frames = bs_get_value(&cell->frames);
+		if (!frames)
+			continue;
+
+		enum canopen_object object = i ? 1 << (i - 1) : CANOPEN_UNSPEC;
+
+		fprintf(out, "%s \"%s\": { \"frames\": %llu, \"bytes\": %llu }",
+			is_first ? "" : ",",
+			canopen_object_type_to_string_exact(object),
+			(unsigned long long)frames,
+			(unsigned long long)bs_get_value(&cell->bytes));
+
+		is_first = 0;
+	}
+}
+
+static void bs__print_total(FILE* out, const char* name,
+			    const struct bs_counter* total, uint64_t n_errors)
+{
+	fprintf(out, "  \"%s\": { \"frames\": %llu, \"bytes\": %llu, "
+		"\"errors\": %llu", name,
+		(unsigned long long)total->frames,
+		(unsigned long long)total->bytes,
+		(unsigned long long)n_errors);
+}
+
+void bs_print_json(const struct bus_stats* self, FILE* out, uint64_t now)
+{
+	struct bs_counter rx, tx;
+	int is_first = 1;
+
+	bs_get_total(self, BS_RX, &rx);
+	bs_get_total(self, BS_TX, &tx);
+
+	fprintf(out, "{\n \"bitrate\": %u,\n", self->bitrate);
+	fprintf(out, " \"load\": { \"1s\": %.4f, \"10s\": %.4f },\n",
+		bs_get_load(self, 1000000000ULL, now),
+		bs_get_load(self, 10000000000ULL, now));
+
+	fprintf(out, " \"total\": {\n");
+	bs__print_total(out, "rx", &rx, bs_get_value(&self->n_errors[BS_RX]));
+	fprintf(out, ", \"unknown\": %llu, \"dropped\": %llu },\n",
+		(unsigned long long)bs_get_value(&self->n_unknown),
+		(unsigned long long)bs_get_value(&self->n_dropped));
+	bs__print_total(out, "tx", &tx, bs_get_value(&self->n_errors[BS_TX]));
+	fprintf(out, " }\n },\n");
+
+	fprintf(out, " \"nodes\": {");
+
+	for (int i = 0; i < BS_N_NODES; ++i) {
+		struct bs_counter node_rx, node_tx;
+		bs_get_node_total(self, BS_RX, i, &node_rx);
+		bs_get_node_total(self, BS_TX, i, &node_tx);
+
+		if (!node_rx.frames && !node_tx.frames)
+			continue;
+
+		fprintf(out, "%s\n  \"%d\": {\n   \"rx\": {", is_first ? "" : ",",
+			i);
+		bs__print_types(self, out, BS_RX, i);
+		fprintf(out, " },\n   \"tx\": {");
+		bs__print_types(self, out, BS_TX, i);
+		fprintf(out, " }\n  }");
+
+		is_first = 0;
+	}
+
+	fprintf(out, "\n }\n}\n");
+}
@@ -15,11 +15,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <getopt.h>
 #include <mloop.h>
 
 #include "canopen/dump.h"
+#include "trace-format.h"
+
+#define MAX_BITRATE 1000000 /* bit/s */
+#define MAX_JOBS 1024
 
 const char usage_[] =
 "Usage: canopen-dump [options] <interface>\n"
@@ -28,17 +33,40 @@ const char usage_[] =
 "    -h, --help                 Get help.\n"
 "    -u, --time                 Show time of arrival.\n"
 "    -T, --tcp                  Connect via TCP.\n"
-"    -f, --file                 Dump from trace buffer file.\n"
+"    -f, --file                 Dump from trace buffer file, pcapng file or\n"
+"                               trace capture directory.\n"
+"    -P, --pcapng               Write pcapng to stdout instead of text.\n"
+"    -o, --format=fmt           Output format: text (default), json or csv.\n"
+"                               json and csv print one record per frame.\n"
 "    -n, --nmt                  Show NMT.\n"
 "    -S, --sync                 Show SYNC.\n"
 "    -e, --emcy                 Show EMCY.\n"
 "    -p, --pdo[=mask]           Show PDO.\n"
 "    -s, --sdo                  Show SDO.\n"
 "    -H, --heartbeat            Show heartbeat.\n"
+"    -F, --from=time            Only show frames at or after this time.\n"
+"    -t, --to=time              Only show frames at or before this time.\n"
+"    -N, --node=id              Only show frames from/to this node, including\n"
+"                               NMT commands to it. May be given more than\n"
+"                               once.\n"
+"    -c, --cob=id               Only show frames with this COB-ID (hex).\n"
+"    -a, --analyze              Print bus statistics instead of frames.\n"
+"    -b, --bitrate=bps          Bit rate used for bus load (default 125000).\n"
+"    -j, --jobs=n               Threads used to analyse a file (default: one\n"
+"                               per CPU).\n"
+"\n"
+"Times are given as local time, e.g. 2018-03-01T12:00:00.5, as printed with\n"
+"--time, or as seconds since the epoch. Compact trace files are indexed, so\n"
+"only the parts of the file that match are read.\n"
 "\n"
 "Examples:\n"
 "    $ canopen-dump can0\n"
 "    $ canopen-dump -T 127.0.0.1\n"
+"    $ canopen-dump -uf --from=2018-03-01T12:00:00 --node=5 trace.bin\n"
+"    $ canopen-dump -af --bitrate=250000 trace.bin\n"
+"    $ canopen-dump -fP trace.bin > trace.pcapng\n"
+"    $ canopen-dump -P can0 | wireshark -k -i -\n"
+"    $ canopen-dump --format=json -p can0\n"
 "\n";
 
 static inline int print_usage(FILE* output, int status)
@@ -54,6 +82,31 @@ unsigned int apply_pdo_option(const char* arg)
 	     : CO_DUMP_FILTER_PDO;
 }
 
+static int parse_format(enum co_dump_options* opt, const char* arg)
+{
+	if (strcmp(arg, "json") == 0)
+		*opt |= CO_DUMP_JSON;
+	else if (strcmp(arg, "csv") == 0)
+		*opt |= CO_DUMP_CSV;
+	else if (strcmp(arg, "text") != 0)
+		return -1;
+
+	return 0;
+}
+
+static int parse_uint(unsigned int* dst, const char* arg, unsigned long min,
+		      unsigned long max)
+{
+	char* end = NULL;
+	unsigned long value = strtoul(arg, &end, 0);
+
+	if (end == arg || *end != '\0' || value < min || value > max)
+		return -1;
+
+	*dst = value;
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
 	static const struct option long_options[] = {
@@ -61,19 +114,32 @@ int main(int argc, char* argv[])
 		{ "time",      no_argument,       0, 'u' },
 		{ "tcp",       no_argument,       0, 'T' },
 		{ "file",      no_argument,       0, 'f' },
+		{ "pcapng",    no_argument,       0, 'P' },
+		{ "format",    required_argument, 0, 'o' },
 		{ "nmt",       no_argument,       0, 'n' },
 		{ "sync",      no_argument,       0, 'S' },
 		{ "emcy",      no_argument,       0, 'e' },
 		{ "pdo",       optional_argument, 0, 'p' },
 		{ "sdo",       no_argument,       0, 's' },
 		{ "heartbeat", no_argument,       0, 'H' },
+		{ "from",      required_argument, 0, 'F' },
+		{ "to",        required_argument, 0, 't' },
+		{ "node",      required_argument, 0, 'N' },
+		{ "cob",       required_argument, 0, 'c' },
+		{ "analyze",   no_argument,       0, 'a' },
+		{ "bitrate",   required_argument, 0, 'b' },
+		{ "jobs",      required_argument, 0, 'j' },
 		{ 0, 0, 0, 0 }
 	};
 
 	enum co_dump_options opt = 0;
+	struct co_dump_query query = { .cob = -1 };
+	struct co_dump_analysis analysis = { .bitrate = 125000 };
+	int analyze = 0;
+	int rc = 0;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "huTfnSepsiH", long_options, NULL);
+		int c = getopt_long(argc, argv, "huTfPo:nSepsiHF:t:N:c:ab:j:", long_options, NULL);
 		if (c < 0)
 			break;
 
@@ -82,14 +148,34 @@ int main(int argc, char* argv[])
 		case 'u': opt |= CO_DUMP_TIMESTAMP; break;
 		case 'T': opt |= CO_DUMP_TCP; break;
 		case 'f': opt |= CO_DUMP_FILE; break;
+		case 'P': opt |= CO_DUMP_PCAPNG; break;
+		case 'o': rc = parse_format(&opt, optarg); break;
 		case 'n': opt |= CO_DUMP_FILTER_NMT; break;
 		case 'S': opt |= CO_DUMP_FILTER_SYNC; break;
 		case 'e': opt |= CO_DUMP_FILTER_EMCY; break;
 		case 'p': opt |= apply_pdo_option(optarg); break;
 		case 's': opt |= CO_DUMP_FILTER_SDO; break;
 		case 'H': opt |= CO_DUMP_FILTER_HEARTBEAT; break;
+		case 'F': rc = tf_parse_time(&query.from, optarg); break;
+		case 't': rc = tf_parse_time(&query.to, optarg); break;
+		case 'N': rc = tf_parse_node(query.nodes, optarg); break;
+		case 'c': rc = tf_parse_cob(&query.cob, optarg); break;
+		case 'a': analyze = 1; break;
+		case 'b':
+			rc = parse_uint(&analysis.bitrate, optarg, 1,
+					MAX_BITRATE);
+			break;
+		case 'j':
+			rc = parse_uint(&analysis.n_threads, optarg, 0,
+					MAX_JOBS);
+			break;
 		default: return print_usage(stderr, 1);
 		}
+
+		if (rc < 0) {
+			fprintf(stderr, "Invalid argument: %s\n", optarg);
+			return print_usage(stderr, 1);
+		}
 	}
 
 	int nargs = argc - optind;
@@ -100,7 +186,13 @@ int main(int argc, char* argv[])
 
 	const char* iface = args[0];
 
-	setvbuf(stdout, NULL, _IOLBF, 0);
+	/* Output is written in large chunks to keep up with a busy bus. It is
+	 * flushed whenever the bus goes idle.
+	 */
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+	if (analyze)
+		return co_dump_analyze(iface, opt, &query, &analysis);
 
-	return co_dump(iface, opt);
+	return co_dump_query(iface, opt, &query);
 }
@@ -0,0 +1,151 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "trace-replay.h"
+
+const char usage_[] =
+"Usage: canopen-replay [options] <trace> <interface>\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -T, --tcp                  Connect via TCP.\n"
+"    -s, --speed=factor         Replay speed relative to the recording, e.g.\n"
+"                               2 or 10, or max to send as fast as the bus\n"
+"                               allows. Default 1.\n"
+"    -F, --from=time            Only replay frames at or after this time.\n"
+"    -t, --to=time              Only replay frames at or before this time.\n"
+"    -N, --node=id              Only replay frames from/to this node. May be\n"
+"                               given more than once.\n"
+"    -c, --cob=id               Only replay frames with this COB-ID (hex).\n"
+"    -q, --quiet                Don't print a summary when done.\n"
+"\n"
+"The trace may be a trace buffer file, a compact trace file, a pcapng file or\n"
+"a trace capture directory. Times are given as local time, e.g.\n"
+"2018-03-01T12:00:00.5, or as seconds since the epoch.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-replay trace.bin vcan0\n"
+"    $ canopen-replay --speed=max --node=5 trace.bin vcan0\n"
+"    $ canopen-replay -T --speed=10 trace.pcapng 127.0.0.1:5555\n"
+"\n";
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+static int parse_speed(double* dst, const char* arg)
+{
+	char* end = NULL;
+
+	if (strcmp(arg, "max") == 0) {
+		*dst = 0.0;
+		return 0;
+	}
+
+	double speed = strtod(arg, &end);
+	if (end == arg || *end != '\0' || !(speed > 0.0))
+		return -1;
+
+	*dst = speed;
+	return 0;
+}
+
+static void print_stats(const struct tr_stats* stats)
+{
+	double duration = stats->duration / 1e9;
+
+	fprintf(stderr, "Replayed %llu frames in %.3f s (%.0f frames/s) using "
+		"%llu batches. Max lag: %.3f ms\n",
+		(unsigned long long)stats->n_frames, duration,
+		duration > 0.0 ? stats->n_frames / duration : 0.0,
+		(unsigned long long)stats->n_batches, stats->max_lag / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",      no_argument,       0, 'h' },
+		{ "tcp",       no_argument,       0, 'T' },
+		{ "speed",     required_argument, 0, 's' },
+		{ "from",      required_argument, 0, 'F' },
+		{ "to",        required_argument, 0, 't' },
+		{ "node",      required_argument, 0, 'N' },
+		{ "cob",       required_argument, 0, 'c' },
+		{ "quiet",     no_argument,       0, 'q' },
+		{ 0, 0, 0, 0 }
+	};
+
+	struct tr_options options;
+	enum sock_type type = SOCK_TYPE_CAN;
+	int quiet = 0;
+	int rc = 0;
+
+	tr_options_init(&options);
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hTs:F:t:N:c:q", long_options,
+				    NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'T': type = SOCK_TYPE_TCP; break;
+		case 's': rc = parse_speed(&options.speed, optarg); break;
+		case 'F': rc = tf_parse_time(&options.query.from, optarg); break;
+		case 't': rc = tf_parse_time(&options.query.to, optarg); break;
+		case 'N':
+			rc = tf_parse_node(options.query.nodes, optarg);
+			options.query.has_nodes = 1;
+			break;
+		case 'c': rc = tf_parse_cob(&options.query.cob, optarg); break;
+		case 'q': quiet = 1; break;
+		default: return print_usage(stderr, 1);
+		}
+
+		if (rc < 0) {
+			fprintf(stderr, "Invalid argument: %s\n", optarg);
+			return print_usage(stderr, 1);
+		}
+	}
+
+	int nargs = argc - optind;
+	char** args = &argv[optind];
+
+	if (nargs < 2)
+		return print_usage(stderr, 1);
+
+	const char* path = args[0];
+	const char* iface = args[1];
+
+	struct tr_stats stats = { 0 };
+	if (tr_replay(path, type, iface, &options, &stats) < 0) {
+		perror("Could not replay trace");
+		rc = 1;
+	}
+
+	if (!quiet)
+		print_stats(&stats);
+
+	return rc;
+}
@@ -24,6 +24,9 @@
 const char usage_[] =
 "Usage: canopen-vnode [options] <interface> <nodeid> [nodeid] [...]\n"
 "\n"
+"A nodeid of the form lss:<serial> creates a node without a node id that\n"
+"waits for one to be assigned via LSS.\n"
+"\n"
 "Options:\n"
 "    -h, --help                 Get help.\n"
 "    -T, --tcp                  Connect via TCP.\n"
@@ -32,9 +35,11 @@ const char usage_[] =
 "Examples:\n"
 "    $ canopen-vnode can0\n"
 "    $ canopen-vnode -T 127.0.0.1\n"
+"    $ canopen-vnode can0 1 2 lss:1001 lss:1002\n"
 "\n";
 
-static struct vnode* node[127];
+static struct vnode* node[254];
+static int n_nodes = 0;
 
 static inline int print_usage(FILE* output, int status)
 {
@@ -42,40 +47,43 @@ static inline int print_usage(FILE* output, int status)
 	return status;
 }
 
+static struct vnode* new_node(enum sock_type type, const char* config,
+			      const char* iface, const char* id)
+{
+	if (strncmp(id, "lss:", 4) == 0)
+		return co_vnode_new_unconfigured(type, iface, config,
+						 strtoul(id + 4, NULL, 0));
+
+	return co_vnode_new(type, iface, config, atoi(id));
+}
+
+void destroy_nodes(void)
+{
+	while (n_nodes > 0)
+		co_vnode_destroy(node[--n_nodes]);
+}
+
 int init_nodes(enum sock_type type, const char* config, const char* iface,
 	       char* ids[], int n_ids)
 {
-	memset(node, 0, sizeof(node));
+	if (n_ids > (int)(sizeof(node) / sizeof(node[0])))
+		return -1;
 
-	int i;
-	for (i = 0; i < n_ids; ++i) {
-		int nodeid = atoi(ids[i]);
-
-		struct vnode* vnode = co_vnode_new(type, iface, config, nodeid);
+	for (int i = 0; i < n_ids; ++i) {
+		struct vnode* vnode = new_node(type, config, iface, ids[i]);
 		if (!vnode)
 			goto failure;
 
-		node[nodeid - 1] = vnode;
+		node[n_nodes++] = vnode;
 	}
 
 	return 0;
 
 failure:
-	for (--i; i >= 0; --i) {
-		int nodeid = atoi(ids[i]);
-		co_vnode_destroy(node[nodeid - 1]);
-	}
-
+	destroy_nodes();
 	return -1;
 }
 
-void destroy_nodes(void)
-{
-	for (int i = 0; i < 127; ++i)
-		if (node[i])
-			co_vnode_destroy(node[i]);
-}
-
 int main(int argc, char* argv[])
 {
 	static const struct option long_options[] = {
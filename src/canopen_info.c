@@ -14,10 +14,12 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sharedmalloc.h>
 #include "canopen_info.h"
 
 struct canopen_info* canopen_info_ = NULL;
+struct canopen_bus_info* canopen_bus_info_ = NULL;
 
 static const char canopen_info_name[] = "canopen2";
 static const char canopen_info_description[] = "canopen2.xml";
@@ -28,7 +30,8 @@ int canopen_info_init(const char* iface)
 	snprintf(buffer, sizeof(buffer), "%s.%s", canopen_info_name, iface);
 	buffer[sizeof(buffer) - 1] = '\0';
 
-	canopen_info_ = s_malloc(sizeof(struct canopen_info) * 127, buffer,
+	canopen_info_ = s_malloc(sizeof(struct canopen_info) * 127
+				 + sizeof(struct canopen_bus_info), buffer,
 				 canopen_info_description);
 	if (!canopen_info_)
 		return -1;
@@ -36,6 +39,9 @@ int canopen_info_init(const char* iface)
 	for (size_t i = 0; i < 127; ++i)
 		canopen_info_[i].is_active = 0;
 
+	canopen_bus_info_ = (struct canopen_bus_info*)&canopen_info_[127];
+	memset(canopen_bus_info_, 0, sizeof(*canopen_bus_info_));
+
 	return 0;
 }
 
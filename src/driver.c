@@ -105,6 +105,9 @@ void co_drv_unload(struct co_drv* drv)
 
 	dlclose(drv->dso);
 
+	struct co_master_node_hot* hot = co_master_node_hot(co_drv_node(drv));
+	memset(hot->pdo_fn, 0, sizeof(hot->pdo_fn));
+
 	memset(drv, 0, sizeof(*drv));
 }
 
@@ -201,22 +204,22 @@ void* co_get_context(const struct co_drv* self)
 
 void co_set_pdo1_fn(struct co_drv* self, co_pdo_fn fn)
 {
-	self->pdo1_fn = fn;
+	co_master_node_hot(co_drv_node(self))->pdo_fn[0] = fn;
 }
 
 void co_set_pdo2_fn(struct co_drv* self, co_pdo_fn fn)
 {
-	self->pdo2_fn = fn;
+	co_master_node_hot(co_drv_node(self))->pdo_fn[1] = fn;
 }
 
 void co_set_pdo3_fn(struct co_drv* self, co_pdo_fn fn)
 {
-	self->pdo3_fn = fn;
+	co_master_node_hot(co_drv_node(self))->pdo_fn[2] = fn;
 }
 
 void co_set_pdo4_fn(struct co_drv* self, co_pdo_fn fn)
 {
-	self->pdo4_fn = fn;
+	co_master_node_hot(co_drv_node(self))->pdo_fn[3] = fn;
 }
 
 int co_rpdo1(struct co_drv* self, const void* data, size_t size)
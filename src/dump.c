@@ -17,6 +17,13 @@
 #include <unistd.h>
 #include <time.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include "socketcan.h"
 #include "canopen.h"
@@ -33,6 +40,12 @@
 #include "canopen/error.h"
 #include "time-utils.h"
 #include "trace-buffer.h"
+#include "trace-capture.h"
+#include "trace-format.h"
+#include "trace-stats.h"
+#include "pcapng.h"
+#include "outbuf.h"
+#include "co_atomic.h"
 
 #ifndef CAN_MAX_DLC
 #define CAN_MAX_DLC 8
@@ -40,8 +53,14 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/* Frames are queued between the socket reader and the formatter. If the
+ * formatter falls this far behind, frames are dropped rather than letting
+ * the socket's receive queue overflow.
+ */
+#define DUMP_RING_SIZE (1 << 16)
+
 #define printx(cf, fmt, ...) \
-	printf(fmt "%s\n", ## __VA_ARGS__, (cf)->can_id & CAN_RTR_FLAG ? " [RTR]" : "")
+	outbuf_printf(&out_, fmt "%s\n", ## __VA_ARGS__, (cf)->can_id & CAN_RTR_FLAG ? " [RTR]" : "")
 
 struct node_state {
 	uint32_t current_mux;
@@ -52,23 +71,64 @@ struct node_state {
 static enum co_dump_options options_ = 0;
 static struct node_state node_state_[127] = { 0 };
 static uint64_t current_time_ = 0;
+static struct tf_query query_;
+static int use_query_ = 0;
+static struct trace_stats* stats_ = NULL;
+static struct pcapng_writer* pcapng_ = NULL;
+static struct outbuf out_;
+
+/* Set on SIGINT or SIGTERM. The handler also wakes the formatter through
+ * interrupt_fd_ in case it is waiting for frames.
+ */
+static volatile sig_atomic_t is_interrupted_ = 0;
+static volatile int interrupt_fd_ = -1;
+
+/* Set when the pcapng output can no longer be written */
+static int is_output_broken_ = 0;
 
 char* strlcpy(char* dst, const char* src, size_t size);
 const char* hexdump(const void* data, size_t size);
 
+/* Formatting the date is slow, so it's only done once per second */
+static const char* get_time_prefix(uint64_t seconds, size_t* size)
+{
+	static uint64_t cached_seconds = UINT64_MAX;
+	static char prefix[64];
+	static size_t prefix_size = 0;
+
+	if (seconds != cached_seconds) {
+		time_t t = seconds;
+		struct tm tm = { 0 };
+
+		prefix_size = strftime(prefix, sizeof(prefix), "%FT%T.",
+				       localtime_r(&t, &tm));
+		cached_seconds = seconds;
+	}
+
+	*size = prefix_size;
+	return prefix;
+}
+
 static inline void print_ts(void)
 {
 	if (!(options_ & CO_DUMP_TIMESTAMP))
 		return;
 
-	time_t seconds = current_time_ / 1000000ULL;
-	uint32_t microseconds = current_time_ % 1000000ULL;
+	size_t size;
+	const char* prefix = get_time_prefix(current_time_ / 1000000ULL, &size);
 
-	struct tm tm = { 0 };
-	char buffer[256];
+	outbuf_write(&out_, prefix, size);
+	outbuf_put_uint(&out_, current_time_ % 1000000ULL, 6);
+	outbuf_write(&out_, "Z ", 2);
+}
 
-	strftime(buffer, sizeof(buffer), "%FT%T", localtime_r(&seconds, &tm));
-	printf("%s.%06"PRIu32"Z ", buffer, microseconds);
+/* The hot paths below format by hand rather than through printx() */
+static inline void print_rtr_and_newline(const struct can_frame* cf)
+{
+	if (cf->can_id & CAN_RTR_FLAG)
+		outbuf_write(&out_, " [RTR]\n", 7);
+	else
+		outbuf_putc(&out_, '\n');
 }
 
 static inline struct node_state* get_node_state(int nodeid)
@@ -120,10 +180,9 @@ static int dump_sync(struct can_frame* cf)
 	if (!(options_ & CO_DUMP_FILTER_SYNC))
 		return 0;
 
-	(void)cf;
-
 	print_ts();
-	printx(cf, "SYNC");
+	outbuf_write(&out_, "SYNC", 4);
+	print_rtr_and_newline(cf);
 
 	return 0;
 }
@@ -176,17 +235,32 @@ static int dump_pdo(int type, int n, struct canopen_msg* msg,
 	if (!is_pdo_in_filter(n))
 		return 0;
 
+	char header[] = { type, 'P', 'D', 'O', '0' + n, ' ' };
+	size_t size = cf->can_dlc > CAN_MAX_DLC ? CAN_MAX_DLC : cf->can_dlc;
+
 	print_ts();
 
-	printx(cf, "%cPDO%d %d length=%d,data=%s", type, n, msg->id,
-	       cf->can_dlc, hexdump(cf->data, cf->can_dlc));
+	outbuf_write(&out_, header, sizeof(header));
+	outbuf_put_uint(&out_, msg->id, 0);
+	outbuf_write(&out_, " length=", 8);
+	outbuf_put_uint(&out_, cf->can_dlc, 0);
+	outbuf_write(&out_, ",data=", 6);
+	outbuf_put_hex(&out_, cf->data, size);
+	print_rtr_and_newline(cf);
 
 	return 0;
 }
 
+/* Malformed frames must not make the sizes below wrap around */
+static size_t get_payload_size(const struct can_frame* cf, size_t offset)
+{
+	size_t dlc = MIN(cf->can_dlc, CAN_MAX_DLC);
+	return dlc > offset ? dlc - offset : 0;
+}
+
 static size_t get_expediated_size(const struct can_frame* cf)
 {
-	size_t max_size = cf->can_dlc - SDO_EXPEDIATED_DATA_IDX;
+	size_t max_size = get_payload_size(cf, SDO_EXPEDIATED_DATA_IDX);
 
 	return sdo_is_size_indicated(cf)
 	     ? MIN(sdo_get_expediated_size(cf), max_size) : max_size;
@@ -207,8 +281,9 @@ static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("RSDO %d init-download-%s index=%x,subindex=%d", msg->id,
-	       is_expediated ? "expediated" : "segment", index, subindex);
+	outbuf_printf(&out_, "RSDO %d init-download-%s index=%x,subindex=%d",
+		      msg->id, is_expediated ? "expediated" : "segment", index,
+		      subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
 		size_t size = sdo_get_indicated_size(cf);
@@ -221,6 +296,8 @@ static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 		size_t size = get_expediated_size(cf);
 		printx(cf, ",size=%zu,data=%s", size,
 		       hexdump(&cf->data[SDO_EXPEDIATED_DATA_IDX], size));
+	} else {
+		printx(cf, "");
 	}
 
 	return 0;
@@ -252,22 +329,24 @@ static int dump_sdo_dl_seg_req(struct canopen_msg* msg, struct can_frame* cf)
 	int is_end = sdo_is_end_segment(cf);
 
 	const void* data = &cf->data[SDO_SEGMENT_IDX];
-	size_t size = cf->can_dlc - SDO_SEGMENT_IDX;
+	size_t size = get_payload_size(cf, SDO_SEGMENT_IDX);
 
 	if (state)
 		vector_append(&state->sdo_data, data, size);
 
 	print_ts();
 
-	printf("RSDO %d download-segment%s size=%zu,data=%s", msg->id,
-	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
+	outbuf_printf(&out_, "RSDO %d download-segment%s size=%zu,data=%s",
+		      msg->id, is_end ? "-end" : "", size,
+		      get_segment_data(state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%zu,final-data=%s", final_size,
-		       get_segment_data(state, final_data, final_size));
+		outbuf_printf(&out_, ",final-size=%zu,final-data=%s",
+			      final_size,
+			      get_segment_data(state, final_data, final_size));
 
 		state->current_mux = 0;
 	}
@@ -348,8 +427,9 @@ static int dump_sdo_ul_init_res(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("TSDO %d init-upload-%s index=%x,subindex=%d", msg->id,
-	       is_expediated ? "expediated" : "segment", index, subindex);
+	outbuf_printf(&out_, "TSDO %d init-upload-%s index=%x,subindex=%d",
+		      msg->id, is_expediated ? "expediated" : "segment", index,
+		      subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
 		size_t size = sdo_get_indicated_size(cf);
@@ -368,6 +448,8 @@ static int dump_sdo_ul_init_res(struct canopen_msg* msg, struct can_frame* cf)
 				   MIN(sizeof(state->device_type), size));
 
 		printx(cf, ",size=%zu,data=%s", size, hexdump(payload, size));
+	} else {
+		printx(cf, "");
 	}
 
 	return 0;
@@ -380,22 +462,24 @@ static int dump_sdo_ul_seg_res(struct canopen_msg* msg, struct can_frame* cf)
 	int is_end = sdo_is_end_segment(cf);
 
 	const void* data = &cf->data[SDO_SEGMENT_IDX];
-	size_t size = cf->can_dlc - SDO_SEGMENT_IDX;
+	size_t size = get_payload_size(cf, SDO_SEGMENT_IDX);
 
 	if (state)
 		vector_append(&state->sdo_data, data, size);
 
 	print_ts();
 
-	printf("TSDO %d upload-segment%s size=%zu,data=%s", msg->id,
-	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
+	outbuf_printf(&out_, "TSDO %d upload-segment%s size=%zu,data=%s",
+		      msg->id, is_end ? "-end" : "", size,
+		      get_segment_data(state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%zu,final-data=%s", final_size,
-		       get_segment_data(state, final_data, final_size));
+		outbuf_printf(&out_, ",final-size=%zu,final-data=%s",
+			      final_size,
+			      get_segment_data(state, final_data, final_size));
 	}
 
 	printx(cf, "");
@@ -464,14 +548,20 @@ static int dump_heartbeat(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
+	outbuf_write(&out_, "HEARTBEAT ", 10);
+	outbuf_put_uint(&out_, msg->id, 0);
+
 	if (heartbeat_is_bootup(cf)) {
-		printx(cf, "HEARTBEAT %d bootup", msg->id);
+		outbuf_puts(&out_, " bootup");
 	} else if (state == 1) {
-		printx(cf, "HEARTBEAT %d poll", msg->id);
+		outbuf_puts(&out_, " poll");
 	} else {
-		printx(cf, "HEARTBEAT %d state=%s", msg->id, state_str(state));
+		outbuf_puts(&out_, " state=");
+		outbuf_puts(&out_, state_str(state));
 	}
 
+	print_rtr_and_newline(cf);
+
 	return 0;
 }
 
@@ -506,19 +596,292 @@ static int multiplex(struct can_frame* cf)
 	return -1;
 }
 
-static void run_dumper(struct sock* sock)
+static int is_object_in_filter(enum canopen_object object)
 {
-	struct can_frame cf;
+	switch (object) {
+	case CANOPEN_NMT: return options_ & CO_DUMP_FILTER_NMT;
+	case CANOPEN_SYNC: return options_ & CO_DUMP_FILTER_SYNC;
+	case CANOPEN_TIMESTAMP: return options_ & CO_DUMP_FILTER_TIMESTAMP;
+	case CANOPEN_EMCY: return options_ & CO_DUMP_FILTER_EMCY;
+	case CANOPEN_TPDO1: case CANOPEN_RPDO1: return is_pdo_in_filter(1);
+	case CANOPEN_TPDO2: case CANOPEN_RPDO2: return is_pdo_in_filter(2);
+	case CANOPEN_TPDO3: case CANOPEN_RPDO3: return is_pdo_in_filter(3);
+	case CANOPEN_TPDO4: case CANOPEN_RPDO4: return is_pdo_in_filter(4);
+	case CANOPEN_TSDO: case CANOPEN_RSDO:
+		return options_ & CO_DUMP_FILTER_SDO;
+	case CANOPEN_HEARTBEAT: return options_ & CO_DUMP_FILTER_HEARTBEAT;
+	default: break;
+	}
 
-	while (1) {
-		memset(&cf, 0, sizeof(cf));
+	return 1;
+}
+
+static void print_bool(int value)
+{
+	if (value)
+		outbuf_write(&out_, "true", 4);
+	else
+		outbuf_write(&out_, "false", 5);
+}
+
+/* One line per frame for machine consumption. The timestamp is in
+ * microseconds since the epoch.
+ */
+static void dump_record(const struct tb_frame* frame)
+{
+	const struct can_frame* cf = &frame->cf;
+	struct canopen_msg msg = { .id = 0, .object = CANOPEN_UNSPEC };
+	int is_extended = !!(cf->can_id & CAN_EFF_FLAG);
+	int is_rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	size_t size = cf->can_dlc > CAN_MAX_DLC ? CAN_MAX_DLC : cf->can_dlc;
+
+	if (!is_extended && canopen_get_object_type(&msg, cf) < 0)
+		msg.object = CANOPEN_UNSPEC;
+
+	if (!is_object_in_filter(msg.object))
+		return;
+
+	const char* type = canopen_object_type_to_string_exact(msg.object);
+	uint32_t id = cf->can_id & (is_extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+
+	if (options_ & CO_DUMP_JSON) {
+		outbuf_write(&out_, "{\"timestamp\":", 13);
+		outbuf_put_uint(&out_, frame->timestamp, 0);
+		outbuf_write(&out_, ",\"id\":", 6);
+		outbuf_put_uint(&out_, id, 0);
+		outbuf_write(&out_, ",\"extended\":", 12);
+		print_bool(is_extended);
+		outbuf_write(&out_, ",\"rtr\":", 7);
+		print_bool(is_rtr);
+		outbuf_write(&out_, ",\"type\":\"", 9);
+		outbuf_puts(&out_, type);
+		outbuf_write(&out_, "\",\"node\":", 9);
+		outbuf_put_uint(&out_, msg.id, 0);
+		outbuf_write(&out_, ",\"dlc\":", 7);
+		outbuf_put_uint(&out_, cf->can_dlc, 0);
+		outbuf_write(&out_, ",\"data\":\"", 9);
+		outbuf_put_hex(&out_, cf->data, is_rtr ? 0 : size);
+		outbuf_write(&out_, "\"}\n", 3);
+	} else {
+		outbuf_put_uint(&out_, frame->timestamp, 0);
+		outbuf_putc(&out_, ',');
+		outbuf_put_uint(&out_, id, 0);
+		outbuf_putc(&out_, ',');
+		outbuf_putc(&out_, '0' + is_extended);
+		outbuf_putc(&out_, ',');
+		outbuf_putc(&out_, '0' + is_rtr);
+		outbuf_putc(&out_, ',');
+		outbuf_puts(&out_, type);
+		outbuf_putc(&out_, ',');
+		outbuf_put_uint(&out_, msg.id, 0);
+		outbuf_putc(&out_, ',');
+		outbuf_put_uint(&out_, cf->can_dlc, 0);
+		outbuf_putc(&out_, ',');
+		outbuf_put_hex(&out_, cf->data, is_rtr ? 0 : size);
+		outbuf_putc(&out_, '\n');
+	}
+}
+
+static void dump_trace_frame(const struct tb_frame* frame, void* context)
+{
+	(void)context;
+
+	if (use_query_ && !tf_query_match(&query_, frame))
+		return;
+
+	if (stats_) {
+		ts_add(stats_, frame);
+		return;
+	}
+
+	if (pcapng_) {
+		if (pcapng_write_frame(pcapng_, frame->timestamp * 1000ULL,
+				       &frame->cf) < 0)
+			is_output_broken_ = 1;
+		return;
+	}
+
+	if (options_ & (CO_DUMP_JSON | CO_DUMP_CSV)) {
+		dump_record(frame);
+		return;
+	}
+
+	struct can_frame cf = frame->cf;
+
+	current_time_ = frame->timestamp;
+	multiplex(&cf);
+}
+
+/* The socket is read in its own thread so that slow formatting or a slow
+ * consumer of the output never holds up reading the socket. Frames are
+ * passed on through a single producer, single consumer ring. Its positions
+ * are 32 bits wide so that they are native atomics everywhere; they wrap
+ * around, which is fine because DUMP_RING_SIZE is a power of two.
+ */
+struct dump_reader {
+	uint32_t head;
+	char head_padding[64 - sizeof(uint32_t)];
+	uint32_t tail;
+	char tail_padding[64 - sizeof(uint32_t)];
+
+	const struct sock* sock;
+	struct tb_frame* frames;
+	int eventfd;
+	int is_done;
+	uint64_t n_dropped;
+	pthread_t thread;
+};
+
+static void dump_reader_wake(struct dump_reader* self)
+{
+	uint64_t one = 1;
+	ssize_t rc = write(self->eventfd, &one, sizeof(one));
+	(void)rc;
+}
+
+static void* dump_reader_run(void* context)
+{
+	struct dump_reader* self = context;
+	struct tb_frame batch[SOCK_BATCH_MAX];
+	uint32_t head = self->head;
+	uint32_t tail = co_atomic_load_acquire(&self->tail);
 
-		if (sock_recv(sock, &cf, MSG_WAITALL) <= 0)
+	while (1) {
+		ssize_t n = sock_recv_batch(self->sock, batch, SOCK_BATCH_MAX);
+		if (n <= 0)
 			break;
 
-		current_time_ = gettime_us(CLOCK_REALTIME);
-		multiplex(&cf);
+		for (ssize_t i = 0; i < n; ++i) {
+			if (head - tail == DUMP_RING_SIZE) {
+				tail = co_atomic_load_acquire(&self->tail);
+
+				if (head - tail == DUMP_RING_SIZE) {
+					self->n_dropped++;
+					continue;
+				}
+			}
+
+			self->frames[head++ % DUMP_RING_SIZE] = batch[i];
+		}
+
+		co_atomic_store_release(&self->head, head);
+		dump_reader_wake(self);
 	}
+
+	co_atomic_store_release(&self->is_done, 1);
+	dump_reader_wake(self);
+	return NULL;
+}
+
+static int dump_reader_start(struct dump_reader* self, const struct sock* sock)
+{
+	sigset_t signals, old_signals;
+
+	memset(self, 0, sizeof(*self));
+	self->sock = sock;
+
+	self->frames = malloc(DUMP_RING_SIZE * sizeof(*self->frames));
+	if (!self->frames)
+		return -1;
+
+	self->eventfd = eventfd(0, EFD_CLOEXEC);
+	if (self->eventfd < 0)
+		goto eventfd_failure;
+
+	/* Interrupts are handled by the formatter */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+	int rc = pthread_create(&self->thread, NULL, dump_reader_run, self);
+
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (rc != 0)
+		goto thread_failure;
+
+	return 0;
+
+thread_failure:
+	close(self->eventfd);
+eventfd_failure:
+	free(self->frames);
+	return -1;
+}
+
+static void dump_reader_stop(struct dump_reader* self)
+{
+	if (!co_atomic_load_acquire(&self->is_done))
+		pthread_cancel(self->thread);
+
+	pthread_join(self->thread, NULL);
+
+	if (self->n_dropped)
+		fprintf(stderr, "Dropped %"PRIu64" frames because the output "
+			"could not keep up\n", self->n_dropped);
+
+	close(self->eventfd);
+	free(self->frames);
+}
+
+static int dump_should_stop(void)
+{
+	return is_interrupted_ || is_output_broken_;
+}
+
+/* Frames carry the kernel's receive timestamp where the socket provides one,
+ * so the output does not depend on when the formatter got around to them.
+ */
+static void run_dumper(struct sock* sock)
+{
+	struct dump_reader reader;
+
+	if (dump_reader_start(&reader, sock) < 0) {
+		perror("Could not start reader");
+		return;
+	}
+
+	uint32_t tail = 0;
+
+	interrupt_fd_ = reader.eventfd;
+
+	while (!dump_should_stop()) {
+		uint32_t head = co_atomic_load_acquire(&reader.head);
+
+		if (head == tail) {
+			if (co_atomic_load_acquire(&reader.is_done)
+			 && co_atomic_load_acquire(&reader.head) == tail)
+				break;
+
+			/* Idle, so this is a good time to write */
+			outbuf_flush(&out_);
+			if (pcapng_)
+				fflush(stdout);
+
+			/* The flag is checked again at the top of the loop */
+			uint64_t value;
+			if (read(reader.eventfd, &value, sizeof(value)) < 0
+			 && errno == EINTR)
+				break;
+
+			continue;
+		}
+
+		while (tail != head && !dump_should_stop()) {
+			dump_trace_frame(&reader.frames[tail++ % DUMP_RING_SIZE],
+					 NULL);
+
+			/* Make room for the reader every now and then */
+			if (tail % SOCK_BATCH_MAX == 0)
+				co_atomic_store_release(&reader.tail, tail);
+		}
+
+		co_atomic_store_release(&reader.tail, tail);
+	}
+
+	interrupt_fd_ = -1;
+	dump_reader_stop(&reader);
 }
 
 static void resolve_filters(enum co_dump_options options)
@@ -532,35 +895,312 @@ static void resolve_filters(enum co_dump_options options)
 
 static int dump_file(const char* path, enum co_dump_options options)
 {
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return tb_capture_read(path, dump_trace_frame, NULL);
+
 	FILE* stream = fopen(path, "r");
 	if (!stream)
 		return -1;
 
-	struct tb_frame frame;
-	while (fread(&frame, sizeof(frame), 1, stream)) {
-		current_time_ = frame.timestamp;
-		multiplex(&frame.cf);
+	if (tf_is_compact(stream)) {
+		fclose(stream);
+		return tf_read_file(path, use_query_ ? &query_ : NULL,
+				    dump_trace_frame, NULL);
+	}
+
+	if (pcapng_is_pcapng(stream)) {
+		int rc = pcapng_read(stream, dump_trace_frame, NULL);
+		fclose(stream);
+		return rc;
 	}
 
+	struct tb_frame frame;
+	while (fread(&frame, sizeof(frame), 1, stream))
+		dump_trace_frame(&frame, NULL);
+
 	fclose(stream);
 	return 0;
 }
 
-__attribute__((visibility("default")))
-int co_dump(const char* addr, enum co_dump_options options)
+static void resolve_query(struct tf_query* dst,
+			  const struct co_dump_query* src)
+{
+	tf_query_init(dst);
+
+	dst->from = src->from;
+	dst->to = src->to;
+	dst->cob = src->cob;
+
+	for (int i = 0; i < 128; ++i)
+		if (src->nodes[i / 8] & (1 << (i % 8)))
+			dst->has_nodes = 1;
+
+	if (dst->has_nodes)
+		memcpy(dst->nodes, src->nodes, sizeof(dst->nodes));
+}
+
+struct analysis_chunk {
+	pthread_t thread;
+	const struct tf_file* file;
+	const struct tb_frame* frames;
+	size_t first, last;
+	struct trace_stats* stats;
+	int rc;
+};
+
+static void analyze_frame(const struct tb_frame* frame, void* context)
+{
+	struct trace_stats* stats = context;
+
+	if (use_query_ && !tf_query_match(&query_, frame))
+		return;
+
+	ts_add(stats, frame);
+}
+
+static void* analysis_thread(void* context)
+{
+	struct analysis_chunk* chunk = context;
+
+	if (chunk->file) {
+		chunk->rc = tf_file_read(chunk->file, chunk->first, chunk->last,
+					 use_query_ ? &query_ : NULL,
+					 analyze_frame, chunk->stats);
+		return NULL;
+	}
+
+	for (size_t i = chunk->first; i < chunk->last; ++i)
+		analyze_frame(&chunk->frames[i], chunk->stats);
+
+	return NULL;
+}
+
+/* Split [first, last) into n_threads consecutive chunks, analyse them in
+ * parallel and merge the results in order.
+ */
+static int analyze_chunks(struct trace_stats* stats, const struct tf_file* file,
+			  const struct tb_frame* frames, size_t first,
+			  size_t last, unsigned int n_threads)
 {
+	size_t n_items = last - first;
+	int rc = -1;
+
+	if (n_threads > n_items)
+		n_threads = n_items ? n_items : 1;
+
+	struct analysis_chunk* chunks = calloc(n_threads, sizeof(*chunks));
+	if (!chunks)
+		return -1;
+
+	unsigned int n_started = 0;
+
+	for (unsigned int i = 0; i < n_threads; ++i) {
+		struct analysis_chunk* chunk = &chunks[i];
+
+		chunk->file = file;
+		chunk->frames = frames;
+		chunk->first = first + n_items * i / n_threads;
+		chunk->last = first + n_items * (i + 1) / n_threads;
+		chunk->stats = ts_new();
+		if (!chunk->stats)
+			goto done;
+
+		if (pthread_create(&chunk->thread, NULL, analysis_thread,
+				   chunk) != 0)
+			goto done;
+
+		++n_started;
+	}
+
+	rc = 0;
+
+done:
+	for (unsigned int i = 0; i < n_started; ++i)
+		pthread_join(chunks[i].thread, NULL);
+
+	for (unsigned int i = 0; i < n_threads; ++i) {
+		if (rc == 0 && (chunks[i].rc < 0
+			     || ts_merge(stats, chunks[i].stats) < 0))
+			rc = -1;
+
+		ts_free(chunks[i].stats);
+	}
+
+	free(chunks);
+	return rc;
+}
+
+static int analyze_compact_file(struct trace_stats* stats, const char* path,
+				unsigned int n_threads)
+{
+	struct tf_file file;
+
+	if (tf_file_open(&file, path) < 0)
+		return -1;
+
+	size_t first = use_query_ ? tf_file_find(&file, query_.from) : 0;
+
+	int rc = analyze_chunks(stats, &file, NULL, first, file.n_blocks,
+				n_threads);
+
+	tf_file_close(&file);
+	return rc;
+}
+
+static int analyze_raw_file(struct trace_stats* stats, const char* path,
+			    unsigned int n_threads)
+{
+	struct stat st;
+	int rc = -1;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto done;
+
+	size_t n_frames = st.st_size / sizeof(struct tb_frame);
+	if (n_frames == 0) {
+		rc = 0;
+		goto done;
+	}
+
+	size_t size = n_frames * sizeof(struct tb_frame);
+	void* frames = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (frames == MAP_FAILED)
+		goto done;
+
+	rc = analyze_chunks(stats, NULL, frames, 0, n_frames, n_threads);
+
+	munmap(frames, size);
+done:
+	close(fd);
+	return rc;
+}
+
+static int analyze_file(struct trace_stats* stats, const char* path,
+			unsigned int n_threads)
+{
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return tb_capture_read(path, analyze_frame, stats);
+
+	FILE* stream = fopen(path, "r");
+	if (!stream)
+		return -1;
+
+	/* pcapng files have no index, so they are read in one pass */
+	if (pcapng_is_pcapng(stream)) {
+		int rc = pcapng_read(stream, analyze_frame, stats);
+		fclose(stream);
+		return rc;
+	}
+
+	int is_compact = tf_is_compact(stream);
+	fclose(stream);
+
+	return is_compact ? analyze_compact_file(stats, path, n_threads)
+			  : analyze_raw_file(stats, path, n_threads);
+}
+
+static void prepare_can_socket(int fd)
+{
+	/* A deep receive queue rides out bursts while the output is slow */
+	int rcvbuf = 1 << 22;
+	int enable = 1;
+
+	net_fix_sndbuf(fd);
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable));
+}
+
+static void on_interrupt(int signo)
+{
+	(void)signo;
+
+	int saved_errno = errno;
+
+	is_interrupted_ = 1;
+
+	int fd = interrupt_fd_;
+	if (fd >= 0) {
+		uint64_t one = 1;
+		ssize_t rc = write(fd, &one, sizeof(one));
+		(void)rc;
+	}
+
+	errno = saved_errno;
+}
+
+/* Stop reading instead of terminating, so that a report can be printed or
+ * buffered output flushed. The signal may arrive at any point in the loop, so
+ * the loop checks is_interrupted_ rather than relying on EINTR.
+ */
+static void catch_interrupts(void)
+{
+	struct sigaction action = { .sa_handler = on_interrupt };
+
+	is_interrupted_ = 0;
+
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+}
+
+static int run(const char* addr, enum co_dump_options options,
+	       const struct co_dump_query* query,
+	       const struct co_dump_analysis* analysis)
+{
+	int rc = 0;
+
 	vector_init(&string_buffer_, 256);
 	node_state_init();
+	is_output_broken_ = 0;
 
 	resolve_filters(options);
+	outbuf_init(&out_, stdout);
+
+	if (query) {
+		resolve_query(&query_, query);
+		use_query_ = 1;
+	}
+
+	struct pcapng_writer pcapng;
+
+	if (analysis) {
+		stats_ = ts_new();
+		if (!stats_) {
+			perror("Could not allocate statistics");
+			return 1;
+		}
+	} else if (options & CO_DUMP_PCAPNG) {
+		if (pcapng_writer_init(&pcapng, stdout) < 0) {
+			perror("Could not write pcapng header");
+			return 1;
+		}
+
+		pcapng_ = &pcapng;
+	} else if (options & CO_DUMP_CSV) {
+		outbuf_puts(&out_, "timestamp,id,extended,rtr,type,node,dlc,"
+			    "data\n");
+	}
 
 	if (options & CO_DUMP_FILE) {
-		if (dump_file(addr, options) < 0) {
+		unsigned int n_threads = 1;
+
+		if (analysis)
+			n_threads = analysis->n_threads ? analysis->n_threads
+				  : (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+
+		if ((analysis ? analyze_file(stats_, addr, n_threads)
+			      : dump_file(addr, options)) < 0) {
 			perror("Could not read file");
-			return 1;
+			rc = 1;
 		}
 
-		return 0;
+		goto done;
 	}
 
 	struct sock sock;
@@ -568,14 +1208,51 @@ int co_dump(const char* addr, enum co_dump_options options)
 						    : SOCK_TYPE_CAN;
 	if (sock_open(&sock, type, addr, NULL) < 0) {
 		perror("Could not open CAN bus");
-		return 1;
+		rc = 1;
+		goto done;
 	}
 
 	if (type == SOCK_TYPE_CAN)
-		net_fix_sndbuf(sock.fd);
+		prepare_can_socket(sock.fd);
+
+	catch_interrupts();
 
 	run_dumper(&sock);
 
 	sock_close(&sock);
-	return 0;
+
+done:
+	outbuf_flush(&out_);
+
+	if (stats_ && rc == 0)
+		ts_print(stats_, stdout, analysis->bitrate);
+
+	if (pcapng_)
+		fflush(stdout);
+
+	ts_free(stats_);
+	stats_ = NULL;
+	pcapng_ = NULL;
+	return rc;
+}
+
+__attribute__((visibility("default")))
+int co_dump(const char* addr, enum co_dump_options options)
+{
+	return run(addr, options, NULL, NULL);
+}
+
+__attribute__((visibility("default")))
+int co_dump_query(const char* addr, enum co_dump_options options,
+		  const struct co_dump_query* query)
+{
+	return run(addr, options, query, NULL);
+}
+
+__attribute__((visibility("default")))
+int co_dump_analyze(const char* addr, enum co_dump_options options,
+		    const struct co_dump_query* query,
+		    const struct co_dump_analysis* analysis)
+{
+	return run(addr, options, query, analysis);
 }
@@ -0,0 +1,593 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <mloop.h>
+
+#include "event-rest.h"
+#include "rest.h"
+#include "http.h"
+#include "time-utils.h"
+#include "co_atomic.h"
+#include "canopen/emcy.h"
+#include "canopen/heartbeat.h"
+#include "canopen/nmt.h"
+
+#define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define EVENT_REST_KEY_EMCY 4
+#define EVENT_REST_KEY_NMT 5
+
+/* How long to wait before trying again when a client is not reading */
+#define EVENT_REST_RETRY 50 /* ms */
+
+/* The list of subscribers is only touched on the default main loop, which is
+ * also where frames are published.
+ */
+static struct event_rest_sub* event_rest_subs_[EVENT_REST_SUBSCRIBERS_MAX];
+static int event_rest_n_subs_ = 0;
+
+static unsigned int event_rest_interval_ = 100;
+
+void event_rest_set_interval(unsigned int interval)
+{
+	event_rest_interval_ = interval;
+}
+
+struct event_rest_sub* event_rest__sub_new(struct rest_client* client)
+{
+	struct event_rest_sub* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->ref = 1;
+	self->client = client;
+	self->topics = EVENT_REST_ALL;
+	memset(self->nodes, 1, sizeof(self->nodes));
+	self->interval = event_rest_interval_;
+
+	if (client)
+		rest_client_ref(client);
+
+	return self;
+}
+
+static void event_rest__sub_free(struct event_rest_sub* self)
+{
+	if (self->client)
+		rest_client_unref(self->client);
+
+	free(self);
+}
+
+void event_rest__sub_ref(struct event_rest_sub* self)
+{
+	co_atomic_add_fetch(&self->ref, 1);
+}
+
+void event_rest__sub_unref(struct event_rest_sub* self)
+{
+	if (co_atomic_sub_fetch(&self->ref, 1) == 0)
+		event_rest__sub_free(self);
+}
+
+static void event_rest__unref_sub(void* ptr)
+{
+	event_rest__sub_unref(ptr);
+}
+
+static int event_rest__parse_nodes(struct event_rest_sub* self,
+				   const char* list)
+{
+	if (!list || !*list)
+		return -1;
+
+	memset(self->nodes, 0, sizeof(self->nodes));
+
+	while (*list) {
+		char* end = NULL;
+		unsigned long nodeid = strtoul(list, &end, 0);
+		if (end == list || !is_in_range(nodeid, 1, 127))
+			return -1;
+
+		self->nodes[nodeid] = 1;
+
+		if (*end != ',' && *end != '\0')
+			return -1;
+
+		list = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+static unsigned int event_rest__topic(const char* name, size_t length)
+{
+	if (length == 3 && strncmp(name, "pdo", 3) == 0)
+		return EVENT_REST_PDO;
+	if (length == 4 && strncmp(name, "emcy", 4) == 0)
+		return EVENT_REST_EMCY;
+	if (length == 3 && strncmp(name, "nmt", 3) == 0)
+		return EVENT_REST_NMT;
+
+	return 0;
+}
+
+static int event_rest__parse_topics(struct event_rest_sub* self,
+				    const char* list)
+{
+	if (!list)
+		return -1;
+
+	self->topics = 0;
+
+	while (*list) {
+		size_t length = strcspn(list, ",");
+
+		unsigned int topic = event_rest__topic(list, length);
+		if (!topic)
+			return -1;
+
+		self->topics |= topic;
+
+		list += length;
+		if (*list == ',')
+			++list;
+	}
+
+	return self->topics ? 0 : -1;
+}
+
+static int event_rest__parse_interval(struct event_rest_sub* self,
+				      const char* value)
+{
+	if (!value || !*value)
+		return -1;
+
+	char* end = NULL;
+	unsigned long interval = strtoul(value, &end, 10);
+	if (*end != '\0')
+		return -1;
+
+	self->interval = MAX(interval, event_rest_interval_);
+	return 0;
+}
+
+int event_rest__parse_query(struct event_rest_sub* self, struct http_req* req)
+{
+	for (size_t i = 0; i < req->url_query_index; ++i) {
+		const char* key = req->url_query[i].key;
+		const char* value = req->url_query[i].value;
+		int rc;
+
+		if (strcmp(key, "node") == 0)
+			rc = event_rest__parse_nodes(self, value);
+		else if (strcmp(key, "topics") == 0)
+			rc = event_rest__parse_topics(self, value);
+		else if (strcmp(key, "interval") == 0)
+			rc = event_rest__parse_interval(self, value);
+		else
+			rc = -1;
+
+		if (rc < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int event_rest__key(const struct canopen_msg* msg, const struct can_frame* cf,
+		    enum event_rest_topic* topic)
+{
+	int n;
+
+	switch (msg->object) {
+	case CANOPEN_TPDO1: n = 0; *topic = EVENT_REST_PDO; break;
+	case CANOPEN_TPDO2: n = 1; *topic = EVENT_REST_PDO; break;
+	case CANOPEN_TPDO3: n = 2; *topic = EVENT_REST_PDO; break;
+	case CANOPEN_TPDO4: n = 3; *topic = EVENT_REST_PDO; break;
+	case CANOPEN_EMCY:
+		/* An empty EMCY is a legacy boot-up message */
+		if (cf->can_dlc == 0)
+			return -1;
+		n = EVENT_REST_KEY_EMCY;
+		*topic = EVENT_REST_EMCY;
+		break;
+	case CANOPEN_HEARTBEAT:
+		if (!heartbeat_is_valid(cf))
+			return -1;
+		n = EVENT_REST_KEY_NMT;
+		*topic = EVENT_REST_NMT;
+		break;
+	default:
+		return -1;
+	}
+
+	if (!is_in_range(msg->id, 1, 127))
+		return -1;
+
+	return msg->id * EVENT_REST_KEYS_PER_NODE + n;
+}
+
+int event_rest__push(struct event_rest_sub* self, int key,
+		     const struct can_frame* cf)
+{
+	struct event_rest_slot* slot = &self->slot[key];
+
+	/* Slots are only written on the receive path, so the sequence number
+	 * is not changed by anyone else.
+	 */
+	uint32_t seq = slot->seq;
+
+	co_atomic_store_release(&slot->seq, seq + 1);
+	co_atomic_fence_release();
+
+	slot->size = cf->can_dlc;
+	memcpy(slot->data, cf->data, sizeof(slot->data));
+
+	co_atomic_store_release(&slot->seq, seq + 2);
+
+	if (!co_atomic_cas(&slot->is_pending, 0, 1)) {
+		co_atomic_add_fetch(&slot->n_coalesced, 1);
+		return 0;
+	}
+
+	uint32_t head = self->head;
+	self->ring[head % EVENT_REST_KEYS] = key;
+	co_atomic_store_release(&self->head, head + 1);
+
+	return 1;
+}
+
+static void event_rest__read_slot(struct event_rest_slot* slot,
+				  struct event_rest_event* ev)
+{
+	while (1) {
+		uint32_t seq = co_atomic_load_acquire(&slot->seq);
+
+		/* The receive path is in the middle of writing to the slot */
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		ev->size = slot->size;
+		memcpy(ev->data, slot->data, sizeof(ev->data));
+		co_atomic_fence_acquire();
+
+		if (co_atomic_load_acquire(&slot->seq) == seq)
+			return;
+	}
+}
+
+int event_rest__pop(struct event_rest_sub* self, struct event_rest_event* ev)
+{
+	uint32_t tail = self->tail;
+	if (tail == co_atomic_load_acquire(&self->head))
+		return 0;
+
+	int key = self->ring[tail % EVENT_REST_KEYS];
+	self->tail = tail + 1;
+
+	struct event_rest_slot* slot = &self->slot[key];
+
+	/* The slot is released before it is read, so that a frame which
+	 * arrives in the meantime is sent again rather than lost.
+	 */
+	co_atomic_store(&slot->is_pending, 0);
+
+	uint32_t n_coalesced = co_atomic_load(&slot->n_coalesced);
+	co_atomic_sub_fetch(&slot->n_coalesced, n_coalesced);
+
+	ev->key = key;
+	ev->n_coalesced = n_coalesced;
+	event_rest__read_slot(slot, ev);
+
+	return 1;
+}
+
+static const char* event_rest__state_name(enum nmt_state state)
+{
+	switch (state) {
+	case NMT_STATE_BOOTUP: return "bootup";
+	case NMT_STATE_STOPPED: return "stopped";
+	case NMT_STATE_OPERATIONAL: return "operational";
+	case NMT_STATE_PREOPERATIONAL: return "pre-operational";
+	}
+
+	return "unknown";
+}
+
+void event_rest__print(FILE* output, const struct event_rest_event* ev)
+{
+	int nodeid = ev->key / EVENT_REST_KEYS_PER_NODE;
+	int n = ev->key % EVENT_REST_KEYS_PER_NODE;
+
+	struct can_frame cf = { .can_dlc = ev->size };
+	memcpy(cf.data, ev->data, sizeof(cf.data));
+
+	switch (n) {
+	case EVENT_REST_KEY_EMCY:
+		fprintf(output, "event: emcy\ndata: {\"node\": %d, \"code\": %u, \"register\": %u, \"manufacturer-error\": %llu, \"coalesced\": %u}\n\n",
+			nodeid, emcy_get_code(&cf), emcy_get_register(&cf),
+			(unsigned long long)emcy_get_manufacturer_error(&cf),
+			ev->n_coalesced);
+		break;
+	case EVENT_REST_KEY_NMT:
+		fprintf(output, "event: nmt\ndata: {\"node\": %d, \"state\": \"%s\", \"coalesced\": %u}\n\n",
+			nodeid, event_rest__state_name(heartbeat_get_state(&cf)),
+			ev->n_coalesced);
+		break;
+	default:
+		fprintf(output, "event: pdo\ndata: {\"node\": %d, \"pdo\": %d, \"data\": \"",
+			nodeid, n + 1);
+		for (int i = 0; i < ev->size && i < 8; ++i)
+			fprintf(output, "%02x", ev->data[i]);
+		fprintf(output, "\", \"coalesced\": %u}\n\n", ev->n_coalesced);
+		break;
+	}
+}
+
+static int event_rest__post(struct mloop* mloop, struct event_rest_sub* sub,
+			    mloop_async_fn fn)
+{
+	struct mloop_async* async = mloop_async_new(mloop);
+	if (!async)
+		return -1;
+
+	event_rest__sub_ref(sub);
+	mloop_async_set_context(async, sub, event_rest__unref_sub);
+	mloop_async_set_callback(async, fn);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+	return rc;
+}
+
+static void event_rest__on_remove(struct mloop_async* async)
+{
+	struct event_rest_sub* self = mloop_async_get_context(async);
+
+	for (int i = 0; i < event_rest_n_subs_; ++i) {
+		if (event_rest_subs_[i] != self)
+			continue;
+
+		event_rest_subs_[i] = event_rest_subs_[--event_rest_n_subs_];
+		event_rest__sub_unref(self);
+		break;
+	}
+}
+
+/* Everything below runs on the REST main loop, except for the service itself
+ * and the publishing of frames.
+ */
+static void event_rest__close(struct event_rest_sub* self)
+{
+	if (self->is_closed)
+		return;
+
+	self->is_closed = 1;
+
+	if (self->timer) {
+		mloop_timer_stop(self->timer);
+		mloop_timer_unref(self->timer);
+		self->timer = NULL;
+	}
+
+	event_rest__post(mloop_default(), self, event_rest__on_remove);
+}
+
+static void event_rest__arm(struct event_rest_sub* self, uint64_t delay)
+{
+	mloop_timer_stop(self->timer);
+	mloop_timer_set_time(self->timer, delay * 1000000ULL);
+	mloop_timer_start(self->timer);
+}
+
+/* Pending events are sent as one chunk at most once per interval. While the
+ * client is not keeping up, they stay in their slots and keep being coalesced.
+ */
+static void event_rest__flush(struct event_rest_sub* self)
+{
+	struct rest_client* client = self->client;
+
+	if (self->is_closed || !self->timer)
+		return;
+
+	if (rest_client_is_disconnected(client)) {
+		event_rest__close(self);
+		return;
+	}
+
+	uint64_t now = gettime_ms(CLOCK_MONOTONIC);
+	uint64_t next = self->last_flush + self->interval;
+
+	if (now < next) {
+		event_rest__arm(self, next - now);
+		return;
+	}
+
+	if (rest_client_is_congested(client)) {
+		event_rest__arm(self, MAX(self->interval, EVENT_REST_RETRY));
+		return;
+	}
+
+	co_atomic_store(&self->is_notified, 0);
+	self->last_flush = now;
+
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* output = open_memstream(&buffer, &size);
+	if (!output) {
+		event_rest__arm(self, EVENT_REST_RETRY);
+		return;
+	}
+
+	struct event_rest_event ev;
+	while (event_rest__pop(self, &ev))
+		event_rest__print(output, &ev);
+
+	/* Comments keep proxies from timing out and reveal closed connections */
+	if (ftell(output) == 0 && now - self->last_sent >= EVENT_REST_KEEPALIVE)
+		fprintf(output, ":\n\n");
+
+	fclose(output);
+
+	if (size > 0) {
+		rest_reply_chunk(client, buffer, size);
+		self->last_sent = now;
+	}
+
+	free(buffer);
+
+	event_rest__arm(self, EVENT_REST_KEEPALIVE);
+}
+
+static void event_rest__on_timer(struct mloop_timer* timer)
+{
+	event_rest__flush(mloop_timer_get_context(timer));
+}
+
+static void event_rest__on_notify(struct mloop_async* async)
+{
+	event_rest__flush(mloop_async_get_context(async));
+}
+
+static void event_rest__on_start(struct mloop_async* async)
+{
+	struct event_rest_sub* self = mloop_async_get_context(async);
+
+	struct mloop_timer* timer = mloop_timer_new(rest_get_mloop());
+	if (!timer) {
+		event_rest__close(self);
+		rest_client_abort(self->client);
+		return;
+	}
+
+	event_rest__sub_ref(self);
+	mloop_timer_set_context(timer, self, event_rest__unref_sub);
+	mloop_timer_set_callback(timer, event_rest__on_timer);
+	self->timer = timer;
+
+	self->last_sent = gettime_ms(CLOCK_MONOTONIC);
+	event_rest__flush(self);
+}
+
+/* Only one notification is posted to the REST main loop until the events are
+ * taken, however many frames arrive in the meantime.
+ */
+static void event_rest__notify(struct event_rest_sub* self)
+{
+	if (!co_atomic_cas(&self->is_notified, 0, 1))
+		return;
+
+	if (event_rest__post(rest_get_mloop(), self, event_rest__on_notify) < 0)
+		co_atomic_store(&self->is_notified, 0);
+}
+
+void event_rest_publish(const struct canopen_msg* msg,
+			const struct can_frame* cf)
+{
+	if (event_rest_n_subs_ == 0)
+		return;
+
+	enum event_rest_topic topic;
+	int key = event_rest__key(msg, cf, &topic);
+	if (key < 0)
+		return;
+
+	for (int i = 0; i < event_rest_n_subs_; ++i) {
+		struct event_rest_sub* sub = event_rest_subs_[i];
+
+		if (!(sub->topics & topic) || !sub->nodes[msg->id])
+			continue;
+
+		if (event_rest__push(sub, key, cf))
+			event_rest__notify(sub);
+	}
+}
+
+static void event_rest__reply_error(struct rest_client* client,
+				    const char* status_code,
+				    const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
+
+	rest_client_done(client);
+}
+
+void event_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index != 1) {
+		event_rest__reply_error(client, "404 Not Found",
+					"No such event stream\r\n");
+		return;
+	}
+
+	if (event_rest_n_subs_ >= EVENT_REST_SUBSCRIBERS_MAX) {
+		event_rest__reply_error(client, "503 Service Unavailable",
+					"Too many subscribers\r\n");
+		return;
+	}
+
+	struct event_rest_sub* sub = event_rest__sub_new(client);
+	if (!sub) {
+		rest_client_abort(client);
+		return;
+	}
+
+	if (event_rest__parse_query(sub, &client->req) < 0) {
+		event_rest__reply_error(client, "400 Bad Request",
+					"Invalid subscription\r\n");
+		goto done;
+	}
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "text/event-stream",
+		.content_length = -1,
+	};
+
+	rest_reply_header(client, &reply);
+
+	if (event_rest__post(rest_get_mloop(), sub, event_rest__on_start) < 0) {
+		rest_client_abort(client);
+		goto done;
+	}
+
+	/* The response never finishes; the subscription lasts until the client
+	 * goes away.
+	 */
+	event_rest__sub_ref(sub);
+	event_rest_subs_[event_rest_n_subs_++] = sub;
+
+done:
+	event_rest__sub_unref(sub);
+}
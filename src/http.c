@@ -14,526 +14,480 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
-#include "vector.h"
 #include "http.h"
 
-enum httplex_token_type {
-	HTTPLEX_SOLIDUS,
-	HTTPLEX_CR,
-	HTTPLEX_LF,
-	HTTPLEX_WS,
-	HTTPLEX_LITERAL,
-	HTTPLEX_KEY,
-	HTTPLEX_VALUE,
-	HTTPLEX_QUERY,
-	HTTPLEX_AMPERSAND,
-	HTTPLEX_EQ,
-	HTTPLEX_END,
+enum http__state {
+	HTTP__METHOD = 0,
+	HTTP__METHOD_WS,
+	HTTP__PATH,
+	HTTP__SEGMENT,
+	HTTP__QUERY,
+	HTTP__QUERY_KEY,
+	HTTP__QUERY_VALUE,
+	HTTP__URL_WS,
+	HTTP__VERSION,
+	HTTP__REQUEST_LF,
+	HTTP__LINE,
+	HTTP__KEY,
+	HTTP__VALUE_WS,
+	HTTP__VALUE,
+	HTTP__VALUE_LF,
+	HTTP__END_LF,
+	HTTP__DONE,
+	HTTP__ERROR,
 };
 
-struct httplex_token {
-	enum httplex_token_type type;
-	const char* value;
+enum http__header {
+	HTTP__HEADER_OTHER = 0,
+	HTTP__HEADER_CONTENT_LENGTH,
+	HTTP__HEADER_CONTENT_TYPE,
+	HTTP__HEADER_CONNECTION,
+	HTTP__HEADER_IF_NONE_MATCH,
+	HTTP__HEADER_ACCEPT_ENCODING,
+	HTTP__HEADER_ACCEPT,
 };
 
-enum httplex_state {
-	HTTPLEX_STATE_REQUEST = 0,
-	HTTPLEX_STATE_KEY,
-	HTTPLEX_STATE_VALUE,
-};
-
-struct httplex {
-	enum httplex_state state;
-	struct httplex_token current_token;
-	const char* input;
-	const char* pos;
-	const char* next_pos;
-	struct vector buffer;
-	int accepted;
-	int errno_;
-};
-
-int httplex_init(struct httplex* self, const char* input)
+void http_parser_init(struct http_parser* self)
 {
 	memset(self, 0, sizeof(*self));
-
-	self->input = input;
-	self->pos = input;
-	self->accepted = 1;
-
-	if (vector_reserve(&self->buffer, 256) < 0)
-		return -1;
-
-	return 0;
 }
 
-void httplex_destroy(struct httplex* self)
+static inline int http__is_ws(int c)
 {
-	vector_destroy(&self->buffer);
+	return c == ' ' || c == '\t';
 }
 
-static inline int httplex__is_literal(char c)
+static inline int http__is_path_char(int c)
 {
-	switch (c) {
-	case '/': case '\r': case '\n': case ' ': case '\t':
-	case '?': case '&': case '=':
-		return 0;
-	}
-
-	return isprint(c);
+	return isgraph(c) && c != '/' && c != '?';
 }
 
-static inline size_t httplex__literal_length(const char* str)
+static inline int http__is_query_char(int c)
 {
-	size_t len = 0;
-	while (httplex__is_literal(*str++))
-		++len;
-	return len;
+	return isgraph(c) && c != '&' && c != '=';
 }
 
-int httplex__classify_request_token(struct httplex* self)
+static inline int http__is_value_char(int c)
 {
-	switch (*self->pos) {
-	case '/':
-		self->current_token.type = HTTPLEX_SOLIDUS;
-		self->next_pos = self->pos + strspn(self->pos, "/");
-		return 0;
-	case '\r':
-		self->current_token.type = HTTPLEX_CR;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '\n':
-		self->current_token.type = HTTPLEX_LF;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '?':
-		self->current_token.type = HTTPLEX_QUERY;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '&':
-		self->current_token.type = HTTPLEX_AMPERSAND;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '=':
-		self->current_token.type = HTTPLEX_EQ;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case ' ':
-	case '\t':
-		self->current_token.type = HTTPLEX_WS;
-		self->next_pos = self->pos + strspn(self->pos, " \t");
-		return 0;
-	}
-
-	if (httplex__is_literal(*self->pos)) {
-		self->current_token.type = HTTPLEX_LITERAL;
-		size_t len = httplex__literal_length(self->pos);
-		self->next_pos = self->pos + len;
-		vector_assign(&self->buffer, self->pos, len);
-		vector_append(&self->buffer, "", 1);
-		self->current_token.value = self->buffer.data;
-		return 0;
-	}
-
-	return -1;
-}
-
-static inline int httplex__is_key_char(char c)
-{
-	return isalnum(c) || c == '-';
+	return isgraph(c) && c != '&';
 }
 
-static inline size_t httplex__key_length(const char* str)
+static inline int http__is_key_char(int c)
 {
-	size_t len = 0;
-	while (httplex__is_key_char(*str++))
-		++len;
-	return len;
+	return isalnum(c) || (c && strchr("!#$%&'*+-.^_`|~", c));
 }
 
-int httplex__classify_key_token(struct httplex* self)
+static inline int http__is_token(const char* str, size_t len,
+				 const char* token)
 {
-	switch (*self->pos) {
-	case '\r':
-		self->current_token.type = HTTPLEX_CR;
-		self->next_pos = self->pos + 1;
-		return 0;
-	case '\n':
-		self->current_token.type = HTTPLEX_LF;
-		self->next_pos = self->pos + 1;
-		return 0;
-	}
-
-	if (!httplex__is_key_char(*self->pos))
-		return -1;
-
-	size_t len = httplex__key_length(self->pos);
-
-	if (self->pos[len] != ':')
-		return -1;
-
-	len += 1;
-
-	self->next_pos = self->pos + len;
-	self->next_pos += strspn(self->next_pos, " \t");
-
-	vector_assign(&self->buffer, self->pos, len - 1);
-	vector_append(&self->buffer, "", 1);
-
-	self->current_token.type = HTTPLEX_KEY;
-	self->current_token.value = self->buffer.data;
-	return 0;
+	return strlen(token) == len && strncasecmp(str, token, len) == 0;
 }
 
-int httplex__classify_value_token(struct httplex* self)
+static enum http_method http__method(const char* str, size_t len)
 {
-	size_t len = strcspn(self->pos, "\r");
-	if (strncmp(&self->pos[len], "\r\n", 2) != 0)
-		return -1;
-
-	self->next_pos = self->pos + len + 2;
-
-	vector_assign(&self->buffer, self->pos, len);
-	vector_append(&self->buffer, "", 1);
-
-	self->current_token.type = HTTPLEX_VALUE;
-	self->current_token.value = self->buffer.data;
+	if (http__is_token(str, len, "GET")) return HTTP_GET;
+	if (http__is_token(str, len, "PUT")) return HTTP_PUT;
+	if (http__is_token(str, len, "OPTIONS")) return HTTP_OPTIONS;
 	return 0;
 }
 
-int httplex__classify_token(struct httplex* self)
+static enum http__header http__header(const char* str, size_t len)
 {
-	switch (self->state) {
-	case HTTPLEX_STATE_REQUEST:
-		return httplex__classify_request_token(self);
-	case HTTPLEX_STATE_KEY:
-		return httplex__classify_key_token(self);
-	case HTTPLEX_STATE_VALUE:
-		return httplex__classify_value_token(self);
-	};
-
-	abort();
-	return -1;
+	if (http__is_token(str, len, "Content-Length"))
+		return HTTP__HEADER_CONTENT_LENGTH;
+	if (http__is_token(str, len, "Content-Type"))
+		return HTTP__HEADER_CONTENT_TYPE;
+	if (http__is_token(str, len, "Connection"))
+		return HTTP__HEADER_CONNECTION;
+	if (http__is_token(str, len, "If-None-Match"))
+		return HTTP__HEADER_IF_NONE_MATCH;
+	if (http__is_token(str, len, "Accept-Encoding"))
+		return HTTP__HEADER_ACCEPT_ENCODING;
+	if (http__is_token(str, len, "Accept"))
+		return HTTP__HEADER_ACCEPT;
+	return HTTP__HEADER_OTHER;
 }
 
-struct httplex_token* httplex_next_token(struct httplex* self)
+static int http__has_token(const char* list, const char* token)
 {
-	if (self->current_token.type == HTTPLEX_END)
-		return &self->current_token;
-
-	if (!self->accepted)
-		return &self->current_token;
+	size_t len = strlen(token);
 
-	if (self->next_pos)
-		self->pos = self->next_pos;
+	while (*list) {
+		list += strspn(list, " \t,");
+		size_t tok_len = strcspn(list, " \t,");
 
-	if (httplex__classify_token(self) < 0)
-		return NULL;
+		if (tok_len == len && strncasecmp(list, token, len) == 0)
+			return 1;
 
-	self->accepted = 0;
+		list += tok_len;
+	}
 
-	return &self->current_token;
+	return 0;
 }
 
-static inline int httplex_accept_token(struct httplex* self)
+/* Matches a content coding or a media type in an Accept-* list, honouring
+ * q=0. Wildcards are not expanded.
+ */
+static int http__accepts(const char* list, const char* name)
 {
-	self->accepted = 1;
-	return 1;
-}
+	size_t len = strlen(name);
 
-int http__literal(struct httplex* lex, const char* str)
-{
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	while (*list) {
+		list += strspn(list, " \t,");
+		size_t item_len = strcspn(list, ",");
+		size_t name_len = strcspn(list, " \t;,");
 
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
+		if (name_len == len && strncasecmp(list, name, len) == 0) {
+			const char* q = strstr(list, "q=");
+			return !q || q >= list + item_len
+			    || strtod(q + 2, NULL) != 0.0;
+		}
 
-	if (strcasecmp(str, tok->value) != 0)
-		return 0;
+		list += item_len;
+	}
 
-	return httplex_accept_token(lex);
+	return 0;
 }
 
-int http__get(struct http_req* req, struct httplex* lex)
+static int http__parse_length(size_t* dst, const char* str)
 {
-	if (!http__literal(lex, "GET"))
-		return 0;
+	size_t value = 0;
 
-	req->method = HTTP_GET;
-	return 1;
-}
-
-int http__put(struct http_req* req, struct httplex* lex)
-{
-	if (!http__literal(lex, "PUT"))
-		return 0;
+	if (!*str)
+		return -1;
 
-	req->method = HTTP_PUT;
-	return 1;
-}
+	for (; *str; ++str) {
+		if (!isdigit((unsigned char)*str))
+			return -1;
 
-int http__options(struct http_req* req, struct httplex* lex)
-{
-	if (!http__literal(lex, "OPTIONS"))
-		return 0;
+		if (value > (SIZE_MAX - 9) / 10)
+			return -1;
 
-	req->method = HTTP_OPTIONS;
-	return 1;
-}
+		value = value * 10 + *str - '0';
+	}
 
-int http__method(struct http_req* req, struct httplex* lex)
-{
-	return http__get(req, lex)
-	    || http__put(req, lex)
-	    || http__options(req, lex);
+	*dst = value;
+	return 0;
 }
 
-int http__peek(struct httplex* lex, enum httplex_token_type type)
+static int http__begin_segment(struct http_parser* self)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != type)
-		return 0;
+	if (self->url_index >= URL_INDEX_MAX)
+		return -1;
 
-	return 1;
+	self->url[self->url_index++] = self->pos;
+	self->state = HTTP__SEGMENT;
+	return 0;
 }
 
-int http__expect(struct httplex* lex, enum httplex_token_type type)
+static int http__begin_query(struct http_parser* self)
 {
-	return http__peek(lex, type) && httplex_accept_token(lex);
-}
+	if (self->url_query_index >= URL_QUERY_INDEX_MAX)
+		return -1;
 
-int http__version(struct httplex* lex)
-{
-	return http__literal(lex, "HTTP")
-	    && http__expect(lex, HTTPLEX_SOLIDUS)
-	    && http__literal(lex, "1.1");
+	self->query_key[self->url_query_index++] = self->pos;
+	self->state = HTTP__QUERY_KEY;
+	return 0;
 }
 
-int http__url_path(struct http_req* req, struct httplex* lex)
-{
-	if (!http__expect(lex, HTTPLEX_SOLIDUS))
-		return 0;
-
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_LITERAL)
-		return tok->type == HTTPLEX_WS;
-
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
-
-	char* elem = strdup(tok->value);
-	if (!elem)
-		return 0;
-
-	req->url[req->url_index++] = elem;
-
-	httplex_accept_token(lex);
+/* A key without a value is given an empty value by pointing it at the NUL
+ * that terminates the key.
+ */
+static void http__end_query_key(struct http_parser* self, char* buffer,
+				enum http__state next)
+{
+	size_t i = self->url_query_index - 1;
+
+	buffer[self->pos] = '\0';
+	self->query_value[i] = next == HTTP__QUERY_VALUE
+			     ? self->pos + 1 : self->pos;
+	self->state = next;
+}
+
+static int http__end_value(struct http_parser* self, struct http_req* req,
+			   char* buffer)
+{
+	size_t end = self->pos;
+	while (end > self->start && http__is_ws(buffer[end - 1]))
+		--end;
+
+	buffer[end] = '\0';
+
+	const char* value = buffer + self->start;
+
+	switch (self->header) {
+	case HTTP__HEADER_CONTENT_LENGTH:
+		if (http__parse_length(&req->content_length, value) < 0)
+			return -1;
+		break;
+	case HTTP__HEADER_CONTENT_TYPE:
+		self->content_type = self->start;
+		break;
+	case HTTP__HEADER_CONNECTION:
+		req->has_connection_close = http__has_token(value, "close");
+		break;
+	case HTTP__HEADER_IF_NONE_MATCH:
+		self->if_none_match = self->start;
+		break;
+	case HTTP__HEADER_ACCEPT_ENCODING:
+		req->accepts_gzip = http__accepts(value, "gzip");
+		break;
+	case HTTP__HEADER_ACCEPT:
+		req->accepts_octet_stream =
+			http__accepts(value, "application/octet-stream");
+		break;
+	}
 
-	return http__peek(lex, HTTPLEX_SOLIDUS)
-	     ? http__url_path(req, lex) : 1;
+	self->state = HTTP__VALUE_LF;
+	return 0;
 }
 
-int http__url_query_key(struct http_req* req, struct httplex* lex)
+static void http__finish(struct http_parser* self, struct http_req* req,
+			 char* buffer)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
+	req->header_length = self->pos;
 
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
+	req->url_index = self->url_index;
+	for (size_t i = 0; i < self->url_index; ++i)
+		req->url[i] = buffer + self->url[i];
 
-	char* elem = strdup(tok->value);
-	if (!elem)
-		return 0;
+	req->url_query_index = self->url_query_index;
+	for (size_t i = 0; i < self->url_query_index; ++i) {
+		req->url_query[i].key = buffer + self->query_key[i];
+		req->url_query[i].value = buffer + self->query_value[i];
+	}
 
-	req->url_query[req->url_query_index].key = elem;
+	req->content_type = self->content_type
+			  ? buffer + self->content_type : NULL;
+	req->if_none_match = self->if_none_match
+			   ? buffer + self->if_none_match : NULL;
 
-	return httplex_accept_token(lex);
+	self->state = HTTP__DONE;
 }
 
-int http__url_query_value(struct http_req* req, struct httplex* lex)
+static int http__step(struct http_parser* self, struct http_req* req,
+		      char* buffer)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	int c = (unsigned char)buffer[self->pos];
 
-	if (tok->type != HTTPLEX_LITERAL)
-		return 0;
-
-	if (req->url_index >= URL_INDEX_MAX)
-		return 0;
-
-	char* elem = strdup(tok->value);
-	if (!elem)
+	switch (self->state) {
+	case HTTP__METHOD:
+		if (isalpha(c))
+			return 0;
+		if (!http__is_ws(c))
+			return -1;
+		req->method = http__method(buffer, self->pos);
+		if (!req->method)
+			return -1;
+		self->state = HTTP__METHOD_WS;
+		return 0;
+
+	case HTTP__METHOD_WS:
+		if (http__is_ws(c))
+			return 0;
+		if (c != '/')
+			return -1;
+		self->state = HTTP__PATH;
+		return 0;
+
+	case HTTP__PATH:
+	case HTTP__SEGMENT:
+		if (c == '/') {
+			buffer[self->pos] = '\0';
+			self->state = HTTP__PATH;
+			return 0;
+		}
+		if (c == '?') {
+			buffer[self->pos] = '\0';
+			self->state = HTTP__QUERY;
+			return 0;
+		}
+		if (http__is_ws(c)) {
+			buffer[self->pos] = '\0';
+			self->state = HTTP__URL_WS;
+			return 0;
+		}
+		if (!http__is_path_char(c))
+			return -1;
+		if (self->state == HTTP__PATH)
+			return http__begin_segment(self);
+		return 0;
+
+	case HTTP__QUERY:
+		if (c == '&')
+			return 0;
+		if (http__is_ws(c)) {
+			self->state = HTTP__URL_WS;
+			return 0;
+		}
+		if (!http__is_query_char(c))
+			return -1;
+		return http__begin_query(self);
+
+	case HTTP__QUERY_KEY:
+		if (c == '=')
+			http__end_query_key(self, buffer, HTTP__QUERY_VALUE);
+		else if (c == '&')
+			http__end_query_key(self, buffer, HTTP__QUERY);
+		else if (http__is_ws(c))
+			http__end_query_key(self, buffer, HTTP__URL_WS);
+		else if (!http__is_query_char(c))
+			return -1;
+		return 0;
+
+	case HTTP__QUERY_VALUE:
+		if (c == '&') {
+			buffer[self->pos] = '\0';
+			self->state = HTTP__QUERY;
+			return 0;
+		}
+		if (http__is_ws(c)) {
+			buffer[self->pos] = '\0';
+			self->state = HTTP__URL_WS;
+			return 0;
+		}
+		return http__is_value_char(c) ? 0 : -1;
+
+	case HTTP__URL_WS:
+		if (http__is_ws(c))
+			return 0;
+		if (!isgraph(c))
+			return -1;
+		self->start = self->pos;
+		self->state = HTTP__VERSION;
+		return 0;
+
+	case HTTP__VERSION:
+		if (c != '\r')
+			return isgraph(c) ? 0 : -1;
+		if (!http__is_token(buffer + self->start,
+				    self->pos - self->start, "HTTP/1.1"))
+			return -1;
+		self->state = HTTP__REQUEST_LF;
+		return 0;
+
+	case HTTP__REQUEST_LF:
+	case HTTP__VALUE_LF:
+		if (c != '\n')
+			return -1;
+		self->state = HTTP__LINE;
+		return 0;
+
+	case HTTP__LINE:
+		if (c == '\r') {
+			self->state = HTTP__END_LF;
+			return 0;
+		}
+		if (!http__is_key_char(c))
+			return -1;
+		self->start = self->pos;
+		self->state = HTTP__KEY;
+		return 0;
+
+	case HTTP__KEY:
+		if (http__is_key_char(c))
+			return 0;
+		if (c != ':')
+			return -1;
+		self->header = http__header(buffer + self->start,
+					    self->pos - self->start);
+		self->state = HTTP__VALUE_WS;
+		return 0;
+
+	case HTTP__VALUE_WS:
+		if (http__is_ws(c))
+			return 0;
+		self->start = self->pos;
+		self->state = HTTP__VALUE;
+		/* fall through */
+	case HTTP__VALUE:
+		if (c == '\r')
+			return http__end_value(self, req, buffer);
+		return (c == '\0' || c == '\n') ? -1 : 0;
+
+	case HTTP__END_LF:
+		if (c != '\n')
+			return -1;
+		self->pos++;
+		http__finish(self, req, buffer);
 		return 0;
+	}
 
-	req->url_query[req->url_query_index++].value = elem;
-
-	return httplex_accept_token(lex);
-}
-
-int http__url_query(struct http_req* req, struct httplex* lex)
-{
-	return http__url_query_key(req, lex)
-	    && http__expect(lex, HTTPLEX_EQ)
-	    && http__url_query_value(req, lex)
-	    && http__expect(lex, HTTPLEX_AMPERSAND)
-	       ? http__url_query(req, lex) : 1;
-}
-
-int http__url(struct http_req* req, struct httplex* lex)
-{
-	return http__url_path(req, lex)
-	    && http__expect(lex, HTTPLEX_QUERY) ? http__url_query(req, lex) : 1;
-}
-
-int http__request(struct http_req* req, struct httplex* lex)
-{
-	return http__method(req, lex)
-	    && http__expect(lex, HTTPLEX_WS)
-	    && http__url(req, lex)
-	    && http__expect(lex, HTTPLEX_WS)
-	    && http__version(lex)
-	    && http__expect(lex, HTTPLEX_CR)
-	    && http__expect(lex, HTTPLEX_LF);
+	abort();
+	return -1;
 }
 
-int http__expect_key(struct httplex* lex, const char* key)
+enum http_parse_status http_parser_feed(struct http_parser* self,
+					struct http_req* req,
+					char* buffer, size_t size)
 {
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	if (self->state == HTTP__ERROR)
+		return HTTP_PARSE_ERROR;
 
-	if (tok->type != HTTPLEX_KEY)
-		return 0;
+	if (self->state == HTTP__DONE) {
+		http__finish(self, req, buffer);
+		return HTTP_PARSE_DONE;
+	}
 
-	if (key && strcasecmp(tok->value, key) != 0)
-		return 0;
+	if (self->pos == 0)
+		memset(req, 0, sizeof(*req));
 
-	return httplex_accept_token(lex);
-}
-
-int http__content_length(struct http_req* req, struct httplex* lex)
-{
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, "Content-Length"))
-		return 0;
+	size_t end = size < HTTP_HEAD_MAX ? size : HTTP_HEAD_MAX;
 
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
+	while (self->pos < end) {
+		if (http__step(self, req, buffer) < 0) {
+			self->state = HTTP__ERROR;
+			return HTTP_PARSE_ERROR;
+		}
 
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
+		if (self->state == HTTP__DONE)
+			return HTTP_PARSE_DONE;
 
-	req->content_length = atoi(tok->value);
+		self->pos++;
+	}
 
-	return httplex_accept_token(lex);
+	return self->pos >= HTTP_HEAD_MAX ? HTTP_PARSE_TOO_LARGE
+					  : HTTP_PARSE_INCOMPLETE;
 }
 
-int http__content_type(struct http_req* req, struct httplex* lex)
+int http_req_parse(struct http_req* req, char* buffer, size_t size)
 {
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, "Content-Type"))
-		return 0;
+	struct http_parser parser;
+	http_parser_init(&parser);
 
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
-
-	req->content_type = strdup(tok->value);
-
-	return httplex_accept_token(lex);
+	return http_parser_feed(&parser, req, buffer, size) == HTTP_PARSE_DONE
+	       ? 0 : -1;
 }
 
-int http__dummy_kv(struct httplex* lex)
+int http_req_etag_matches(const struct http_req* req, const char* etag)
 {
-	lex->state = HTTPLEX_STATE_KEY;
-	if (!http__expect_key(lex, NULL))
+	const char* list = req->if_none_match;
+	if (!list)
 		return 0;
 
-	lex->state = HTTPLEX_STATE_VALUE;
-	struct httplex_token* tok = httplex_next_token(lex);
-	if (!tok)
-		return 0;
-
-	if (tok->type != HTTPLEX_VALUE)
-		return 0;
-
-	return httplex_accept_token(lex);
-}
-
-
-int http__header_kv(struct http_req* req, struct httplex* lex)
-{
-	return http__content_length(req, lex)
-	    || http__content_type(req, lex)
-	    || http__dummy_kv(lex);
-}
-
-int http__header(struct http_req* req, struct httplex* lex)
-{
-	while (http__header_kv(req, lex));
-
-	lex->state = HTTPLEX_STATE_KEY;
-	if (http__expect(lex, HTTPLEX_CR))
-		return http__expect(lex, HTTPLEX_LF);
-
-	return 1;
-}
-
-int http_req_parse(struct http_req* req, const char* input)
-{
-	int rc = -1;
-	memset(req, 0, sizeof(*req));
-
-	struct httplex lex;
-	if (httplex_init(&lex, input) < 0)
-		return -1;
-
-	if (!http__request(req, &lex))
-		goto failure;
-
-	if (!http__header(req, &lex))
-		goto failure;
+	size_t len = strlen(etag);
 
-	req->header_length = lex.next_pos - input;
+	while (*list) {
+		list += strspn(list, " \t,");
+		if (*list == '*')
+			return 1;
 
-	rc = 0;
-failure:
-	httplex_destroy(&lex);
-	return rc;
-}
-
-void http_req_free(struct http_req* req)
-{
-	free(req->content_type);
+		/* If-None-Match uses the weak comparison */
+		if (strncmp(list, "W/", 2) == 0)
+			list += 2;
 
-	for (size_t i = 0; i < req->url_index; ++i)
-		free(req->url[i]);
+		size_t tag_len = strcspn(list, " \t,");
+		if (tag_len == len && strncmp(list, etag, len) == 0)
+			return 1;
 
-	for (size_t i = 0; i < req->url_query_index; ++i) {
-		free(req->url_query[i].key);
-		free(req->url_query[i].value);
+		list += tag_len;
 	}
+
+	return 0;
 }
 
 const char* http_req_query(struct http_req* req, const char* key)
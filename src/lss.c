@@ -0,0 +1,196 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "canopen.h"
+#include "canopen/lss.h"
+
+void lss_slave_init(struct lss_slave* self, const struct lss_identity* id,
+		    int nodeid)
+{
+	memset(self, 0, sizeof(*self));
+	self->identity = *id;
+	self->state = LSS_SLAVE_WAITING;
+	self->nodeid = nodeid;
+	self->pending_nodeid = nodeid;
+}
+
+static inline int lss__is_valid_nodeid(int nodeid)
+{
+	return (CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX)
+	    || nodeid == LSS_NODEID_UNCONFIGURED;
+}
+
+static inline uint32_t lss__identity_at(struct lss_slave* self, int sub)
+{
+	return *lss_identity_at(&self->identity, sub);
+}
+
+static int lss__reply_u32(struct can_frame* out, enum lss_cs cs,
+			  uint32_t value)
+{
+	lss_clear_frame(out, LSS_COB_SLAVE);
+	lss_set_cs(out, cs);
+	lss_set_u32(out, value);
+	return 1;
+}
+
+static int lss__reply_error(struct can_frame* out, enum lss_cs cs, int error)
+{
+	lss_clear_frame(out, LSS_COB_SLAVE);
+	lss_set_cs(out, cs);
+	out->data[1] = error;
+	return 1;
+}
+
+static int lss__switch_global(struct lss_slave* self,
+			      const struct can_frame* in)
+{
+	switch (in->data[1]) {
+	case LSS_MODE_CONFIGURATION:
+		self->state = LSS_SLAVE_CONFIGURATION;
+		break;
+	case LSS_MODE_WAITING:
+		if (self->nodeid == LSS_NODEID_UNCONFIGURED)
+			self->nodeid = self->pending_nodeid;
+		self->state = LSS_SLAVE_WAITING;
+		break;
+	}
+
+	self->selective_sub = 0;
+	return 0;
+}
+
+static int lss__switch_selective(struct lss_slave* self,
+				 const struct can_frame* in,
+				 struct can_frame* out)
+{
+	int sub = lss_get_cs(in) - LSS_CS_SWITCH_SELECTIVE_VENDOR;
+
+	if (sub != self->selective_sub
+	 || lss_get_u32(in) != lss__identity_at(self, sub)) {
+		self->selective_sub = 0;
+		return 0;
+	}
+
+	if (++self->selective_sub < 4)
+		return 0;
+
+	self->selective_sub = 0;
+	self->state = LSS_SLAVE_CONFIGURATION;
+	return lss__reply_error(out, LSS_CS_SWITCH_SELECTIVE_RESPONSE, 0);
+}
+
+static int lss__configure_nodeid(struct lss_slave* self,
+				 const struct can_frame* in,
+				 struct can_frame* out)
+{
+	int nodeid = in->data[1];
+
+	if (!lss__is_valid_nodeid(nodeid))
+		return lss__reply_error(out, LSS_CS_CONFIGURE_NODEID, 1);
+
+	self->pending_nodeid = nodeid;
+	return lss__reply_error(out, LSS_CS_CONFIGURE_NODEID, 0);
+}
+
+static int lss__fastscan(struct lss_slave* self, const struct can_frame* in,
+			 struct can_frame* out)
+{
+	if (self->state != LSS_SLAVE_WAITING
+	 || self->nodeid != LSS_NODEID_UNCONFIGURED)
+		return 0;
+
+	int bit_checked = in->data[5];
+	int sub = in->data[6];
+	int next = in->data[7];
+
+	if (bit_checked == LSS_FASTSCAN_CONFIRM) {
+		self->fastscan_sub = 0;
+		return lss__reply_error(out, LSS_CS_IDENTIFY_SLAVE, 0);
+	}
+
+	if (bit_checked > 31 || sub > 3 || next > 3)
+		return 0;
+
+	if (sub != self->fastscan_sub)
+		return 0;
+
+	uint32_t mask = 0xffffffffU << bit_checked;
+	if ((lss_get_u32(in) ^ lss__identity_at(self, sub)) & mask)
+		return 0;
+
+	if (bit_checked == 0) {
+		if (next < sub) {
+			self->state = LSS_SLAVE_CONFIGURATION;
+			self->fastscan_sub = 0;
+		} else {
+			self->fastscan_sub = next;
+		}
+	}
+
+	return lss__reply_error(out, LSS_CS_IDENTIFY_SLAVE, 0);
+}
+
+static int lss__inquire(struct lss_slave* self, const struct can_frame* in,
+			struct can_frame* out)
+{
+	enum lss_cs cs = lss_get_cs(in);
+
+	if (cs == LSS_CS_INQUIRE_NODEID)
+		return lss__reply_error(out, cs, self->nodeid);
+
+	int sub = cs - LSS_CS_INQUIRE_VENDOR;
+	return lss__reply_u32(out, cs, lss__identity_at(self, sub));
+}
+
+int lss_slave_feed(struct lss_slave* self, const struct can_frame* in,
+		   struct can_frame* out)
+{
+	if ((in->can_id & CAN_SFF_MASK) != LSS_COB_MASTER
+	 || (in->can_id & CAN_RTR_FLAG) || in->can_dlc < 8)
+		return 0;
+
+	enum lss_cs cs = lss_get_cs(in);
+	int is_configuring = self->state == LSS_SLAVE_CONFIGURATION;
+
+	switch (cs) {
+	case LSS_CS_SWITCH_GLOBAL:
+		return lss__switch_global(self, in);
+	case LSS_CS_SWITCH_SELECTIVE_VENDOR ... LSS_CS_SWITCH_SELECTIVE_SERIAL:
+		return lss__switch_selective(self, in, out);
+	case LSS_CS_FASTSCAN:
+		return lss__fastscan(self, in, out);
+	case LSS_CS_IDENTIFY_NON_CONFIGURED:
+		return self->nodeid == LSS_NODEID_UNCONFIGURED
+		     ? lss__reply_error(out,
+				LSS_CS_IDENTIFY_NON_CONFIGURED_RESPONSE, 0)
+		     : 0;
+	case LSS_CS_CONFIGURE_NODEID:
+		return is_configuring ? lss__configure_nodeid(self, in, out)
+				      : 0;
+	case LSS_CS_CONFIGURE_BIT_TIMING:
+	case LSS_CS_STORE_CONFIGURATION:
+		/* Not supported */
+		return is_configuring ? lss__reply_error(out, cs, 1) : 0;
+	case LSS_CS_INQUIRE_VENDOR ... LSS_CS_INQUIRE_NODEID:
+		return is_configuring ? lss__inquire(self, in, out) : 0;
+	default:
+		break;
+	}
+
+	return 0;
+}
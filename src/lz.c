@@ -0,0 +1,219 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+#define LZ_NONE UINT32_MAX
+
+static inline uint32_t lz__read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lz__hash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* lz__put_length(uint8_t* op, const uint8_t* oend, size_t len)
+{
+	for (; len >= 255; len -= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+	}
+
+	if (op >= oend)
+		return NULL;
+
+	*op++ = len;
+	return op;
+}
+
+static uint8_t* lz__put_sequence(uint8_t* op, const uint8_t* oend,
+				 const uint8_t* literals, size_t n_literals,
+				 size_t offset, size_t match_len)
+{
+	if (op >= oend)
+		return NULL;
+
+	uint8_t* token = op++;
+	*token = (n_literals < 15 ? n_literals : 15) << 4;
+
+	if (n_literals >= 15)
+		if (!(op = lz__put_length(op, oend, n_literals - 15)))
+			return NULL;
+
+	if ((size_t)(oend - op) < n_literals)
+		return NULL;
+
+	memcpy(op, literals, n_literals);
+	op += n_literals;
+
+	/* The last sequence only has literals */
+	if (match_len == 0)
+		return op;
+
+	if (oend - op < 2)
+		return NULL;
+
+	*op++ = offset;
+	*op++ = offset >> 8;
+
+	match_len -= LZ_MIN_MATCH;
+	*token |= match_len < 15 ? match_len : 15;
+
+	if (match_len >= 15)
+		if (!(op = lz__put_length(op, oend, match_len - 15)))
+			return NULL;
+
+	return op;
+}
+
+size_t lz_compress(void* dst, size_t dst_size, const void* src,
+		   size_t src_size)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0xff, sizeof(table));
+
+	const uint8_t* base = src;
+	const uint8_t* ip = base;
+	const uint8_t* anchor = base;
+	const uint8_t* end = base + src_size;
+	uint8_t* op = dst;
+	const uint8_t* oend = op + dst_size;
+
+	if (src_size > LZ_MF_LIMIT) {
+		const uint8_t* mf_limit = end - LZ_MF_LIMIT;
+		const uint8_t* match_limit = end - LZ_LAST_LITERALS;
+
+		while (ip < mf_limit) {
+			uint32_t value = lz__read32(ip);
+			uint32_t h = lz__hash(value);
+			uint32_t ref = table[h];
+			table[h] = ip - base;
+
+			if (ref == LZ_NONE
+			 || (size_t)(ip - base) - ref > LZ_MAX_OFFSET
+			 || lz__read32(base + ref) != value) {
+				++ip;
+				continue;
+			}
+
+			const uint8_t* match = base + ref;
+			size_t len = LZ_MIN_MATCH;
+			while (ip + len < match_limit && match[len] == ip[len])
+				++len;
+
+			op = lz__put_sequence(op, oend, anchor, ip - anchor,
+					      ip - match, len);
+			if (!op)
+				return 0;
+
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	op = lz__put_sequence(op, oend, anchor, end - anchor, 0, 0);
+	if (!op)
+		return 0;
+
+	return op - (uint8_t*)dst;
+}
+
+static int lz__get_length(const uint8_t** ip, const uint8_t* iend,
+			  size_t* len)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip >= iend)
+			return -1;
+
+		byte = *(*ip)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return 0;
+}
+
+ssize_t lz_decompress(void* dst, size_t dst_size, const void* src,
+		      size_t src_size)
+{
+	const uint8_t* ip = src;
+	const uint8_t* iend = ip + src_size;
+	uint8_t* op = dst;
+	uint8_t* oend = op + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t n_literals = token >> 4;
+		if (n_literals == 15)
+			if (lz__get_length(&ip, iend, &n_literals) < 0)
+				return -1;
+
+		if ((size_t)(iend - ip) < n_literals
+		 || (size_t)(oend - op) < n_literals)
+			return -1;
+
+		memcpy(op, ip, n_literals);
+		ip += n_literals;
+		op += n_literals;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst))
+			return -1;
+
+		size_t len = token & 15;
+		if (len == 15)
+			if (lz__get_length(&ip, iend, &len) < 0)
+				return -1;
+
+		len += LZ_MIN_MATCH;
+
+		if ((size_t)(oend - op) < len)
+			return -1;
+
+		/* The match may overlap the output */
+		const uint8_t* match = op - offset;
+		for (size_t i = 0; i < len; ++i)
+			op[i] = match[i];
+
+		op += len;
+	}
+
+	return op - (uint8_t*)dst;
+}
@@ -20,6 +20,8 @@
 #include <stddef.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -40,6 +42,8 @@
 #include "canopen/error.h"
 #include "rest.h"
 #include "sdo-rest.h"
+#include "event-rest.h"
+#include "rpc.h"
 #include "time-utils.h"
 #include "profiling.h"
 #include "string-utils.h"
@@ -47,6 +51,12 @@
 #include "sock.h"
 #include "cfg.h"
 #include "trace-buffer.h"
+#include "trace-capture.h"
+#include "trace-format.h"
+#include "bus-stats.h"
+#include "trace-trigger.h"
+#include "metrics.h"
+#include "co_atomic.h"
 #include "userdata.h"
 
 #ifndef NO_MAREL_CODE
@@ -62,6 +72,7 @@
 #define __unused __attribute__((unused))
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
 
 #define for_each_node(index) \
 	for(index = nodeid_min(); index <= nodeid_max(); ++index)
@@ -94,6 +105,12 @@ static struct mloop* mloop_ = NULL;
 static struct mloop_socket* mux_handler_ = NULL;
 
 static struct tracebuffer tracebuffer_;
+static struct tb_capture trace_capture_;
+
+static struct bus_stats bus_stats_;
+
+static struct trace_trigger trace_trigger_;
+static unsigned int n_incidents_ = 0;
 
 static struct userdata userdata_;
 
@@ -104,10 +121,9 @@ static int master_send_sdo(int nodeid, int index, int subindex,
 static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size);
 static void unload_legacy_module(int device_type, void* driver);
 static void on_bootup_done(struct mloop_work* self);
-static int init_heartbeat_timer(struct co_master_node* node);
-static int init_ping_timer(struct co_master_node* node);
 
 struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
+struct co_master_node_hot co_master_node_hot_[CANOPEN_NODEID_MAX + 1];
 /* Note: node_[0] is unused */
 
 static inline int nodeid_min(void)
@@ -166,40 +182,17 @@ static char* get_string(int nodeid, int index, int subindex)
 	return buffer;
 }
 
-static void stop_heartbeat_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	if (!timer)
-		return;
-
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->heartbeat_timer = NULL;
-}
-
-static void stop_ping_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->ping_timer;
-	if (!timer)
-		return;
-
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->ping_timer = NULL;
-}
-
 #ifndef NO_MAREL_CODE
 static void unload_legacy_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
-	unload_legacy_module(node->device_type, node->driver);
+	unload_legacy_module(node->device_type, hot->driver);
 
 	legacy_master_iface_delete(node->master_iface);
 
-	node->driver = NULL;
+	hot->driver = NULL;
 	node->master_iface = NULL;
 }
 #endif /* NO_MAREL_CODE */
@@ -225,28 +218,21 @@ static void turn_off_heartbeat(int nodeid)
 
 static void stop_node_guarding(int nodeid)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-
-	if (!cfg.node[nodeid].enable_node_guarding)
-		return;
-
-	stop_heartbeat_timer(nodeid);
-
-	if (!node->is_heartbeat_supported)
-		stop_ping_timer(nodeid);
+	co_master_get_node_hot(nodeid)->is_supervised = 0;
 }
 
 static void unload_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
-	node->is_initialized = 0;
+	hot->is_initialized = 0;
 
 	stop_node_guarding(nodeid);
 
 	sdo_req_queue_flush(sdo_req_queue_get(nodeid));
 
-	switch (node->driver_type) {
+	switch (hot->driver_type) {
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
 		unload_legacy_driver(nodeid);
@@ -263,7 +249,7 @@ static void unload_driver(int nodeid)
 
 	node->device_type = 0;
 	node->is_heartbeat_supported = 0;
-	node->driver_type = CO_MASTER_DRIVER_NONE;
+	hot->driver_type = CO_MASTER_DRIVER_NONE;
 
 	if (master_state_ == MASTER_STATE_STOPPING)
 		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
@@ -310,7 +296,11 @@ static void do_dump_tracebuffer(struct mloop_work* work)
 	if (!stream)
 		return;
 
-	tb_dump(&tracebuffer_, stream);
+	if (cfg.use_compact_trace)
+		tb_dump_compact(&tracebuffer_, stream,
+				cfg.compress_trace ? TF_COMPRESS : 0);
+	else
+		tb_dump(&tracebuffer_, stream);
 
 	fclose(stream);
 }
@@ -335,12 +325,245 @@ static void dump_tracebuffer(const char* name)
 	mloop_work_unref(work);
 }
 
-static void on_heartbeat_timeout(struct mloop_timer* timer)
+#define INCIDENTS_MAX 4
+
+/* An incident trace covers the time from pre ms before a trigger fired until
+ * post ms after. The part before the trigger is copied out of the trace buffer
+ * right away on a worker, the rest once the post-trigger window has passed,
+ * so the trace buffer keeps recording throughout.
+ */
+struct incident {
+	const struct tt_trigger* trigger;
+	int nodeid;
+	uint32_t pos;
+	uint64_t time; /* us, CLOCK_REALTIME */
+	uint64_t deadline; /* ns, CLOCK_MONOTONIC */
+	struct tb_frame* frames;
+	size_t n_frames;
+};
+
+static void incident_free(void* ptr)
 {
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	struct incident* incident = ptr;
+	free(incident->frames);
+	free(incident);
+}
+
+static int write_trace_frames(FILE* stream, const struct tb_frame* frames,
+			      size_t n)
+{
+	struct tf_writer writer;
+
+	if (!cfg.use_compact_trace)
+		return fwrite(frames, sizeof(*frames), n, stream) == n ? 0 : -1;
+
+	if (tf_writer_init(&writer, stream,
+			   cfg.compress_trace ? TF_COMPRESS : 0) < 0)
+		return -1;
+
+	for (size_t i = 0; i < n; ++i)
+		if (tf_writer_append(&writer, &frames[i]) < 0)
+			break;
+
+	return tf_writer_finish(&writer);
+}
+
+static void freeze_incident(struct mloop_work* work)
+{
+	struct incident* incident = mloop_work_get_context(work);
+	const struct tt_trigger* trigger = incident->trigger;
+
+	size_t n = tb_copy(&tracebuffer_, incident->pos - tracebuffer_.length,
+			   incident->pos, incident->frames);
+
+	uint64_t start = incident->time - trigger->pre * 1000ULL;
+	size_t first = 0;
+
+	while (first < n && incident->frames[first].timestamp < start)
+		++first;
+
+	memmove(incident->frames, &incident->frames[first],
+		(n - first) * sizeof(*incident->frames));
+	incident->n_frames = n - first;
+}
+
+static void write_incident(struct mloop_work* work)
+{
+	struct incident* incident = mloop_work_get_context(work);
+	const struct tt_trigger* trigger = incident->trigger;
+
+	struct tb_frame* post = &incident->frames[incident->n_frames];
+	uint32_t head = tb_get_head(&tracebuffer_);
+	size_t n = tb_copy(&tracebuffer_, incident->pos, head, post);
+
+	/* The start of the post-trigger window has been overwritten if more
+	 * frames than the buffer holds were received during it.
+	 */
+	uint32_t n_received = head - incident->pos;
+	uint32_t n_lost = n_received > tracebuffer_.length
+			? n_received - tracebuffer_.length : 0;
+
+	uint64_t end = incident->time + trigger->post * 1000ULL;
+
+	for (size_t i = 0; i < n && post[i].timestamp <= end; ++i)
+		incident->n_frames++;
+
+	char ts[32];
+	char name[64];
+	char path[256];
+
+	compose_trace_name(ts, sizeof(ts));
+
+	if (incident->nodeid)
+		snprintf(name, sizeof(name), "%s-%s-%d", ts,
+			 tt_type_to_string(trigger->type), incident->nodeid);
+	else
+		snprintf(name, sizeof(name), "%s-%s", ts,
+			 tt_type_to_string(trigger->type));
+
+	compose_trace_buffer_path(path, sizeof(path), name);
+
+	FILE* stream = fopen(path, "w");
+	if (!stream) {
+		plog(LOG_ERROR, "write_incident: Could not open \"%s\": %s",
+		     path, strerror(errno));
+		return;
+	}
+
+	if (write_trace_frames(stream, incident->frames, incident->n_frames) < 0)
+		plog(LOG_ERROR, "write_incident: Could not write \"%s\"", path);
+
+	if (n_lost > 0)
+		plog(LOG_WARNING, "write_incident: \"%s\" is missing %"PRIu32" frames after the trigger; the post-trigger window is longer than the trace buffer holds",
+		     path, n_lost);
+
+	fclose(stream);
+}
+
+static void on_incident_written(struct mloop_work* work)
+{
+	(void)work;
+	n_incidents_--;
+}
+
+static void on_incident_post_window(struct mloop_timer* timer)
+{
+	struct incident* incident = mloop_timer_get_context(timer);
+
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work) {
+		incident_free(incident);
+		n_incidents_--;
+		return;
+	}
+
+	mloop_work_set_context(work, incident, incident_free);
+	mloop_work_set_work_fn(work, write_incident);
+	mloop_work_set_done_fn(work, on_incident_written);
+
+	mloop_work_start(work);
+	mloop_work_unref(work);
+}
+
+static void on_incident_frozen(struct mloop_work* work)
+{
+	struct incident* incident = mloop_work_get_context(work);
+
+	struct mloop_timer* timer = mloop_timer_new(mloop_default());
+	if (!timer) {
+		incident_free(incident);
+		n_incidents_--;
+		return;
+	}
+
+	mloop_timer_set_context(timer, incident, NULL);
+	mloop_timer_set_callback(timer, on_incident_post_window);
+	mloop_timer_set_type(timer, MLOOP_TIMER_ABSOLUTE);
+	mloop_timer_set_time(timer, incident->deadline);
+
+	mloop_timer_start(timer);
+	mloop_timer_unref(timer);
+}
+
+static void on_incident_trigger(struct trace_trigger* self,
+				const struct tt_trigger* trigger, int nodeid,
+				void* context)
+{
+	(void)self;
+	(void)context;
+
+	plog(LOG_NOTICE, "Incident trigger \"%s\" fired for node %d",
+	     tt_type_to_string(trigger->type), nodeid);
+
+	if (n_incidents_ >= INCIDENTS_MAX) {
+		plog(LOG_WARNING, "on_incident_trigger: Too many incidents are being recorded; skipping");
+		return;
+	}
+
+	struct incident* incident = calloc(1, sizeof(*incident));
+	if (!incident)
+		return;
+
+	incident->frames = malloc(2 * tracebuffer_.length
+				  * sizeof(*incident->frames));
+	if (!incident->frames)
+		goto frames_failure;
+
+	incident->trigger = trigger;
+	incident->nodeid = nodeid;
+	incident->pos = tb_get_head(&tracebuffer_);
+	incident->time = gettime_us(CLOCK_REALTIME);
+	incident->deadline = gettime_ns(CLOCK_MONOTONIC)
+			   + msec_to_nsec(trigger->post);
+
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work)
+		goto work_failure;
+
+	mloop_work_set_context(work, incident, NULL);
+	mloop_work_set_work_fn(work, freeze_incident);
+	mloop_work_set_done_fn(work, on_incident_frozen);
+
+	n_incidents_++;
+	mloop_work_start(work);
+	mloop_work_unref(work);
+	return;
+
+work_failure:
+	free(incident->frames);
+frames_failure:
+	free(incident);
+}
+
+static int init_trace_triggers(void)
+{
+	if (tt_init(&trace_trigger_, cfg.incident_triggers,
+		    on_incident_trigger, NULL) < 0) {
+		plog(LOG_ERROR, "init_trace_triggers: Invalid triggers \"%s\"",
+		     cfg.incident_triggers);
+		return -1;
+	}
+
+	/* Nothing to record from */
+	if (cfg.trace_buffer_size == 0)
+		tt_init(&trace_trigger_, NULL, NULL, NULL);
+
+	return 0;
+}
+
+static inline uint64_t heartbeat_deadline_ns(int nodeid)
+{
+	return msec_to_nsec(cfg.node[nodeid].heartbeat_period
+			    + cfg.node[nodeid].heartbeat_timeout);
+}
+
+static void on_heartbeat_timeout(int nodeid, uint64_t now)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
-	node->ntimeouts++;
+	hot->ntimeouts++;
+	node->n_missed_heartbeats++;
 
 #ifndef NO_MAREL_CODE
 	struct canopen_info* info = canopen_info_get(nodeid);
@@ -348,10 +571,12 @@ static void on_heartbeat_timeout(struct mloop_timer* timer)
 #endif /* NO_MAREL_CODE */
 
 	plog(LOG_DEBUG, "Node \"%s\" with id %d has missed %u heartbeats",
-	     node->name, nodeid, node->ntimeouts);
+	     node->name, nodeid, hot->ntimeouts);
 
-	if (node->ntimeouts <= cfg.node[nodeid].n_timeouts_max)
+	if (hot->ntimeouts <= cfg.node[nodeid].n_timeouts_max) {
+		hot->last_heartbeat = now;
 		return;
+	}
 
 	plog(LOG_NOTICE, "Node \"%s\" with id %d has timed out; unloading...",
 	     node->name, nodeid);
@@ -359,82 +584,106 @@ static void on_heartbeat_timeout(struct mloop_timer* timer)
 	if (cfg.enable_incident_trace)
 		dump_tracebuffer(NULL);
 
+	tt_event(&trace_trigger_, TT_HEARTBEAT_LOSS, nodeid, now);
+
 	co_net_send_nmt(&socket_, NMT_CS_RESET_NODE, nodeid);
-	unload_driver(co_master_get_node_id(node));
+	unload_driver(nodeid);
 	userdata_set_missing(&userdata_, nodeid);
 }
 
-static struct mloop_timer* get_heartbeat_timer(struct co_master_node* node)
+static void make_ping(struct can_frame* cf, int nodeid)
 {
-	if (!node->heartbeat_timer)
-		init_heartbeat_timer(node);
+	memset(cf, 0, sizeof(*cf));
 
-	return node->heartbeat_timer;
+	cf->can_id = R_HEARTBEAT + nodeid;
+	cf->can_id |= CAN_RTR_FLAG;
+	cf->can_dlc = 1;
+	heartbeat_set_state(cf, 1);
 }
 
-static struct mloop_timer* get_ping_timer(struct co_master_node* node)
+static int is_ping_due(int nodeid, uint64_t now)
 {
-	if (!node->ping_timer)
-		init_ping_timer(node);
+	struct co_master_node* node = co_master_get_node(nodeid);
 
-	return node->ping_timer;
-}
+	if (node->is_heartbeat_supported || now < node->ping_deadline)
+		return 0;
 
-static int start_heartbeat_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_heartbeat_timer(node);
-	node->ntimeouts = 0;
-	return mloop_timer_start(timer);
+	node->ping_deadline += msec_to_nsec(cfg.node[nodeid].heartbeat_period);
+	if (node->ping_deadline < now)
+		node->ping_deadline = now
+			+ msec_to_nsec(cfg.node[nodeid].heartbeat_period);
+
+	return 1;
 }
 
-static int restart_heartbeat_timer(int nodeid)
+/* All nodes are supervised from a single coarse periodic timer. Receiving a
+ * heartbeat only records the time at which it was received, and the node
+ * guarding requests that are due are sent together at the end of each sweep.
+ */
+static void on_supervisor_sweep(struct mloop_timer* timer)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	assert(timer);
+	(void)timer;
 
-	if (!cfg.node[nodeid].enable_node_guarding)
-		return 0;
+	struct can_frame pings[CANOPEN_NODEID_MAX + 1];
+	int n_pings = 0;
+
+	uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+		struct co_master_node_hot* hot = co_master_get_node_hot(i);
+		if (!hot->is_supervised)
+			continue;
+
+		if (is_ping_due(i, now))
+			make_ping(&pings[n_pings++], i);
 
-	mloop_timer_stop(timer);
+		if (now - hot->last_heartbeat >= heartbeat_deadline_ns(i))
+			on_heartbeat_timeout(i, now);
+	}
 
-	return mloop_timer_start(timer);
+	for (int i = 0; i < n_pings; ++i)
+		sock_send(&socket_, &pings[i], 0);
 }
 
-static void on_ping_timeout(struct mloop_timer* timer)
+static int start_supervisor_timer(void)
 {
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	uint64_t interval = cfg.heartbeat_sweep_interval;
 
-	struct can_frame cf = { 0 };
+	/* A zero period would never fire and leave every node unsupervised */
+	if (interval == 0) {
+		plog(LOG_WARNING, "start_supervisor_timer: heartbeat_sweep_interval is 0; using 1 ms");
+		interval = 1;
+	}
 
-	cf.can_id = R_HEARTBEAT + nodeid;
-	cf.can_id |= CAN_RTR_FLAG;
-	cf.can_dlc = 1;
-	heartbeat_set_state(&cf, 1);
+	struct mloop_timer* timer = mloop_timer_new(mloop_default());
+	if (!timer)
+		return -1;
 
-	sock_send(&socket_, &cf, 0);
-}
+	mloop_timer_set_callback(timer, on_supervisor_sweep);
+	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(timer, msec_to_nsec(interval));
 
-static int start_ping_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_ping_timer(node);
-	return mloop_timer_start(timer);
+	int rc = mloop_timer_start(timer);
+	mloop_timer_unref(timer);
+	return rc;
 }
 
 static void start_nodeguarding(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
 	if (!cfg.node[nodeid].enable_node_guarding)
 		return;
 
-	if (!node->is_heartbeat_supported)
-		start_ping_timer(nodeid);
+	uint64_t now = gettime_ns(CLOCK_MONOTONIC);
 
-	start_heartbeat_timer(nodeid);
+	node->ping_deadline = now
+		+ msec_to_nsec(cfg.node[nodeid].heartbeat_period);
+
+	hot->ntimeouts = 0;
+	hot->last_heartbeat = now;
+	hot->is_supervised = 1;
 }
 
 #ifndef NO_MAREL_CODE
@@ -485,6 +734,7 @@ static int load_identity_driver(int nodeid)
 static int load_new_driver(int nodeid, int has_identity)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
 	if (co_drv_load(&node->ndrv, node->name) >= 0)
 		goto ok;
@@ -498,7 +748,7 @@ static int load_new_driver(int nodeid, int has_identity)
 	return -1;
 
 ok:
-	node->driver_type = CO_MASTER_DRIVER_NEW;
+	hot->driver_type = CO_MASTER_DRIVER_NEW;
 	return 0;
 }
 
@@ -506,6 +756,7 @@ ok:
 static int load_legacy_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
 	void* master_iface = master_iface_init(nodeid);
 	if (!master_iface)
@@ -516,8 +767,8 @@ static int load_legacy_driver(int nodeid)
 	if (!driver)
 		goto failure;
 
-	node->driver_type = CO_MASTER_DRIVER_LEGACY;
-	node->driver = driver;
+	hot->driver_type = CO_MASTER_DRIVER_LEGACY;
+	hot->driver = driver;
 	node->master_iface = master_iface;
 
 	return 0;
@@ -590,6 +841,30 @@ static void apply_quirks(struct co_master_node* node)
 
 }
 
+static void init_pdo_filters(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
+
+	const char* spec[] = {
+		cfg.node[nodeid].tpdo1_filter,
+		cfg.node[nodeid].tpdo2_filter,
+		cfg.node[nodeid].tpdo3_filter,
+		cfg.node[nodeid].tpdo4_filter,
+	};
+
+	hot->pdo_filter_mask = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		if (pdo_filter_init(&node->pdo_filter[i], spec[i]) < 0)
+			plog(LOG_WARNING, "init_pdo_filters: Invalid filter \"%s\" for TPDO%d at id %d",
+			     spec[i], i + 1, nodeid);
+
+		if (node->pdo_filter[i].is_enabled)
+			hot->pdo_filter_mask |= 1 << i;
+	}
+}
+
 static int load_any_driver(int nodeid, int has_identity)
 {
 	if (load_new_driver(nodeid, has_identity) >= 0)
@@ -606,12 +881,13 @@ static int load_any_driver(int nodeid, int has_identity)
 static int load_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
 	node->name[0] = '\0';
 	cfg_load_node(nodeid);
 	apply_quirks(node);
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
+	if (hot->driver_type != CO_MASTER_DRIVER_NONE) {
 		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
 		     nodeid);
 		return -1;
@@ -638,6 +914,7 @@ static int load_driver(int nodeid)
 	/* Reload config when we have the name of the node */
 	cfg_load_node(nodeid);
 	apply_quirks(node);
+	init_pdo_filters(nodeid);
 
 	int has_identity = node_has_identity(nodeid);
 	if (has_identity) {
@@ -681,7 +958,7 @@ static int load_driver(int nodeid)
 	}
 
 	plog(LOG_DEBUG, "load_driver: Successfully loaded %s for \"%s\" at id %d",
-	     driver_type_str(node->driver_type), node->name, nodeid);
+	     driver_type_str(hot->driver_type), node->name, nodeid);
 
 	return 0;
 
@@ -691,9 +968,10 @@ static int load_driver(int nodeid)
 static int initialize_legacy_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 	struct canopen_info* info = canopen_info_get(nodeid);
 
-	int rc = legacy_driver_iface_initialize(node->driver);
+	int rc = legacy_driver_iface_initialize(hot->driver);
 	if (rc >= 0) {
 		info->is_active = 1;
 		info->last_seen = time(NULL);
@@ -706,11 +984,11 @@ static int initialize_legacy_driver(int nodeid)
 		plog(LOG_ERROR, "initialize_legacy_driver: Failed to initialize \"%s\" with id %d",
 		     node->name, nodeid);
 
-		unload_legacy_module(node->device_type, node->driver);
+		unload_legacy_module(node->device_type, hot->driver);
 		legacy_master_iface_delete(node->master_iface);
-		node->driver = NULL;
+		hot->driver = NULL;
 		node->master_iface = NULL;
-		node->driver_type = CO_MASTER_DRIVER_NONE;
+		hot->driver_type = CO_MASTER_DRIVER_NONE;
 	}
 
 	return rc;
@@ -720,6 +998,7 @@ static int initialize_legacy_driver(int nodeid)
 static int initialize_new_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 	int rc = co_drv_init(&node->ndrv);
 	if (rc >= 0) {
 #ifndef NO_MAREL_CODE
@@ -741,7 +1020,7 @@ static int initialize_new_driver(int nodeid)
 		     node->name, nodeid);
 
 		co_drv_unload(&node->ndrv);
-		node->driver_type = CO_MASTER_DRIVER_NONE;
+		hot->driver_type = CO_MASTER_DRIVER_NONE;
 	}
 
 	return rc;
@@ -749,9 +1028,9 @@ static int initialize_new_driver(int nodeid)
 
 static int initialize_driver(int nodeid)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 
-	switch (node->driver_type) {
+	switch (hot->driver_type) {
 	case CO_MASTER_DRIVER_NEW:
 		return initialize_new_driver(nodeid);
 #ifndef NO_MAREL_CODE
@@ -766,6 +1045,141 @@ static int initialize_driver(int nodeid)
 	}
 }
 
+static int load_expected_nodes(char* expected, int start, int stop)
+{
+	memset(expected, 0, CANOPEN_NODEID_MAX + 1);
+
+	userdata_get_required(&userdata_, expected);
+
+	FILE* stream = fopen(cfg.discovery_cache_path, "r");
+	if (stream) {
+		unsigned int nodeid;
+		while (fscanf(stream, "%u", &nodeid) == 1)
+			if (nodeid <= CANOPEN_NODEID_MAX)
+				expected[nodeid] = 1;
+
+		fclose(stream);
+	}
+
+	int n = 0;
+	for (int i = start; i <= stop; ++i)
+		if (expected[i])
+			++n;
+
+	return n;
+}
+
+/* The list is written to a temporary file which then replaces the old one so
+ * that a crash or a full disk never leaves a truncated list behind.
+ */
+static void save_discovered_nodes(void)
+{
+	char path[PATH_MAX];
+	int errsv;
+
+	if ((size_t)snprintf(path, sizeof(path), "%s.tmp",
+			     cfg.discovery_cache_path) >= sizeof(path)) {
+		errno = ENAMETOOLONG;
+		goto failure;
+	}
+
+	FILE* stream = fopen(path, "w");
+	if (!stream)
+		goto failure;
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i)
+		if (nodes_seen_[i])
+			fprintf(stream, "%d\n", i);
+
+	int has_error = ferror(stream);
+	if (fclose(stream) != 0 || has_error)
+		goto write_failure;
+
+	if (rename(path, cfg.discovery_cache_path) < 0)
+		goto write_failure;
+
+	return;
+
+write_failure:
+	errsv = errno;
+	unlink(path);
+	errno = errsv;
+failure:
+	plog(LOG_WARNING, "Could not save discovered nodes to \"%s\": %s",
+	     cfg.discovery_cache_path, strerror(errno));
+}
+
+/* Discovery for a known topology: Instead of waiting for fixed periods of
+ * silence, we stop as soon as all the nodes that we expect have reported.
+ * Expected nodes that have not booted up when the bus goes quiet are probed
+ * with heartbeat and SDO requests at the same time.
+ */
+static int run_fast_discovery(int start, int stop)
+{
+	char expected[CANOPEN_NODEID_MAX + 1];
+
+	int n_expected = load_expected_nodes(expected, start, stop);
+	if (n_expected == 0)
+		return -1;
+
+	uint64_t t_start = gettime_ms(CLOCK_MONOTONIC);
+
+	profile("Reset network, expecting %d nodes...\n", n_expected);
+	if (start == CANOPEN_NODEID_MIN && stop == CANOPEN_NODEID_MAX) {
+		co_net_send_nmt(&socket_, NMT_CS_RESET_COMMUNICATION, 0);
+	} else {
+		for (int i = start; i <= stop; ++i)
+			co_net_send_nmt(&socket_, NMT_CS_RESET_COMMUNICATION, i);
+	}
+
+	int n_missing = co_net__wait_for_nodes(&socket_, nodes_seen_, expected,
+					       start, stop, 100,
+					       cfg.discovery_timeout);
+
+	uint64_t t_reset = gettime_ms(CLOCK_MONOTONIC);
+	int n_probed = 0;
+
+	if (n_missing > 0) {
+		profile("Probe network, %d nodes missing...\n", n_missing);
+		n_probed = co_net_probe_parallel(&socket_, nodes_seen_,
+						 expected, start, stop);
+
+		int elapsed = t_reset - t_start;
+		int remaining = MAX(100, (int)cfg.discovery_timeout - elapsed);
+
+		n_missing = co_net__wait_for_nodes(&socket_, nodes_seen_,
+						   expected, start, stop,
+						   remaining, remaining);
+	}
+
+	uint64_t t_probe = gettime_ms(CLOCK_MONOTONIC);
+
+	plog(LOG_INFO, "Discovery: reset phase took %"PRIu64" ms, probing %d nodes took %"PRIu64" ms; %d of %d expected nodes missing",
+	     t_reset - t_start, n_probed, t_probe - t_reset, n_missing,
+	     n_expected);
+
+	return 0;
+}
+
+static void on_lss_assigned(int nodeid, const struct lss_identity* id,
+			    void* context)
+{
+	(void)context;
+
+	plog(LOG_INFO, "LSS: Assigned node id %d to vendor=%#x product=%#x revision=%#x serial=%#x",
+	     nodeid, id->vendor, id->product, id->revision, id->serial);
+}
+
+static void run_lss_commissioning(int start, int stop)
+{
+	profile("Commission unconfigured LSS slaves...\n");
+
+	int n = co_net_lss_commission(&socket_, nodes_seen_, start, stop,
+				      cfg.lss_timeout, on_lss_assigned, NULL);
+	if (n > 0)
+		plog(LOG_INFO, "LSS: Assigned node ids to %d nodes", n);
+}
+
 static void run_net_probe(struct mloop_work* self)
 {
 	(void)self;
@@ -774,31 +1188,46 @@ static void run_net_probe(struct mloop_work* self)
 
 	int start = CANOPEN_NODEID_MIN, stop = CANOPEN_NODEID_MAX;
 
+	if (cfg.range_start != 0 || cfg.range_stop != 0) {
+		start = cfg.range_start;
+		stop = cfg.range_stop;
+	}
+
+	if (cfg.enable_fast_discovery && run_fast_discovery(start, stop) >= 0)
+		goto done;
+
 	if (cfg.range_start == 0 && cfg.range_stop == 0) {
 		co_net_reset(&socket_, nodes_seen_, 100);
 	} else  {
-		start = cfg.range_start;
-		stop = cfg.range_stop;
 		co_net_reset_range(&socket_, nodes_seen_, start, stop,
 				   100 * (start - stop + 1));
 	}
 
 	co_net_probe(&socket_, nodes_seen_, start, stop, 100);
+
+done:
+	if (cfg.enable_lss)
+		run_lss_commissioning(start, stop);
+
+	if (cfg.enable_fast_discovery)
+		save_discovered_nodes();
 }
 
 static void run_load_driver(struct mloop_work* self)
 {
 	struct co_master_node* node = mloop_work_get_context(self);
+	struct co_master_node_hot* hot = co_master_node_hot(node);
 	int nodeid = co_master_get_node_id(node);
 	load_driver(nodeid);
-	node->is_loading = 0;
+	hot->is_loading = 0;
 }
 
 static void call_start_fn(struct co_master_node* node)
 {
+	struct co_master_node_hot* hot = co_master_node_hot(node);
 	co_start_fn start_fn;
 
-	switch (node->driver_type) {
+	switch (hot->driver_type) {
 	case CO_MASTER_DRIVER_NEW:
 		start_fn = node->ndrv.start_fn;
 		if (start_fn)
@@ -806,7 +1235,7 @@ static void call_start_fn(struct co_master_node* node)
 		break;
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
-		legacy_driver_iface_process_node_state(node->driver, 1);
+		legacy_driver_iface_process_node_state(hot->driver, 1);
 		break;
 #endif /* NO_MAREL_CODE */
 	case CO_MASTER_DRIVER_NONE:
@@ -825,23 +1254,24 @@ static void start_single_node(struct co_master_node* node)
 static void on_load_driver_done(struct mloop_work* self)
 {
 	struct co_master_node* node = mloop_work_get_context(self);
+	struct co_master_node_hot* hot = co_master_node_hot(node);
 	int nodeid = co_master_get_node_id(node);
 
 	--n_scheduled_bootups;
 
-	if (node->driver_type == CO_MASTER_DRIVER_NONE)
+	if (hot->driver_type == CO_MASTER_DRIVER_NONE)
 		return;
 
 	if (initialize_driver(nodeid) < 0)
 		return;
 
-	node->is_initialized = 1;
+	hot->is_initialized = 1;
 	userdata_clear_missing(&userdata_, nodeid);
 
 	if (master_state_ == MASTER_STATE_STARTUP)
 		return;
 
-	if (node->driver_type == CO_MASTER_DRIVER_NEW
+	if (hot->driver_type == CO_MASTER_DRIVER_NEW
 	 && node->ndrv.options & CO_OPT_INHIBIT_START)
 		return;
 
@@ -851,11 +1281,12 @@ static void on_load_driver_done(struct mloop_work* self)
 static int schedule_load_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
-	if (node->is_loading)
+	struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
+	if (hot->is_loading)
 		return 0;
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
-		if (!node->is_initialized)
+	if (hot->driver_type != CO_MASTER_DRIVER_NONE) {
+		if (!hot->is_initialized)
 			return -1;
 
 		unload_driver(nodeid);
@@ -876,7 +1307,7 @@ static int schedule_load_driver(int nodeid)
 
 	mloop_work_unref(work);
 
-	node->is_loading = 1;
+	hot->is_loading = 1;
 
 	return rc;
 }
@@ -911,6 +1342,7 @@ static int handle_emcy(struct co_master_node* node,
 
 	uint32_t error_register = emcy_get_register(frame);
 
+	struct co_master_node_hot* hot = co_master_node_hot(node);
 	int nodeid = co_master_get_node_id(node);
 
 #ifndef NO_MAREL_CODE
@@ -923,15 +1355,15 @@ static int handle_emcy(struct co_master_node* node,
 		.manufacturer_error = emcy_get_manufacturer_error(frame)
 	};
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE)
+	if (hot->driver_type != CO_MASTER_DRIVER_NONE)
 		log_emcy(node, &emcy);
 
-	switch (node->driver_type) {
+	switch (hot->driver_type) {
 	case CO_MASTER_DRIVER_NONE:
 		return -1;
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
-		legacy_driver_iface_process_emr(node->driver, emcy.code,
+		legacy_driver_iface_process_emr(hot->driver, emcy.code,
 						emcy.reg,
 						emcy.manufacturer_error);
 		break;
@@ -948,6 +1380,7 @@ static int handle_emcy(struct co_master_node* node,
 static int handle_heartbeat(struct co_master_node* node,
 			     const struct can_frame* frame)
 {
+	struct co_master_node_hot* hot = co_master_node_hot(node);
 	int nodeid = co_master_get_node_id(node);
 
 	if (!heartbeat_is_valid(frame))
@@ -963,20 +1396,20 @@ static int handle_heartbeat(struct co_master_node* node,
 	/* This can happen if the CAN bus is disconnected but not the power to
 	 * the node. We reset communication to refresh the state.
 	 */
-	if (node->driver_type == CO_MASTER_DRIVER_NONE) {
+	if (hot->driver_type == CO_MASTER_DRIVER_NONE) {
 		if (heartbeat_get_state(frame) != NMT_STATE_STOPPED
-		 && !node->is_loading)
+		 && !hot->is_loading)
 			co_net_send_nmt(&socket_, NMT_CS_RESET_COMMUNICATION,
 					nodeid);
 
 		return 0;
 	}
 
-	if (!node->is_initialized)
+	if (!hot->is_initialized)
 		return -1;
 
-	node->ntimeouts = 0;
-	restart_heartbeat_timer(nodeid);
+	hot->ntimeouts = 0;
+	hot->last_heartbeat = gettime_ns(CLOCK_MONOTONIC);
 
 	/* Make sure the node is in operational state */
 	if (heartbeat_get_state(frame) != NMT_STATE_OPERATIONAL)
@@ -998,6 +1431,17 @@ static int handle_sdo(struct co_master_node* node, const struct can_frame* cf)
 	return sdo_async_feed(sdo_proc, cf);
 }
 
+static inline int is_pdo_suppressed(struct co_master_node* node,
+				    const struct co_master_node_hot* hot,
+				    int n, const struct can_frame* cf)
+{
+	if (!(hot->pdo_filter_mask & (1 << (n - 1))))
+		return 0;
+
+	struct pdo_filter* filter = &node->pdo_filter[n - 1];
+	return !pdo_filter_check(filter, cf->data, cf->can_dlc);
+}
+
 static int handle_not_loaded(struct co_master_node* node,
 			     const struct canopen_msg* msg,
 			     const struct can_frame* frame)
@@ -1019,25 +1463,34 @@ static int handle_not_loaded(struct co_master_node* node,
 
 #ifndef NO_MAREL_CODE
 static int handle_with_legacy(struct co_master_node* node,
+			      const struct co_master_node_hot* hot,
 			      const struct canopen_msg* msg,
 			      const struct can_frame* cf)
 {
-	void* driver = node->driver;
+	void* driver = hot->driver;
 	if (!driver)
 		return -1;
 
 	switch (msg->object)
 	{
 	case CANOPEN_TPDO1:
+		if (is_pdo_suppressed(node, hot, 1, cf))
+			return 0;
 		return legacy_driver_iface_process_pdo(driver, 1, cf->data,
 						       cf->can_dlc);
 	case CANOPEN_TPDO2:
+		if (is_pdo_suppressed(node, hot, 2, cf))
+			return 0;
 		return legacy_driver_iface_process_pdo(driver, 2, cf->data,
 						       cf->can_dlc);
 	case CANOPEN_TPDO3:
+		if (is_pdo_suppressed(node, hot, 3, cf))
+			return 0;
 		return legacy_driver_iface_process_pdo(driver, 3, cf->data,
 						       cf->can_dlc);
 	case CANOPEN_TPDO4:
+		if (is_pdo_suppressed(node, hot, 4, cf))
+			return 0;
 		return legacy_driver_iface_process_pdo(driver, 4, cf->data,
 						       cf->can_dlc);
 	case CANOPEN_TSDO:
@@ -1054,30 +1507,33 @@ static int handle_with_legacy(struct co_master_node* node,
 }
 #endif /* NO_MAREL_CODE */
 
+static int handle_pdo_with_new_driver(struct co_master_node* node,
+				      const struct co_master_node_hot* hot,
+				      int n, const struct can_frame* cf)
+{
+	co_pdo_fn pdo_fn = hot->pdo_fn[n - 1];
+
+	if (pdo_fn && !is_pdo_suppressed(node, hot, n, cf))
+		pdo_fn(&node->ndrv, cf->data, cf->can_dlc);
+
+	return 0;
+}
+
 static int handle_with_new_driver(struct co_master_node* node,
+				  const struct co_master_node_hot* hot,
 				  const struct canopen_msg* msg,
 				  const struct can_frame* cf)
 {
-	struct co_drv* drv = &node->ndrv;
-
 	switch (msg->object)
 	{
 	case CANOPEN_TPDO1:
-		if (drv->pdo1_fn)
-			drv->pdo1_fn(drv, cf->data, cf->can_dlc);
-		return 0;
+		return handle_pdo_with_new_driver(node, hot, 1, cf);
 	case CANOPEN_TPDO2:
-		if (drv->pdo2_fn)
-			drv->pdo2_fn(drv, cf->data, cf->can_dlc);
-		return 0;
+		return handle_pdo_with_new_driver(node, hot, 2, cf);
 	case CANOPEN_TPDO3:
-		if (drv->pdo3_fn)
-			drv->pdo3_fn(drv, cf->data, cf->can_dlc);
-		return 0;
+		return handle_pdo_with_new_driver(node, hot, 3, cf);
 	case CANOPEN_TPDO4:
-		if (drv->pdo4_fn)
-			drv->pdo4_fn(drv, cf->data, cf->can_dlc);
-		return 0;
+		return handle_pdo_with_new_driver(node, hot, 4, cf);
 	case CANOPEN_TSDO:
 		return handle_sdo(node, cf);
 	case CANOPEN_EMCY:
@@ -1091,44 +1547,66 @@ static int handle_with_new_driver(struct co_master_node* node,
 	return -1;
 }
 
-static void mux_on_frame(const struct can_frame* cf)
+static int mux_dispatch(const struct canopen_msg* msg,
+			const struct can_frame* cf)
 {
-	struct canopen_msg msg;
+	if (msg->object == CANOPEN_NMT) {
+		plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
+		return 0;
+	}
 
-	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG | CAN_ERR_FLAG))
-		return;
-
-	if (canopen_get_object_type(&msg, cf) < 0)
-		return;
-
-	if (msg.object == CANOPEN_NMT) {
-		plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
-		return;
-	}
+	/* SYNC and TIME are broadcast and belong to no node, so there is
+	 * nothing to pass them on to, but they are not dropped either.
+	 */
+	if (msg->object & (CANOPEN_SYNC | CANOPEN_TIMESTAMP))
+		return 0;
 
-	if (!(nodeid_min() <= msg.id && msg.id <= nodeid_max()))
-		return;
+	if (!(nodeid_min() <= msg->id && msg->id <= nodeid_max()))
+		return -1;
 
-	struct co_master_node* node = co_master_get_node(msg.id);
+	struct co_master_node* node = co_master_get_node(msg->id);
+	const struct co_master_node_hot* hot = co_master_get_node_hot(msg->id);
 
-	if (!node->is_initialized) {
-		handle_not_loaded(node, &msg, cf);
-		return;
-	}
+	if (!hot->is_initialized)
+		return handle_not_loaded(node, msg, cf);
 
-	switch (node->driver_type) {
+	switch (hot->driver_type) {
 	case CO_MASTER_DRIVER_NONE:
-		handle_not_loaded(node, &msg, cf);
-		break;
+		return handle_not_loaded(node, msg, cf);
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
-		handle_with_legacy(node, &msg, cf);
-		break;
+		return handle_with_legacy(node, hot, msg, cf);
 #endif /* NO_MAREL_CODE */
 	case CO_MASTER_DRIVER_NEW:
-		handle_with_new_driver(node, &msg, cf);
-		break;
+		return handle_with_new_driver(node, hot, msg, cf);
 	}
+
+	return -1;
+}
+
+static void mux_on_frame(const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+	uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+
+	tt_check(&trace_trigger_, cf, now);
+
+	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG | CAN_ERR_FLAG)) {
+		bs_count(&bus_stats_, BS_RX, cf, NULL, now);
+		return;
+	}
+
+	if (canopen_get_object_type(&msg, cf) < 0) {
+		bs_count(&bus_stats_, BS_RX, cf, NULL, now);
+		return;
+	}
+
+	bs_count(&bus_stats_, BS_RX, cf, &msg, now);
+	event_rest_publish(&msg, cf);
+	rpc_publish(&msg, cf, now);
+
+	if (mux_dispatch(&msg, cf) < 0)
+		bs_count_dropped(&bus_stats_);
 }
 
 static void mux_handler_fn(struct mloop_socket* self)
@@ -1242,12 +1720,12 @@ static void start_all_nodes(void)
 	 */
 	profile("Start nodes...\n");
 	for_each_node_reverse(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+		if (co_master_get_node_hot(i)->driver_type != CO_MASTER_DRIVER_NONE)
 			co_net_send_nmt(&socket_, NMT_CS_START, i);
 
 	profile("Start node guarding...\n");
 	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+		if (co_master_get_node_hot(i)->driver_type != CO_MASTER_DRIVER_NONE)
 			start_nodeguarding(i);
 
 	profile("Notify drivers about start...\n");
@@ -1261,6 +1739,7 @@ static void start_all_nodes(void)
 	load_late_nodes();
 
 	start_sync_timer();
+	start_supervisor_timer();
 
 	if (cfg.enable_bootup_trace)
 		dump_tracebuffer("bootup");
@@ -1369,7 +1848,7 @@ get_node_from_sdo_queue(const struct sdo_req_queue* queue)
 static void on_master_sdo_request_done(struct sdo_req* req)
 {
 	struct co_master_node* node = get_node_from_sdo_queue(req->parent);
-	void* driver = node->driver;
+	void* driver = co_master_node_hot(node)->driver;
 	assert(driver);
 
 	if (req->status == SDO_REQ_OK) {
@@ -1494,69 +1973,616 @@ static void* master_iface_init(int nodeid)
 }
 #endif /* NO_MAREL_CODE */
 
-static int init_heartbeat_timer(struct co_master_node* node)
+static void unload_all_drivers()
 {
-	int nodeid = co_master_get_node_id(node);
+	int i;
+	for_each_node(i)
+		if (co_master_get_node_hot(i)->driver_type != CO_MASTER_DRIVER_NONE)
+			unload_driver(i);
+}
+
+static int init_trace_dump_path(const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0) {
+		if (!S_ISDIR(st.st_mode)) {
+			errno = EEXIST;
+			return -1;
+		}
+	} else {
+		if (mkdir(path, 0755) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void on_trace_capture_rotate(struct mloop_timer* self)
+{
+	(void)self;
+
+	tb_capture_rotate(&trace_capture_);
+}
+
+static int start_trace_capture_timer(void)
+{
+	if (cfg.trace_capture_rotate_interval == 0)
+		return 0;
 
 	struct mloop_timer* timer = mloop_timer_new(mloop_default());
 	if (!timer)
 		return -1;
 
-	uint64_t period = cfg.node[nodeid].heartbeat_period
-			+ cfg.node[nodeid].heartbeat_timeout;
+	mloop_timer_set_callback(timer, on_trace_capture_rotate);
+	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(timer,
+			     cfg.trace_capture_rotate_interval * 1000000000ULL);
 
-	if (cfg.node[nodeid].n_timeouts_max > 0)
-		mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	int rc = mloop_timer_start(timer);
+	mloop_timer_unref(timer);
+	return rc;
+}
 
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, period * 1000000LL);
-	mloop_timer_set_callback(timer, on_heartbeat_timeout);
-	node->heartbeat_timer = timer;
+static int init_trace_capture(void)
+{
+	if (init_trace_dump_path(cfg.trace_capture_path) < 0)
+		return -1;
 
+	if (tb_capture_init(&trace_capture_, cfg.trace_capture_path,
+			    cfg.trace_capture_segment_size,
+			    cfg.trace_capture_segments) < 0)
+		return -1;
+
+	if (start_trace_capture_timer() < 0) {
+		tb_capture_destroy(&trace_capture_);
+		return -1;
+	}
+
+	tb_set_capture(&tracebuffer_, &trace_capture_);
 	return 0;
 }
 
-static int init_ping_timer(struct co_master_node* node)
+static void print_pdo_filter_stats(FILE* out, int nodeid)
 {
-	int nodeid = co_master_get_node_id(node);
+	struct co_master_node* node = co_master_get_node(nodeid);
+	int is_first = 1;
+
+	for (int i = 0; i < 4; ++i) {
+		const struct pdo_filter* filter = &node->pdo_filter[i];
+		if (!filter->is_enabled)
+			continue;
+
+		fprintf(out, "%s\n  \"tpdo%d\": { \"delivered\": %llu, \"suppressed\": %llu }",
+			is_first ? "" : ",", i + 1,
+			(unsigned long long)filter->n_delivered,
+			(unsigned long long)filter->n_suppressed);
+
+		is_first = 0;
+	}
+}
+
+static void pdo_filter_rest_service(struct rest_client* client,
+				    const void* content)
+{
+	(void)content;
+
+	char* buffer = NULL;
+	size_t size = 0;
+	int is_first = 1;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		rest_client_abort(client);
+		return;
+	}
+
+	fprintf(out, "{");
+
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+		const struct co_master_node_hot* hot = co_master_get_node_hot(i);
+		if (!hot->is_initialized || !hot->pdo_filter_mask)
+			continue;
+
+		fprintf(out, "%s\n \"%d\": {", is_first ? "" : ",", i);
+		print_pdo_filter_stats(out, i);
+		fprintf(out, "\n }");
+
+		is_first = 0;
+	}
+
+	fprintf(out, "\n}\n");
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client, &reply);
+	free(buffer);
+
+	rest_client_done(client);
+}
+
+static void bus_stats_rest_service(struct rest_client* client,
+				   const void* content)
+{
+	(void)content;
+
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		rest_client_abort(client);
+		return;
+	}
+
+	bs_print_json(&bus_stats_, out, gettime_ns(CLOCK_MONOTONIC));
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client, &reply);
+	free(buffer);
+
+	rest_client_done(client);
+}
+
+typedef uint64_t (*node_metric_fn)(int nodeid);
+
+static void print_node_metric(FILE* out, const char* is_reported,
+			      const char* name, const char* type,
+			      const char* help, node_metric_fn fn)
+{
+	char labels[32];
+
+	metrics_print_type(out, name, type, help);
+
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+		if (!is_reported[i])
+			continue;
+
+		snprintf(labels, sizeof(labels), "node=\"%d\"", i);
+		metrics_print(out, name, labels, fn(i));
+	}
+}
+
+static uint64_t get_sdo_queue_depth(int nodeid)
+{
+	return co_atomic_load(&sdo_req_queue_get(nodeid)->size);
+}
+
+static uint64_t get_sdo_requests(int nodeid)
+{
+	return sdo_req_queue_get(nodeid)->stats.n_requests;
+}
+
+static uint64_t get_sdo_timeouts(int nodeid)
+{
+	return sdo_req_queue_get(nodeid)->stats.n_timeouts;
+}
+
+static uint64_t get_sdo_aborts(int nodeid)
+{
+	return sdo_req_queue_get(nodeid)->stats.n_aborts;
+}
+
+static uint64_t get_heartbeat_misses(int nodeid)
+{
+	return co_master_get_node(nodeid)->n_missed_heartbeats;
+}
+
+static uint64_t get_heartbeat_ntimeouts(int nodeid)
+{
+	return co_master_get_node_hot(nodeid)->ntimeouts;
+}
+
+static void print_sdo_metrics(FILE* out, const char* is_reported)
+{
+	char labels[32];
+
+	print_node_metric(out, is_reported, "canopen_sdo_queue_depth",
+			  "gauge", "SDO requests waiting to be started.",
+			  get_sdo_queue_depth);
+	print_node_metric(out, is_reported, "canopen_sdo_requests_total",
+			  "counter", "Finished SDO requests.",
+			  get_sdo_requests);
+	print_node_metric(out, is_reported, "canopen_sdo_timeouts_total",
+			  "counter", "SDO requests that timed out.",
+			  get_sdo_timeouts);
+	print_node_metric(out, is_reported, "canopen_sdo_aborts_total",
+			  "counter", "SDO requests aborted for other reasons than timeout.",
+			  get_sdo_aborts);
 
+	metrics_print_type(out, "canopen_sdo_latency_seconds", "histogram",
+			   "Time from queueing an SDO request until it is done.");
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+		if (!is_reported[i])
+			continue;
+
+		const struct sdo_req_stats* stats = &sdo_req_queue_get(i)->stats;
+		snprintf(labels, sizeof(labels), "node=\"%d\"", i);
+		metrics_print_histogram(out, "canopen_sdo_latency_seconds",
+					labels, &stats->latency);
+	}
+}
+
+static void print_heartbeat_metrics(FILE* out, const char* is_reported)
+{
+	print_node_metric(out, is_reported, "canopen_heartbeat_misses_total",
+			  "counter", "Heartbeat deadlines that have passed without a heartbeat.",
+			  get_heartbeat_misses);
+	print_node_metric(out, is_reported, "canopen_heartbeat_ntimeouts",
+			  "gauge", "Heartbeats missed in a row.",
+			  get_heartbeat_ntimeouts);
+}
+
+static void print_pdo_filter_metrics(FILE* out, const char* is_reported)
+{
+	static const char* names[] = {
+		"canopen_pdo_delivered_total", "canopen_pdo_suppressed_total"
+	};
+
+	static const char* help[] = {
+		"Filtered TPDOs that were passed on to the driver.",
+		"Filtered TPDOs that were dropped as unchanged."
+	};
+
+	char labels[32];
+
+	for (int k = 0; k < 2; ++k) {
+		metrics_print_type(out, names[k], "counter", help[k]);
+
+		for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+			const struct co_master_node_hot* hot =
+				co_master_get_node_hot(i);
+			if (!is_reported[i] || !hot->pdo_filter_mask)
+				continue;
+
+			for (int n = 0; n < 4; ++n) {
+				const struct pdo_filter* filter =
+					&co_master_get_node(i)->pdo_filter[n];
+				if (!filter->is_enabled)
+					continue;
+
+				snprintf(labels, sizeof(labels),
+					 "node=\"%d\",pdo=\"%d\"", i, n + 1);
+				metrics_print(out, names[k], labels,
+					      k ? filter->n_suppressed
+						: filter->n_delivered);
+			}
+		}
+	}
+}
+
+static void print_bus_metrics(FILE* out, const char* is_reported,
+			      uint64_t now)
+{
+	static const char* directions[] = { "rx", "tx" };
+	char labels[48];
+
+	metrics_print_type(out, "canopen_frames_total", "counter",
+			   "CAN frames by node and direction.");
+	for (int d = BS_RX; d <= BS_TX; ++d)
+		for (int i = nodeid_min(); i <= nodeid_max(); ++i) {
+			if (!is_reported[i])
+				continue;
+
+			struct bs_counter total;
+			bs_get_node_total(&bus_stats_, d, i, &total);
+			snprintf(labels, sizeof(labels),
+				 "node=\"%d\",direction=\"%s\"", i,
+				 directions[d]);
+			metrics_print(out, "canopen_frames_total", labels,
+				      total.frames);
+		}
+
+	metrics_print_type(out, "canopen_bus_frames_total", "counter",
+			   "CAN frames on the bus, including broadcasts.");
+	for (int d = BS_RX; d <= BS_TX; ++d) {
+		struct bs_counter total;
+		bs_get_total(&bus_stats_, d, &total);
+		snprintf(labels, sizeof(labels), "direction=\"%s\"",
+			 directions[d]);
+		metrics_print(out, "canopen_bus_frames_total", labels,
+			      total.frames);
+	}
+
+	metrics_print_type(out, "canopen_bus_bytes_total", "counter",
+			   "CAN payload bytes on the bus.");
+	for (int d = BS_RX; d <= BS_TX; ++d) {
+		struct bs_counter total;
+		bs_get_total(&bus_stats_, d, &total);
+		snprintf(labels, sizeof(labels), "direction=\"%s\"",
+			 directions[d]);
+		metrics_print(out, "canopen_bus_bytes_total", labels,
+			      total.bytes);
+	}
+
+	metrics_print_type(out, "canopen_bus_errors_total", "counter",
+			   "CAN error frames and failed sends.");
+	for (int d = BS_RX; d <= BS_TX; ++d) {
+		snprintf(labels, sizeof(labels), "direction=\"%s\"",
+			 directions[d]);
+		metrics_print(out, "canopen_bus_errors_total", labels,
+			      bs_get_value(&bus_stats_.n_errors[d]));
+	}
+
+	metrics_print_type(out, "canopen_bus_unknown_frames_total", "counter",
+			   "Received frames that are not CANopen.");
+	metrics_print(out, "canopen_bus_unknown_frames_total", NULL,
+		      bs_get_value(&bus_stats_.n_unknown));
+
+	metrics_print_type(out, "canopen_bus_dropped_frames_total", "counter",
+			   "Received frames that the master did not handle.");
+	metrics_print(out, "canopen_bus_dropped_frames_total", NULL,
+		      bs_get_value(&bus_stats_.n_dropped));
+
+	metrics_print_type(out, "canopen_bus_load", "gauge",
+			   "Estimated bus load as a fraction of the bitrate.");
+	metrics_print_real(out, "canopen_bus_load", "window=\"1s\"",
+			   bs_get_load(&bus_stats_, 1000000000ULL, now));
+	metrics_print_real(out, "canopen_bus_load", "window=\"10s\"",
+			   bs_get_load(&bus_stats_, 10000000000ULL, now));
+}
+
+/* The trace buffer head wraps around at 2^32, so it is widened here. That is
+ * exact as long as it is read at least once every 2^32 frames, which
+ * on_stats_update() takes care of.
+ */
+static uint64_t get_trace_buffer_appended(void)
+{
+	static uint32_t last_head = 0;
+	static uint64_t n_appended = 0;
+
+	uint32_t head = tb_get_head(&tracebuffer_);
+	n_appended += (uint32_t)(head - last_head);
+	last_head = head;
+
+	return n_appended;
+}
+
+static void print_trace_buffer_metrics(FILE* out)
+{
+	if (tracebuffer_.length == 0)
+		return;
+
+	uint64_t head = get_trace_buffer_appended();
+
+	metrics_print_type(out, "canopen_trace_buffer_frames", "gauge",
+			   "Frames held in the trace buffer.");
+	metrics_print(out, "canopen_trace_buffer_frames", NULL,
+		      MIN(head, tracebuffer_.length));
+
+	metrics_print_type(out, "canopen_trace_buffer_size", "gauge",
+			   "Capacity of the trace buffer in frames.");
+	metrics_print(out, "canopen_trace_buffer_size", NULL,
+		      tracebuffer_.length);
+
+	metrics_print_type(out, "canopen_trace_buffer_appended_total",
+			   "counter", "Frames appended to the trace buffer.");
+	metrics_print(out, "canopen_trace_buffer_appended_total", NULL, head);
+}
+
+#ifdef MLOOP_HAVE_STATS
+static void print_mloop_metrics(FILE* out)
+{
+	struct mloop_stats stats[2];
+	const char* labels[2] = { "loop=\"main\"", "loop=\"rest\"" };
+	int n_loops = rest_get_mloop() != mloop_default() ? 2 : 1;
+
+	mloop_get_stats(mloop_default(), &stats[0]);
+	if (n_loops > 1)
+		mloop_get_stats(rest_get_mloop(), &stats[1]);
+
+	metrics_print_type(out, "canopen_mloop_iterations_total", "counter",
+			   "Main loop iterations.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print(out, "canopen_mloop_iterations_total", labels[i],
+			      stats[i].n_iterations);
+
+	metrics_print_type(out, "canopen_mloop_busy_seconds_total", "counter",
+			   "Time spent processing, i.e. not waiting for events.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print_seconds(out, "canopen_mloop_busy_seconds_total",
+				      labels[i], stats[i].busy_time);
+
+	metrics_print_type(out, "canopen_mloop_callbacks_total", "counter",
+			   "Callbacks run by the main loop.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print(out, "canopen_mloop_callbacks_total", labels[i],
+			      stats[i].n_callbacks);
+
+	metrics_print_type(out, "canopen_mloop_callback_seconds_total",
+			   "counter", "Time spent in callbacks.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print_seconds(out, "canopen_mloop_callback_seconds_total",
+				      labels[i], stats[i].callback_time);
+
+	metrics_print_type(out, "canopen_mloop_callback_max_seconds", "gauge",
+			   "Longest time spent in a single callback.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print_seconds(out, "canopen_mloop_callback_max_seconds",
+				      labels[i], stats[i].max_callback_time);
+
+	metrics_print_type(out, "canopen_mloop_pending_jobs", "gauge",
+			   "Async jobs and finished work waiting for the loop.");
+	for (int i = 0; i < n_loops; ++i)
+		metrics_print(out, "canopen_mloop_pending_jobs", labels[i],
+			      stats[i].n_pending_jobs);
+
+	/* The worker pool is global */
+	metrics_print_type(out, "canopen_workers", "gauge",
+			   "Worker threads.");
+	metrics_print(out, "canopen_workers", NULL, stats[0].n_workers);
+
+	metrics_print_type(out, "canopen_workers_busy", "gauge",
+			   "Worker threads that are running work.");
+	metrics_print(out, "canopen_workers_busy", NULL,
+		      stats[0].n_busy_workers);
+
+	metrics_print_type(out, "canopen_work_queue_depth", "gauge",
+			   "Work waiting for a worker thread.");
+	metrics_print(out, "canopen_work_queue_depth", NULL,
+		      stats[0].n_queued_work);
+
+	metrics_print_type(out, "canopen_work_done_total", "counter",
+			   "Work run by worker threads.");
+	metrics_print(out, "canopen_work_done_total", NULL,
+		      stats[0].n_work_done);
+
+	metrics_print_type(out, "canopen_work_seconds_total", "counter",
+			   "Time worker threads spent running work.");
+	metrics_print_seconds(out, "canopen_work_seconds_total", NULL,
+			      stats[0].work_time);
+}
+#endif /* MLOOP_HAVE_STATS */
+
+/* Nodes are reported if they are up or have ever been active, so that series
+ * do not come and go while a node is rebooting.
+ */
+static int is_node_reported(int nodeid)
+{
+	const struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+	struct bs_counter rx;
+
+	if (co_master_get_node_hot(nodeid)->is_initialized)
+		return 1;
+
+	bs_get_node_total(&bus_stats_, BS_RX, nodeid, &rx);
+
+	return rx.frames > 0 || queue->stats.n_requests > 0
+	    || co_atomic_load(&queue->size) > 0;
+}
+
+static void metrics_rest_service(struct rest_client* client,
+				 const void* content)
+{
+	(void)content;
+
+	char is_reported[CANOPEN_NODEID_MAX + 1] = { 0 };
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		rest_client_abort(client);
+		return;
+	}
+
+	for (int i = nodeid_min(); i <= nodeid_max(); ++i)
+		is_reported[i] = is_node_reported(i);
+
+	print_sdo_metrics(out, is_reported);
+	print_heartbeat_metrics(out, is_reported);
+	print_pdo_filter_metrics(out, is_reported);
+	print_bus_metrics(out, is_reported, gettime_ns(CLOCK_MONOTONIC));
+	print_trace_buffer_metrics(out);
+#ifdef MLOOP_HAVE_STATS
+	print_mloop_metrics(out);
+#endif
+
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "text/plain; version=0.0.4",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client, &reply);
+	free(buffer);
+
+	rest_client_done(client);
+}
+
+/* Widen the counters that wrap around, often enough that none of them can
+ * wrap around twice in between.
+ */
+static void on_stats_update(struct mloop_timer* timer)
+{
+	(void)timer;
+
+	bs_update(&bus_stats_, gettime_ns(CLOCK_MONOTONIC));
+	get_trace_buffer_appended();
+}
+
+static int start_stats_timer(void)
+{
 	struct mloop_timer* timer = mloop_timer_new(mloop_default());
 	if (!timer)
 		return -1;
 
+	mloop_timer_set_callback(timer, on_stats_update);
 	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, cfg.node[nodeid].heartbeat_period * 1000000LL);
-	mloop_timer_set_callback(timer, on_ping_timeout);
-	node->ping_timer = timer;
+	mloop_timer_set_time(timer, BS_UPDATE_INTERVAL);
 
-	return 0;
+	int rc = mloop_timer_start(timer);
+	mloop_timer_unref(timer);
+	return rc;
 }
 
-static void unload_all_drivers()
+#ifndef NO_MAREL_CODE
+static void on_bus_info_update(struct mloop_timer* timer)
 {
-	int i;
-	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
-			unload_driver(i);
+	(void)timer;
+
+	uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+	struct bs_counter rx, tx;
+
+	for (int i = 1; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct canopen_info* info = canopen_info_get(i);
+
+		bs_get_node_total(&bus_stats_, BS_RX, i, &rx);
+		bs_get_node_total(&bus_stats_, BS_TX, i, &tx);
+
+		info->rx_frames = rx.frames;
+		info->rx_bytes = rx.bytes;
+		info->tx_frames = tx.frames;
+		info->tx_bytes = tx.bytes;
+	}
+
+	struct canopen_bus_info* bus = canopen_bus_info_;
+
+	bs_get_total(&bus_stats_, BS_RX, &rx);
+	bs_get_total(&bus_stats_, BS_TX, &tx);
+
+	bus->bitrate = bus_stats_.bitrate;
+	bus->load_1s = bs_get_load(&bus_stats_, 1000000000ULL, now) * 10000.0;
+	bus->load_10s = bs_get_load(&bus_stats_, 10000000000ULL, now) * 10000.0;
+	bus->rx_frames = rx.frames;
+	bus->tx_frames = tx.frames;
+	bus->rx_errors = bs_get_value(&bus_stats_.n_errors[BS_RX]);
+	bus->tx_errors = bs_get_value(&bus_stats_.n_errors[BS_TX]);
+	bus->rx_unknown = bs_get_value(&bus_stats_.n_unknown);
+	bus->rx_dropped = bs_get_value(&bus_stats_.n_dropped);
 }
 
-static int init_trace_dump_path(const char* path)
+static int start_bus_info_timer(void)
 {
-	struct stat st;
+	struct mloop_timer* timer = mloop_timer_new(mloop_default());
+	if (!timer)
+		return -1;
 
-	if (stat(path, &st) == 0) {
-		if (!S_ISDIR(st.st_mode)) {
-			errno = EEXIST;
-			return -1;
-		}
-	} else {
-		if (mkdir(path, 0755) < 0)
-			return -1;
-	}
+	mloop_timer_set_callback(timer, on_bus_info_update);
+	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(timer, 1000000000ULL);
 
-	return 0;
+	int rc = mloop_timer_start(timer);
+	mloop_timer_unref(timer);
+	return rc;
 }
+#endif /* NO_MAREL_CODE */
 
 void on_stop_signal(struct mloop_signal* sig, int signo)
 {
@@ -1605,6 +2631,7 @@ int co_master_run(void)
 	memset(nodes_seen_, 0, sizeof(nodes_seen_));
 	memset(nodes_seen_late_, 0, sizeof(nodes_seen_));
 	memset(co_master_node_, 0, sizeof(co_master_node_));
+	memset(co_master_node_hot_, 0, sizeof(co_master_node_hot_));
 
 	mloop_ = mloop_default();
 	mloop_ref(mloop_);
@@ -1612,29 +2639,76 @@ int co_master_run(void)
 	profile("Load EDS database...\n");
 	eds_db_load();
 
+	profile("Build EDS documents...\n");
+	if (sdo_rest_init() < 0) {
+		perror("Could not build EDS documents");
+		rc = 1;
+		goto eds_doc_failure;
+	}
+
 	profile("Initialize and register SDO REST service...\n");
-	if (rest_init(cfg.rest_port) < 0) {
+	rest_set_keepalive(cfg.rest_keepalive_timeout, cfg.rest_max_requests);
+	event_rest_set_interval(cfg.event_interval);
+
+	rc = cfg.use_rest_thread ? rest_init_threaded(cfg.rest_port)
+				 : rest_init(cfg.rest_port);
+	if (rc < 0) {
 		perror("Could not initialize rest service");
 		goto rest_init_failure;
 	}
 
-	if (rest_register_service(HTTP_GET | HTTP_PUT,
-				  "sdo", sdo_rest_service) < 0)
+	if (rest_register_streaming_service(HTTP_GET | HTTP_PUT,
+					    "sdo", sdo_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_PUT, "sdo-bulk",
+				  sdo_rest_bulk_service) < 0)
 		goto rest_service_failure;
 
+	if (rest_register_service(HTTP_GET, "events",
+				  event_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "pdo-filter",
+				  pdo_filter_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "bus-stats",
+				  bus_stats_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "metrics",
+				  metrics_rest_service) < 0)
+		goto rest_service_failure;
+
+	bs_init(&bus_stats_, cfg.bitrate);
+
+	if (start_stats_timer() < 0) {
+		perror("Could not start statistics timer");
+		goto stats_timer_failure;
+	}
+
 	profile("Open interface...\n");
 	enum sock_type sock_type = cfg.use_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
+	int is_tracing = cfg.trace_buffer_size > 0 || cfg.enable_trace_capture;
 	if (sock_open(&socket_, sock_type, cfg.iface,
-		      cfg.trace_buffer_size > 0 ? &tracebuffer_ : NULL) < 0) {
+		      is_tracing ? &tracebuffer_ : NULL) < 0) {
 		perror("Could not open CAN bus");
 		goto socketcan_open_failure;
 	}
 
+	sock_set_stats(&socket_, &bus_stats_);
+
 #ifndef NO_MAREL_CODE
 	if (canopen_info_init(cfg.iface) < 0) {
 		perror("Could not initialize info structure");
 		goto info_failure;
 	}
+
+	if (start_bus_info_timer() < 0) {
+		perror("Could not start bus info timer");
+		goto bus_info_failure;
+	}
 #endif /* NO_MAREL_CODE */
 
 	enum sdo_async_quirks_flags sdo_quirks;
@@ -1648,6 +2722,12 @@ int co_master_run(void)
 	if (sock_type == SOCK_TYPE_CAN)
 		net_fix_sndbuf(socket_.fd);
 
+	if (cfg.rpc_path[0] && rpc_init(cfg.rpc_path) < 0) {
+		perror("Could not initialize RPC service");
+		rc = 1;
+		goto rpc_failure;
+	}
+
 #ifndef NO_MAREL_CODE
 	profile("Create legacy driver manager...\n");
 	driver_manager_ = legacy_driver_manager_new();
@@ -1681,6 +2761,20 @@ int co_master_run(void)
 		}
 	}
 
+	if (init_trace_triggers() < 0) {
+		rc = 1;
+		goto trace_trigger_failure;
+	}
+
+	if (cfg.enable_trace_capture) {
+		profile("Initialize trace capture...\n");
+		if (init_trace_capture() < 0) {
+			perror("Could not initialize trace capture");
+			rc = 1;
+			goto trace_capture_failure;
+		}
+	}
+
 	init_signal_handler(mloop_);
 
 #ifndef NO_MAREL_CODE
@@ -1702,6 +2796,12 @@ int co_master_run(void)
 	}
 
 bootup_failure:
+	if (cfg.enable_trace_capture) {
+		tb_set_capture(&tracebuffer_, NULL);
+		tb_capture_destroy(&trace_capture_);
+	}
+trace_capture_failure:
+trace_trigger_failure:
 trace_dump_path_failure:
 	if (cfg.trace_buffer_size > 0)
 		tb_destroy(&tracebuffer_);
@@ -1712,6 +2812,9 @@ worker_failure:
 #endif /* NO_MAREL_CODE */
 
 driver_manager_failure:
+	rpc_cleanup();
+
+rpc_failure:
 	sdo_req_queues_cleanup();
 
 sdo_req_queues_failure:
@@ -1719,14 +2822,18 @@ sdo_req_queues_failure:
 		sock_close(&socket_);
 
 #ifndef NO_MAREL_CODE
+bus_info_failure:
 	canopen_info_cleanup();
 #endif /* NO_MAREL_CODE */
 info_failure:
 socketcan_open_failure:
+stats_timer_failure:
 rest_service_failure:
 	rest_cleanup();
 
 rest_init_failure:
+eds_doc_failure:
+	sdo_rest_cleanup();
 	eds_db_unload();
 
 	mloop_unref(mloop_);
@@ -0,0 +1,97 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "metrics.h"
+
+/* The last bucket is +Inf */
+static const uint64_t metrics__bounds[METRICS_N_BUCKETS - 1] = {
+	1000000ULL, 2000000ULL, 5000000ULL,
+	10000000ULL, 20000000ULL, 50000000ULL,
+	100000000ULL, 200000000ULL, 500000000ULL,
+	1000000000ULL, 2000000000ULL,
+};
+
+void metrics_histogram_observe(struct metrics_histogram* self, uint64_t ns)
+{
+	int i = 0;
+
+	while (i < METRICS_N_BUCKETS - 1 && ns > metrics__bounds[i])
+		++i;
+
+	self->bucket[i]++;
+	self->sum += ns;
+}
+
+void metrics_print_type(FILE* out, const char* name, const char* type,
+			const char* help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics__print_name(FILE* out, const char* name,
+				const char* labels)
+{
+	if (labels)
+		fprintf(out, "%s{%s} ", name, labels);
+	else
+		fprintf(out, "%s ", name);
+}
+
+void metrics_print(FILE* out, const char* name, const char* labels,
+		   uint64_t value)
+{
+	metrics__print_name(out, name, labels);
+	fprintf(out, "%llu\n", (unsigned long long)value);
+}
+
+void metrics_print_real(FILE* out, const char* name, const char* labels,
+			double value)
+{
+	metrics__print_name(out, name, labels);
+	fprintf(out, "%.9g\n", value);
+}
+
+void metrics_print_seconds(FILE* out, const char* name, const char* labels,
+			   uint64_t ns)
+{
+	metrics_print_real(out, name, labels, ns / 1e9);
+}
+
+void metrics_print_histogram(FILE* out, const char* name, const char* labels,
+			     const struct metrics_histogram* hist)
+{
+	char buffer[256];
+	uint64_t count = 0;
+
+	for (int i = 0; i < METRICS_N_BUCKETS; ++i) {
+		count += hist->bucket[i];
+
+		fprintf(out, "%s_bucket{%s%s", name, labels ? labels : "",
+			labels ? "," : "");
+
+		if (i < METRICS_N_BUCKETS - 1)
+			fprintf(out, "le=\"%g\"} ", metrics__bounds[i] / 1e9);
+		else
+			fprintf(out, "le=\"+Inf\"} ");
+
+		fprintf(out, "%llu\n", (unsigned long long)count);
+	}
+
+	snprintf(buffer, sizeof(buffer), "%s_sum", name);
+	metrics_print_seconds(out, buffer, labels, hist->sum);
+
+	snprintf(buffer, sizeof(buffer), "%s_count", name);
+	metrics_print(out, buffer, labels, count);
+}
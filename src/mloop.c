@@ -31,6 +31,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <execinfo.h>
+#include <time.h>
 #include <sys/queue.h>
 
 #include "atomic_compat.h"
@@ -54,6 +55,33 @@
 #define mloop__atomic_store(ptr, val) \
 	__atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
 
+#define mloop__stats_load(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+/* Each set of statistics has a single writer, either the thread running a
+ * loop or a worker. Other threads read them through a sequence count that is
+ * odd while they are being updated, so 64-bit values are never read half
+ * written and no 64-bit atomics are needed.
+ */
+#define mloop__stats_write_begin(stats) \
+({ \
+	__atomic_store_n(&(stats)->seq, (stats)->seq + 1, __ATOMIC_RELAXED); \
+	__atomic_thread_fence(__ATOMIC_RELEASE); \
+})
+
+#define mloop__stats_write_end(stats) \
+	__atomic_store_n(&(stats)->seq, (stats)->seq + 1, __ATOMIC_RELEASE)
+
+#define mloop__stats_read(dst, src) \
+({ \
+	unsigned int seq_; \
+	do { \
+		seq_ = __atomic_load_n(&(src)->seq, __ATOMIC_ACQUIRE); \
+		*(dst) = *(src); \
+		__atomic_thread_fence(__ATOMIC_ACQUIRE); \
+	} while ((seq_ & 1) \
+	      || seq_ != __atomic_load_n(&(src)->seq, __ATOMIC_RELAXED)); \
+})
+
 enum mloop_type {
 	MLOOP_INIT   = -1,
 	MLOOP_NONE   = 0,
@@ -145,6 +173,21 @@ struct mloop_idle {
 LIST_HEAD(mloop_object_list, mloop_common);
 TAILQ_HEAD(mloop_idle_list, mloop_idle);
 
+struct mloop__stats {
+	unsigned int seq;
+	uint64_t n_iterations;
+	uint64_t busy_time;
+	uint64_t n_callbacks;
+	uint64_t callback_time;
+	uint64_t max_callback_time;
+};
+
+struct mloop__work_stats {
+	unsigned int seq;
+	uint64_t n_work_done;
+	uint64_t work_time;
+};
+
 struct mloop_core {
 	int ref;
 	int epollfd;
@@ -155,6 +198,7 @@ struct mloop_core {
 	pthread_mutex_t idle_list_mutex;
 	struct mloop_object_list free_list;
 	pthread_mutex_t free_list_mutex;
+	struct mloop__stats stats;
 };
 
 struct mloop {
@@ -175,6 +219,8 @@ static int mloop__nthreads = 0;
 static size_t mloop__qsize = 64;
 static size_t mloop__stacksize = 0;
 static pthread_t mloop__threads[NTHREADS_MAX];
+static int mloop__n_busy_workers = 0;
+static struct mloop__work_stats mloop__work_stats[NTHREADS_MAX];
 
 static struct mloop* mloop__default = NULL;
 static size_t mloop__core_count = 0;
@@ -346,6 +392,36 @@ static enum mloop_type mloop__get_debug_type()
 	return mloop__debug;
 }
 
+static inline uint64_t mloop__now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Callbacks are timed back to back; each one is charged the time since the
+ * previous callback returned, or since the iteration started.
+ */
+static inline void mloop__account_callback(struct mloop_core* core,
+					   uint64_t* t)
+{
+	struct mloop__stats* stats = &core->stats;
+
+	uint64_t now = mloop__now();
+	uint64_t elapsed = now - *t;
+	*t = now;
+
+	mloop__stats_write_begin(stats);
+
+	stats->n_callbacks++;
+	stats->callback_time += elapsed;
+
+	if (elapsed > stats->max_callback_time)
+		stats->max_callback_time = elapsed;
+
+	mloop__stats_write_end(stats);
+}
+
 static inline int mloop__is_exiting(const struct mloop* self)
 {
 	return mloop__atomic_load(&self->core->do_exit);
@@ -692,7 +768,7 @@ failure:
 
 static void* mloop__worker_fn(void* context)
 {
-	(void)context;
+	struct mloop__work_stats* stats = context;
 
 	mloop__block_all_signals();
 
@@ -711,9 +787,24 @@ static void* mloop__worker_fn(void* context)
 		mloop_work_ref(work);
 
 		mloop_work_fn work_fn = work->work_fn;
-		if (work_fn)
+		if (work_fn) {
+			__atomic_add_fetch(&mloop__n_busy_workers, 1,
+					   __ATOMIC_RELAXED);
+			uint64_t t0 = mloop__now();
+
 			work_fn(work);
 
+			uint64_t elapsed = mloop__now() - t0;
+
+			mloop__stats_write_begin(stats);
+			stats->n_work_done++;
+			stats->work_time += elapsed;
+			mloop__stats_write_end(stats);
+
+			__atomic_sub_fetch(&mloop__n_busy_workers, 1,
+					   __ATOMIC_RELAXED);
+		}
+
 		if (mloop_work_unref(work) == 0)
 			continue; /* No one is interested in the result */
 
@@ -770,7 +861,7 @@ static int mloop__start_threads(size_t stacksize, int required)
 	int i;
 	for (i = mloop__nthreads; i < required; ++i) {
 		rc = pthread_create(&mloop__threads[i], &attr,
-				    mloop__worker_fn, NULL);
+				    mloop__worker_fn, &mloop__work_stats[i]);
 		if (rc < 0) {
 			errno = rc;
 			mloop__nthreads = i;
@@ -1220,13 +1311,6 @@ mloop_socket_get_event(const struct mloop_socket* socket)
 	return socket->revents;
 }
 
-EXPORT
-void mloop_socket_set_event(struct mloop_socket* socket,
-			    enum mloop_socket_event events)
-{
-	socket->events = events;
-}
-
 enum mloop_socket_event
 mloop__get_socket_event(uint32_t events)
 {
@@ -1250,8 +1334,26 @@ uint32_t mloop__get_epoll_event(enum mloop_socket_event events)
 	return e;
 }
 
+EXPORT
+void mloop_socket_set_event(struct mloop_socket* socket,
+			    enum mloop_socket_event events)
+{
+	socket->events = events;
+
+	if (!mloop_socket_is_started(socket))
+		return;
+
+	struct epoll_event event = {
+		.events = mloop__get_epoll_event(events),
+		.data.ptr = socket
+	};
+
+	epoll_ctl(socket->parent_core->epollfd, EPOLL_CTL_MOD, socket->fd,
+		  &event);
+}
+
 void mloop__process_events(struct mloop* self, struct epoll_event* events,
-			   int nfds)
+			   int nfds, uint64_t* t)
 {
 	int i;
 
@@ -1279,13 +1381,15 @@ void mloop__process_events(struct mloop* self, struct epoll_event* events,
 
 		if (socket->type == MLOOP_TIMER)
 			mloop__process_timer(socket);
+
+		mloop__account_callback(self->core, t);
 	}
 
 	for (i = 0; i < nfds; ++i)
 		mloop__unref_any(events[i].data.ptr);
 }
 
-void mloop__process_async_jobs(struct mloop* self)
+void mloop__process_async_jobs(struct mloop* self, uint64_t* t)
 {
 	struct prioq_elem elem;
 
@@ -1300,8 +1404,10 @@ void mloop__process_async_jobs(struct mloop* self)
 		goto cancelled;
 
 	mloop_async_fn callback_fn = async->callback_fn;
-	if (callback_fn)
+	if (callback_fn) {
 		callback_fn(async);
+		mloop__account_callback(self->core, t);
+	}
 
 cancelled:
 	if (mloop__object_list_remove(async) == 0)
@@ -1311,7 +1417,7 @@ cancelled:
 	assert(rc == 0);
 }
 
-void mloop__process_idle_jobs(struct mloop* self)
+void mloop__process_idle_jobs(struct mloop* self, uint64_t* t)
 {
 	/* Note: pop() does not unreference the job and this is crucial for the
 	 * sake of concurrency. */
@@ -1322,8 +1428,10 @@ void mloop__process_idle_jobs(struct mloop* self)
 	mloop_idle_cond_fn cond_fn = job->cond_fn;
 	if (cond_fn && cond_fn(job)) {
 		mloop_idle_fn idle_fn = job->idle_fn;
-		if (idle_fn)
+		if (idle_fn) {
 			idle_fn(job);
+			mloop__account_callback(self->core, t);
+		}
 	}
 
 	if (mloop_idle_unref(job) > 0)
@@ -1352,6 +1460,28 @@ static inline int mloop__have_async_or_idle_jobs(struct mloop* self)
 	return self->core->async_jobs.index > 0 || mloop__have_idle_jobs(self);
 }
 
+static void mloop__process(struct mloop* self, struct epoll_event* events,
+			   int nfds)
+{
+	struct mloop__stats* stats = &self->core->stats;
+	uint64_t t0 = mloop__now();
+	uint64_t t = t0;
+
+	if (nfds > 0)
+		mloop__process_events(self, events, nfds, &t);
+
+	mloop__process_async_jobs(self, &t);
+	mloop__process_idle_jobs(self, &t);
+	mloop__collect(self->core);
+
+	uint64_t elapsed = mloop__now() - t0;
+
+	mloop__stats_write_begin(stats);
+	stats->n_iterations++;
+	stats->busy_time += elapsed;
+	mloop__stats_write_end(stats);
+}
+
 EXPORT
 int mloop_run(struct mloop* self)
 {
@@ -1374,13 +1504,7 @@ int mloop_run(struct mloop* self)
 
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-		if (nfds > 0)
-			mloop__process_events(self, events, nfds);
-
-		mloop__process_async_jobs(self);
-		mloop__process_idle_jobs(self);
-		mloop__collect(self->core);
-
+		mloop__process(self, events, nfds);
 
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
@@ -1397,12 +1521,7 @@ int mloop_run_once(struct mloop* self)
 	struct epoll_event events[MAX_EVENTS];
 
 	int nfds = epoll_wait(self->core->epollfd, events, MAX_EVENTS, 0);
-	if (nfds > 0)
-		mloop__process_events(self, events, nfds);
-
-	mloop__process_async_jobs(self);
-	mloop__process_idle_jobs(self);
-	mloop__collect(self->core);
+	mloop__process(self, events, nfds);
 
 	return 0;
 }
@@ -1413,6 +1532,36 @@ void mloop_iterate(struct mloop* self)
 	mloop__break_out(self);
 }
 
+EXPORT
+void mloop_get_stats(const struct mloop* self, struct mloop_stats* stats)
+{
+	struct mloop__stats core;
+	mloop__stats_read(&core, &self->core->stats);
+
+	stats->n_iterations = core.n_iterations;
+	stats->busy_time = core.busy_time;
+	stats->n_callbacks = core.n_callbacks;
+	stats->callback_time = core.callback_time;
+	stats->max_callback_time = core.max_callback_time;
+	stats->n_pending_jobs =
+		mloop__stats_load(&self->core->async_jobs.index);
+
+	stats->n_workers = mloop__stats_load(&mloop__nthreads);
+	stats->n_busy_workers = mloop__stats_load(&mloop__n_busy_workers);
+	stats->n_queued_work = stats->n_workers > 0
+			     ? mloop__stats_load(&mloop__job_queue.index) : 0;
+	stats->n_work_done = 0;
+	stats->work_time = 0;
+
+	for (int i = 0; i < NTHREADS_MAX; ++i) {
+		struct mloop__work_stats work;
+		mloop__stats_read(&work, &mloop__work_stats[i]);
+
+		stats->n_work_done += work.n_work_done;
+		stats->work_time += work.work_time;
+	}
+}
+
 EXPORT
 void mloop_exit(struct mloop* self)
 {
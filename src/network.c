@@ -26,11 +26,13 @@
 #include "canopen/heartbeat.h"
 #include "canopen/network.h"
 #include "canopen/sdo.h"
+#include "canopen/lss.h"
 #include "net-util.h"
 #include "time-utils.h"
 #include "sock.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid)
 {
@@ -150,3 +152,229 @@ int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 
 	return co_net__wait_for_sdo(sock, nodes_seen, start, end, timeout);
 }
+
+static int co_net__count_missing(const char* nodes_seen, const char* expected,
+				 int start, int end)
+{
+	int n = 0;
+
+	for (int i = start; i <= end; ++i)
+		if (expected[i] && !nodes_seen[i])
+			++n;
+
+	return n;
+}
+
+int co_net__wait_for_nodes(const struct sock* sock, char* nodes_seen,
+			   const char* expected, int start, int end,
+			   int idle_timeout, int timeout)
+{
+	struct can_frame cf;
+	struct canopen_msg msg;
+
+	int n_missing = co_net__count_missing(nodes_seen, expected, start, end);
+
+	int t = gettime_ms(CLOCK_MONOTONIC);
+	int t_deadline = t + timeout;
+	int t_end = MIN(t + idle_timeout, t_deadline);
+
+	while (n_missing > 0
+	    && sock_timed_recv(sock, &cf, MAX(0, t_end - t)) > 0) {
+		t = gettime_ms(CLOCK_MONOTONIC);
+
+		if (cf.can_id & CAN_RTR_FLAG)
+			continue;
+
+		canopen_get_object_type(&msg, &cf);
+
+		if (!(start <= msg.id && msg.id <= end))
+			continue;
+
+		if (msg.object != CANOPEN_HEARTBEAT
+		 && msg.object != CANOPEN_TSDO)
+			continue;
+
+		if (!nodes_seen[msg.id] && expected[msg.id])
+			--n_missing;
+
+		nodes_seen[msg.id] = 1;
+		t_end = MIN(t + idle_timeout, t_deadline);
+	}
+
+	return n_missing;
+}
+
+int co_net_probe_parallel(const struct sock* sock, const char* nodes_seen,
+			  const char* expected, int start, int end)
+{
+	int n = 0;
+
+	for (int i = start; i <= end; ++i) {
+		if (nodes_seen[i] || !expected[i])
+			continue;
+
+		co_net__request_heartbeat(sock, i);
+		co_net__request_sdo(sock, i);
+		++n;
+	}
+
+	return n;
+}
+
+static int co_net__lss_send(const struct sock* sock, struct can_frame* cf)
+{
+	struct can_frame stale;
+
+	/* Several slaves may answer the same request, so any replies that
+	 * arrived after the one we waited for must not be mistaken for replies
+	 * to this request.
+	 */
+	while (sock_timed_recv(sock, &stale, 0) > 0)
+		;
+
+	return sock_send(sock, cf, 0);
+}
+
+static int co_net__lss_wait(const struct sock* sock, enum lss_cs cs,
+			    struct can_frame* reply, int timeout)
+{
+	struct can_frame cf;
+
+	int t = gettime_ms(CLOCK_MONOTONIC);
+	int t_end = t + timeout;
+
+	while (sock_timed_recv(sock, &cf, MAX(0, t_end - t)) > 0) {
+		t = gettime_ms(CLOCK_MONOTONIC);
+
+		if ((cf.can_id & CAN_SFF_MASK) != LSS_COB_SLAVE
+		 || (cf.can_id & CAN_RTR_FLAG))
+			continue;
+
+		if (lss_get_cs(&cf) != cs)
+			continue;
+
+		if (reply)
+			*reply = cf;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int co_net_lss_switch_global(const struct sock* sock, enum lss_mode mode)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_MASTER);
+	lss_set_cs(&cf, LSS_CS_SWITCH_GLOBAL);
+	cf.data[1] = mode;
+	return co_net__lss_send(sock, &cf);
+}
+
+int co_net_lss_configure_nodeid(const struct sock* sock, int nodeid,
+				int timeout)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_MASTER);
+	lss_set_cs(&cf, LSS_CS_CONFIGURE_NODEID);
+	cf.data[1] = nodeid;
+
+	if (co_net__lss_send(sock, &cf) < 0)
+		return -1;
+
+	if (!co_net__lss_wait(sock, LSS_CS_CONFIGURE_NODEID, &cf, timeout))
+		return -1;
+
+	return cf.data[1];
+}
+
+static int co_net__lss_fastscan_step(const struct sock* sock, uint32_t id,
+				     int bit_checked, int sub, int next,
+				     int timeout)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_MASTER);
+	lss_set_fastscan(&cf, id, bit_checked, sub, next);
+
+	if (co_net__lss_send(sock, &cf) < 0)
+		return -1;
+
+	return co_net__lss_wait(sock, LSS_CS_IDENTIFY_SLAVE, NULL, timeout);
+}
+
+int co_net_lss_fastscan(const struct sock* sock, struct lss_identity* id,
+			unsigned int known, int timeout)
+{
+	int rc = co_net__lss_fastscan_step(sock, 0, LSS_FASTSCAN_CONFIRM, 0, 0,
+					   timeout);
+	if (rc <= 0)
+		return rc;
+
+	for (int sub = 0; sub < 4; ++sub) {
+		uint32_t* value = lss_identity_at(id, sub);
+		int next = (sub + 1) % 4;
+
+		if (!(known & (1 << sub))) {
+			*value = 0;
+
+			/* A bit is set if no slave matches it being cleared */
+			for (int bit = 31; bit >= 0; --bit) {
+				rc = co_net__lss_fastscan_step(sock, *value,
+							       bit, sub, sub,
+							       timeout);
+				if (rc < 0)
+					return -1;
+
+				if (rc == 0)
+					*value |= 1U << bit;
+			}
+		}
+
+		rc = co_net__lss_fastscan_step(sock, *value, 0, sub, next,
+					       timeout);
+		if (rc <= 0)
+			return -1;
+	}
+
+	return 1;
+}
+
+int co_net_lss_commission(const struct sock* sock, char* nodes_seen,
+			  int start, int end, int timeout,
+			  co_net_lss_fn on_assigned, void* context)
+{
+	int n = 0;
+	int nodeid = start;
+
+	co_net_lss_switch_global(sock, LSS_MODE_WAITING);
+
+	while (1) {
+		while (nodeid <= end && nodes_seen[nodeid])
+			++nodeid;
+
+		if (nodeid > end)
+			break;
+
+		struct lss_identity id = { 0 };
+		if (co_net_lss_fastscan(sock, &id, 0, timeout) <= 0)
+			break;
+
+		int rc = co_net_lss_configure_nodeid(sock, nodeid, timeout);
+
+		/* The slave takes on its new node id and sends a bootup
+		 * message when it returns to the waiting state.
+		 */
+		co_net_lss_switch_global(sock, LSS_MODE_WAITING);
+
+		if (rc != 0)
+			break;
+
+		nodes_seen[nodeid] = 1;
+		++n;
+
+		if (on_assigned)
+			on_assigned(nodeid, &id, context);
+	}
+
+	return n;
+}
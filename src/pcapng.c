@@ -0,0 +1,338 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "socketcan.h"
+#include "pcapng.h"
+
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+#define PCAPNG_BLOCK_SIZE_MAX (1 << 24)
+#define PCAPNG_INTERFACES_MAX 256
+
+/* The SocketCAN pseudo header as Wireshark expects it: the id and flags are
+ * in network byte order.
+ */
+struct pcapng_can_frame {
+	uint32_t can_id;
+	uint8_t len;
+	uint8_t flags;
+	uint8_t reserved[2];
+	uint8_t data[8];
+};
+
+struct pcapng_epb {
+	uint32_t type;
+	uint32_t length;
+	uint32_t interface;
+	uint32_t timestamp_high;
+	uint32_t timestamp_low;
+	uint32_t captured_length;
+	uint32_t original_length;
+	struct pcapng_can_frame frame;
+	uint32_t trailing_length;
+};
+
+static inline size_t pcapng__pad(size_t size)
+{
+	return (size + 3) & ~(size_t)3;
+}
+
+int pcapng_writer_init(struct pcapng_writer* self, FILE* stream)
+{
+	self->stream = stream;
+
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint32_t byte_order_magic;
+		uint16_t major;
+		uint16_t minor;
+		int64_t section_length;
+		uint32_t trailing_length;
+	} shb = {
+		.type = PCAPNG_BLOCK_SHB,
+		.length = sizeof(shb),
+		.byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC,
+		.major = 1,
+		.minor = 0,
+		.section_length = -1,
+		.trailing_length = sizeof(shb),
+	};
+
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint16_t linktype;
+		uint16_t reserved;
+		uint32_t snaplen;
+		uint16_t tsresol_code;
+		uint16_t tsresol_length;
+		uint8_t tsresol[4];
+		uint16_t end_code;
+		uint16_t end_length;
+		uint32_t trailing_length;
+	} idb = {
+		.type = PCAPNG_BLOCK_IDB,
+		.length = sizeof(idb),
+		.linktype = PCAPNG_LINKTYPE_CAN_SOCKETCAN,
+		.snaplen = sizeof(struct pcapng_can_frame),
+		.tsresol_code = PCAPNG_OPT_IF_TSRESOL,
+		.tsresol_length = 1,
+		.tsresol = { 9 }, /* 10^-9 s */
+		.end_code = PCAPNG_OPT_ENDOFOPT,
+		.trailing_length = sizeof(idb),
+	};
+
+	if (fwrite(&shb, sizeof(shb), 1, stream) != 1
+	 || fwrite(&idb, sizeof(idb), 1, stream) != 1)
+		return -1;
+
+	return 0;
+}
+
+int pcapng_write_frame(struct pcapng_writer* self, uint64_t timestamp_ns,
+		       const struct can_frame* cf)
+{
+	struct pcapng_epb epb = {
+		.type = PCAPNG_BLOCK_EPB,
+		.length = sizeof(epb),
+		.interface = 0,
+		.timestamp_high = timestamp_ns >> 32,
+		.timestamp_low = timestamp_ns,
+		.captured_length = sizeof(epb.frame),
+		.original_length = sizeof(epb.frame),
+		.frame = {
+			.can_id = htonl(cf->can_id),
+			.len = cf->can_dlc,
+		},
+		.trailing_length = sizeof(epb),
+	};
+
+	memcpy(epb.frame.data, cf->data, sizeof(epb.frame.data));
+
+	return fwrite(&epb, sizeof(epb), 1, self->stream) == 1 ? 0 : -1;
+}
+
+int pcapng_is_pcapng(FILE* stream)
+{
+	uint32_t type = 0;
+	size_t n = fread(&type, sizeof(type), 1, stream);
+
+	rewind(stream);
+
+	return n == 1 && type == PCAPNG_BLOCK_SHB;
+}
+
+struct pcapng_interface {
+	int is_can;
+	uint64_t units_per_second;
+};
+
+struct pcapng_reader {
+	FILE* stream;
+	int swap;
+	uint8_t* block;
+	size_t n_interfaces;
+	struct pcapng_interface interfaces[PCAPNG_INTERFACES_MAX];
+};
+
+static inline uint16_t pcapng__u16(const struct pcapng_reader* self,
+				   const uint8_t* p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return self->swap ? __builtin_bswap16(value) : value;
+}
+
+static inline uint32_t pcapng__u32(const struct pcapng_reader* self,
+				   const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return self->swap ? __builtin_bswap32(value) : value;
+}
+
+static uint64_t pcapng__resolution(uint8_t tsresol)
+{
+	uint64_t units = 1;
+	int exponent = tsresol & 0x7f;
+
+	/* The most significant bit selects a power of 2 instead of 10 */
+	for (int i = 0; i < exponent && units < UINT64_MAX / 10; ++i)
+		units *= tsresol & 0x80 ? 2 : 10;
+
+	return units;
+}
+
+static void pcapng__read_idb(struct pcapng_reader* self, const uint8_t* body,
+			     size_t size)
+{
+	if (self->n_interfaces >= PCAPNG_INTERFACES_MAX || size < 8)
+		return;
+
+	struct pcapng_interface* interface =
+		&self->interfaces[self->n_interfaces++];
+
+	interface->is_can = pcapng__u16(self, body)
+			 == PCAPNG_LINKTYPE_CAN_SOCKETCAN;
+	interface->units_per_second = 1000000;
+
+	const uint8_t* p = body + 8;
+	const uint8_t* end = body + size;
+
+	while (end - p >= 4) {
+		uint16_t code = pcapng__u16(self, p);
+		uint16_t length = pcapng__u16(self, p + 2);
+		p += 4;
+
+		if (code == PCAPNG_OPT_ENDOFOPT || (size_t)(end - p) < length)
+			break;
+
+		if (code == PCAPNG_OPT_IF_TSRESOL && length == 1)
+			interface->units_per_second = pcapng__resolution(*p);
+
+		p += pcapng__pad(length);
+	}
+}
+
+static void pcapng__read_epb(struct pcapng_reader* self, const uint8_t* body,
+			     size_t size, pcapng_frame_fn fn, void* context)
+{
+	if (size < 20)
+		return;
+
+	uint32_t index = pcapng__u32(self, body);
+	if (index >= self->n_interfaces || !self->interfaces[index].is_can)
+		return;
+
+	uint64_t units = self->interfaces[index].units_per_second;
+	uint64_t timestamp = (uint64_t)pcapng__u32(self, body + 4) << 32
+			   | pcapng__u32(self, body + 8);
+	uint32_t captured_length = pcapng__u32(self, body + 12);
+
+	if (captured_length < 8 || captured_length > size - 20)
+		return;
+
+	struct pcapng_can_frame packet = { 0 };
+	memcpy(&packet, body + 20,
+	       captured_length < sizeof(packet) ? captured_length
+						: sizeof(packet));
+
+	struct tb_frame frame = {
+		.timestamp = units == 1000000 ? timestamp
+			   : timestamp / units * 1000000
+			   + timestamp % units * 1000000 / units,
+	};
+
+	frame.cf.can_id = ntohl(packet.can_id);
+	frame.cf.can_dlc = packet.len > 8 ? 8 : packet.len;
+	memcpy(frame.cf.data, packet.data, frame.cf.can_dlc);
+
+	fn(&frame, context);
+}
+
+static int pcapng__read_shb(struct pcapng_reader* self, const uint8_t* header)
+{
+	uint32_t magic;
+	memcpy(&magic, header + 8, sizeof(magic));
+
+	if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+		self->swap = 0;
+	else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+		self->swap = 1;
+	else
+		return -1;
+
+	/* Interface ids are local to a section */
+	self->n_interfaces = 0;
+	return 0;
+}
+
+int pcapng_read(FILE* stream, pcapng_frame_fn fn, void* context)
+{
+	struct pcapng_reader* self = calloc(1, sizeof(*self));
+	uint8_t header[12];
+	int rc = -1;
+
+	if (!self)
+		return -1;
+
+	self->stream = stream;
+	self->block = malloc(PCAPNG_BLOCK_SIZE_MAX);
+	if (!self->block)
+		goto done;
+
+	while (1) {
+		size_t n = fread(header, 1, 8, stream);
+		if (n == 0)
+			break;
+
+		if (n != 8)
+			goto done;
+
+		uint32_t type;
+		memcpy(&type, header, sizeof(type));
+
+		/* The byte order of the section is only known after reading
+		 * the byte order magic.
+		 */
+		if (type == PCAPNG_BLOCK_SHB) {
+			if (fread(header + 8, 1, 4, stream) != 4
+			 || pcapng__read_shb(self, header) < 0)
+				goto done;
+		}
+
+		uint32_t length = pcapng__u32(self, header + 4);
+		size_t header_size = type == PCAPNG_BLOCK_SHB ? 12 : 8;
+
+		if (length < header_size + 4 || length % 4 != 0
+		 || length > PCAPNG_BLOCK_SIZE_MAX)
+			goto done;
+
+		size_t body_size = length - header_size - 4;
+
+		if (fread(self->block, 1, length - header_size, stream)
+				!= length - header_size)
+			goto done;
+
+		switch (pcapng__u32(self, header)) {
+		case PCAPNG_BLOCK_IDB:
+			pcapng__read_idb(self, self->block, body_size);
+			break;
+		case PCAPNG_BLOCK_EPB:
+			pcapng__read_epb(self, self->block, body_size, fn,
+					 context);
+			break;
+		default:
+			break;
+		}
+	}
+
+	rc = ferror(stream) ? -1 : 0;
+
+done:
+	if (rc < 0 && !ferror(stream))
+		errno = EINVAL;
+
+	free(self->block);
+	free(self);
+	return rc;
+}
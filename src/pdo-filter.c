@@ -0,0 +1,195 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "pdo-filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+size_t strlcpy(char*, const char*, size_t);
+
+static int pdo_filter__parse_mask(struct pdo_filter* self, const char* hex)
+{
+	memset(self->mask, 0, sizeof(self->mask));
+
+	size_t len = strlen(hex);
+	if (len == 0 || len % 2 != 0 || len > 2 * sizeof(self->mask))
+		return -1;
+
+	for (size_t i = 0; i < len; i += 2) {
+		char byte[3] = { hex[i], hex[i + 1], '\0' };
+		if (!isxdigit(byte[0]) || !isxdigit(byte[1]))
+			return -1;
+
+		self->mask[i / 2] = strtoul(byte, NULL, 16);
+	}
+
+	return 0;
+}
+
+static int pdo_filter__parse_field(struct pdo_filter* self, const char* token)
+{
+	char* end;
+
+	if (self->n_fields >= PDO_FILTER_FIELDS_MAX)
+		return -1;
+
+	struct pdo_filter_field* field = &self->field[self->n_fields];
+
+	switch (*token++) {
+	case 'u': field->is_signed = 0; break;
+	case 's': field->is_signed = 1; break;
+	default: return -1;
+	}
+
+	errno = 0;
+
+	unsigned long bits = strtoul(token, &end, 10);
+	if (*end != '@' || bits == 0 || bits % 8 != 0 || bits > 64)
+		return -1;
+
+	unsigned long offset = strtoul(end + 1, &end, 10);
+	if (*end != ':' || offset > 8 || offset + bits / 8 > 8)
+		return -1;
+
+	field->deadband = strtoull(end + 1, &end, 0);
+	if (*end != '\0' || errno == ERANGE)
+		return -1;
+
+	field->offset = offset;
+	field->size = bits / 8;
+
+	self->n_fields++;
+	return 0;
+}
+
+static int pdo_filter__parse_token(struct pdo_filter* self, const char* token)
+{
+	if (strcmp(token, "changed") == 0)
+		return 0;
+
+	if (strncmp(token, "mask=", 5) == 0)
+		return pdo_filter__parse_mask(self, token + 5);
+
+	return pdo_filter__parse_field(self, token);
+}
+
+int pdo_filter_init(struct pdo_filter* self, const char* spec)
+{
+	char buffer[256];
+	char* state = NULL;
+
+	memset(self, 0, sizeof(*self));
+	memset(self->mask, 0xff, sizeof(self->mask));
+
+	if (!spec || !*spec)
+		return 0;
+
+	if (strlcpy(buffer, spec, sizeof(buffer)) >= sizeof(buffer))
+		goto failure;
+
+	for (char* token = strtok_r(buffer, " ,", &state); token;
+	     token = strtok_r(NULL, " ,", &state))
+		if (pdo_filter__parse_token(self, token) < 0)
+			goto failure;
+
+	for (unsigned int i = 0; i < self->n_fields; ++i) {
+		const struct pdo_filter_field* field = &self->field[i];
+		memset(&self->mask[field->offset], 0, field->size);
+	}
+
+	self->is_enabled = 1;
+	return 0;
+
+failure:
+	memset(self, 0, sizeof(*self));
+	return -1;
+}
+
+void pdo_filter_reset(struct pdo_filter* self)
+{
+	self->has_last = 0;
+	self->n_delivered = 0;
+	self->n_suppressed = 0;
+}
+
+static int64_t pdo_filter__decode(const struct pdo_filter_field* field,
+				  const uint8_t* data)
+{
+	uint64_t value = 0;
+
+	for (int i = field->size - 1; i >= 0; --i)
+		value = (value << 8) | data[field->offset + i];
+
+	if (field->is_signed && field->size < 8) {
+		int shift = 64 - 8 * field->size;
+		return (int64_t)(value << shift) >> shift;
+	}
+
+	return value;
+}
+
+static int pdo_filter__is_within_deadband(const struct pdo_filter_field* field,
+					  const uint8_t* a, const uint8_t* b)
+{
+	int64_t x = pdo_filter__decode(field, a);
+	int64_t y = pdo_filter__decode(field, b);
+
+	uint64_t diff;
+	if (field->is_signed)
+		diff = x > y ? (uint64_t)x - y : (uint64_t)y - x;
+	else
+		diff = (uint64_t)x > (uint64_t)y ? (uint64_t)x - y
+						 : (uint64_t)y - x;
+
+	return diff <= field->deadband;
+}
+
+int pdo_filter_check(struct pdo_filter* self, const void* data, size_t size)
+{
+	const uint8_t* bytes = data;
+
+	if (size > sizeof(self->last))
+		size = sizeof(self->last);
+
+	if (!self->has_last || size != self->last_size)
+		goto deliver;
+
+	for (size_t i = 0; i < size; ++i)
+		if ((bytes[i] ^ self->last[i]) & self->mask[i])
+			goto deliver;
+
+	for (unsigned int i = 0; i < self->n_fields; ++i) {
+		const struct pdo_filter_field* field = &self->field[i];
+
+		if (field->offset + field->size > size)
+			continue;
+
+		if (!pdo_filter__is_within_deadband(field, bytes, self->last))
+			goto deliver;
+	}
+
+	self->n_suppressed++;
+	return 0;
+
+deliver:
+	memcpy(self->last, bytes, size);
+	self->last_size = size;
+	self->has_last = 1;
+	self->n_delivered++;
+	return 1;
+}
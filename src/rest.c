@@ -23,20 +23,48 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <mloop.h>
+#include <pthread.h>
 #include <sys/queue.h>
 
 #include "net-util.h"
 #include "http.h"
 #include "vector.h"
 #include "rest.h"
-#include "stream.h"
+#include "time-utils.h"
+#include "co_atomic.h"
 
 #define REST_BACKLOG 16
+#define REST_PIPELINE_MAX 65536
+#define REST_READ_SIZE 4096
+
+/* Content of a streaming request is read ahead by up to REST_STREAM_WINDOW
+ * bytes while the service is working on what it has been given.
+ */
+#define REST_STREAM_WINDOW 65536
+
+/* Content that is not streamed is buffered whole before the service is called,
+ * so requests that announce more than this are refused.
+ */
+#define REST_CONTENT_MAX (1024 * 1024)
+
+/* Pipelined requests are not served while more than REST_OUTPUT_HIGH bytes of
+ * output are waiting to be sent, and a client is disconnected if more output
+ * is added while REST_OUTPUT_MAX bytes are waiting.
+ */
+#define REST_OUTPUT_HIGH 65536
+#define REST_OUTPUT_MAX (1024 * 1024)
 
 SLIST_HEAD(rest_service_list, rest_service);
 
 static struct rest_service_list rest_service_list_;
 
+static unsigned int rest_keepalive_timeout_ = 5000;
+static unsigned int rest_max_requests_ = 100;
+
+static int rest_is_threaded_ = 0;
+static struct mloop* rest_mloop_ = NULL;
+static pthread_t rest_thread_;
+
 int rest__service_is_match(const struct rest_service* service,
 			   const struct http_req* req)
 {
@@ -83,36 +111,114 @@ failure:
 	return -1;
 }
 
+/* Input is read straight into the spare capacity of the buffer */
 int rest__read(struct vector* buffer, int fd)
 {
-	errno = 0;
-	char input[256];
-	ssize_t size = read(fd, &input, sizeof(input));
-	if (size == 0)
-		return -1;
+	while (1) {
+		if (vector_reserve(buffer, buffer->index + REST_READ_SIZE) < 0)
+			return -1;
 
-	if (size < 0)
-		return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
+		errno = 0;
+		ssize_t size = read(fd, (char*)buffer->data + buffer->index,
+				    buffer->size - buffer->index);
+		if (size == 0)
+			return -1;
 
-	if (vector_append(buffer, input, size) < 0)
-		return -1;
+		if (size < 0)
+			return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
 
-	return rest__read(buffer, fd);
+		buffer->index += size;
+	}
 }
 
-int rest__read_head(struct vector* buffer, int fd)
+/* Same as rest__read() except that the buffer is never grown, so that pointers
+ * into it stay valid. Reading stops when the buffer is full.
+ */
+int rest__read_reserved(struct vector* buffer, int fd)
 {
-	int rc = rest__read(buffer, fd);
-	if (rc < 0)
-		return -1;
+	while (buffer->index < buffer->size) {
+		errno = 0;
+		ssize_t size = read(fd, (char*)buffer->data + buffer->index,
+				    buffer->size - buffer->index);
+		if (size == 0)
+			return -1;
 
-	vector_append(buffer, "", 1);
-	rc = !!strstr(buffer->data, "\r\n\r\n");
-	buffer->index--;
+		if (size < 0)
+			return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
 
-	return rc;
+		buffer->index += size;
+	}
+
+	return 0;
+}
+
+/* Remove a request that has been served from the front of the buffer, leaving
+ * whatever has been pipelined behind it.
+ */
+void rest__consume(struct vector* buffer, size_t size)
+{
+	if (size >= buffer->index) {
+		vector_clear(buffer);
+		return;
+	}
+
+	memmove(buffer->data, (char*)buffer->data + size, buffer->index - size);
+	buffer->index -= size;
+}
+
+/* Versions of mloop without MLOOP_HAVE_LIVE_SET_EVENT only apply the event
+ * mask when a socket is started, so the socket is restarted to change it.
+ */
+void rest__set_socket_event(struct mloop_socket* socket,
+			    enum mloop_socket_event events)
+{
+#ifdef MLOOP_HAVE_LIVE_SET_EVENT
+	mloop_socket_set_event(socket, events);
+#else
+	if (!mloop_socket_is_started(socket)) {
+		mloop_socket_set_event(socket, events);
+		return;
+	}
+
+	/* Stopping drops the loop's reference */
+	mloop_socket_ref(socket);
+	mloop_socket_stop(socket);
+	mloop_socket_set_event(socket, events);
+	mloop_socket_start(socket);
+	mloop_socket_unref(socket);
+#endif
+}
+
+static inline int rest__is_on_rest_thread(void)
+{
+	return !rest_is_threaded_ || pthread_equal(pthread_self(), rest_thread_);
 }
 
+static inline struct mloop* rest__mloop(void)
+{
+	return rest_is_threaded_ ? rest_mloop_ : mloop_default();
+}
+
+/* Services on other threads look at the state, so it is stored atomically */
+static inline void rest__set_state(struct rest_client* client,
+				   enum rest_client_state state)
+{
+	co_atomic_store(&client->state, state);
+}
+
+static ssize_t rest__output_write(void* cookie, const char* buf, size_t size);
+
+static int rest__output_close(void* cookie)
+{
+	(void)cookie;
+	return 0;
+}
+
+static cookie_io_functions_t rest__output_funcs_ = {
+	.write = rest__output_write,
+	.close = rest__output_close,
+};
+
 static struct rest_client* rest_client_new()
 {
 	struct rest_client* self = malloc(sizeof(*self));
@@ -124,11 +230,30 @@ static struct rest_client* rest_client_new()
 	self->ref = 1;
 
 	if (vector_init(&self->buffer, 256) < 0)
-		goto failure;
+		goto buffer_failure;
+
+	if (vector_init(&self->output_buffer, 256) < 0)
+		goto output_buffer_failure;
+
+	if (vector_init(&self->content_chunk, 256) < 0)
+		goto content_chunk_failure;
+
+	pthread_mutex_init(&self->output_lock, NULL);
+
+	self->output = fopencookie(self, "w", rest__output_funcs_);
+	if (!self->output)
+		goto output_failure;
 
 	return self;
 
-failure:
+output_failure:
+	pthread_mutex_destroy(&self->output_lock);
+	vector_destroy(&self->content_chunk);
+content_chunk_failure:
+	vector_destroy(&self->output_buffer);
+output_buffer_failure:
+	vector_destroy(&self->buffer);
+buffer_failure:
 	free(self);
 	return NULL;
 }
@@ -136,26 +261,190 @@ failure:
 void rest_client_free(struct rest_client* self)
 {
 	if (!self) return;
+
+	/* Anything still buffered in the stream is discarded by fclose() */
+	rest__set_state(self, REST_CLIENT_DISCONNECTED);
+	fclose(self->output);
+
+	pthread_mutex_destroy(&self->output_lock);
+	vector_destroy(&self->content_chunk);
+	vector_destroy(&self->output_buffer);
 	vector_destroy(&self->buffer);
-	if (self->state > REST_CLIENT_START)
-		http_req_free(&self->req);
 	free(self);
 }
 
 void rest_client_ref(struct rest_client* self)
 {
-	++self->ref;
+	co_atomic_add_fetch(&self->ref, 1);
 }
 
 int rest_client_unref(struct rest_client* self)
 {
-	int ref = --self->ref;
+	int ref = co_atomic_sub_fetch(&self->ref, 1);
 	if (ref == 0)
 		rest_client_free(self);
 
 	return ref;
 }
 
+static void rest__unref_client(void* ptr)
+{
+	rest_client_unref(ptr);
+}
+
+/* Run fn on the given main loop with a reference to the client.
+ */
+static int rest__post(struct mloop* mloop, struct rest_client* client,
+		      mloop_async_fn fn)
+{
+	struct mloop_async* async = mloop_async_new(mloop);
+	if (!async)
+		return -1;
+
+	rest_client_ref(client);
+	mloop_async_set_context(async, client, rest__unref_client);
+	mloop_async_set_callback(async, fn);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+	return rc;
+}
+
+static void rest__process(struct rest_client* client);
+
+/* Content that has been streamed to the service is no longer in the buffer */
+static inline size_t rest__request_length(const struct rest_client* client)
+{
+	return client->req.header_length + client->req.content_length
+	     - client->content_read;
+}
+
+static inline int rest__have_full_content(struct rest_client* client)
+{
+	return client->buffer.index >= rest__request_length(client);
+}
+
+static void rest__update_events(struct rest_client* client)
+{
+	if (!client->socket)
+		return;
+
+	enum mloop_socket_event events = MLOOP_SOCKET_EVENT_NONE;
+
+	switch (client->state) {
+	case REST_CLIENT_SERVICING:
+		/* The service may still be using the input buffer, but streamed
+		 * content is read into space that was reserved for it.
+		 */
+		if (client->is_streaming && !rest__have_full_content(client)
+		 && client->buffer.index < client->buffer.size)
+			events |= MLOOP_SOCKET_EVENT_IN;
+		break;
+	case REST_CLIENT_START:
+		if (client->output_pending < REST_OUTPUT_HIGH)
+			events |= MLOOP_SOCKET_EVENT_IN;
+		break;
+	default:
+		events |= MLOOP_SOCKET_EVENT_IN;
+		break;
+	}
+
+	if (client->output_pending > 0)
+		events |= MLOOP_SOCKET_EVENT_OUT;
+
+	if ((int)events == client->events)
+		return;
+
+	client->events = events;
+	rest__set_socket_event(client->socket, events);
+}
+
+/* Send as much of the pending output as the socket will take without blocking.
+ * The rest is sent when the socket becomes writable. This must be called on
+ * the REST thread by someone who holds a reference to the client.
+ */
+static void rest__send_output(struct rest_client* client)
+{
+	if (!client->socket)
+		return;
+
+	int fd = mloop_socket_get_fd(client->socket);
+	struct vector* output = &client->output_buffer;
+
+	pthread_mutex_lock(&client->output_lock);
+
+	while (output->index > 0 && !client->is_output_broken) {
+		ssize_t size = send(fd, output->data, output->index,
+				    MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				client->is_output_broken = 1;
+
+			break;
+		}
+
+		rest__consume(output, size);
+		client->last_active = gettime_ms(CLOCK_MONOTONIC);
+	}
+
+	int is_broken = client->is_output_broken;
+	co_atomic_store(&client->output_pending, output->index);
+
+	pthread_mutex_unlock(&client->output_lock);
+
+	if (is_broken) {
+		mloop_socket_stop(client->socket);
+		return;
+	}
+
+	if (client->output_pending == 0 && !client->is_shut_down
+	 && client->state == REST_CLIENT_CLOSING) {
+		shutdown(fd, SHUT_WR);
+		client->is_shut_down = 1;
+	}
+
+	rest__update_events(client);
+
+	/* Pipelined requests are held back while the client is not reading */
+	if (client->state == REST_CLIENT_START && !client->is_processing
+	 && client->output_pending < REST_OUTPUT_HIGH)
+		rest__process(client);
+}
+
+static void rest__on_output(struct mloop_async* async)
+{
+	rest__send_output(mloop_async_get_context(async));
+}
+
+static ssize_t rest__output_write(void* cookie, const char* buf, size_t size)
+{
+	struct rest_client* client = cookie;
+
+	if (rest_client_is_disconnected(client))
+		return size;
+
+	pthread_mutex_lock(&client->output_lock);
+
+	/* A client that leaves this much unread is not keeping up, so it is
+	 * disconnected rather than buffering without bounds.
+	 */
+	if (client->output_buffer.index > REST_OUTPUT_MAX
+	 || vector_append(&client->output_buffer, buf, size) < 0)
+		client->is_output_broken = 1;
+
+	pthread_mutex_unlock(&client->output_lock);
+
+	if (rest__is_on_rest_thread())
+		rest__send_output(client);
+	else
+		rest__post(rest_mloop_, client, rest__on_output);
+
+	return size;
+}
+
 static inline void rest__print_status_code(FILE* output, const char* status)
 {
 	fprintf(output, "HTTP/1.1 %s\r\n", status);
@@ -176,9 +465,9 @@ static inline void rest__print_content_length(FILE* output, size_t length)
 	fprintf(output, "Content-Length: %zu\r\n", length);
 }
 
-static inline void rest__print_connection_type(FILE* output)
+static inline void rest__print_connection_type(FILE* output, int is_last)
 {
-	fprintf(output, "Connection: close\r\n");
+	fprintf(output, "Connection: %s\r\n", is_last ? "close" : "keep-alive");
 }
 
 static inline void rest__print_allow_origin(FILE* output)
@@ -196,30 +485,76 @@ static inline void rest__print_chunked_transfer_encoding(FILE* output)
 	fprintf(output, "Transfer-Encoding: chunked\r\n");
 }
 
-void rest_reply_header(FILE* output, struct rest_reply_data* data)
+static inline void rest__print_optional(FILE* output, const char* name,
+					const char* value)
+{
+	if (value)
+		fprintf(output, "%s: %s\r\n", name, value);
+}
+
+/* The connection is also closed after a streaming request whose content the
+ * service did not read to the end.
+ */
+static int rest__is_last_response(const struct rest_client* client)
+{
+	return co_atomic_load(&client->is_last_request)
+	    || (client->is_streaming
+		&& co_atomic_load(&client->content_read)
+		   < client->req.content_length);
+}
+
+static void rest__print_header(struct rest_client* client,
+			       struct rest_reply_data* data)
 {
+	FILE* output = client->output;
+
 	rest__print_status_code(output, data->status_code);
 
 	rest__print_server(output);
-	rest__print_connection_type(output);
-	rest__print_content_type(output, data->content_type);
+	rest__print_connection_type(output, rest__is_last_response(client));
+	if (data->content_type)
+		rest__print_content_type(output, data->content_type);
 
 	if (data->content_length >= 0)
 		rest__print_content_length(output, data->content_length);
-	else
+	else if (data->content_length != REST_NO_CONTENT_LENGTH)
 		rest__print_chunked_transfer_encoding(output);
 
+	rest__print_optional(output, "Content-Encoding", data->content_encoding);
+	rest__print_optional(output, "ETag", data->etag);
+	rest__print_optional(output, "Cache-Control", data->cache_control);
+	rest__print_optional(output, "Vary", data->vary);
+
 	rest__print_allow_origin(output);
 	rest__print_allow_methods(output);
 	fprintf(output, "\r\n");
-	fflush(output);
 }
 
-void rest_reply(FILE* output, struct rest_reply_data* data)
+void rest_reply_header(struct rest_client* client,
+		       struct rest_reply_data* data)
+{
+	rest__print_header(client, data);
+	fflush(client->output);
+}
+
+void rest_reply_chunk(struct rest_client* client, const void* data,
+		      size_t size)
+{
+	fprintf(client->output, "%zx\r\n", size);
+	fwrite(data, 1, size, client->output);
+	fprintf(client->output, "\r\n");
+	fflush(client->output);
+}
+
+/* The header and the content are flushed together so that small responses go
+ * out in a single segment.
+ */
+void rest_reply(struct rest_client* client, struct rest_reply_data* data)
 {
-	rest_reply_header(output, data);
-	fwrite(data->content, 1, data->content_length, output);
-	fflush(output);
+	rest__print_header(client, data);
+	if (data->content_length > 0)
+		fwrite(data->content, 1, data->content_length, client->output);
+	fflush(client->output);
 }
 
 void rest__not_found(struct rest_client* client)
@@ -233,9 +568,9 @@ void rest__not_found(struct rest_client* client)
 		.content_length = strlen(content),
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
 void rest__print_index(struct rest_client* client)
@@ -249,9 +584,9 @@ void rest__print_index(struct rest_client* client)
 		.content_length = strlen(content),
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
 void rest__print_options(struct rest_client* client,
@@ -262,7 +597,8 @@ void rest__print_options(struct rest_client* client,
 
 	rest__print_status_code(client->output, "200 OK");
 	rest__print_server(output);
-	rest__print_connection_type(output);
+	rest__print_connection_type(output,
+				    co_atomic_load(&client->is_last_request));
 	rest__print_content_length(output, 0);
 	rest__print_allow_origin(output);
 	rest__print_allow_methods(output);
@@ -274,36 +610,42 @@ void rest__print_options(struct rest_client* client,
 	fprintf(client->output, "\r\n");
 	fflush(client->output);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
-static inline int rest__have_full_content(struct rest_client* client)
+/* The number of received bytes that belong to requests which have not been
+ * parsed yet.
+ */
+static size_t rest__pending_size(const struct rest_client* client)
 {
-	size_t full_length = client->req.header_length
-			   + client->req.content_length;
+	size_t used = client->state == REST_CLIENT_START
+		    ? 0 : rest__request_length(client);
 
-	return client->buffer.index >= full_length;
+	return client->buffer.index > used ? client->buffer.index - used : 0;
 }
 
-void rest__process_content(struct rest_client* client)
-{
-	size_t full_length = client->req.header_length
-			   + client->req.content_length;
+static void rest__request_done(struct rest_client* client);
 
-	if (!rest__have_full_content(client))
-		return;
+static void rest__reject(struct rest_client* client, const char* status_code,
+			 const char* content)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = "text/plain",
+		.content = content,
+		.content_length = strlen(content),
+	};
 
-	const struct rest_service* service = rest__find_service(&client->req);
-	if (!service) {
-		rest__not_found(client);
-		return;
-	}
+	co_atomic_store(&client->is_last_request, 1);
+	rest_reply(client, &reply);
 
-	const void* content = (char*)client->buffer.data
-			    + client->req.header_length;
+	rest__request_done(client);
+}
 
-	client->state = REST_CLIENT_SERVICING;
-	service->fn(client, content);
+void rest__bad_request(struct rest_client* client)
+{
+	rest__reject(client, "400 Bad Request",
+		     "The request could not be parsed.\r\n");
 }
 
 void rest__handle_get(struct rest_client* client)
@@ -319,10 +661,23 @@ void rest__handle_get(struct rest_client* client)
 		return;
 	}
 
-	client->state = REST_CLIENT_SERVICING;
 	service->fn(client, NULL);
 }
 
+void rest__handle_put(struct rest_client* client)
+{
+	const struct rest_service* service = rest__find_service(&client->req);
+	if (!service) {
+		rest__not_found(client);
+		return;
+	}
+
+	const void* content = client->is_streaming ? NULL
+			    : (char*)client->buffer.data + client->req.header_length;
+
+	service->fn(client, content);
+}
+
 void rest__handle_options(struct rest_client* client)
 {
 	if (client->req.url_index == 0) {
@@ -344,26 +699,57 @@ void rest__handle_options(struct rest_client* client)
 	rest__print_options(client, service);
 }
 
-void rest__handle_header(int fd, struct rest_client* client,
-			 struct mloop_socket* socket)
+static int rest__begin_request(struct rest_client* client)
 {
-	int rc = rest__read_head(&client->buffer, fd);
-	if (rc < 0)
-		mloop_socket_stop(socket);
+	switch (http_parser_feed(&client->parser, &client->req,
+				 client->buffer.data, client->buffer.index)) {
+	case HTTP_PARSE_INCOMPLETE:
+		return 0;
+	case HTTP_PARSE_DONE:
+		break;
+	case HTTP_PARSE_TOO_LARGE:
+		rest__set_state(client, REST_CLIENT_CONTENT);
+		rest__reject(client, "431 Request Header Fields Too Large",
+			     "The request head is too large.\r\n");
+		return 1;
+	case HTTP_PARSE_ERROR:
+		rest__set_state(client, REST_CLIENT_CONTENT);
+		rest__bad_request(client);
+		return 1;
+	}
 
-	if (rc <= 0)
-		return;
+	rest__set_state(client, REST_CLIENT_CONTENT);
 
-	if (http_req_parse(&client->req, client->buffer.data) < 0)
-		mloop_socket_stop(socket);
+	++client->n_requests;
+
+	co_atomic_store(&client->is_last_request,
+			client->req.has_connection_close
+			|| (rest_max_requests_
+			    && client->n_requests >= rest_max_requests_));
+
+	return 1;
+}
+
+/* The buffer may have been moved while the content was being received, so
+ * the request is pointed at it again.
+ */
+static void rest__rebase_request(struct rest_client* client)
+{
+	http_parser_feed(&client->parser, &client->req, client->buffer.data,
+			 client->buffer.index);
+}
 
+/* Services are always called on the default main loop, also when the REST
+ * server runs on its own thread.
+ */
+static void rest__route(struct rest_client* client)
+{
 	switch (client->req.method) {
 	case HTTP_GET:
 		rest__handle_get(client);
 		break;
 	case HTTP_PUT:
-		client->state = REST_CLIENT_CONTENT;
-		rest__process_content(client);
+		rest__handle_put(client);
 		break;
 	case HTTP_OPTIONS:
 		rest__handle_options(client);
@@ -371,20 +757,264 @@ void rest__handle_header(int fd, struct rest_client* client,
 	}
 }
 
-void rest__handle_content(int fd, struct rest_client* client,
-			  struct mloop_socket* socket)
+static void rest__on_route(struct mloop_async* async)
 {
-	int rc = rest__read(&client->buffer, fd);
-	if (rc < 0) {
-		mloop_socket_stop(socket);
+	struct rest_client* client = mloop_async_get_context(async);
+
+	if (!rest_client_is_disconnected(client))
+		rest__route(client);
+}
+
+static void rest__dispatch(struct rest_client* client)
+{
+	rest__set_state(client, REST_CLIENT_SERVICING);
+
+	if (!rest_is_threaded_) {
+		rest__route(client);
+		return;
+	}
+
+	if (rest__post(mloop_default(), client, rest__on_route) < 0) {
+		co_atomic_store(&client->is_last_request, 1);
+		rest__request_done(client);
+	}
+}
+
+static int rest__is_octet_stream(const char* type)
+{
+	static const char name[] = "application/octet-stream";
+	size_t len = sizeof(name) - 1;
+
+	return type && strncasecmp(type, name, len) == 0
+	    && (type[len] == '\0' || type[len] == ';' || type[len] == ' ');
+}
+
+static int rest__is_streaming_request(const struct rest_client* client)
+{
+	const struct http_req* req = &client->req;
+
+	if (req->method != HTTP_PUT || req->content_length == 0
+	 || !rest__is_octet_stream(req->content_type))
+		return 0;
+
+	const struct rest_service* service = rest__find_service(req);
+	return service && service->is_streaming;
+}
+
+/* The service is called before the content has arrived. The head must stay
+ * where it is while the service runs, so the space that content is read into
+ * is reserved up front.
+ */
+static void rest__begin_streaming(struct rest_client* client)
+{
+	size_t size = client->req.header_length + REST_STREAM_WINDOW;
+
+	if (vector_reserve(&client->buffer, size) < 0) {
+		rest__reject(client, "500 Internal Server Error",
+			     "Out of memory.\r\n");
+		return;
+	}
+
+	rest__rebase_request(client);
+	client->is_streaming = 1;
+	rest__dispatch(client);
+}
+
+static void rest__on_content(struct mloop_async* async)
+{
+	struct rest_client* client = mloop_async_get_context(async);
+
+	if (rest_client_is_disconnected(client))
+		client->read_fn(client->read_context, NULL, 0);
+	else
+		client->read_fn(client->read_context,
+				client->content_chunk.data,
+				client->content_chunk.index);
+}
+
+/* Hand the next piece of content over to the service if a read is pending and
+ * something has arrived. Content is taken from right behind the head and the
+ * rest is moved down, so that the head stays in place.
+ */
+static void rest__continue_read(struct rest_client* client)
+{
+	if (!client->is_reading)
+		return;
+
+	char* content = (char*)client->buffer.data + client->req.header_length;
+	size_t buffered = client->buffer.index - client->req.header_length;
+	size_t remaining = client->req.content_length - client->content_read;
+
+	size_t size = buffered < remaining ? buffered : remaining;
+	if (size > REST_STREAM_CHUNK)
+		size = REST_STREAM_CHUNK;
+
+	if (size == 0 && remaining > 0)
+		return;
+
+	if (vector_assign(&client->content_chunk, content, size) < 0)
+		goto failure;
+
+	memmove(content, content + size, buffered - size);
+	client->buffer.index -= size;
+	co_atomic_store(&client->content_read, client->content_read + size);
+	client->is_reading = 0;
+
+	if (rest__post(mloop_default(), client, rest__on_content) < 0)
+		goto failure;
+
+	return;
+
+failure:
+	mloop_socket_stop(client->socket);
+}
+
+static void rest__on_read(struct mloop_async* async)
+{
+	struct rest_client* client = mloop_async_get_context(async);
+
+	if (client->state == REST_CLIENT_DISCONNECTED) {
+		rest__post(mloop_default(), client, rest__on_content);
+		return;
+	}
+
+	client->is_reading = 1;
+	rest__continue_read(client);
+	rest__update_events(client);
+}
+
+void rest_client_read(struct rest_client* self, rest_read_fn fn,
+		      void* context)
+{
+	self->read_fn = fn;
+	self->read_context = context;
+	rest__post(rest__mloop(), self, rest__on_read);
+}
+
+/* Send FIN once all output has been sent but keep reading until the peer
+ * closes its end. Closing the socket while pipelined requests are still unread
+ * would make the kernel send a reset which may discard the last response
+ * before the client has read it.
+ */
+static void rest__close(struct rest_client* client)
+{
+	vector_clear(&client->buffer);
+	rest__set_state(client, REST_CLIENT_CLOSING);
+	rest__send_output(client);
+}
+
+static void rest__finish_request(struct rest_client* client)
+{
+	size_t length = rest__request_length(client);
+
+	/* The rest of the content may not even have arrived yet */
+	if (client->content_read < client->req.content_length
+	 && client->is_streaming)
+		co_atomic_store(&client->is_last_request, 1);
+
+	client->is_streaming = 0;
+	client->is_reading = 0;
+	co_atomic_store(&client->content_read, 0);
+
+	http_parser_init(&client->parser);
+	memset(&client->req, 0, sizeof(client->req));
+
+	if (client->is_last_request) {
+		rest__close(client);
 		return;
 	}
 
-	rest__process_content(client);
+	rest__consume(&client->buffer, length);
+	rest__set_state(client, REST_CLIENT_START);
+	client->last_active = gettime_ms(CLOCK_MONOTONIC);
 }
 
-void rest__handle_junk(int fd, struct rest_client* client,
-		       struct mloop_socket* socket)
+/* Serve requests from the buffer in order until one of them has to wait for
+ * more input, for output to drain or for a service to finish.
+ */
+static void rest__process(struct rest_client* client)
+{
+	rest_client_ref(client);
+	client->is_processing = 1;
+
+	while (1) {
+		switch (client->state) {
+		case REST_CLIENT_START:
+			if (client->output_pending >= REST_OUTPUT_HIGH)
+				goto done;
+			if (!rest__begin_request(client))
+				goto done;
+			break;
+		case REST_CLIENT_CONTENT:
+			if (rest__is_streaming_request(client)) {
+				rest__begin_streaming(client);
+				break;
+			}
+			if (client->req.content_length > REST_CONTENT_MAX) {
+				rest__reject(client, "413 Payload Too Large",
+					     "The content is too large.\r\n");
+				break;
+			}
+			if (!rest__have_full_content(client))
+				goto done;
+			rest__rebase_request(client);
+			rest__dispatch(client);
+			break;
+		case REST_CLIENT_DONE:
+			rest__finish_request(client);
+			break;
+		default:
+			goto done;
+		}
+	}
+
+done:
+	client->is_processing = 0;
+	rest__update_events(client);
+	rest_client_unref(client);
+}
+
+static void rest__request_done(struct rest_client* client)
+{
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		return;
+
+	rest__set_state(client, REST_CLIENT_DONE);
+
+	if (!client->is_processing)
+		rest__process(client);
+}
+
+static void rest__on_request_done(struct mloop_async* async)
+{
+	rest__request_done(mloop_async_get_context(async));
+}
+
+void rest_client_done(struct rest_client* self)
+{
+	if (rest__is_on_rest_thread())
+		rest__request_done(self);
+	else
+		rest__post(rest_mloop_, self, rest__on_request_done);
+}
+
+void rest_client_abort(struct rest_client* self)
+{
+	co_atomic_store(&self->is_last_request, 1);
+	rest_client_done(self);
+}
+
+int rest_client_is_congested(const struct rest_client* self)
+{
+	return co_atomic_load(&self->output_pending) >= REST_OUTPUT_HIGH;
+}
+
+int rest_client_is_disconnected(const struct rest_client* self)
+{
+	return co_atomic_load(&self->state) == REST_CLIENT_DISCONNECTED;
+}
+
+void rest__handle_junk(int fd, struct mloop_socket* socket)
 {
 	char junk[256];
 	ssize_t size;
@@ -397,37 +1027,132 @@ void rest__handle_junk(int fd, struct rest_client* client,
 		mloop_socket_stop(socket);
 }
 
+static void rest__handle_input(struct rest_client* client, int fd)
+{
+	if (client->state == REST_CLIENT_CLOSING) {
+		rest__handle_junk(fd, client->socket);
+		return;
+	}
+
+	client->last_active = gettime_ms(CLOCK_MONOTONIC);
+
+	if (rest__read(&client->buffer, fd) < 0) {
+		mloop_socket_stop(client->socket);
+		return;
+	}
+
+	/* Heads are parsed first, so that content which arrived along with its
+	 * head is counted as part of the request, and content that is too large
+	 * is refused before it is buffered.
+	 */
+	rest__process(client);
+
+	if (rest__pending_size(client) > REST_PIPELINE_MAX)
+		mloop_socket_stop(client->socket);
+}
+
+static void rest__handle_content(struct rest_client* client, int fd)
+{
+	client->last_active = gettime_ms(CLOCK_MONOTONIC);
+
+	if (rest__read_reserved(&client->buffer, fd) < 0) {
+		mloop_socket_stop(client->socket);
+		return;
+	}
+
+	rest__continue_read(client);
+	rest__update_events(client);
+}
+
 static void rest__on_client_data(struct mloop_socket* socket)
 {
 	struct rest_client* client = mloop_socket_get_context(socket);
 	int fd = mloop_socket_get_fd(socket);
+	enum mloop_socket_event events = mloop_socket_get_event(socket);
 
-	switch (client->state) {
-	case REST_CLIENT_START:
-		rest__handle_header(fd, client, socket);
-		break;
-	case REST_CLIENT_CONTENT:
-		rest__handle_content(fd, client, socket);
-		break;
-	case REST_CLIENT_SERVICING:
-		rest__handle_junk(fd, client, socket);
-		break;
-	case REST_CLIENT_DONE:
-		mloop_socket_stop(socket);
-		break;
-	default:
-		abort();
+	rest_client_ref(client);
+
+	if (events & MLOOP_SOCKET_EVENT_OUT)
+		rest__send_output(client);
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		goto done;
+
+	if (client->state == REST_CLIENT_SERVICING) {
+		/* Only streamed content is read while servicing */
+		if (events & (MLOOP_SOCKET_EVENT_HUP | MLOOP_SOCKET_EVENT_ERR))
+			mloop_socket_stop(socket);
+		else if (client->is_streaming
+		      && (events & MLOOP_SOCKET_EVENT_IN))
+			rest__handle_content(client, fd);
+		goto done;
 	}
+
+	if (events & (MLOOP_SOCKET_EVENT_IN | MLOOP_SOCKET_EVENT_HUP
+		      | MLOOP_SOCKET_EVENT_ERR))
+		rest__handle_input(client, fd);
+
+done:
+	rest_client_unref(client);
+}
+
+static void rest__on_idle_check(struct mloop_timer* timer)
+{
+	struct rest_client* client = mloop_timer_get_context(timer);
+
+	if (client->state == REST_CLIENT_SERVICING)
+		return;
+
+	uint64_t idle = gettime_ms(CLOCK_MONOTONIC) - client->last_active;
+	if (idle >= rest_keepalive_timeout_)
+		mloop_socket_stop(client->socket);
 }
 
 static void rest__on_socket_free(void* ptr)
 {
 	struct rest_client* client = ptr;
-	client->state = REST_CLIENT_DISCONNECTED;
-	fclose(client->output);
+	rest__set_state(client, REST_CLIENT_DISCONNECTED);
+	client->socket = NULL;
+
+	/* The service is told that the rest of the content is not coming */
+	if (client->is_reading) {
+		client->is_reading = 0;
+		rest__post(mloop_default(), client, rest__on_content);
+	}
+
+	if (client->idle_timer) {
+		mloop_timer_stop(client->idle_timer);
+		mloop_timer_unref(client->idle_timer);
+		client->idle_timer = NULL;
+	}
+
 	rest_client_unref(client);
 }
 
+static struct mloop_timer* rest__new_idle_timer(struct rest_client* client)
+{
+	struct mloop_timer* timer = mloop_timer_new(rest__mloop());
+	if (!timer)
+		return NULL;
+
+	/* The timer only checks how long the connection has been idle, so that
+	 * it need not be re-armed for every request.
+	 */
+	uint64_t period = rest_keepalive_timeout_ / 4 + 1;
+
+	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(timer, period * 1000000ULL);
+	mloop_timer_set_context(timer, client, NULL);
+	mloop_timer_set_callback(timer, rest__on_idle_check);
+
+	if (mloop_timer_start(timer) < 0) {
+		mloop_timer_unref(timer);
+		return NULL;
+	}
+
+	return timer;
+}
+
 static void rest__on_connection(struct mloop_socket* socket)
 {
 	int sfd = mloop_socket_get_fd(socket);
@@ -439,7 +1164,7 @@ static void rest__on_connection(struct mloop_socket* socket)
 	net_dont_block(cfd);
 	net_dont_delay(cfd);
 
-	struct mloop_socket* client = mloop_socket_new(mloop_default());
+	struct mloop_socket* client = mloop_socket_new(rest__mloop());
 	if (!client)
 		goto socket_failure;
 
@@ -447,15 +1172,18 @@ static void rest__on_connection(struct mloop_socket* socket)
 	if (!state)
 		goto state_failure;
 
-	int nfd = dup(cfd);
-	if (nfd < 0)
-		goto nfd_failure;
+	if (rest_keepalive_timeout_ > 0) {
+		state->idle_timer = rest__new_idle_timer(state);
+		if (!state->idle_timer)
+			goto timer_failure;
+	}
 
-	state->output = stream_open(nfd, "w");
-	if (!state->output)
-		goto fdopen_failure;
+	state->socket = client;
+	state->events = MLOOP_SOCKET_EVENT_IN;
+	state->last_active = gettime_ms(CLOCK_MONOTONIC);
 
 	mloop_socket_set_fd(client, cfd);
+	mloop_socket_set_event(client, state->events);
 	mloop_socket_set_callback(client, rest__on_client_data);
 	mloop_socket_set_context(client, state, rest__on_socket_free);
 	mloop_socket_start(client);
@@ -463,17 +1191,27 @@ static void rest__on_connection(struct mloop_socket* socket)
 	mloop_socket_unref(client);
 	return;
 
-fdopen_failure:
-	close(nfd);
-nfd_failure:
-	free(state);
+timer_failure:
+	rest_client_unref(state);
 state_failure:
 	mloop_socket_unref(client);
 socket_failure:
 	close(cfd);
 }
 
-int rest_register_service(enum http_method method, const char* path, rest_fn fn)
+void rest_set_keepalive(unsigned int timeout, unsigned int max_requests)
+{
+	rest_keepalive_timeout_ = timeout;
+	rest_max_requests_ = max_requests;
+}
+
+struct mloop* rest_get_mloop(void)
+{
+	return rest__mloop();
+}
+
+static int rest__register_service(enum http_method method, const char* path,
+				  rest_fn fn, int is_streaming)
 {
 	struct rest_service *service = malloc(sizeof(*service));
 	if (!service)
@@ -482,12 +1220,24 @@ int rest_register_service(enum http_method method, const char* path, rest_fn fn)
 	service->method = method | HTTP_OPTIONS;
 	service->path = path;
 	service->fn = fn;
+	service->is_streaming = is_streaming;
 
 	SLIST_INSERT_HEAD(&rest_service_list_, service, links);
 
 	return 0;
 }
 
+int rest_register_service(enum http_method method, const char* path, rest_fn fn)
+{
+	return rest__register_service(method, path, fn, 0);
+}
+
+int rest_register_streaming_service(enum http_method method, const char* path,
+				    rest_fn fn)
+{
+	return rest__register_service(method, path, fn, 1);
+}
+
 void rest__init_service_list(void)
 {
 	SLIST_INIT(&rest_service_list_);
@@ -495,7 +1245,7 @@ void rest__init_service_list(void)
 
 int rest_init(int port)
 {
-	struct mloop* mloop = mloop_default();
+	struct mloop* mloop = rest__mloop();
 
 	rest__init_service_list();
 
@@ -522,12 +1272,48 @@ socket_failure:
 	return -1;
 }
 
+static void* rest__run(void* arg)
+{
+	mloop_run(arg);
+	return NULL;
+}
+
+int rest_init_threaded(int port)
+{
+	rest_mloop_ = mloop_new();
+	if (!rest_mloop_)
+		return -1;
+
+	rest_is_threaded_ = 1;
+
+	if (rest_init(port) < 0)
+		goto failure;
+
+	if (pthread_create(&rest_thread_, NULL, rest__run, rest_mloop_) != 0)
+		goto failure;
+
+	return 0;
+
+failure:
+	rest_is_threaded_ = 0;
+	mloop_unref(rest_mloop_);
+	rest_mloop_ = NULL;
+	return -1;
+}
+
 void rest_cleanup()
 {
+	if (rest_is_threaded_) {
+		mloop_exit(rest_mloop_);
+		pthread_join(rest_thread_, NULL);
+		mloop_unref(rest_mloop_);
+		rest_mloop_ = NULL;
+		rest_is_threaded_ = 0;
+	}
+
 	while (!SLIST_EMPTY(&rest_service_list_)) {
 		struct rest_service* service = SLIST_FIRST(&rest_service_list_);
 		SLIST_REMOVE_HEAD(&rest_service_list_, links);
 		free(service);
 	}
 }
-
@@ -0,0 +1,457 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "canopen-rpc.h"
+#include "rpc.h"
+#include "vector.h"
+
+#define CO_RPC_READ_SIZE 65536
+
+/* Requests are sent when this much has been buffered */
+#define CO_RPC_OUTPUT_FLUSH 65536
+
+struct co_rpc {
+	int fd;
+	uint32_t next_id;
+	struct vector output;
+	struct vector input;
+	size_t input_pos;
+	size_t last_size;
+	void* retired_input;
+};
+
+struct co_rpc* co_rpc__new(int fd)
+{
+	struct co_rpc* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->fd = fd;
+
+	if (vector_init(&self->output, CO_RPC_OUTPUT_FLUSH) < 0)
+		goto output_failure;
+
+	if (vector_init(&self->input, CO_RPC_READ_SIZE) < 0)
+		goto input_failure;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return self;
+
+input_failure:
+	vector_destroy(&self->output);
+output_failure:
+	free(self);
+	return NULL;
+}
+
+/* The message returned by co_rpc_receive() must stay where it is until the
+ * next receive, so input that arrives meanwhile goes into a new buffer if the
+ * current one is full. The old buffer is freed on the next receive.
+ */
+static int co_rpc__retire_input(struct co_rpc* self)
+{
+	struct vector* input = &self->input;
+	size_t pos = self->input_pos + self->last_size;
+	size_t unread = input->index - pos;
+	struct vector fresh;
+
+	if (vector_init(&fresh, unread + CO_RPC_READ_SIZE) < 0)
+		return -1;
+
+	memcpy(fresh.data, (char*)input->data + pos, unread);
+	fresh.index = unread;
+
+	free(self->retired_input);
+	self->retired_input = input->data;
+	*input = fresh;
+	self->input_pos = 0;
+	self->last_size = 0;
+	return 0;
+}
+
+/* Whatever has been consumed is moved out of the way before reading, so the
+ * buffer only grows when replies are not being taken.
+ */
+static int co_rpc__read(struct co_rpc* self)
+{
+	struct vector* input = &self->input;
+
+	if (self->last_size > 0) {
+		if (input->index + CO_RPC_READ_SIZE > input->size
+		    && co_rpc__retire_input(self) < 0)
+			return -1;
+	} else if (self->input_pos > 0) {
+		memmove(input->data, (char*)input->data + self->input_pos,
+			input->index - self->input_pos);
+		input->index -= self->input_pos;
+		self->input_pos = 0;
+	}
+
+	if (vector_reserve(input, input->index + CO_RPC_READ_SIZE) < 0)
+		return -1;
+
+	ssize_t size = read(self->fd, (char*)input->data + input->index,
+			    input->size - input->index);
+	if (size == 0) {
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	if (size < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK
+			|| errno == EINTR) ? 0 : -1;
+
+	input->index += size;
+	return 0;
+}
+
+static void* co_rpc__new_message(struct co_rpc* self, size_t size, int type,
+				 int flags)
+{
+	struct vector* output = &self->output;
+
+	size = co_rpc_align(size);
+
+	if (output->index + size > CO_RPC_OUTPUT_FLUSH && co_rpc_flush(self) < 0)
+		return NULL;
+
+	if (vector_reserve(output, output->index + size) < 0)
+		return NULL;
+
+	struct co_rpc_header* header =
+		(void*)((char*)output->data + output->index);
+	memset(header, 0, size);
+	output->index += size;
+
+	header->size = size;
+	header->type = type;
+	header->flags = flags;
+	header->id = self->next_id;
+
+	self->next_id = (self->next_id + 1) & INT_MAX;
+
+	return header;
+}
+
+static int co_rpc__errno(enum co_rpc_status status)
+{
+	switch (status) {
+	case CO_RPC_OK: return 0;
+	case CO_RPC_SDO_LOCAL_ABORT: return EIO;
+	case CO_RPC_SDO_REMOTE_ABORT: return EIO;
+	case CO_RPC_CANCELLED: return ECANCELED;
+	case CO_RPC_NOMEM: return ENOMEM;
+	case CO_RPC_BUSY: return EBUSY;
+	case CO_RPC_INVALID: return EINVAL;
+	case CO_RPC_SEND_FAILED: return EIO;
+	case CO_RPC_TOO_LARGE: return EMSGSIZE;
+	}
+
+	return EPROTO;
+}
+
+/* Failed requests may be answered with a bare header */
+static const struct co_rpc_sdo_reply*
+co_rpc__wait_sdo(struct co_rpc* self, int id, uint32_t* abort_code)
+{
+	if (id < 0)
+		return NULL;
+
+	const struct co_rpc_header* msg = co_rpc_receive(self, -1);
+	if (!msg)
+		return NULL;
+
+	const struct co_rpc_sdo_reply* reply = (const void*)msg;
+	int is_full = msg->size >= sizeof(*reply);
+
+	if (abort_code)
+		*abort_code = is_full ? reply->abort_code : 0;
+
+	if (msg->id != (uint32_t)id) {
+		errno = EPROTO;
+		return NULL;
+	}
+
+	if (msg->status != CO_RPC_OK) {
+		errno = co_rpc__errno(msg->status);
+		return NULL;
+	}
+
+	if (!is_full || reply->size > msg->size - sizeof(*reply)) {
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return reply;
+}
+
+#pragma GCC visibility push(default)
+
+struct co_rpc* co_rpc_open(const char* path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		goto failure;
+
+	struct co_rpc* self = co_rpc__new(fd);
+	if (!self)
+		goto failure;
+
+	return self;
+
+failure:
+	close(fd);
+	return NULL;
+}
+
+void co_rpc_close(struct co_rpc* self)
+{
+	if (!self)
+		return;
+
+	close(self->fd);
+	vector_destroy(&self->input);
+	vector_destroy(&self->output);
+	free(self->retired_input);
+	free(self);
+}
+
+int co_rpc_get_fd(const struct co_rpc* self)
+{
+	return self->fd;
+}
+
+/* Replies are read while waiting for the socket to become writable, so that
+ * the master never waits for us to read while we wait for it to read.
+ */
+int co_rpc_flush(struct co_rpc* self)
+{
+	struct vector* output = &self->output;
+	size_t pos = 0;
+
+	while (pos < output->index) {
+		ssize_t size = send(self->fd, (char*)output->data + pos,
+				    output->index - pos, MSG_NOSIGNAL);
+		if (size >= 0) {
+			pos += size;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			goto failure;
+
+		struct pollfd pfd = {
+			.fd = self->fd,
+			.events = POLLIN | POLLOUT
+		};
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			goto failure;
+
+		if ((pfd.revents & POLLIN) && co_rpc__read(self) < 0)
+			goto failure;
+	}
+
+	vector_clear(output);
+	return 0;
+
+failure:
+	vector_clear(output);
+	return -1;
+}
+
+int co_rpc_sdo_upload(struct co_rpc* self, int nodeid, int index,
+		      int subindex)
+{
+	struct co_rpc_sdo_req* msg;
+
+	msg = co_rpc__new_message(self, sizeof(*msg), CO_RPC_SDO_UPLOAD, 0);
+	if (!msg)
+		return -1;
+
+	msg->nodeid = nodeid;
+	msg->index = index;
+	msg->subindex = subindex;
+
+	return msg->header.id;
+}
+
+int co_rpc_sdo_download(struct co_rpc* self, int nodeid, int index,
+			int subindex, const void* data, size_t size)
+{
+	struct co_rpc_sdo_req* msg;
+
+	if (size > CO_RPC_SDO_DATA_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	msg = co_rpc__new_message(self, sizeof(*msg) + size,
+				  CO_RPC_SDO_DOWNLOAD, 0);
+	if (!msg)
+		return -1;
+
+	msg->nodeid = nodeid;
+	msg->index = index;
+	msg->subindex = subindex;
+	msg->size = size;
+	memcpy(msg->data, data, size);
+
+	return msg->header.id;
+}
+
+int co_rpc_send_rpdo(struct co_rpc* self, int nodeid, int n, const void* data,
+		     size_t size, enum co_rpc_flags flags)
+{
+	struct co_rpc_rpdo* msg;
+
+	if (size > sizeof(msg->data)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	msg = co_rpc__new_message(self, sizeof(*msg), CO_RPC_RPDO, flags);
+	if (!msg)
+		return -1;
+
+	msg->nodeid = nodeid;
+	msg->n = n;
+	msg->size = size;
+	memcpy(msg->data, data, size);
+
+	return msg->header.id;
+}
+
+int co_rpc_subscribe(struct co_rpc* self, unsigned int topics,
+		     const int* nodes, size_t n_nodes)
+{
+	struct co_rpc_subscribe* msg;
+
+	for (size_t i = 0; i < n_nodes; ++i)
+		if (nodes[i] < 1 || nodes[i] > 127) {
+			errno = EINVAL;
+			return -1;
+		}
+
+	msg = co_rpc__new_message(self, sizeof(*msg), CO_RPC_SUBSCRIBE, 0);
+	if (!msg)
+		return -1;
+
+	msg->topics = topics;
+
+	for (size_t i = 0; i < n_nodes; ++i)
+		msg->nodes[nodes[i] / 8] |= 1 << (nodes[i] % 8);
+
+	return msg->header.id;
+}
+
+const struct co_rpc_header* co_rpc_receive(struct co_rpc* self, int timeout)
+{
+	struct vector* input = &self->input;
+
+	self->input_pos += self->last_size;
+	self->last_size = 0;
+
+	free(self->retired_input);
+	self->retired_input = NULL;
+
+	if (co_rpc_flush(self) < 0)
+		return NULL;
+
+	while (1) {
+		const void* msg = (const char*)input->data + self->input_pos;
+
+		ssize_t size = rpc__message_size(msg,
+				input->index - self->input_pos);
+		if (size < 0) {
+			errno = EPROTO;
+			return NULL;
+		}
+
+		if (size > 0) {
+			self->last_size = size;
+			return msg;
+		}
+
+		struct pollfd pfd = { .fd = self->fd, .events = POLLIN };
+
+		int rc = poll(&pfd, 1, timeout);
+		if (rc == 0) {
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+
+		if (rc < 0 && errno != EINTR)
+			return NULL;
+
+		if (rc > 0 && co_rpc__read(self) < 0)
+			return NULL;
+	}
+}
+
+ssize_t co_rpc_sdo_read(struct co_rpc* self, int nodeid, int index,
+			int subindex, void* buffer, size_t size,
+			uint32_t* abort_code)
+{
+	int id = co_rpc_sdo_upload(self, nodeid, index, subindex);
+
+	const struct co_rpc_sdo_reply* reply =
+		co_rpc__wait_sdo(self, id, abort_code);
+	if (!reply)
+		return -1;
+
+	if (reply->size > size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	memcpy(buffer, reply->data, reply->size);
+	return reply->size;
+}
+
+int co_rpc_sdo_write(struct co_rpc* self, int nodeid, int index, int subindex,
+		     const void* data, size_t size, uint32_t* abort_code)
+{
+	int id = co_rpc_sdo_download(self, nodeid, index, subindex, data, size);
+	return co_rpc__wait_sdo(self, id, abort_code) ? 0 : -1;
+}
+
+#pragma GCC visibility pop
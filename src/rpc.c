@@ -0,0 +1,718 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/queue.h>
+#include <mloop.h>
+
+#include "rpc.h"
+#include "rest.h"
+#include "vector.h"
+#include "net-util.h"
+#include "event-rest.h"
+#include "canopen/master.h"
+#include "canopen/sdo_req.h"
+
+#define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+
+#define RPC_BACKLOG 16
+#define RPC_INPUT_INITIAL_SIZE 4096
+#define RPC_READ_SIZE 4096
+#define RPC_INPUT_HIGH 262144
+#define RPC_OUTPUT_INITIAL_SIZE 4096
+
+struct rpc_client {
+	int ref;
+	struct mloop_socket* socket;
+	enum mloop_socket_event events;
+	struct vector input;
+	struct vector output;
+	int is_processing;
+	int is_flush_scheduled;
+
+	LIST_ENTRY(rpc_client) sub_links;
+	int is_subscribed;
+	uint32_t sub_id;
+	unsigned int topics;
+	int is_all_nodes;
+	uint8_t nodes[16];
+	uint32_t n_dropped;
+};
+
+LIST_HEAD(rpc_client_list, rpc_client);
+
+struct rpc_sdo_context {
+	struct rpc_client* client;
+	uint16_t type;
+	uint32_t id;
+};
+
+static struct rpc_client_list rpc_subs_ = LIST_HEAD_INITIALIZER(rpc_subs_);
+static struct mloop_socket* rpc_server_ = NULL;
+static char* rpc_path_ = NULL;
+
+static struct rpc_client* rpc__client_new(void)
+{
+	struct rpc_client* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->ref = 1;
+
+	if (vector_init(&self->input, RPC_INPUT_INITIAL_SIZE) < 0)
+		goto input_failure;
+
+	if (vector_init(&self->output, RPC_OUTPUT_INITIAL_SIZE) < 0)
+		goto output_failure;
+
+	return self;
+
+output_failure:
+	vector_destroy(&self->input);
+input_failure:
+	free(self);
+	return NULL;
+}
+
+static void rpc__client_ref(struct rpc_client* self)
+{
+	++self->ref;
+}
+
+static void rpc__client_unref(struct rpc_client* self)
+{
+	if (--self->ref > 0)
+		return;
+
+	vector_destroy(&self->output);
+	vector_destroy(&self->input);
+	free(self);
+}
+
+static void rpc__unref_client(void* ptr)
+{
+	rpc__client_unref(ptr);
+}
+
+static void rpc__disconnect(struct rpc_client* client)
+{
+	if (client->socket)
+		mloop_socket_stop(client->socket);
+}
+
+static void rpc__update_events(struct rpc_client* client)
+{
+	if (!client->socket)
+		return;
+
+	enum mloop_socket_event events = MLOOP_SOCKET_EVENT_NONE;
+
+	/* Requests are held back while the client is not reading replies */
+	if (client->output.index < RPC_OUTPUT_HIGH)
+		events |= MLOOP_SOCKET_EVENT_IN;
+
+	if (client->output.index > 0)
+		events |= MLOOP_SOCKET_EVENT_OUT;
+
+	if (events == client->events)
+		return;
+
+	client->events = events;
+	rest__set_socket_event(client->socket, events);
+}
+
+/* Send as much of the pending output as the socket will take without blocking.
+ * The rest is sent when the socket becomes writable.
+ */
+static void rpc__send_output(struct rpc_client* client)
+{
+	if (!client->socket)
+		return;
+
+	int fd = mloop_socket_get_fd(client->socket);
+	struct vector* output = &client->output;
+
+	while (output->index > 0) {
+		ssize_t size = send(fd, output->data, output->index,
+				    MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				rpc__disconnect(client);
+				return;
+			}
+
+			break;
+		}
+
+		rest__consume(output, size);
+	}
+
+	rpc__update_events(client);
+}
+
+static void rpc__on_flush(struct mloop_async* async)
+{
+	struct rpc_client* client = mloop_async_get_context(async);
+	client->is_flush_scheduled = 0;
+	rpc__send_output(client);
+}
+
+/* Output that is made while handling input is sent once the input has been
+ * handled. Anything else is sent at the end of the main loop iteration, so
+ * that replies and events that come in bursts share a system call.
+ */
+static void rpc__schedule_flush(struct rpc_client* client)
+{
+	if (client->is_processing || client->is_flush_scheduled
+	 || !client->socket)
+		return;
+
+	struct mloop_async* async = mloop_async_new(mloop_default());
+	if (!async)
+		goto failure;
+
+	rpc__client_ref(client);
+	mloop_async_set_context(async, client, rpc__unref_client);
+	mloop_async_set_callback(async, rpc__on_flush);
+
+	int rc = mloop_async_start(async);
+	mloop_async_unref(async);
+	if (rc < 0)
+		goto failure;
+
+	client->is_flush_scheduled = 1;
+	return;
+
+failure:
+	rpc__send_output(client);
+}
+
+/* Returns zeroed space for a message of the given size at the end of the
+ * output, or NULL if the client is gone or has been disconnected for not
+ * reading.
+ */
+static void* rpc__reserve(struct rpc_client* client, size_t size)
+{
+	struct vector* output = &client->output;
+
+	if (!client->socket)
+		return NULL;
+
+	size = co_rpc_align(size);
+
+	if (output->index > RPC_OUTPUT_MAX
+	 || vector_reserve(output, output->index + size) < 0) {
+		rpc__disconnect(client);
+		return NULL;
+	}
+
+	void* message = (char*)output->data + output->index;
+	memset(message, 0, size);
+	output->index += size;
+
+	return message;
+}
+
+static void rpc__set_header(struct co_rpc_header* header, size_t size,
+			    int type, uint32_t id, enum co_rpc_status status)
+{
+	header->size = co_rpc_align(size);
+	header->type = type;
+	header->id = id;
+	header->status = status;
+}
+
+static void rpc__reply(struct rpc_client* client,
+		       const struct co_rpc_header* req,
+		       enum co_rpc_status status)
+{
+	struct co_rpc_header* reply = rpc__reserve(client, sizeof(*reply));
+	if (reply)
+		rpc__set_header(reply, sizeof(*reply), req->type, req->id,
+				status);
+}
+
+static enum co_rpc_status rpc__sdo_status(enum sdo_req_status status)
+{
+	switch (status) {
+	case SDO_REQ_OK: return CO_RPC_OK;
+	case SDO_REQ_LOCAL_ABORT: return CO_RPC_SDO_LOCAL_ABORT;
+	case SDO_REQ_REMOTE_ABORT: return CO_RPC_SDO_REMOTE_ABORT;
+	case SDO_REQ_CANCELLED: return CO_RPC_CANCELLED;
+	case SDO_REQ_NOMEM: return CO_RPC_NOMEM;
+	case SDO_REQ_PENDING: break;
+	}
+
+	return CO_RPC_CANCELLED;
+}
+
+static void rpc__free_sdo_context(void* ptr)
+{
+	struct rpc_sdo_context* context = ptr;
+	rpc__client_unref(context->client);
+	free(context);
+}
+
+static void rpc__on_sdo_done(struct sdo_req* req)
+{
+	struct rpc_sdo_context* context = req->context;
+	struct rpc_client* client = context->client;
+	struct co_rpc_sdo_reply* reply;
+
+	enum co_rpc_status status = rpc__sdo_status(req->status);
+	size_t size = 0;
+
+	if (status == CO_RPC_OK && req->type == SDO_REQ_UPLOAD)
+		size = req->data.index;
+
+	if (sizeof(*reply) + size > CO_RPC_MESSAGE_MAX) {
+		status = CO_RPC_TOO_LARGE;
+		size = 0;
+	}
+
+	reply = rpc__reserve(client, sizeof(*reply) + size);
+	if (!reply)
+		return;
+
+	rpc__set_header(&reply->header, sizeof(*reply) + size, context->type,
+			context->id, status);
+	reply->abort_code = req->abort_code;
+	reply->size = size;
+	memcpy(reply->data, req->data.data, size);
+
+	rpc__schedule_flush(client);
+}
+
+static void rpc__sdo(struct rpc_client* client,
+		     const struct co_rpc_sdo_req* msg)
+{
+	const struct co_rpc_header* header = &msg->header;
+	int is_download = header->type == CO_RPC_SDO_DOWNLOAD;
+
+	if (header->size < sizeof(*msg) || !is_in_range(msg->nodeid, 1, 127)
+	 || (is_download && msg->size > header->size - sizeof(*msg))) {
+		rpc__reply(client, header, CO_RPC_INVALID);
+		return;
+	}
+
+	struct rpc_sdo_context* context = malloc(sizeof(*context));
+	if (!context) {
+		rpc__reply(client, header, CO_RPC_NOMEM);
+		return;
+	}
+
+	context->client = client;
+	context->type = header->type;
+	context->id = header->id;
+
+	struct sdo_req_info info = {
+		.type = is_download ? SDO_REQ_DOWNLOAD : SDO_REQ_UPLOAD,
+		.index = msg->index,
+		.subindex = msg->subindex,
+		.on_done = rpc__on_sdo_done,
+		.dl_data = msg->data,
+		.dl_size = is_download ? msg->size : 0,
+		.context = context
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req) {
+		free(context);
+		rpc__reply(client, header, CO_RPC_NOMEM);
+		return;
+	}
+
+	rpc__client_ref(client);
+	req->context_free_fn = rpc__free_sdo_context;
+
+	if (sdo_req_start(req, sdo_req_queue_get(msg->nodeid)) < 0)
+		rpc__reply(client, header, CO_RPC_BUSY);
+
+	sdo_req_unref(req);
+}
+
+static int rpc__rpdo_type(int n)
+{
+	switch (n) {
+	case 1: return R_RPDO1;
+	case 2: return R_RPDO2;
+	case 3: return R_RPDO3;
+	case 4: return R_RPDO4;
+	}
+
+	return -1;
+}
+
+static void rpc__rpdo(struct rpc_client* client, const struct co_rpc_rpdo* msg)
+{
+	const struct co_rpc_header* header = &msg->header;
+	int type = rpc__rpdo_type(msg->n);
+
+	if (header->size < sizeof(*msg) || type < 0
+	 || !is_in_range(msg->nodeid, 1, 127) || msg->size > 8) {
+		rpc__reply(client, header, CO_RPC_INVALID);
+		return;
+	}
+
+	if (co__rpdox(msg->nodeid, type, msg->data, msg->size) < 0)
+		rpc__reply(client, header, CO_RPC_SEND_FAILED);
+	else if (!(header->flags & CO_RPC_NO_REPLY))
+		rpc__reply(client, header, CO_RPC_OK);
+}
+
+static void rpc__unsubscribe(struct rpc_client* client)
+{
+	if (!client->is_subscribed)
+		return;
+
+	LIST_REMOVE(client, sub_links);
+	client->is_subscribed = 0;
+}
+
+static void rpc__subscribe(struct rpc_client* client,
+			   const struct co_rpc_subscribe* msg)
+{
+	const struct co_rpc_header* header = &msg->header;
+
+	if (header->size < sizeof(*msg) || (msg->topics & ~CO_RPC_ALL)) {
+		rpc__reply(client, header, CO_RPC_INVALID);
+		return;
+	}
+
+	client->sub_id = header->id;
+	client->topics = msg->topics;
+	client->n_dropped = 0;
+	memcpy(client->nodes, msg->nodes, sizeof(client->nodes));
+
+	client->is_all_nodes = 1;
+	for (size_t i = 0; i < sizeof(client->nodes); ++i)
+		if (client->nodes[i])
+			client->is_all_nodes = 0;
+
+	if (!client->topics) {
+		rpc__unsubscribe(client);
+	} else if (!client->is_subscribed) {
+		LIST_INSERT_HEAD(&rpc_subs_, client, sub_links);
+		client->is_subscribed = 1;
+	}
+
+	rpc__reply(client, header, CO_RPC_OK);
+}
+
+static void rpc__handle_message(struct rpc_client* client,
+				const struct co_rpc_header* msg)
+{
+	switch (msg->type) {
+	case CO_RPC_SDO_UPLOAD:
+	case CO_RPC_SDO_DOWNLOAD:
+		rpc__sdo(client, (const struct co_rpc_sdo_req*)msg);
+		break;
+	case CO_RPC_RPDO:
+		rpc__rpdo(client, (const struct co_rpc_rpdo*)msg);
+		break;
+	case CO_RPC_SUBSCRIBE:
+		rpc__subscribe(client, (const struct co_rpc_subscribe*)msg);
+		break;
+	default:
+		rpc__reply(client, msg, CO_RPC_INVALID);
+		break;
+	}
+}
+
+/* Messages are aligned in the input buffer, since they are padded and the
+ * buffer is only ever consumed up to the end of a message.
+ */
+static void rpc__process(struct rpc_client* client)
+{
+	struct vector* input = &client->input;
+	size_t pos = 0;
+
+	client->is_processing = 1;
+
+	while (client->socket && client->output.index < RPC_OUTPUT_HIGH) {
+		const void* msg = (const char*)input->data + pos;
+
+		ssize_t size = rpc__message_size(msg, input->index - pos);
+		if (size == 0)
+			break;
+
+		if (size < 0) {
+			rpc__disconnect(client);
+			break;
+		}
+
+		rpc__handle_message(client, msg);
+		pos += size;
+	}
+
+	client->is_processing = 0;
+
+	rest__consume(input, pos);
+	rpc__send_output(client);
+}
+
+/* A short read means that the socket has been drained, which saves a system
+ * call per request compared to reading until it would block. Whatever does not
+ * fit below RPC_INPUT_HIGH is read once the input has been handled.
+ */
+static int rpc__read(struct vector* input, int fd)
+{
+	while (input->index < RPC_INPUT_HIGH) {
+		if (vector_reserve(input, input->index + RPC_READ_SIZE) < 0)
+			return -1;
+
+		size_t space = input->size - input->index;
+
+		ssize_t size = read(fd, (char*)input->data + input->index, space);
+		if (size == 0)
+			return -1;
+
+		if (size < 0)
+			return (errno == EWOULDBLOCK || errno == EAGAIN
+				|| errno == EINTR) ? 0 : -1;
+
+		input->index += size;
+
+		if ((size_t)size < space)
+			return 0;
+	}
+
+	return 0;
+}
+
+static void rpc__on_client_data(struct mloop_socket* socket)
+{
+	struct rpc_client* client = mloop_socket_get_context(socket);
+	int fd = mloop_socket_get_fd(socket);
+	enum mloop_socket_event events = mloop_socket_get_event(socket);
+
+	rpc__client_ref(client);
+
+	if (events & MLOOP_SOCKET_EVENT_OUT)
+		rpc__send_output(client);
+
+	if (client->socket && (events & (MLOOP_SOCKET_EVENT_IN
+					 | MLOOP_SOCKET_EVENT_HUP
+					 | MLOOP_SOCKET_EVENT_ERR))
+	 && rpc__read(&client->input, fd) < 0)
+		rpc__disconnect(client);
+
+	/* This also picks up input that was held back for congestion */
+	rpc__process(client);
+
+	rpc__client_unref(client);
+}
+
+static void rpc__on_socket_free(void* ptr)
+{
+	struct rpc_client* client = ptr;
+
+	client->socket = NULL;
+	rpc__unsubscribe(client);
+	rpc__client_unref(client);
+}
+
+static void rpc__on_connection(struct mloop_socket* socket)
+{
+	int sfd = mloop_socket_get_fd(socket);
+
+	int cfd = accept(sfd, NULL, 0);
+	if (cfd < 0)
+		return;
+
+	net_dont_block(cfd);
+
+	struct mloop_socket* client = mloop_socket_new(mloop_default());
+	if (!client)
+		goto socket_failure;
+
+	struct rpc_client* state = rpc__client_new();
+	if (!state)
+		goto state_failure;
+
+	state->socket = client;
+	state->events = MLOOP_SOCKET_EVENT_IN;
+
+	mloop_socket_set_fd(client, cfd);
+	mloop_socket_set_event(client, state->events);
+	mloop_socket_set_callback(client, rpc__on_client_data);
+	mloop_socket_set_context(client, state, rpc__on_socket_free);
+	mloop_socket_start(client);
+
+	mloop_socket_unref(client);
+	return;
+
+state_failure:
+	mloop_socket_unref(client);
+socket_failure:
+	close(cfd);
+}
+
+static int rpc__open_server(const char* path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	/* A socket file that is left behind by a previous run is replaced */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		goto failure;
+
+	if (listen(fd, RPC_BACKLOG) < 0)
+		goto failure;
+
+	net_dont_block(fd);
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int rpc_init(const char* path)
+{
+	rpc_path_ = strdup(path);
+	if (!rpc_path_)
+		return -1;
+
+	int lfd = rpc__open_server(path);
+	if (lfd < 0)
+		goto open_failure;
+
+	rpc_server_ = mloop_socket_new(mloop_default());
+	if (!rpc_server_)
+		goto socket_failure;
+
+	mloop_socket_set_fd(rpc_server_, lfd);
+	mloop_socket_set_callback(rpc_server_, rpc__on_connection);
+	if (mloop_socket_start(rpc_server_) < 0)
+		goto start_failure;
+
+	return 0;
+
+start_failure:
+	/* This also closes the listening socket */
+	mloop_socket_unref(rpc_server_);
+	rpc_server_ = NULL;
+	goto unlink_path;
+socket_failure:
+	close(lfd);
+unlink_path:
+	unlink(path);
+open_failure:
+	free(rpc_path_);
+	rpc_path_ = NULL;
+	return -1;
+}
+
+void rpc_cleanup(void)
+{
+	if (!rpc_server_)
+		return;
+
+	mloop_socket_stop(rpc_server_);
+	mloop_socket_unref(rpc_server_);
+	rpc_server_ = NULL;
+
+	unlink(rpc_path_);
+	free(rpc_path_);
+	rpc_path_ = NULL;
+}
+
+static int rpc__is_node_selected(const struct rpc_client* client, int nodeid)
+{
+	return client->is_all_nodes
+	    || (client->nodes[nodeid / 8] & (1 << (nodeid % 8)));
+}
+
+static void rpc__push_event(struct rpc_client* client,
+			    const struct can_frame* cf, unsigned int topic,
+			    uint64_t now)
+{
+	struct co_rpc_event* event;
+
+	/* Events are dropped rather than queued for a client that is behind */
+	if (client->output.index >= RPC_OUTPUT_HIGH) {
+		++client->n_dropped;
+		return;
+	}
+
+	event = rpc__reserve(client, sizeof(*event));
+	if (!event)
+		return;
+
+	rpc__set_header(&event->header, sizeof(*event), CO_RPC_EVENT,
+			client->sub_id, CO_RPC_OK);
+	event->timestamp = now;
+	event->n_dropped = client->n_dropped;
+	event->cob_id = cf->can_id;
+	event->size = cf->can_dlc;
+	event->topic = topic;
+	memcpy(event->data, cf->data, sizeof(event->data));
+
+	client->n_dropped = 0;
+	rpc__schedule_flush(client);
+}
+
+void rpc_publish(const struct canopen_msg* msg, const struct can_frame* cf,
+		 uint64_t now)
+{
+	enum event_rest_topic topic;
+	struct rpc_client *client, *next;
+
+	if (LIST_EMPTY(&rpc_subs_))
+		return;
+
+	/* The topics of the protocol have the same values as those of the
+	 * event service.
+	 */
+	if (event_rest__key(msg, cf, &topic) < 0)
+		return;
+
+	/* A client that is disconnected for not reading removes itself from
+	 * the list.
+	 */
+	for (client = LIST_FIRST(&rpc_subs_); client; client = next) {
+		next = LIST_NEXT(client, sub_links);
+
+		if (!(client->topics & topic)
+		 || !rpc__is_node_selected(client, msg->id))
+			continue;
+
+		rpc__client_ref(client);
+		rpc__push_event(client, cf, topic, now);
+		rpc__client_unref(client);
+	}
+}
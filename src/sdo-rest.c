@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 #include <mloop.h>
 
 #include "canopen/sdo_req.h"
@@ -27,10 +28,16 @@
 #include "conversions.h"
 #include "string-utils.h"
 #include "canopen/types.h"
+#include "sdo-rest.h"
 
-size_t strlcpy(char*, const char*, size_t);
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+#define XSTR(s) STR(s)
+#define STR(s) #s
+#define EDS_KEY(index, subindex) (((index) << 8) | (subindex))
 
 struct sdo_rest_path {
 	int nodeid, index, subindex;
@@ -40,14 +47,41 @@ struct sdo_rest_context {
 	struct rest_client* client;
 	enum canopen_type type;
 	struct sdo_rest_path path;
+
+	/* application/octet-stream uploads */
+	int is_header_sent;
+
+	/* application/octet-stream downloads */
+	struct sdo_req* req;
+	char expediated_data[SDO_EXPEDIATED_DATA_SIZE];
+	size_t n_read;
+	int is_reading;
+	int is_done;
+};
+
+/* Values of up to SDO_REST_EDS_WINDOW objects are requested at a time. This
+ * keeps the SDO queue of the node busy without making drivers wait behind a
+ * whole dump.
+ */
+#define SDO_REST_EDS_WINDOW 8
+
+struct sdo_rest_eds_context;
+
+struct sdo_rest_eds_item {
+	struct sdo_rest_eds_context* parent;
+	const struct eds_obj* obj;
+	char* value;
+	int is_ready;
 };
 
 struct sdo_rest_eds_context {
 	unsigned int nodeid;
 	struct rest_client* client;
-	const struct canopen_eds* eds;
-	char* buffer;
-	size_t length;
+	struct sdo_rest_eds_item* items;
+	size_t n_items;
+	size_t next_read;
+	size_t next_print;
+	size_t n_in_flight;
 };
 
 static int sdo_rest__convert_path(struct sdo_rest_path* dst,
@@ -104,9 +138,9 @@ static void sdo_rest_not_found(struct rest_client* client, const char* message)
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
 static void sdo_rest_server_error(struct rest_client* client,
@@ -119,9 +153,24 @@ static void sdo_rest_server_error(struct rest_client* client,
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
+
+	rest_client_done(client);
+}
+
+static void sdo_rest_unavailable(struct rest_client* client,
+				 const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = "503 Service Unavailable",
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
 static const struct eds_obj*
@@ -154,9 +203,9 @@ static void sdo_rest_bad_request(struct rest_client* client,
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
 }
 
 static void on_sdo_rest_upload_done(struct sdo_req* req)
@@ -165,7 +214,7 @@ static void on_sdo_rest_upload_done(struct sdo_req* req)
 	assert(context);
 	struct rest_client* client = context->client;
 
-	if (client->state == REST_CLIENT_DISCONNECTED)
+	if (rest_client_is_disconnected(client))
 		goto done;
 
 	if (req->status != SDO_REQ_OK) {
@@ -194,9 +243,76 @@ static void on_sdo_rest_upload_done(struct sdo_req* req)
 		.content = message
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
+
+	rest_client_done(client);
+
+done:
+	rest_client_unref(client);
+	free(context);
+}
+
+static void on_sdo_rest_upload_data(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+	struct rest_client* client = context->client;
+
+	if (rest_client_is_disconnected(client))
+		return;
+
+	if (!context->is_header_sent) {
+		struct rest_reply_data reply = {
+			.status_code = "200 OK",
+			.content_type = "application/octet-stream",
+			.content_length = -1
+		};
+
+		rest_reply_header(client, &reply);
+		context->is_header_sent = 1;
+	}
+
+	rest_reply_chunk(client, req->data.data, req->data.index);
+}
+
+/* Objects that fit in a single piece are sent with a length. Longer ones are
+ * sent in chunks as they are uploaded, so a failure after the first chunk can
+ * only be reported by cutting the response short.
+ */
+static void on_sdo_rest_raw_upload_done(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+	assert(context);
+	struct rest_client* client = context->client;
+
+	if (rest_client_is_disconnected(client))
+		goto done;
+
+	if (req->status != SDO_REQ_OK) {
+		if (context->is_header_sent)
+			rest_client_abort(client);
+		else
+			sdo_rest_server_error(client,
+					      sdo_strerror(req->abort_code));
+		goto done;
+	}
+
+	if (context->is_header_sent) {
+		if (req->data.index > 0)
+			on_sdo_rest_upload_data(req);
 
-	client->state = REST_CLIENT_DONE;
+		rest_reply_chunk(client, NULL, 0);
+	} else {
+		struct rest_reply_data reply = {
+			.status_code = "200 OK",
+			.content_type = "application/octet-stream",
+			.content_length = req->data.index,
+			.content = req->data.data
+		};
+
+		rest_reply(client, &reply);
+	}
+
+	rest_client_done(client);
 
 done:
 	rest_client_unref(client);
@@ -240,6 +356,11 @@ static int sdo_rest__get(struct sdo_rest_context* context)
 		.context = context
 	};
 
+	if (client->req.accepts_octet_stream) {
+		info.on_done = on_sdo_rest_raw_upload_done;
+		info.on_data = on_sdo_rest_upload_data;
+	}
+
 	struct sdo_req* req = sdo_req_new(&info);
 	if (!req) {
 		sdo_rest_server_error(client, "Out of memory\r\n");
@@ -258,18 +379,15 @@ static int sdo_rest__get(struct sdo_rest_context* context)
 	return rc;
 }
 
-static void on_sdo_rest_download_done(struct sdo_req* req)
+static void sdo_rest__reply_download(struct rest_client* client,
+				     const struct sdo_req* req)
 {
-	struct sdo_rest_context* context = req->context;
-	assert(context);
-	struct rest_client* client = context->client;
-
-	if (client->state == REST_CLIENT_DISCONNECTED)
-		goto done;
+	if (rest_client_is_disconnected(client))
+		return;
 
 	if (req->status != SDO_REQ_OK) {
 		sdo_rest_server_error(client, sdo_strerror(req->abort_code));
-		goto done;
+		return;
 	}
 
 	struct rest_reply_data reply = {
@@ -279,15 +397,159 @@ static void on_sdo_rest_download_done(struct sdo_req* req)
 		.content = ""
 	};
 
-	rest_reply(client->output, &reply);
+	rest_reply(client, &reply);
 
-	client->state = REST_CLIENT_DONE;
+	rest_client_done(client);
+}
+
+static void on_sdo_rest_download_done(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+	assert(context);
+	struct rest_client* client = context->client;
+
+	sdo_rest__reply_download(client, req);
 
-done:
 	rest_client_unref(client);
 	free(context);
 }
 
+/* application/octet-stream content is written as it is. Content that has not
+ * all arrived by the time the download starts is passed on to it as it
+ * arrives. The context is kept until both the download and any pending read
+ * are done.
+ */
+static void sdo_rest__release_stream(struct sdo_rest_context* context)
+{
+	if (context->is_reading || !context->is_done)
+		return;
+
+	if (context->req)
+		sdo_req_unref(context->req);
+
+	rest_client_unref(context->client);
+	free(context);
+}
+
+static void on_sdo_rest_stream_done(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+	assert(context);
+
+	sdo_rest__reply_download(context->client, req);
+
+	context->is_done = 1;
+	sdo_rest__release_stream(context);
+}
+
+static void sdo_rest__on_content(void* ptr, const void* data, size_t size);
+
+static void on_sdo_rest_stream_data(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+
+	if (context->is_reading)
+		return;
+
+	context->is_reading = 1;
+	rest_client_read(context->client, sdo_rest__on_content, context);
+}
+
+static int sdo_rest__start_stream(struct sdo_rest_context* context,
+				  const void* data, size_t size)
+{
+	struct rest_client* client = context->client;
+	struct sdo_rest_path* path = &context->path;
+	size_t content_length = client->req.content_length;
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = path->index,
+		.subindex = path->subindex,
+		.on_done = on_sdo_rest_stream_done,
+		.context = context,
+		.dl_data = data,
+		.dl_size = size
+	};
+
+	if (size < content_length) {
+		info.stream_size = content_length;
+		info.on_data = on_sdo_rest_stream_data;
+	}
+
+	context->req = sdo_req_new(&info);
+	if (!context->req) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return -1;
+	}
+
+	if (sdo_req_start(context->req, sdo_req_queue_get(path->nodeid)) < 0) {
+		sdo_rest_server_error(client, "Failed to start sdo request\r\n");
+		sdo_req_unref(context->req);
+		context->req = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sdo_rest__on_content(void* ptr, const void* data, size_t size)
+{
+	struct sdo_rest_context* context = ptr;
+	size_t content_length = context->client->req.content_length;
+
+	context->is_reading = 0;
+
+	/* If the connection is lost, a download that has started runs into its
+	 * timeout.
+	 */
+	if (!data) {
+		if (!context->req)
+			context->is_done = 1;
+		goto done;
+	}
+
+	if (context->is_done)
+		goto done;
+
+	if (context->req) {
+		sdo_req_append(context->req, data, size);
+		goto done;
+	}
+
+	/* Expediated downloads need all of their data up front */
+	if (content_length <= SDO_EXPEDIATED_DATA_SIZE) {
+		memcpy(context->expediated_data + context->n_read, data, size);
+		context->n_read += size;
+
+		if (context->n_read < content_length) {
+			context->is_reading = 1;
+			rest_client_read(context->client, sdo_rest__on_content,
+					 context);
+			goto done;
+		}
+
+		data = context->expediated_data;
+		size = content_length;
+	}
+
+	if (sdo_rest__start_stream(context, data, size) < 0)
+		context->is_done = 1;
+
+done:
+	sdo_rest__release_stream(context);
+}
+
+static int sdo_rest__put_stream(struct sdo_rest_context* context)
+{
+	rest_client_ref(context->client);
+
+	context->is_reading = 1;
+	rest_client_read(context->client, sdo_rest__on_content, context);
+
+	return 0;
+}
+
 static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
 {
 	struct rest_client* client = context->client;
@@ -310,6 +572,9 @@ static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
 		type = eds_obj->type;
 	}
 
+	if (!content)
+		return sdo_rest__put_stream(context);
+
 	struct canopen_data data = { 0 };
 
 	char* input = malloc(content_length + 1);
@@ -372,217 +637,486 @@ int sdo_rest__process(struct sdo_rest_context* context, const void* content)
 	return -1;
 }
 
-ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid, int index,
-			     int subindex, enum canopen_type type)
+static size_t sdo_rest__json_escape(char* dst, size_t size, const char* src)
 {
-	struct sdo_req_info info = {
-		.type = SDO_REQ_UPLOAD,
-		.index = index,
-		.subindex = subindex
-	};
+	size_t len = 0;
 
-	struct sdo_req* req = sdo_req_new(&info);
-	if (!req)
-		goto nomem;
+	for (; *src && len + 2 < size; ++src) {
+		if (!isprint((unsigned char)*src))
+			continue;
 
-	if (sdo_req_start(req, sdo_req_queue_get(nodeid)) < 0)
-		goto failure;
+		if (*src == '"' || *src == '\\')
+			dst[len++] = '\\';
 
-	sdo_req_wait(req);
+		dst[len++] = *src;
+	}
 
-	if (req->status != SDO_REQ_OK)
-		goto failure;
+	dst[len] = '\0';
+	return len;
+}
 
-	struct canopen_data data = {
-		.type = type,
-		.data = req->data.data,
-		.size = req->data.index,
-		.is_size_unknown = !req->is_size_indicated
-	};
+static void sdo_rest__eds_print_string(FILE* out, const char* key,
+				       const char* value)
+{
+	char escaped[512];
+	sdo_rest__json_escape(escaped, sizeof(escaped), value);
+	fprintf(out, ",\n  \"%s\": \"%s\"", key, escaped);
+}
+
+static inline int sdo_rest__eds_is_readable(const struct eds_obj* obj)
+{
+	return !!(obj->access & (EDS_OBJ_R | EDS_OBJ_CONST));
+}
 
+/* Values that the master read while booting the node and constants from the
+ * EDS are served without going to the bus.
+ */
+static char* sdo_rest__cached_value(unsigned int nodeid,
+				    const struct eds_obj* obj)
+{
+	const struct co_master_node* node = co_master_get_node(nodeid);
+	const struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
 	char buffer[256];
-	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
-	if (!str)
-		goto failure;
 
-	sdo_req_unref(req);
-	return fprintf(out, "\"%s\"", str);
+	switch (obj->key) {
+	case EDS_KEY(0x1000, 0):
+		if (!hot->is_initialized)
+			break;
+		snprintf(buffer, sizeof(buffer), "%u", node->device_type);
+		return strdup(buffer);
+	case EDS_KEY(0x1018, 1):
+	case EDS_KEY(0x1018, 2):
+	case EDS_KEY(0x1018, 3):
+		if (!hot->is_initialized || node->vendor_id == 0)
+			break;
+		snprintf(buffer, sizeof(buffer), "%u",
+			 obj->key == EDS_KEY(0x1018, 1) ? node->vendor_id
+			 : obj->key == EDS_KEY(0x1018, 2) ? node->product_code
+			 : node->revision_number);
+		return strdup(buffer);
+	}
 
-failure:
-	sdo_req_unref(req);
-nomem:
-	return fprintf(out, "null");
+	/* Default values may be relative to the node id */
+	if (!(obj->access & EDS_OBJ_CONST) || !obj->default_value
+	 || strchr(obj->default_value, '$'))
+		return NULL;
+
+	struct canopen_data data;
+	if (canopen_data_fromstring(&data, obj->type, obj->default_value) < 0)
+		return NULL;
+
+	const char* value = canopen_data_tostring(buffer, sizeof(buffer),
+						  &data);
+	return value ? strdup(value) : NULL;
 }
 
-static char* sdo_rest__escape_string(const char* str)
+/* The value is only printed if with_value is set, as null if it is missing */
+static void sdo_rest__eds_print_obj(FILE* out, const struct eds_obj* obj,
+				    int with_value, const char* value)
 {
-	static __thread char buffer[256];
-	char* ptr = buffer;
+	int is_const = !!(obj->access & EDS_OBJ_CONST);
+	int is_readable = !!(obj->access & EDS_OBJ_R);
+	int is_writable = !!(obj->access & EDS_OBJ_W);
 
-	while ((size_t)(ptr - buffer) < sizeof(buffer) - 1)
-		switch (*str) {
-		case '\\':
-			*ptr++ = '\\';
-			*ptr++ = *str++;
-			break;
-		case '"':
-			*ptr++ = '\\';
-			*ptr++ = *str++;
-			break;
-		default:
-			*ptr++ = *str++;
-			break;
-		}
+	fprintf(out, " \"%#x:%#x\": {\n", eds_obj_index(obj),
+		eds_obj_subindex(obj));
+
+	fprintf(out, "  \"type\": %u,\n", obj->type);
+	if (is_const) {
+		fprintf(out, "  \"const\": true");
+	} else {
+		fprintf(out, "  \"read-write\": [%s, %s]",
+			       is_readable ? "true" : "false",
+			       is_writable ? "true" : "false");
+	}
+
+	if (with_value && sdo_rest__eds_is_readable(obj)) {
+		if (value)
+			sdo_rest__eds_print_string(out, "value", value);
+		else
+			fprintf(out, ",\n  \"value\": null");
+	}
+
+	if (obj->name)
+		sdo_rest__eds_print_string(out, "name", obj->name);
+
+	if (obj->default_value)
+		sdo_rest__eds_print_string(out, "default-value",
+					   obj->default_value);
+
+	if (obj->low_limit)
+		sdo_rest__eds_print_string(out, "low-limit", obj->low_limit);
+
+	if (obj->high_limit)
+		sdo_rest__eds_print_string(out, "high-limit", obj->high_limit);
+
+	if (obj->unit)
+		sdo_rest__eds_print_string(out, "unit", obj->unit);
 
-	*ptr = '\0';
-	return buffer;
+	if (obj->scaling)
+		sdo_rest__eds_print_string(out, "scaling", obj->scaling);
+
+	fprintf(out, "\n }");
+}
+
+static void sdo_rest__eds_free(struct sdo_rest_eds_context* self)
+{
+	for (size_t i = 0; i < self->n_items; ++i)
+		free(self->items[i].value);
+
+	rest_client_unref(self->client);
+	free(self->items);
+	free(self);
 }
 
-static char* sdo_rest__clean_string(const char* str)
+static inline int sdo_rest__eds_is_done(struct sdo_rest_eds_context* self)
 {
-	static __thread char buffer[256];
-	strlcpy(buffer, str, sizeof(buffer));
-	return string_keep_if(isprint, buffer);
+	return self->next_print == self->n_items
+	    || rest_client_is_disconnected(self->client);
 }
 
-void sdo_rest__eds_job(struct mloop_work* work)
+/* Objects are sent in EDS order, as many as are ready in one chunk */
+static void sdo_rest__eds_flush(struct sdo_rest_eds_context* self)
 {
+	struct rest_client* client = self->client;
 	char* buffer = NULL;
 	size_t size = 0;
 
-	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
-	const struct canopen_eds* eds = context->eds;
-	struct rest_client* client = context->client;
-	unsigned int nodeid = context->nodeid;
-
-	int is_const, is_readable, is_writable;
-	int with_value = http_req_query(&client->req, "with_value") != NULL;
-
-	int index, subindex;
+	if (rest_client_is_disconnected(client))
+		return;
 
 	FILE* out = open_memstream(&buffer, &size);
 	if (!out) {
-		sdo_rest_server_error(client, "Out of memory\r\n");
+		rest_client_abort(client);
+		self->next_print = self->n_items;
 		return;
 	}
 
-	fprintf(out, "{\n");
-	const struct eds_obj* obj = eds_obj_first(eds);
-	if (!obj)
-		goto done;
+	while (self->next_print < self->n_items
+	    && self->items[self->next_print].is_ready) {
+		if (self->next_print > 0)
+			fprintf(out, ",\n");
 
-	goto first_object;
-	do {
-		if (client->state == REST_CLIENT_DISCONNECTED)
-			goto failure;
-
-		fprintf(out, ",\n");
-first_object:
-		is_const = !!(obj->access & EDS_OBJ_CONST);
-		is_readable = !!(obj->access & EDS_OBJ_R);
-		is_writable = !!(obj->access & EDS_OBJ_W);
-
-		index = eds_obj_index(obj);
-		subindex = eds_obj_subindex(obj);
-
-		fprintf(out, " \"%#x:%#x\": {\n", index, subindex);
-
-		fprintf(out, "  \"type\": %u,\n", obj->type);
-		if (is_const) {
-			fprintf(out, "  \"const\": true");
-		} else {
-			fprintf(out, "  \"read-write\": [%s, %s]",
-				       is_readable ? "true" : "false",
-				       is_writable ? "true" : "false");
-		}
+		const struct sdo_rest_eds_item* item
+			= &self->items[self->next_print++];
 
-		if ((is_const || is_readable) && with_value) {
-			fprintf(out, ",\n  \"value\": ");
-			sdo_rest__read_value(out, nodeid, index,
-						    subindex, obj->type);
-		}
+		sdo_rest__eds_print_obj(out, item->obj, 1, item->value);
+	}
 
-		if (obj->name) {
-			const char* clean_name;
-			const char* escaped_name;
-			clean_name = sdo_rest__clean_string(obj->name);
-			escaped_name = sdo_rest__escape_string(clean_name);
+	if (self->next_print == self->n_items)
+		fprintf(out, "\n}\n");
 
-			fprintf(out, ",\n  \"name\": \"%s\"", escaped_name);
-		}
+	fclose(out);
 
-		if (obj->default_value)
-			fprintf(out, ",\n  \"default-value\": \"%s\"",
-				obj->default_value);
+	if (size > 0)
+		rest_reply_chunk(client, buffer, size);
 
-		if (obj->low_limit)
-			fprintf(out, ",\n  \"low-limit\": \"%s\"",
-				obj->low_limit);
+	free(buffer);
 
-		if (obj->high_limit)
-			fprintf(out, ",\n  \"high-limit\": \"%s\"",
-				obj->high_limit);
+	if (self->next_print == self->n_items) {
+		rest_reply_chunk(client, NULL, 0);
+		rest_client_done(client);
+	}
+}
 
-		if (obj->unit)
-			fprintf(out, ",\n  \"unit\": \"%s\"", obj->unit);
+static void sdo_rest__eds_read_more(struct sdo_rest_eds_context* self);
 
-		if (obj->scaling)
-			fprintf(out, ",\n  \"scaling\": \"%s\"", obj->scaling);
+static void sdo_rest__eds_on_read_done(struct sdo_req* req)
+{
+	struct sdo_rest_eds_item* item = req->context;
+	struct sdo_rest_eds_context* self = item->parent;
+	char buffer[256];
 
-		fprintf(out, "\n }");
-		obj = eds_obj_next(eds, obj);
-	} while (obj);
-done:
-	fprintf(out, "\n}\n");
+	--self->n_in_flight;
+
+	if (req->status == SDO_REQ_OK) {
+		struct canopen_data data = {
+			.type = item->obj->type,
+			.data = req->data.data,
+			.size = req->data.index,
+			.is_size_unknown = !req->is_size_indicated
+		};
+
+		const char* value = canopen_data_tostring(buffer,
+							  sizeof(buffer),
+							  &data);
+		if (value)
+			item->value = strdup(value);
+	}
 
-	fclose(out);
+	item->is_ready = 1;
 
-	context->buffer = buffer;
-	context->length = size;
+	if (!rest_client_is_disconnected(self->client)) {
+		sdo_rest__eds_read_more(self);
+		sdo_rest__eds_flush(self);
+	}
 
-	return;
+	if (self->n_in_flight == 0 && sdo_rest__eds_is_done(self))
+		sdo_rest__eds_free(self);
+}
 
-failure:
-	mloop_work_cancel(work);
-	fclose(out);
-	free(buffer);
-	return;
+static void sdo_rest__eds_read_more(struct sdo_rest_eds_context* self)
+{
+	while (self->n_in_flight < SDO_REST_EDS_WINDOW
+	    && self->next_read < self->n_items) {
+		struct sdo_rest_eds_item* item = &self->items[self->next_read++];
+		if (item->is_ready)
+			continue;
+
+		struct sdo_req_info info = {
+			.type = SDO_REQ_UPLOAD,
+			.index = eds_obj_index(item->obj),
+			.subindex = eds_obj_subindex(item->obj),
+			.on_done = sdo_rest__eds_on_read_done,
+			.context = item
+		};
+
+		struct sdo_req* req = sdo_req_new(&info);
+		if (!req) {
+			item->is_ready = 1;
+			continue;
+		}
+
+		if (sdo_req_start(req, sdo_req_queue_get(self->nodeid)) == 0)
+			++self->n_in_flight;
+		else
+			item->is_ready = 1;
+
+		sdo_req_unref(req);
+	}
 }
 
-void sdo_rest__eds_job_done(struct mloop_work* work)
+static int sdo_rest__eds_init_items(struct sdo_rest_eds_context* self,
+				    const struct canopen_eds* eds)
 {
-	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
-	struct rest_client* client = context->client;
-	char* buffer = context->buffer;
-	size_t length = context->length;
+	const struct eds_obj* obj;
+	size_t n = 0;
 
-	if (client->state == REST_CLIENT_DISCONNECTED)
-		return;
+	for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj))
+		++n;
 
-	struct rest_reply_data reply = {
-		.status_code = "200 OK",
-		.content_type = "application/json",
-		.content_length = length,
-		.content = buffer
-	};
+	self->items = calloc(n ? n : 1, sizeof(*self->items));
+	if (!self->items)
+		return -1;
+
+	for (obj = eds_obj_first(eds); obj; obj = eds_obj_next(eds, obj)) {
+		struct sdo_rest_eds_item* item = &self->items[self->n_items++];
+
+		item->parent = self;
+		item->obj = obj;
+
+		if (!sdo_rest__eds_is_readable(obj)) {
+			item->is_ready = 1;
+			continue;
+		}
 
-	rest_reply(client->output, &reply);
+		item->value = sdo_rest__cached_value(self->nodeid, obj);
+		item->is_ready = item->value != NULL;
+	}
 
-	client->state = REST_CLIENT_DONE;
+	return 0;
 }
 
-void sdo_rest__eds_job_free(void* ptr)
+/* Without values, the document only depends on the EDS. All of them are built
+ * along with gzip-compressed copies by sdo_rest_init() right after the EDS
+ * database has been loaded, so serving one never does more than copy it out.
+ * The entity tag is a hash of the document.
+ */
+struct sdo_rest_eds_doc {
+	char* json;
+	size_t json_size;
+	char etag[24];
+#ifdef HAVE_ZLIB
+	void* gzip;
+	size_t gzip_size;
+	char gzip_etag[28];
+#endif
+};
+
+static struct sdo_rest_eds_doc* sdo_rest_eds_docs_ = NULL;
+static size_t sdo_rest_n_eds_docs_ = 0;
+
+static uint64_t sdo_rest__hash(const void* data, size_t size)
 {
-	struct sdo_rest_eds_context* context = ptr;
-	struct rest_client* client = context->client;
-	rest_client_unref(client);
-	free(context->buffer);
-	free(context);
+	const uint8_t* bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
 }
 
-int sdo_rest__send_eds(struct rest_client* client)
+#ifdef HAVE_ZLIB
+/* The compressed copy is only kept if it is smaller. The default level gets
+ * most of the size reduction for a fraction of the time of the best one.
+ */
+static void sdo_rest__eds_doc_compress(struct sdo_rest_eds_doc* doc)
 {
-	unsigned int nodeid = strtoul(client->req.url[1], NULL, 10);
+	z_stream zs = { 0 };
+
+	/* 16 is added to the window bits for a gzip header */
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	size_t bound = deflateBound(&zs, doc->json_size);
+	void* gzip = malloc(bound);
+	if (!gzip)
+		goto done;
+
+	zs.next_in = (Bytef*)doc->json;
+	zs.avail_in = doc->json_size;
+	zs.next_out = gzip;
+	zs.avail_out = bound;
+
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END
+	 || zs.total_out >= doc->json_size) {
+		free(gzip);
+		goto done;
+	}
+
+	doc->gzip = gzip;
+	doc->gzip_size = zs.total_out;
+
+	/* Each encoding is a representation of its own with its own tag */
+	snprintf(doc->gzip_etag, sizeof(doc->gzip_etag), "\"%016llx-gz\"",
+		 (unsigned long long)sdo_rest__hash(doc->json,
+						    doc->json_size));
+done:
+	deflateEnd(&zs);
+}
+#endif
+
+static int sdo_rest__eds_doc_build(struct sdo_rest_eds_doc* doc,
+				   const struct canopen_eds* eds)
+{
+	FILE* out = open_memstream(&doc->json, &doc->json_size);
+	if (!out)
+		return -1;
+
+	fprintf(out, "{\n");
+
+	for (const struct eds_obj* obj = eds_obj_first(eds); obj;
+	     obj = eds_obj_next(eds, obj)) {
+		if (obj != eds_obj_first(eds))
+			fprintf(out, ",\n");
+
+		sdo_rest__eds_print_obj(out, obj, 0, NULL);
+	}
+
+	fprintf(out, "\n}\n");
+
+	if (fclose(out) != 0) {
+		free(doc->json);
+		doc->json = NULL;
+		return -1;
+	}
+
+	snprintf(doc->etag, sizeof(doc->etag), "\"%016llx\"",
+		 (unsigned long long)sdo_rest__hash(doc->json,
+						    doc->json_size));
+#ifdef HAVE_ZLIB
+	sdo_rest__eds_doc_compress(doc);
+#endif
+	return 0;
+}
+
+int sdo_rest_init(void)
+{
+	size_t n = eds_db_length();
+
+	sdo_rest_eds_docs_ = calloc(n ? n : 1, sizeof(*sdo_rest_eds_docs_));
+	if (!sdo_rest_eds_docs_)
+		return -1;
+
+	sdo_rest_n_eds_docs_ = n;
+
+	for (size_t i = 0; i < n; ++i)
+		if (sdo_rest__eds_doc_build(&sdo_rest_eds_docs_[i],
+					    eds_db_get(i)) < 0)
+			return -1;
+
+	return 0;
+}
+
+static const struct sdo_rest_eds_doc*
+sdo_rest__eds_doc_get(const struct canopen_eds* eds)
+{
+	for (size_t i = 0; i < sdo_rest_n_eds_docs_; ++i)
+		if (eds_db_get(i) == eds)
+			return sdo_rest_eds_docs_[i].json
+			     ? &sdo_rest_eds_docs_[i] : NULL;
+
+	return NULL;
+}
+
+void sdo_rest_cleanup(void)
+{
+	for (size_t i = 0; i < sdo_rest_n_eds_docs_; ++i) {
+		free(sdo_rest_eds_docs_[i].json);
+#ifdef HAVE_ZLIB
+		free(sdo_rest_eds_docs_[i].gzip);
+#endif
+	}
+
+	free(sdo_rest_eds_docs_);
+	sdo_rest_eds_docs_ = NULL;
+	sdo_rest_n_eds_docs_ = 0;
+}
+
+static void sdo_rest__send_eds_doc(struct rest_client* client,
+				   const struct canopen_eds* eds)
+{
+	const struct sdo_rest_eds_doc* doc = sdo_rest__eds_doc_get(eds);
+	if (!doc) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return;
+	}
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = doc->json_size,
+		.content = doc->json,
+		.etag = doc->etag,
+		.cache_control = "no-cache",
+	};
+
+#ifdef HAVE_ZLIB
+	if (doc->gzip) {
+		reply.vary = "Accept-Encoding";
+
+		if (client->req.accepts_gzip) {
+			reply.content_length = doc->gzip_size;
+			reply.content = doc->gzip;
+			reply.content_encoding = "gzip";
+			reply.etag = doc->gzip_etag;
+		}
+	}
+#endif
+
+	if (http_req_etag_matches(&client->req, reply.etag)) {
+		reply.status_code = "304 Not Modified";
+		reply.content_type = NULL;
+		reply.content_length = REST_NO_CONTENT_LENGTH;
+		reply.content = NULL;
+		reply.content_encoding = NULL;
+	}
+
+	rest_reply(client, &reply);
+	rest_client_done(client);
+}
+
+/* With ?with_value, the EDS is streamed with chunked encoding. The values are
+ * read through the SDO queue of the node and each object is sent as soon as
+ * it and those before it have their values.
+ */
+int sdo_rest__send_eds(struct rest_client* client)
+{
+	unsigned int nodeid = strtoul(client->req.url[1], NULL, 10);
 	if (!is_in_range(nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)) {
 		sdo_rest_not_found(client, "URL is out of range\r\n");
 		return -1;
@@ -594,33 +1128,53 @@ int sdo_rest__send_eds(struct rest_client* client)
 		return -1;
 	}
 
+	if (!http_req_query(&client->req, "with_value")) {
+		sdo_rest__send_eds_doc(client, eds);
+		return 0;
+	}
+
 	struct sdo_rest_eds_context* context = malloc(sizeof(*context));
+	if (!context)
+		goto failure;
+
 	memset(context, 0, sizeof(*context));
 	context->client = client;
-	context->eds = eds;
 	context->nodeid = nodeid;
 
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	if (!work) {
-		sdo_rest_server_error(client, "Out of memory\r\n");
+	if (sdo_rest__eds_init_items(context, eds) < 0)
 		goto failure;
-	}
 
-	mloop_work_set_context(work, context, sdo_rest__eds_job_free);
-	mloop_work_set_work_fn(work, sdo_rest__eds_job);
-	mloop_work_set_done_fn(work, sdo_rest__eds_job_done);
-	if (mloop_work_start(work) < 0)
-		sdo_rest_server_error(client, "Failed to schedule response\r\n");
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = -1,
+	};
+
+	rest_reply_header(client, &reply);
+	rest_reply_chunk(client, "{\n", 2);
 
 	rest_client_ref(client);
-	mloop_work_unref(work);
+
+	sdo_rest__eds_read_more(context);
+	sdo_rest__eds_flush(context);
+
+	if (context->n_in_flight == 0)
+		sdo_rest__eds_free(context);
+
 	return 0;
 
 failure:
+	sdo_rest_server_error(client, "Out of memory\r\n");
 	free(context);
 	return -1;
 }
 
+/* Values are read and written as text unless a read is made with
+ * "Accept: application/octet-stream" or a write with "Content-Type:
+ * application/octet-stream". The raw bytes of the object are then streamed to
+ * and from the bus as they go, so that large DOMAIN objects need not be held
+ * in memory.
+ */
 void sdo_rest_service(struct rest_client* client, const void* content)
 {
 	if (client->req.url_index == 2 && client->req.method == HTTP_GET) {
@@ -649,3 +1203,522 @@ void sdo_rest_service(struct rest_client* client, const void* content)
 	if (sdo_rest__process(context, content) < 0)
 		free(context);
 }
+
+/* Bulk SDO access
+ *
+ * PUT /sdo-bulk takes a JSON list of operations:
+ *
+ *	[{"node": 3, "index": "0x1017", "subindex": 0},
+ *	 {"node": 4, "index": 4119, "subindex": 0, "value": 1000,
+ *	  "type": "UNSIGNED16"}]
+ *
+ * Operations with a value are writes and the others are reads. The type is
+ * looked up in the EDS if it is not given. Each node works through its own
+ * operations in order while different nodes proceed in parallel, and a
+ * result is streamed back for each operation as soon as it completes:
+ *
+ *	[{"i": 1, "node": 4, "index": "0x1017", "subindex": 0, "ok": true},
+ *	 {"i": 0, "node": 3, "index": "0x1017", "subindex": 0, "ok": true,
+ *	  "value": "1000"}]
+ *
+ * Only one operation per node is queued at a time so that requests from
+ * drivers never wait behind more than one of them.
+ */
+#define SDO_REST_BULK_MAX_ACTIVE 4
+#define SDO_REST_BULK_NONE ((size_t)-1)
+
+static int sdo_rest_bulk_active_ = 0;
+
+static char* sdo_rest__json_skip_ws(char* str)
+{
+	return str + strspn(str, " \t\r\n");
+}
+
+/* The string is unescaped in place and NUL terminated where the closing
+ * quote was.
+ */
+char* sdo_rest__json_string(char* str, const char** dst)
+{
+	if (*str++ != '"')
+		return NULL;
+
+	*dst = str;
+	char* out = str;
+
+	while (*str != '"') {
+		if (*str == '\0')
+			return NULL;
+
+		if (*str != '\\') {
+			*out++ = *str++;
+			continue;
+		}
+
+		switch (*++str) {
+		case '"': case '\\': case '/': *out++ = *str; break;
+		case 'n': *out++ = '\n'; break;
+		case 't': *out++ = '\t'; break;
+		case 'r': *out++ = '\r'; break;
+		default: return NULL;
+		}
+
+		++str;
+	}
+
+	*out = '\0';
+	return str + 1;
+}
+
+/* Only numbers are taken; true, false and null are not valid values here */
+char* sdo_rest__json_literal(char* str, char* dst, size_t size)
+{
+	size_t len = strspn(str, "+-.0123456789abcdefxABCDEFX");
+	if (len == 0 || len >= size || isalnum((unsigned char)str[len]))
+		return NULL;
+
+	memcpy(dst, str, len);
+	dst[len] = '\0';
+	return str + len;
+}
+
+char* sdo_rest__json_int(char* str, int* dst)
+{
+	char buffer[32];
+	const char* value = buffer;
+	char* end;
+
+	if (*str == '"')
+		str = sdo_rest__json_string(str, &value);
+	else
+		str = sdo_rest__json_literal(str, buffer, sizeof(buffer));
+
+	if (!str)
+		return NULL;
+
+	long number = strtol(value, &end, 0);
+	if (*value == '\0' || *end != '\0' || number < 0 || number > 0xffff)
+		return NULL;
+
+	*dst = number;
+	return str;
+}
+
+char* sdo_rest__json_value(char* str, struct sdo_rest_bulk_op* op)
+{
+	if (*str == '"')
+		return sdo_rest__json_string(str, &op->value);
+
+	op->value = op->literal;
+	return sdo_rest__json_literal(str, op->literal, sizeof(op->literal));
+}
+
+enum sdo_rest_bulk_key {
+	SDO_REST_BULK_KEY_NODE = 1 << 0,
+	SDO_REST_BULK_KEY_INDEX = 1 << 1,
+	SDO_REST_BULK_KEY_SUBINDEX = 1 << 2,
+	SDO_REST_BULK_KEY_VALUE = 1 << 3,
+	SDO_REST_BULK_KEY_TYPE = 1 << 4,
+};
+
+static enum sdo_rest_bulk_key sdo_rest__bulk_key(const char* key)
+{
+	if (strcmp(key, "node") == 0) return SDO_REST_BULK_KEY_NODE;
+	if (strcmp(key, "index") == 0) return SDO_REST_BULK_KEY_INDEX;
+	if (strcmp(key, "subindex") == 0) return SDO_REST_BULK_KEY_SUBINDEX;
+	if (strcmp(key, "value") == 0) return SDO_REST_BULK_KEY_VALUE;
+	if (strcmp(key, "type") == 0) return SDO_REST_BULK_KEY_TYPE;
+	return 0;
+}
+
+/* Unknown and repeated keys are rejected rather than guessing which one was
+ * meant.
+ */
+static char* sdo_rest__bulk_parse_op(char* str, struct sdo_rest_bulk_op* op)
+{
+	const char* key;
+	unsigned int keys_seen = 0;
+
+	op->nodeid = -1;
+	op->index = -1;
+	op->subindex = -1;
+
+	if (*str++ != '{')
+		return NULL;
+
+	str = sdo_rest__json_skip_ws(str);
+	if (*str == '}')
+		return NULL;
+
+	while (1) {
+		str = sdo_rest__json_string(str, &key);
+		if (!str)
+			return NULL;
+
+		str = sdo_rest__json_skip_ws(str);
+		if (*str++ != ':')
+			return NULL;
+
+		str = sdo_rest__json_skip_ws(str);
+
+		enum sdo_rest_bulk_key id = sdo_rest__bulk_key(key);
+		if (!id || (keys_seen & id))
+			return NULL;
+
+		keys_seen |= id;
+
+		switch (id) {
+		case SDO_REST_BULK_KEY_NODE:
+			str = sdo_rest__json_int(str, &op->nodeid);
+			break;
+		case SDO_REST_BULK_KEY_INDEX:
+			str = sdo_rest__json_int(str, &op->index);
+			break;
+		case SDO_REST_BULK_KEY_SUBINDEX:
+			str = sdo_rest__json_int(str, &op->subindex);
+			break;
+		case SDO_REST_BULK_KEY_VALUE:
+			str = sdo_rest__json_value(str, op);
+			break;
+		case SDO_REST_BULK_KEY_TYPE:
+			str = sdo_rest__json_string(str, &op->type);
+			break;
+		}
+
+		if (!str)
+			return NULL;
+
+		str = sdo_rest__json_skip_ws(str);
+		if (*str == '}')
+			break;
+
+		if (*str++ != ',')
+			return NULL;
+
+		str = sdo_rest__json_skip_ws(str);
+	}
+
+	if (!is_in_range(op->nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)
+	 || op->index < 0x1000 || !is_in_range(op->subindex, 0, 0xff))
+		return NULL;
+
+	return str + 1;
+}
+
+int sdo_rest__bulk_parse(struct sdo_rest_bulk* self, char* str)
+{
+	size_t size = 0;
+
+	str = sdo_rest__json_skip_ws(str);
+	if (*str++ != '[')
+		return -1;
+
+	str = sdo_rest__json_skip_ws(str);
+	if (*str == ']')
+		return 0;
+
+	while (1) {
+		if (self->n_ops >= SDO_REST_BULK_MAX_OPS)
+			return -1;
+
+		if (self->n_ops >= size) {
+			size = size ? size * 2 : 16;
+			void* ops = realloc(self->ops, size * sizeof(*self->ops));
+			if (!ops)
+				return -1;
+
+			self->ops = ops;
+		}
+
+		struct sdo_rest_bulk_op* op = &self->ops[self->n_ops++];
+		memset(op, 0, sizeof(*op));
+
+		str = sdo_rest__bulk_parse_op(str, op);
+		if (!str)
+			return -1;
+
+		str = sdo_rest__json_skip_ws(str);
+		if (*str == ']')
+			break;
+
+		if (*str++ != ',')
+			return -1;
+
+		str = sdo_rest__json_skip_ws(str);
+	}
+
+	str = sdo_rest__json_skip_ws(str + 1);
+	return *str == '\0' ? 0 : -1;
+}
+
+/* Operations are chained per node in the order in which they were given */
+static void sdo_rest__bulk_link(struct sdo_rest_bulk* self)
+{
+	size_t last[CANOPEN_NODEID_MAX + 1];
+
+	for (int i = 0; i <= CANOPEN_NODEID_MAX; ++i)
+		self->next[i] = SDO_REST_BULK_NONE;
+
+	for (size_t i = 0; i < self->n_ops; ++i) {
+		struct sdo_rest_bulk_op* op = &self->ops[i];
+		op->bulk = self;
+		op->next = SDO_REST_BULK_NONE;
+
+		if (self->next[op->nodeid] == SDO_REST_BULK_NONE)
+			self->next[op->nodeid] = i;
+		else
+			self->ops[last[op->nodeid]].next = i;
+
+		last[op->nodeid] = i;
+	}
+}
+
+static void sdo_rest__bulk_free(struct sdo_rest_bulk* self)
+{
+	free(self->ops);
+	free(self->body);
+	free(self);
+}
+
+static void sdo_rest__bulk_result(struct sdo_rest_bulk* self,
+				  const struct sdo_rest_bulk_op* op,
+				  const char* value, const char* error)
+{
+	struct rest_client* client = self->client;
+	char escaped[512];
+	char line[768];
+
+	if (rest_client_is_disconnected(client))
+		return;
+
+	int len = snprintf(line, sizeof(line),
+			   "%s{\"i\": %zu, \"node\": %d, \"index\": \"%#x\", "
+			   "\"subindex\": %d, \"ok\": %s",
+			   self->is_first_result ? "" : ",\n",
+			   (size_t)(op - self->ops), op->nodeid, op->index,
+			   op->subindex, error ? "false" : "true");
+
+	if (value || error) {
+		sdo_rest__json_escape(escaped, sizeof(escaped),
+				      error ? error : value);
+		len += snprintf(line + len, sizeof(line) - len,
+				", \"%s\": \"%s\"", error ? "error" : "value",
+				escaped);
+	}
+
+	len += snprintf(line + len, sizeof(line) - len, "}");
+
+	self->is_first_result = 0;
+	rest_reply_chunk(client, line, len);
+}
+
+static void sdo_rest__bulk_finish(struct sdo_rest_bulk* self)
+{
+	struct rest_client* client = self->client;
+
+	if (!rest_client_is_disconnected(client)) {
+		rest_reply_chunk(client, "\n]\n", 3);
+		rest_reply_chunk(client, NULL, 0);
+		rest_client_done(client);
+	}
+
+	--sdo_rest_bulk_active_;
+	rest_client_unref(client);
+	sdo_rest__bulk_free(self);
+}
+
+static void sdo_rest__bulk_on_done(struct sdo_req* req);
+
+static enum canopen_type
+sdo_rest__bulk_get_type(const struct sdo_rest_bulk_op* op, const char** error)
+{
+	int is_write = op->value != NULL;
+
+	if (op->type) {
+		enum canopen_type type = canopen_type_from_string(op->type);
+		if (type == CANOPEN_UNKNOWN)
+			*error = "Unknown type";
+		return type;
+	}
+
+	const struct canopen_eds* eds = sdo_rest__find_eds(op->nodeid);
+	if (!eds) {
+		*error = "Could not find EDS for node";
+		return CANOPEN_UNKNOWN;
+	}
+
+	const struct eds_obj* obj = eds_obj_find(eds, op->index, op->subindex);
+	if (!obj) {
+		*error = "Index/subindex not found in EDS";
+		return CANOPEN_UNKNOWN;
+	}
+
+	if (is_write && !(obj->access & EDS_OBJ_W)) {
+		*error = "Object is not writable";
+		return CANOPEN_UNKNOWN;
+	}
+
+	if (!is_write && !(obj->access & (EDS_OBJ_R | EDS_OBJ_CONST))) {
+		*error = "Object is not readable";
+		return CANOPEN_UNKNOWN;
+	}
+
+	return obj->type;
+}
+
+static int sdo_rest__bulk_start_op(struct sdo_rest_bulk_op* op,
+				   const char** error)
+{
+	int is_write = op->value != NULL;
+	struct canopen_data data = { 0 };
+
+	enum canopen_type type = sdo_rest__bulk_get_type(op, error);
+	if (type == CANOPEN_UNKNOWN)
+		return -1;
+
+	if (is_write && canopen_data_fromstring(&data, type, op->value) < 0) {
+		*error = "Data conversion failed";
+		return -1;
+	}
+
+	struct sdo_req_info info = {
+		.type = is_write ? SDO_REQ_DOWNLOAD : SDO_REQ_UPLOAD,
+		.index = op->index,
+		.subindex = op->subindex,
+		.on_done = sdo_rest__bulk_on_done,
+		.context = op,
+		.dl_data = data.data,
+		.dl_size = data.size
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req) {
+		*error = "Out of memory";
+		return -1;
+	}
+
+	op->data_type = type;
+
+	int rc = sdo_req_start(req, sdo_req_queue_get(op->nodeid));
+	sdo_req_unref(req);
+
+	if (rc < 0)
+		*error = "Failed to start sdo request";
+
+	return rc;
+}
+
+/* Start the next operation for the node, reporting those that fail to start
+ * along the way.
+ */
+static void sdo_rest__bulk_start_next(struct sdo_rest_bulk* self, int nodeid)
+{
+	while (self->next[nodeid] != SDO_REST_BULK_NONE) {
+		struct sdo_rest_bulk_op* op = &self->ops[self->next[nodeid]];
+		self->next[nodeid] = op->next;
+
+		const char* error = NULL;
+		if (sdo_rest__bulk_start_op(op, &error) == 0) {
+			++self->n_in_flight;
+			return;
+		}
+
+		sdo_rest__bulk_result(self, op, NULL, error);
+	}
+}
+
+static void sdo_rest__bulk_on_done(struct sdo_req* req)
+{
+	struct sdo_rest_bulk_op* op = req->context;
+	struct sdo_rest_bulk* self = op->bulk;
+	char buffer[256];
+
+	--self->n_in_flight;
+
+	if (req->status != SDO_REQ_OK) {
+		sdo_rest__bulk_result(self, op, NULL,
+				      sdo_strerror(req->abort_code));
+	} else if (req->type == SDO_REQ_UPLOAD) {
+		struct canopen_data data = {
+			.type = op->data_type,
+			.data = req->data.data,
+			.size = req->data.index,
+			.is_size_unknown = !req->is_size_indicated
+		};
+
+		const char* value = canopen_data_tostring(buffer,
+							  sizeof(buffer),
+							  &data);
+		sdo_rest__bulk_result(self, op, value,
+				      value ? NULL : "Data conversion failed");
+	} else {
+		sdo_rest__bulk_result(self, op, NULL, NULL);
+	}
+
+	if (!rest_client_is_disconnected(self->client))
+		sdo_rest__bulk_start_next(self, op->nodeid);
+
+	if (self->n_in_flight == 0)
+		sdo_rest__bulk_finish(self);
+}
+
+void sdo_rest_bulk_service(struct rest_client* client, const void* content)
+{
+	size_t content_length = client->req.content_length;
+
+	if (sdo_rest_bulk_active_ >= SDO_REST_BULK_MAX_ACTIVE) {
+		sdo_rest_unavailable(client, "Too many bulk requests\r\n");
+		return;
+	}
+
+	struct sdo_rest_bulk* self = malloc(sizeof(*self));
+	if (!self) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return;
+	}
+
+	memset(self, 0, sizeof(*self));
+
+	self->client = client;
+	self->is_first_result = 1;
+
+	self->body = malloc(content_length + 1);
+	if (!self->body) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		goto failure;
+	}
+
+	memcpy(self->body, content, content_length);
+	self->body[content_length] = '\0';
+
+	if (sdo_rest__bulk_parse(self, self->body) < 0) {
+		sdo_rest_bad_request(client, "Expected a list of at most "
+				     XSTR(SDO_REST_BULK_MAX_OPS)
+				     " operations\r\n");
+		goto failure;
+	}
+
+	sdo_rest__bulk_link(self);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = -1,
+	};
+
+	rest_reply_header(client, &reply);
+	rest_reply_chunk(client, "[\n", 2);
+
+	++sdo_rest_bulk_active_;
+	rest_client_ref(client);
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i)
+		sdo_rest__bulk_start_next(self, i);
+
+	if (self->n_in_flight == 0)
+		sdo_rest__bulk_finish(self);
+
+	return;
+
+failure:
+	sdo_rest__bulk_free(self);
+}
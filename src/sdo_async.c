@@ -142,7 +142,7 @@ void sdo_async_destroy(struct sdo_async* self)
 
 static inline int sdo_async__is_expediated(const struct sdo_async* self)
 {
-	return self->buffer.index <= SDO_EXPEDIATED_DATA_SIZE;
+	return self->size <= SDO_EXPEDIATED_DATA_SIZE;
 }
 
 int sdo_async__send_init_dl(struct sdo_async* self)
@@ -160,7 +160,7 @@ int sdo_async__send_init_dl(struct sdo_async* self)
 		memcpy(&cf.data[SDO_EXPEDIATED_DATA_IDX], self->buffer.data,
 		       self->buffer.index);
 	} else {
-		sdo_set_indicated_size(&cf, self->buffer.index);
+		sdo_set_indicated_size(&cf, self->size);
 		cf.can_dlc = CAN_MAX_DLC;
 	}
 	mloop_timer_start(self->timer);
@@ -181,6 +181,19 @@ int sdo_async__send_init_ul(struct sdo_async* self)
 	return 0;
 }
 
+static void sdo_async__request_data(struct sdo_async* self)
+{
+	if (!self->on_data || self->is_data_requested)
+		return;
+
+	if (self->buffer.index - self->pos >= SDO_ASYNC_STREAM_CHUNK
+	 || self->offset + self->buffer.index >= self->size)
+		return;
+
+	self->is_data_requested = 1;
+	self->on_data(self);
+}
+
 int sdo_async__send_init(struct sdo_async* self)
 {
 	switch (self->type) {
@@ -197,6 +210,10 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	if (self->is_running)
 		return -1;
 
+	if (info->stream_size && (info->stream_size <= SDO_EXPEDIATED_DATA_SIZE
+				  || info->size > info->stream_size))
+		return -1;
+
 	self->context = info->context;
 	self->free_fn = info->free_fn;
 	self->pos = 0;
@@ -207,12 +224,19 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->is_size_indicated = 0;
+	self->offset = 0;
+	self->on_data = info->on_data;
+	self->is_waiting_for_data = 0;
+	self->is_data_requested = 0;
 	mloop_timer_set_time(self->timer, info->timeout * 1000000ULL);
 
-	if (info->type == SDO_REQ_DOWNLOAD)
+	if (info->type == SDO_REQ_DOWNLOAD) {
 		vector_assign(&self->buffer, info->data, info->size);
-	else
+		self->size = info->stream_size ? info->stream_size : info->size;
+	} else {
 		vector_clear(&self->buffer);
+		self->size = 0;
+	}
 
 	self->comm_state = SDO_ASYNC_COMM_INIT_RESPONSE;
 
@@ -220,12 +244,18 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 
 	sdo_async__send_init(self);
 
+	if (info->type == SDO_REQ_DOWNLOAD)
+		sdo_async__request_data(self);
+
 	return 0;
 }
 
+/* Segments that have been sent are dropped from the front of the buffer while
+ * streaming, so offset bytes of the download are no longer in it.
+ */
 static inline int sdo_async__is_at_end(const struct sdo_async* self)
 {
-	return self->pos >= self->buffer.index;
+	return self->offset + self->pos >= self->size;
 }
 
 int sdo_async__request_dl_segment(struct sdo_async* self)
@@ -253,6 +283,50 @@ int sdo_async__request_dl_segment(struct sdo_async* self)
 	return 0;
 }
 
+/* Only full segments are sent, except for the last one, so a streamed download
+ * may have to wait for data. The timer is left running while it waits.
+ */
+static int sdo_async__continue_dl(struct sdo_async* self)
+{
+	size_t available = self->buffer.index - self->pos;
+	size_t remaining = self->size - self->offset - self->pos;
+
+	if (available < SDO_SEGMENT_MAX_SIZE && available < remaining) {
+		self->is_waiting_for_data = 1;
+		mloop_timer_start(self->timer);
+	} else {
+		sdo_async__request_dl_segment(self);
+	}
+
+	sdo_async__request_data(self);
+	return 0;
+}
+
+int sdo_async_append(struct sdo_async* self, const void* data, size_t size)
+{
+	if (!self->is_running || self->type != SDO_REQ_DOWNLOAD
+	 || self->offset + self->buffer.index + size > self->size)
+		return -1;
+
+	char* buffer = self->buffer.data;
+	memmove(buffer, buffer + self->pos, self->buffer.index - self->pos);
+	self->buffer.index -= self->pos;
+	self->offset += self->pos;
+	self->pos = 0;
+
+	if (vector_append(&self->buffer, data, size) < 0)
+		return sdo_async__abort(self, SDO_ABORT_NOMEM);
+
+	self->is_data_requested = 0;
+
+	if (!self->is_waiting_for_data)
+		return 0;
+
+	self->is_waiting_for_data = 0;
+	mloop_timer_stop(self->timer);
+	return sdo_async__continue_dl(self);
+}
+
 int sdo_async__feed_init_dl_response(struct sdo_async* self,
 				     const struct can_frame* cf)
 {
@@ -274,8 +348,8 @@ int sdo_async__feed_init_dl_response(struct sdo_async* self,
 		self->status = SDO_REQ_OK;
 		sdo_async__on_done(self);
 	} else {
-		sdo_async__request_dl_segment(self);
 		self->comm_state = SDO_ASYNC_COMM_SEG_RESPONSE;
+		sdo_async__continue_dl(self);
 	}
 
 	return 0;
@@ -312,7 +386,11 @@ int sdo_async__handle_init_segmented_ul(struct sdo_async* self,
 					const struct can_frame* cf)
 {
 	self->is_size_indicated = sdo_is_size_indicated(cf);
-	if (self->is_size_indicated && cf->can_dlc == CAN_MAX_DLC)
+	/* Streamed uploads are passed on in pieces, so the whole size is not
+	 * reserved for them.
+	 */
+	if (self->is_size_indicated && cf->can_dlc == CAN_MAX_DLC
+	 && !self->on_data)
 		if (vector_reserve(&self->buffer, sdo_get_indicated_size(cf)) < 0)
 			return sdo_async__abort(self, SDO_ABORT_NOMEM);
 
@@ -375,7 +453,7 @@ int sdo_async__feed_dl_seg_response(struct sdo_async* self,
 		self->status = SDO_REQ_OK;
 		sdo_async__on_done(self);
 	} else {
-		sdo_async__request_dl_segment(self);
+		sdo_async__continue_dl(self);
 	}
 
 	return 0;
@@ -404,8 +482,14 @@ int sdo_async__feed_ul_seg_response(struct sdo_async* self,
 	if (sdo_is_end_segment(cf)) {
 		self->status = SDO_REQ_OK;
 		sdo_async__on_done(self);
-	} else {
-		sdo_async__request_ul_segment(self);
+		return 0;
+	}
+
+	sdo_async__request_ul_segment(self);
+
+	if (self->on_data && self->buffer.index >= SDO_ASYNC_STREAM_CHUNK) {
+		self->on_data(self);
+		vector_clear(&self->buffer);
 	}
 
 	return 0;
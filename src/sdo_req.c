@@ -37,6 +37,7 @@
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req.h"
 #include "sock.h"
+#include "time-utils.h"
 
 #define SDO_REQ_TIMEOUT 1000 /* ms */
 #define SDO_REQ_ASYNC_PRIO 1000
@@ -59,8 +60,14 @@ struct sdo_req* sdo_req_new(struct sdo_req_info* info)
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->on_done = info->on_done;
+	self->on_data = info->on_data;
+	self->stream_size = info->stream_size;
 	self->context = info->context;
 
+	if (info->stream_size && (info->stream_size <= SDO_EXPEDIATED_DATA_SIZE
+				  || info->dl_size > info->stream_size))
+		goto failure;
+
 	if (info->type == SDO_REQ_DOWNLOAD) {
 		if (vector_assign(&self->data, info->dl_data,
 				  info->dl_size) < 0)
@@ -209,6 +216,7 @@ int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
 		++self->size;
 
 	req->parent = self;
+	req->start_time = gettime_ns(CLOCK_MONOTONIC);
 	TAILQ_INSERT_TAIL(&self->list, req, links);
 	mloop_iterate(mloop_default());
 
@@ -257,6 +265,7 @@ void sdo_req_wait(struct sdo_req* self)
 }
 
 void sdo_req__on_done(struct sdo_async* async);
+void sdo_req__on_data(struct sdo_async* async);
 
 void sdo_req__on_stop(void* ptr)
 {
@@ -298,7 +307,9 @@ void sdo_req__process_queue(struct mloop_idle* idle)
 		.size = req->data.index,
 		.on_done = sdo_req__on_done,
 		.context = req,
-		.free_fn = sdo_req__on_stop
+		.free_fn = sdo_req__on_stop,
+		.stream_size = req->stream_size,
+		.on_data = req->on_data ? sdo_req__on_data : NULL
 	};
 
 	sdo_async_start(&queue->sdo_client, &info);
@@ -307,6 +318,24 @@ done:
 	sdo_req_queue__unlock(queue);
 }
 
+static void sdo_req__count(struct sdo_req_queue* queue,
+			   const struct sdo_req* req)
+{
+	struct sdo_req_stats* stats = &queue->stats;
+
+	stats->n_requests++;
+
+	if (req->status == SDO_REQ_LOCAL_ABORT
+	 && req->abort_code == SDO_ABORT_TIMEOUT)
+		stats->n_timeouts++;
+	else if (req->status == SDO_REQ_LOCAL_ABORT
+	      || req->status == SDO_REQ_REMOTE_ABORT)
+		stats->n_aborts++;
+
+	metrics_histogram_observe(&stats->latency,
+				  gettime_ns(CLOCK_MONOTONIC) - req->start_time);
+}
+
 void sdo_req__on_done(struct sdo_async* async)
 {
 	struct sdo_req_queue* queue = sdo_req_queue__from_async(async);
@@ -323,6 +352,8 @@ void sdo_req__on_done(struct sdo_async* async)
 		if (vector_copy(&req->data, &async->buffer) < 0)
 			req->status = SDO_REQ_NOMEM;
 
+	sdo_req__count(queue, req);
+
 	sdo_req_fn on_done = req->on_done;
 	if (on_done)
 		on_done(req);
@@ -330,6 +361,39 @@ void sdo_req__on_done(struct sdo_async* async)
 	mloop_iterate(mloop_default());
 }
 
+void sdo_req__on_data(struct sdo_async* async)
+{
+	struct sdo_req* req = async->context;
+	assert(req != NULL);
+
+	/* The buffers are swapped rather than copied. The client clears its
+	 * buffer afterwards.
+	 */
+	if (req->type == SDO_REQ_UPLOAD) {
+		struct vector data = req->data;
+		req->data = async->buffer;
+		async->buffer = data;
+	}
+
+	req->on_data(req);
+}
+
+int sdo_req_append(struct sdo_req* self, const void* data, size_t size)
+{
+	struct sdo_req_queue* queue = self->parent;
+
+	if (queue && queue->sdo_client.is_running
+	 && queue->sdo_client.context == self)
+		return sdo_async_append(&queue->sdo_client, data, size);
+
+	/* The transfer has not started yet */
+	if (self->status != SDO_REQ_PENDING
+	 || self->data.index + size > self->stream_size)
+		return -1;
+
+	return vector_append(&self->data, data, size);
+}
+
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue)
 {
 	sdo_req_ref(self);
@@ -17,14 +17,18 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include "sock.h"
 #include "socketcan.h"
 #include "net-util.h"
 #include "can-tcp.h"
 #include "trace-buffer.h"
+#include "bus-stats.h"
+#include "time-utils.h"
 
 size_t strlcpy(char* dst, const char* src, size_t size);
 
@@ -70,12 +74,100 @@ sock__frame_ntohl(const struct sock* sock, struct can_frame* cf)
 	return cf;
 }
 
+static void sock__count_tx(const struct sock* sock,
+			   const struct can_frame* cf, ssize_t rc)
+{
+	if (rc < 0)
+		bs_count_error(sock->stats, BS_TX);
+	else
+		bs_count(sock->stats, BS_TX, cf, NULL,
+			 gettime_ns(CLOCK_MONOTONIC));
+}
+
 ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags)
 {
 	if (sock->tb)
 		tb_append(sock->tb, cf);
 
-	return send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf), flags);
+	if (!sock->stats)
+		return send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf),
+			    flags);
+
+	struct can_frame copy = *cf;
+	ssize_t rc = send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf),
+			  flags);
+	sock__count_tx(sock, &copy, rc);
+	return rc;
+}
+
+ssize_t sock_send_batch(const struct sock* sock, struct can_frame* frames,
+			size_t n)
+{
+	struct mmsghdr msgs[SOCK_BATCH_MAX];
+	struct iovec iov[SOCK_BATCH_MAX];
+
+	if (n > SOCK_BATCH_MAX)
+		n = SOCK_BATCH_MAX;
+
+	if (sock->tb)
+		for (size_t i = 0; i < n; ++i)
+			tb_append(sock->tb, &frames[i]);
+
+	/* A stream must not be left with half a frame, so everything is
+	 * written out and any error is treated as fatal.
+	 */
+	if (sock->type != SOCK_TYPE_CAN) {
+		for (size_t i = 0; i < n; ++i)
+			sock__frame_htonl(sock, &frames[i]);
+
+		const char* data = (const char*)frames;
+		size_t size = n * sizeof(*frames);
+		size_t sent = 0;
+
+		while (sent < size) {
+			ssize_t rc = send(sock->fd, data + sent, size - sent,
+					  MSG_NOSIGNAL);
+			if (rc < 0 && errno == EINTR)
+				continue;
+
+			if (rc < 0) {
+				if (sock->stats)
+					sock__count_tx(sock, NULL, rc);
+				return -1;
+			}
+
+			sent += rc;
+		}
+
+		if (sock->stats)
+			for (size_t i = 0; i < n; ++i) {
+				struct can_frame cf = frames[i];
+				sock__count_tx(sock, sock__frame_ntohl(sock, &cf),
+					       0);
+			}
+
+		return n;
+	}
+
+	memset(msgs, 0, n * sizeof(*msgs));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int count = sendmmsg(sock->fd, msgs, n, 0);
+
+	if (sock->stats && count < 0)
+		sock__count_tx(sock, NULL, count);
+
+	if (sock->stats)
+		for (int i = 0; i < count; ++i)
+			sock__count_tx(sock, &frames[i], 0);
+
+	return count;
 }
 
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout)
@@ -83,7 +175,15 @@ int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout)
 	if (sock->tb)
 		tb_append(sock->tb, cf);
 
-	return net_write_frame(sock->fd, sock__frame_htonl(sock, cf), timeout);
+	if (!sock->stats)
+		return net_write_frame(sock->fd, sock__frame_htonl(sock, cf),
+				       timeout);
+
+	struct can_frame copy = *cf;
+	int rc = net_write_frame(sock->fd, sock__frame_htonl(sock, cf),
+				 timeout);
+	sock__count_tx(sock, &copy, rc);
+	return rc;
 }
 
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
@@ -92,10 +192,11 @@ ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
 	if (rsize <= 0)
 		return rsize;
 
+	sock__frame_ntohl(sock, cf);
+
 	if (sock->tb)
 		tb_append(sock->tb, cf);
 
-	sock__frame_ntohl(sock, cf);
 	return rsize;
 }
 
@@ -103,10 +204,81 @@ int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout)
 {
 	int rc = net_read_frame(sock->fd, cf, timeout);
 
+	sock__frame_ntohl(sock, cf);
+
 	if (rc >= 0 && sock->tb)
 		tb_append(sock->tb, cf);
 
-	sock__frame_ntohl(sock, cf);
 	return rc;
 }
 
+
+static uint64_t sock__get_timestamp(struct msghdr* msg, uint64_t* now)
+{
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET
+		 || cmsg->cmsg_type != SO_TIMESTAMP)
+			continue;
+
+		struct timeval tv;
+		memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+		return tv.tv_sec * 1000000ULL + tv.tv_usec;
+	}
+
+	if (*now == 0)
+		*now = gettime_us(CLOCK_REALTIME);
+
+	return *now;
+}
+
+ssize_t sock_recv_batch(const struct sock* sock, struct tb_frame* frames,
+			size_t n)
+{
+	struct mmsghdr msgs[SOCK_BATCH_MAX];
+	struct iovec iov[SOCK_BATCH_MAX];
+	union {
+		char buffer[CMSG_SPACE(sizeof(struct timeval))];
+		struct cmsghdr align;
+	} control[SOCK_BATCH_MAX];
+	uint64_t now = 0;
+
+	/* A TCP stream could be split anywhere, so it is read a frame at a
+	 * time.
+	 */
+	if (sock->type != SOCK_TYPE_CAN) {
+		ssize_t rsize = sock_recv(sock, &frames[0].cf, MSG_WAITALL);
+		if (rsize <= 0)
+			return rsize;
+
+		frames[0].timestamp = gettime_us(CLOCK_REALTIME);
+		return 1;
+	}
+
+	if (n > SOCK_BATCH_MAX)
+		n = SOCK_BATCH_MAX;
+
+	memset(msgs, 0, n * sizeof(*msgs));
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = &frames[i].cf;
+		iov[i].iov_len = sizeof(frames[i].cf);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = control[i].buffer;
+		msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buffer);
+	}
+
+	int count = recvmmsg(sock->fd, msgs, n, MSG_WAITFORONE, NULL);
+	if (count <= 0)
+		return count;
+
+	for (int i = 0; i < count; ++i) {
+		frames[i].timestamp = sock__get_timestamp(&msgs[i].msg_hdr,
+							  &now);
+		if (sock->tb)
+			tb_append(sock->tb, &frames[i].cf);
+	}
+
+	return count;
+}
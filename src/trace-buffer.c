@@ -14,6 +14,8 @@
  */
 
 #include "trace-buffer.h"
+#include "trace-capture.h"
+#include "trace-format.h"
 
 #include "socketcan.h"
 #include "co_atomic.h"
@@ -24,6 +26,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <sched.h>
 
 static inline unsigned long clzl(unsigned long x)
 {
@@ -32,71 +35,164 @@ static inline unsigned long clzl(unsigned long x)
 
 static inline unsigned long round_up_to_power_of_2(unsigned long x)
 {
-	return 1UL << ((sizeof(x) << 3) - clzl(x - 1UL));
+	return x > 1 ? 1UL << ((sizeof(x) << 3) - clzl(x - 1UL)) : 1;
 }
 
-static inline int tb_try_block(struct tracebuffer* self)
+#define TB_SPIN_MAX 1000
+
+int tb_init(struct tracebuffer* self, size_t size)
 {
-	return co_atomic_cas(&self->is_blocked, 0, 1);
+	memset(self, 0, sizeof(*self));
+
+	if (size < sizeof(struct tb_frame))
+		return 0;
+
+	self->length = round_up_to_power_of_2(size / sizeof(struct tb_frame));
+	self->slots = calloc(self->length, sizeof(self->slots[0]));
+
+	return self->slots ? 0 : -1;
 }
 
-static inline void tb_unblock(struct tracebuffer* self)
+void tb_destroy(struct tracebuffer* self)
 {
-	co_atomic_store(&self->is_blocked, 0);
+	free(self->slots);
 }
 
-static inline int tb_is_blocked(const struct tracebuffer* self)
+/* A slot that has never been written has sequence number 0, which reads as
+ * position 0 being written, so positions before 0 count as overwritten.
+ */
+static inline uint32_t tb__written_seq(uint32_t pos)
 {
-	return co_atomic_load(&self->is_blocked);
+	return 2 * pos + 1;
 }
 
-int tb_init(struct tracebuffer* self, size_t size)
+void tb_set_capture(struct tracebuffer* self, struct tb_capture* capture)
 {
-	memset(self, 0, sizeof(*self));
+	self->capture = capture;
+}
 
-	self->length = round_up_to_power_of_2(size / sizeof(self->data[0]));
-	self->data = malloc(self->length * sizeof(self->data[0]));
+void tb_append(struct tracebuffer* self, const struct can_frame* frame)
+{
+	uint64_t timestamp = gettime_us(CLOCK_REALTIME);
 
-	return self->data ? 0 : -1;
+	if (self->capture)
+		tb_capture_append(self->capture, timestamp, frame);
+
+	if (self->length == 0)
+		return;
+
+	uint32_t pos = co_atomic_add_fetch(&self->head, 1) - 1;
+	struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+
+	co_atomic_store_release(&slot->seq, tb__written_seq(pos) - 1);
+	co_atomic_fence_release();
+
+	slot->frame.timestamp = timestamp;
+	slot->frame.cf = *frame;
+
+	co_atomic_store_release(&slot->seq, tb__written_seq(pos));
 }
 
-void tb_destroy(struct tracebuffer* self)
+/* Returns 1 if the frame at pos was copied and 0 if it has been overwritten.
+ */
+static int tb__read_slot(struct tracebuffer* self, uint32_t pos,
+			 struct tb_frame* dst)
+{
+	struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+	uint32_t expected = tb__written_seq(pos);
+
+	for (int i = 0; i < TB_SPIN_MAX; ++i) {
+		int32_t diff = co_atomic_load_acquire(&slot->seq) - expected;
+
+		if (diff > 0)
+			return 0;
+
+		/* The slot has been reserved but the writer is not done */
+		if (diff < 0) {
+			sched_yield();
+			continue;
+		}
+
+		*dst = slot->frame;
+		co_atomic_fence_acquire();
+
+		return co_atomic_load_acquire(&slot->seq) == expected;
+	}
+
+	return 0;
+}
+
+uint32_t tb_get_head(struct tracebuffer* self)
 {
-	free(self->data);
+	return co_atomic_load_acquire(&self->head);
 }
 
-void tb_append(struct tracebuffer* self, const struct can_frame* frame)
+size_t tb_copy(struct tracebuffer* self, uint32_t from, uint32_t to,
+	       struct tb_frame* dst)
 {
-	if (tb_is_blocked(self))
-		return;
+	uint32_t head = co_atomic_load_acquire(&self->head);
+	size_t n = 0;
+
+	if ((int32_t)(to - head) > 0)
+		to = head;
+
+	if ((int32_t)(head - from) > (int32_t)self->length)
+		from = head - self->length;
 
-	struct tb_frame tb_frame = {
-		.timestamp = gettime_us(CLOCK_REALTIME),
-		.cf = *frame,
-	};
+	for (uint32_t pos = from; (int32_t)(to - pos) > 0; ++pos)
+		n += tb__read_slot(self, pos, &dst[n]);
 
-	self->data[self->index++] = tb_frame;
-	self->index &= (self->length - 1);
+	return n;
+}
+
+size_t tb_snapshot(struct tracebuffer* self, struct tb_frame* dst)
+{
+	uint32_t head = tb_get_head(self);
 
-	if (self->count < self->length)
-		self->count++;
+	return tb_copy(self, head - self->length, head, dst);
 }
 
 void tb_dump(struct tracebuffer* self, FILE* stream)
 {
-	if (!tb_try_block(self))
+	if (self->length == 0)
 		return;
 
-	if (self->count < self->length) {
-		fwrite(self->data, sizeof(self->data[0]), self->count, stream);
-	} else {
-		fwrite(&self->data[self->index], sizeof(self->data[0]),
-		       self->length - self->index, stream);
+	struct tb_frame* frames = malloc(self->length * sizeof(*frames));
+	if (!frames)
+		return;
 
-		fwrite(self->data, sizeof(self->data[0]), self->index, stream);
-	}
+	size_t n = tb_snapshot(self, frames);
+	fwrite(frames, sizeof(*frames), n, stream);
+	fflush(stream);
+
+	free(frames);
+}
+
+int tb_dump_compact(struct tracebuffer* self, FILE* stream, int flags)
+{
+	struct tf_writer writer;
+	int rc = -1;
+
+	if (self->length == 0)
+		return 0;
+
+	struct tb_frame* frames = malloc(self->length * sizeof(*frames));
+	if (!frames)
+		return -1;
 
-	tb_unblock(self);
+	size_t n = tb_snapshot(self, frames);
 
+	if (tf_writer_init(&writer, stream, flags) < 0)
+		goto done;
+
+	for (size_t i = 0; i < n; ++i)
+		if (tf_writer_append(&writer, &frames[i]) < 0)
+			break;
+
+	rc = tf_writer_finish(&writer);
 	fflush(stream);
+
+done:
+	free(frames);
+	return rc;
 }
@@ -0,0 +1,340 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "trace-capture.h"
+
+#include "socketcan.h"
+#include "co_atomic.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TB_CAPTURE_PREFIX "capture."
+
+static inline unsigned long round_down_to_power_of_2(unsigned long x)
+{
+	return x ? 1UL << ((sizeof(x) << 3) - 1 - __builtin_clzl(x)) : 0;
+}
+
+static inline uint32_t tb_capture__written_seq(uint32_t pos)
+{
+	return 2 * pos + 1;
+}
+
+/* Generations wrap around along with the position counter, so segments are
+ * ordered by comparing the positions of their first slots as differences.
+ */
+static inline uint32_t tb_capture__first_pos(
+		const struct tb_capture_header* header)
+{
+	return header->generation * header->n_slots;
+}
+
+static void tb_capture__compose_path(char* dst, size_t size, const char* path,
+				     size_t index)
+{
+	snprintf(dst, size, "%s/" TB_CAPTURE_PREFIX "%zu", path, index);
+	dst[size - 1] = '\0';
+}
+
+static int tb_capture__is_valid(const struct tb_capture_header* header,
+				size_t n_slots)
+{
+	return header->magic == TB_CAPTURE_MAGIC
+	    && header->version == TB_CAPTURE_VERSION
+	    && header->n_slots == n_slots;
+}
+
+static int tb_capture__map_segment(struct tb_capture_segment* segment,
+				   const char* path, size_t n_slots)
+{
+	size_t size = sizeof(struct tb_capture_header)
+		    + n_slots * sizeof(struct tb_slot);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		goto failure;
+
+	if ((size_t)st.st_size != size) {
+		if (ftruncate(fd, 0) < 0)
+			goto failure;
+
+		errno = posix_fallocate(fd, 0, size);
+		if (errno != 0)
+			goto failure;
+	}
+
+	void* data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	segment->header = data;
+	segment->slots = (struct tb_slot*)(segment->header + 1);
+	segment->size = size;
+
+	if (!tb_capture__is_valid(segment->header, n_slots)) {
+		memset(segment->header, 0, sizeof(*segment->header));
+		segment->header->magic = TB_CAPTURE_MAGIC;
+		segment->header->version = TB_CAPTURE_VERSION;
+		segment->header->n_slots = n_slots;
+		segment->header->generation = TB_CAPTURE_EMPTY;
+	}
+
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int tb_capture_init(struct tb_capture* self, const char* path,
+		    size_t segment_size, size_t n_segments)
+{
+	char segment_path[256];
+
+	memset(self, 0, sizeof(*self));
+
+	if (segment_size <= sizeof(struct tb_capture_header) || n_segments == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	self->n_slots = round_down_to_power_of_2(
+		(segment_size - sizeof(struct tb_capture_header))
+		/ sizeof(struct tb_slot));
+	if (self->n_slots < 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	self->slot_shift = __builtin_ctzl(self->n_slots);
+	n_segments = round_down_to_power_of_2(n_segments);
+
+	self->segments = calloc(n_segments, sizeof(self->segments[0]));
+	if (!self->segments)
+		return -1;
+
+	int is_empty = 1;
+
+	for (self->n_segments = 0; self->n_segments < n_segments;
+	     ++self->n_segments) {
+		struct tb_capture_segment* segment =
+			&self->segments[self->n_segments];
+
+		tb_capture__compose_path(segment_path, sizeof(segment_path),
+					 path, self->n_segments);
+
+		if (tb_capture__map_segment(segment, segment_path,
+					    self->n_slots) < 0)
+			goto failure;
+
+		const struct tb_capture_header* header = segment->header;
+		if (header->generation == TB_CAPTURE_EMPTY)
+			continue;
+
+		uint32_t end = tb_capture__first_pos(header) + self->n_slots;
+		if (is_empty || (int32_t)(end - self->head) > 0)
+			self->head = end;
+
+		is_empty = 0;
+	}
+
+	return 0;
+
+failure:
+	tb_capture_destroy(self);
+	return -1;
+}
+
+void tb_capture_destroy(struct tb_capture* self)
+{
+	for (size_t i = 0; i < self->n_segments; ++i) {
+		struct tb_capture_segment* segment = &self->segments[i];
+		msync(segment->header, segment->size, MS_ASYNC);
+		munmap(segment->header, segment->size);
+	}
+
+	free(self->segments);
+	self->segments = NULL;
+	self->n_segments = 0;
+}
+
+void tb_capture_append(struct tb_capture* self, uint64_t timestamp,
+		       const struct can_frame* frame)
+{
+	uint32_t pos = co_atomic_add_fetch(&self->head, 1) - 1;
+	uint32_t generation = pos >> self->slot_shift;
+	size_t index = pos & (self->n_slots - 1);
+
+	struct tb_capture_segment* segment =
+		&self->segments[generation % self->n_segments];
+	struct tb_slot* slot = &segment->slots[index];
+
+	co_atomic_store_release(&slot->seq, tb_capture__written_seq(pos) - 1);
+	co_atomic_fence_release();
+
+	slot->frame.timestamp = timestamp;
+	slot->frame.cf = *frame;
+
+	co_atomic_store_release(&slot->seq, tb_capture__written_seq(pos));
+
+	if (index == 0) {
+		segment->header->start_time = timestamp;
+		co_atomic_store_release(&segment->header->generation,
+					generation);
+	}
+}
+
+void tb_capture_rotate(struct tb_capture* self)
+{
+	uint32_t head, next;
+
+	do {
+		head = co_atomic_load_acquire(&self->head);
+
+		if ((head & (self->n_slots - 1)) == 0)
+			return;
+
+		next = ((head >> self->slot_shift) + 1) << self->slot_shift;
+	} while (!co_atomic_cas(&self->head, head, next));
+}
+
+static int tb_capture__compare_generation(const void* a, const void* b)
+{
+	const struct tb_capture_segment* sa = a;
+	const struct tb_capture_segment* sb = b;
+	int32_t diff = tb_capture__first_pos(sa->header)
+		     - tb_capture__first_pos(sb->header);
+
+	return diff < 0 ? -1 : diff > 0;
+}
+
+static int tb_capture__open_segment(struct tb_capture_segment* segment,
+				    const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0
+	 || (size_t)st.st_size < sizeof(struct tb_capture_header))
+		goto failure;
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	segment->header = data;
+	segment->slots = (struct tb_slot*)(segment->header + 1);
+	segment->size = st.st_size;
+
+	size_t n_slots = (segment->size - sizeof(struct tb_capture_header))
+		       / sizeof(struct tb_slot);
+
+	if (!tb_capture__is_valid(segment->header, n_slots)
+	 || segment->header->generation == TB_CAPTURE_EMPTY) {
+		munmap(segment->header, segment->size);
+		return -1;
+	}
+
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+static void tb_capture__read_segment(const struct tb_capture_segment* segment,
+				     tb_capture_fn fn, void* context)
+{
+	const struct tb_capture_header* header = segment->header;
+	uint32_t first = tb_capture__first_pos(header);
+
+	for (size_t i = 0; i < header->n_slots; ++i) {
+		const struct tb_slot* slot = &segment->slots[i];
+
+		if (slot->seq == tb_capture__written_seq(first + i))
+			fn(&slot->frame, context);
+	}
+}
+
+int tb_capture_read(const char* path, tb_capture_fn fn, void* context)
+{
+	char segment_path[PATH_MAX];
+	struct tb_capture_segment* segments = NULL;
+	size_t n_segments = 0;
+	struct dirent* entry;
+	int rc = -1;
+
+	DIR* dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, TB_CAPTURE_PREFIX,
+			    strlen(TB_CAPTURE_PREFIX)) != 0)
+			continue;
+
+		struct tb_capture_segment* tmp;
+		tmp = realloc(segments, (n_segments + 1) * sizeof(*segments));
+		if (!tmp)
+			goto done;
+
+		segments = tmp;
+
+		snprintf(segment_path, sizeof(segment_path), "%s/%s", path,
+			 entry->d_name);
+		segment_path[sizeof(segment_path) - 1] = '\0';
+
+		if (tb_capture__open_segment(&segments[n_segments],
+					     segment_path) == 0)
+			++n_segments;
+	}
+
+	qsort(segments, n_segments, sizeof(*segments),
+	      tb_capture__compare_generation);
+
+	for (size_t i = 0; i < n_segments; ++i)
+		tb_capture__read_segment(&segments[i], fn, context);
+
+	rc = 0;
+
+done:
+	for (size_t i = 0; i < n_segments; ++i)
+		munmap(segments[i].header, segments[i].size);
+
+	free(segments);
+	closedir(dir);
+	return rc;
+}
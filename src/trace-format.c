@@ -0,0 +1,953 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "socketcan.h"
+#include "canopen.h"
+#include "canopen/byteorder.h"
+#include "trace-format.h"
+#include "lz.h"
+
+/* Worst case size of an encoded frame: 10 byte varint, 2 byte id/dlc, flags,
+ * extended id, 10 byte varint and 8 bytes of payload.
+ */
+#define TF_FRAME_SIZE_MAX 35
+
+#define TF_STORED_SIZE_MAX (TF_BLOCK_SIZE + TF_BLOCK_SIZE / 255 + 16)
+
+static inline uint8_t* tf__put_varint(uint8_t* p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = value | 0x80;
+		value >>= 7;
+	}
+
+	*p++ = value;
+	return p;
+}
+
+static inline const uint8_t* tf__get_varint(const uint8_t* p,
+					    const uint8_t* end,
+					    uint64_t* value)
+{
+	*value = 0;
+
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t byte = *p++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return p;
+	}
+
+	return NULL;
+}
+
+/* Headers are stored little endian; byteorder() converts either way */
+static void tf__file_header_byteorder(struct tf_file_header* header)
+{
+	BYTEORDER(&header->magic, header->magic);
+	BYTEORDER(&header->version, header->version);
+	BYTEORDER(&header->flags, header->flags);
+	BYTEORDER(&header->block_size, header->block_size);
+	BYTEORDER(&header->reserved, header->reserved);
+}
+
+static void tf__block_header_byteorder(struct tf_block_header* block)
+{
+	BYTEORDER(&block->n_frames, block->n_frames);
+	BYTEORDER(&block->raw_size, block->raw_size);
+	BYTEORDER(&block->stored_size, block->stored_size);
+	BYTEORDER(&block->reserved, block->reserved);
+	BYTEORDER(&block->first_timestamp, block->first_timestamp);
+	BYTEORDER(&block->last_timestamp, block->last_timestamp);
+}
+
+static void tf__index_entry_byteorder(struct tf_index_entry* entry)
+{
+	BYTEORDER(&entry->offset, entry->offset);
+	BYTEORDER(&entry->first_timestamp, entry->first_timestamp);
+	BYTEORDER(&entry->last_timestamp, entry->last_timestamp);
+}
+
+static void tf__index_trailer_byteorder(struct tf_index_trailer* trailer)
+{
+	BYTEORDER(&trailer->magic, trailer->magic);
+	BYTEORDER(&trailer->n_blocks, trailer->n_blocks);
+	BYTEORDER(&trailer->offset, trailer->offset);
+}
+
+static uint8_t* tf__encode_frame(uint8_t* p, const struct can_frame* cf,
+				 uint64_t delta, uint64_t early)
+{
+	uint32_t can_id = cf->can_id;
+	int dlc = cf->can_dlc > 15 ? 15 : cf->can_dlc;
+	int flags = 0;
+
+	if (can_id & CAN_RTR_FLAG) flags |= TF_FLAG_RTR;
+	if (can_id & CAN_EFF_FLAG) flags |= TF_FLAG_EFF;
+	if (can_id & CAN_ERR_FLAG) flags |= TF_FLAG_ERR;
+	if (early) flags |= TF_FLAG_EARLY;
+
+	p = tf__put_varint(p, delta);
+
+	uint16_t id_dlc = (can_id & CAN_SFF_MASK) | dlc << 11
+			| (flags ? 0x8000 : 0);
+	*p++ = id_dlc;
+	*p++ = id_dlc >> 8;
+
+	if (flags) {
+		*p++ = flags;
+
+		if (flags & TF_FLAG_EFF) {
+			uint32_t id = can_id & CAN_EFF_MASK;
+			*p++ = id;
+			*p++ = id >> 8;
+			*p++ = id >> 16;
+			*p++ = id >> 24;
+		}
+
+		if (flags & TF_FLAG_EARLY)
+			p = tf__put_varint(p, early);
+	}
+
+	if (!(flags & TF_FLAG_RTR)) {
+		int size = dlc > 8 ? 8 : dlc;
+		memcpy(p, cf->data, size);
+		p += size;
+	}
+
+	return p;
+}
+
+/* clock is the time of the previous frame that was not early */
+static const uint8_t* tf__decode_frame(const uint8_t* p, const uint8_t* end,
+				       uint64_t* clock, struct tb_frame* frame)
+{
+	uint64_t delta;
+
+	p = tf__get_varint(p, end, &delta);
+	if (!p || end - p < 2)
+		return NULL;
+
+	*clock += delta;
+	frame->timestamp = *clock;
+
+	uint16_t id_dlc = p[0] | p[1] << 8;
+	p += 2;
+
+	struct can_frame* cf = &frame->cf;
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = id_dlc & CAN_SFF_MASK;
+	cf->can_dlc = (id_dlc >> 11) & 15;
+
+	int flags = 0;
+	if (id_dlc & 0x8000) {
+		if (p >= end)
+			return NULL;
+
+		flags = *p++;
+
+		if (flags & TF_FLAG_EFF) {
+			if (end - p < 4)
+				return NULL;
+
+			uint32_t id = p[0] | p[1] << 8 | p[2] << 16
+				    | (uint32_t)p[3] << 24;
+			p += 4;
+			cf->can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		}
+
+		if (flags & TF_FLAG_EARLY) {
+			uint64_t early;
+			p = tf__get_varint(p, end, &early);
+			if (!p || early > *clock)
+				return NULL;
+
+			frame->timestamp = *clock - early;
+		}
+
+		if (flags & TF_FLAG_RTR) cf->can_id |= CAN_RTR_FLAG;
+		if (flags & TF_FLAG_ERR) cf->can_id |= CAN_ERR_FLAG;
+	}
+
+	if (!(flags & TF_FLAG_RTR)) {
+		int size = cf->can_dlc > 8 ? 8 : cf->can_dlc;
+		if (end - p < size)
+			return NULL;
+
+		memcpy(cf->data, p, size);
+		p += size;
+	}
+
+	return p;
+}
+
+static inline void tf__set_node(uint8_t* nodes, int node)
+{
+	nodes[node >> 3] |= 1 << (node & 7);
+}
+
+static inline int tf__has_node(const uint8_t* nodes, int node)
+{
+	return nodes[node >> 3] & (1 << (node & 7));
+}
+
+static int tf__nodes_intersect(const uint8_t* a, const uint8_t* b)
+{
+	for (int i = 0; i < 16; ++i)
+		if (a[i] & b[i])
+			return 1;
+
+	return 0;
+}
+
+/* An NMT command to all nodes concerns every node */
+static int tf__is_nmt_broadcast(const struct can_frame* cf)
+{
+	return cf->can_id == R_NMT && cf->can_dlc >= 2 && cf->data[1] == 0;
+}
+
+int tf_frame_node(const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+
+	if (cf->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG))
+		return 0;
+
+	if (cf->can_id == R_NMT)
+		return cf->can_dlc >= 2 && cf->data[1] < 128 ? cf->data[1] : 0;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return 0;
+
+	return msg.id > 0 && msg.id < 128 ? msg.id : 0;
+}
+
+void tf_query_init(struct tf_query* query)
+{
+	memset(query, 0, sizeof(*query));
+	query->cob = -1;
+}
+
+int tf_query_match(const struct tf_query* query, const struct tb_frame* frame)
+{
+	if (frame->timestamp < query->from)
+		return 0;
+
+	if (query->to && frame->timestamp > query->to)
+		return 0;
+
+	if (query->cob >= 0 && (frame->cf.can_id & (CAN_EFF_FLAG | CAN_EFF_MASK))
+			!= (canid_t)query->cob)
+		return 0;
+
+	if (query->has_nodes && !tf__is_nmt_broadcast(&frame->cf)
+	 && !tf__has_node(query->nodes, tf_frame_node(&frame->cf)))
+		return 0;
+
+	return 1;
+}
+
+__attribute__((visibility("default")))
+int tf_parse_time(uint64_t* dst, const char* arg)
+{
+	char* end = NULL;
+	struct tm tm = { 0 };
+	time_t seconds;
+
+	const char* frac = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+	if (frac) {
+		tm.tm_isdst = -1;
+		seconds = mktime(&tm);
+		if (seconds == (time_t)-1)
+			return -1;
+	} else {
+		seconds = strtoull(arg, &end, 10);
+		if (end == arg)
+			return -1;
+
+		frac = end;
+	}
+
+	double fraction = 0.0;
+	if (*frac == '.') {
+		fraction = strtod(frac, &end);
+		frac = end;
+	}
+
+	if (*frac == 'Z')
+		++frac;
+
+	if (*frac != '\0')
+		return -1;
+
+	*dst = (uint64_t)seconds * 1000000ULL
+	     + (uint64_t)(fraction * 1000000.0 + 0.5);
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int tf_parse_node(uint8_t* nodes, const char* arg)
+{
+	char* end = NULL;
+	unsigned long node = strtoul(arg, &end, 0);
+
+	if (end == arg || *end != '\0' || node < 1 || node > 127)
+		return -1;
+
+	tf__set_node(nodes, node);
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int tf_parse_cob(int32_t* dst, const char* arg)
+{
+	char* end = NULL;
+	unsigned long cob = strtoul(arg, &end, 16);
+
+	if (end == arg || *end != '\0' || cob > 0x7ff)
+		return -1;
+
+	*dst = cob;
+	return 0;
+}
+
+/* Can a block with the given time range and nodes contain matching frames? */
+static int tf__block_may_match(const struct tf_query* query,
+			       uint64_t first_timestamp,
+			       uint64_t last_timestamp, const uint8_t* nodes)
+{
+	if (!query)
+		return 1;
+
+	if (last_timestamp < query->from)
+		return 0;
+
+	if (query->to && first_timestamp > query->to)
+		return 0;
+
+	if (query->has_nodes && !tf__nodes_intersect(query->nodes, nodes))
+		return 0;
+
+	/* NMT commands are filed under the node that they address */
+	if (query->cob >= 0 && query->cob != R_NMT) {
+		struct can_frame cf = { .can_id = query->cob };
+		if (!tf__has_node(nodes, tf_frame_node(&cf)))
+			return 0;
+	}
+
+	return 1;
+}
+
+int tf_writer_init(struct tf_writer* self, FILE* stream, int flags)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->stream = stream;
+	self->flags = flags;
+
+	self->raw = malloc(TF_BLOCK_SIZE);
+	if (!self->raw)
+		return -1;
+
+	if (flags & TF_COMPRESS) {
+		self->stored = malloc(TF_STORED_SIZE_MAX);
+		if (!self->stored)
+			goto failure;
+	}
+
+	struct tf_file_header header = {
+		.magic = TF_MAGIC,
+		.version = TF_VERSION,
+		.flags = flags,
+		.block_size = TF_BLOCK_SIZE,
+	};
+
+	tf__file_header_byteorder(&header);
+
+	if (fwrite(&header, sizeof(header), 1, stream) != 1)
+		goto failure;
+
+	self->offset = sizeof(header);
+
+	return 0;
+
+failure:
+	free(self->stored);
+	free(self->raw);
+	return -1;
+}
+
+static int tf__add_index_entry(struct tf_writer* self)
+{
+	const struct tf_block_header* block = &self->block;
+
+	/* Grow by doubling; the index is a power of 2 in size when full */
+	if ((self->n_blocks & (self->n_blocks - 1)) == 0) {
+		size_t size = self->n_blocks ? self->n_blocks * 2 : 16;
+		void* index = realloc(self->index, size * sizeof(*self->index));
+		if (!index)
+			return -1;
+
+		self->index = index;
+	}
+
+	struct tf_index_entry* entry = &self->index[self->n_blocks++];
+	entry->offset = self->offset;
+	entry->first_timestamp = block->first_timestamp;
+	entry->last_timestamp = block->last_timestamp;
+	memcpy(entry->nodes, block->nodes, sizeof(entry->nodes));
+
+	return 0;
+}
+
+static int tf__flush_block(struct tf_writer* self)
+{
+	struct tf_block_header* block = &self->block;
+	const void* data = self->raw;
+
+	if (block->n_frames == 0)
+		return 0;
+
+	block->stored_size = block->raw_size;
+
+	if (self->flags & TF_COMPRESS) {
+		size_t size = lz_compress(self->stored, block->raw_size - 1,
+					  self->raw, block->raw_size);
+		if (size > 0) {
+			block->stored_size = size;
+			data = self->stored;
+		}
+	}
+
+	if (tf__add_index_entry(self) < 0)
+		return -1;
+
+	struct tf_block_header header = *block;
+	tf__block_header_byteorder(&header);
+
+	if (fwrite(&header, sizeof(header), 1, self->stream) != 1
+	 || fwrite(data, 1, block->stored_size, self->stream)
+			!= block->stored_size)
+		return -1;
+
+	self->offset += sizeof(*block) + block->stored_size;
+
+	memset(block, 0, sizeof(*block));
+	return 0;
+}
+
+int tf_writer_append(struct tf_writer* self, const struct tb_frame* frame)
+{
+	struct tf_block_header* block = &self->block;
+
+	/* A frame from before the start of the block starts a new one, so that
+	 * the block's time range covers all of its frames.
+	 */
+	if (block->raw_size + TF_FRAME_SIZE_MAX > TF_BLOCK_SIZE
+	 || (block->n_frames > 0 && frame->timestamp < block->first_timestamp))
+		if (tf__flush_block(self) < 0)
+			return -1;
+
+	if (block->n_frames == 0) {
+		block->first_timestamp = frame->timestamp;
+		block->last_timestamp = frame->timestamp;
+	}
+
+	/* Timestamps from different threads are not strictly ordered */
+	uint64_t delta = 0, early = 0;
+	if (frame->timestamp >= block->last_timestamp)
+		delta = frame->timestamp - block->last_timestamp;
+	else
+		early = block->last_timestamp - frame->timestamp;
+
+	uint8_t* p = tf__encode_frame(self->raw + block->raw_size, &frame->cf,
+				      delta, early);
+
+	block->raw_size = p - self->raw;
+	block->last_timestamp += delta;
+	block->n_frames++;
+
+	if (tf__is_nmt_broadcast(&frame->cf))
+		memset(block->nodes, 0xff, sizeof(block->nodes));
+	else
+		tf__set_node(block->nodes, tf_frame_node(&frame->cf));
+
+	return 0;
+}
+
+static int tf__write_index(struct tf_writer* self)
+{
+	struct tf_block_header terminator = { 0 };
+	struct tf_index_trailer trailer = {
+		.magic = TF_INDEX_MAGIC,
+		.n_blocks = self->n_blocks,
+		.offset = self->offset + sizeof(terminator),
+	};
+
+	tf__index_trailer_byteorder(&trailer);
+
+	for (size_t i = 0; i < self->n_blocks; ++i)
+		tf__index_entry_byteorder(&self->index[i]);
+
+	if (fwrite(&terminator, sizeof(terminator), 1, self->stream) != 1)
+		return -1;
+
+	if (self->n_blocks > 0
+	 && fwrite(self->index, sizeof(*self->index), self->n_blocks,
+		   self->stream) != self->n_blocks)
+		return -1;
+
+	return fwrite(&trailer, sizeof(trailer), 1, self->stream) == 1 ? 0 : -1;
+}
+
+int tf_writer_finish(struct tf_writer* self)
+{
+	int rc = tf__flush_block(self);
+
+	if (rc == 0)
+		rc = tf__write_index(self);
+
+	free(self->index);
+	free(self->stored);
+	free(self->raw);
+
+	return rc;
+}
+
+int tf_is_compact(FILE* stream)
+{
+	uint32_t magic = 0;
+	size_t n = fread(&magic, sizeof(magic), 1, stream);
+
+	rewind(stream);
+
+	BYTEORDER(&magic, magic);
+	return n == 1 && magic == TF_MAGIC;
+}
+
+int tf_decode_block(const struct tf_block_header* header, const void* data,
+		    const struct tf_query* query, tf_frame_fn fn,
+		    void* context)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = p + header->raw_size;
+
+	struct tb_frame frame;
+	uint64_t clock = header->first_timestamp;
+
+	for (uint32_t i = 0; i < header->n_frames; ++i) {
+		p = tf__decode_frame(p, end, &clock, &frame);
+		if (!p)
+			return -1;
+
+		if (!query || tf_query_match(query, &frame))
+			fn(&frame, context);
+	}
+
+	return 0;
+}
+
+static int tf__check_file_header(const struct tf_file_header* header)
+{
+	if (header->magic != TF_MAGIC || header->version == 0
+	 || header->version > TF_VERSION || header->block_size == 0
+	 || header->block_size > TF_BLOCK_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline size_t tf__block_header_size(int version)
+{
+	return version < 2 ? TF_BLOCK_HEADER_V1_SIZE
+			   : sizeof(struct tf_block_header);
+}
+
+/* Version 1 blocks have no node bitmap, so they may contain any node */
+static void tf__fix_block_header(struct tf_block_header* block, int version)
+{
+	if (version < 2)
+		memset(block->nodes, 0xff, sizeof(block->nodes));
+}
+
+static int tf__check_block_header(const struct tf_block_header* block)
+{
+	if (block->raw_size > TF_BLOCK_SIZE
+	 || block->stored_size > block->raw_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int tf__process_block(const struct tf_block_header* block,
+			     const void* stored, uint8_t* raw,
+			     const struct tf_query* query, tf_frame_fn fn,
+			     void* context)
+{
+	const void* data = stored;
+
+	if (block->stored_size < block->raw_size) {
+		ssize_t size = lz_decompress(raw, TF_BLOCK_SIZE, stored,
+					     block->stored_size);
+		if (size != (ssize_t)block->raw_size) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		data = raw;
+	}
+
+	if (tf_decode_block(block, data, query, fn, context) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int tf_read(FILE* stream, const struct tf_query* query, tf_frame_fn fn,
+	    void* context)
+{
+	struct tf_file_header header;
+	struct tf_block_header block;
+	uint8_t* stored = NULL;
+	uint8_t* raw = NULL;
+	int rc = -1;
+
+	if (fread(&header, sizeof(header), 1, stream) != 1)
+		return -1;
+
+	tf__file_header_byteorder(&header);
+
+	if (tf__check_file_header(&header) < 0)
+		return -1;
+
+	size_t block_header_size = tf__block_header_size(header.version);
+
+	stored = malloc(TF_STORED_SIZE_MAX);
+	raw = malloc(TF_BLOCK_SIZE);
+	if (!stored || !raw)
+		goto done;
+
+	while (fread(&block, block_header_size, 1, stream) == 1) {
+		tf__block_header_byteorder(&block);
+
+		/* An empty block terminates the blocks and the index follows */
+		if (block.n_frames == 0)
+			break;
+
+		tf__fix_block_header(&block, header.version);
+
+		if (tf__check_block_header(&block) < 0)
+			goto done;
+
+		/* The stream may not be seekable, so skipped blocks are still
+		 * read, but they are not decompressed.
+		 */
+		if (fread(stored, 1, block.stored_size, stream)
+				!= block.stored_size)
+			goto done;
+
+		if (!tf__block_may_match(query, block.first_timestamp,
+					 block.last_timestamp, block.nodes))
+			continue;
+
+		if (tf__process_block(&block, stored, raw, query, fn,
+				      context) < 0)
+			goto done;
+	}
+
+	rc = ferror(stream) ? -1 : 0;
+
+done:
+	free(raw);
+	free(stored);
+	return rc;
+}
+
+static int tf__read_mapped_block(const struct tf_file* file, uint8_t* raw,
+				 const struct tf_index_entry* entry,
+				 const struct tf_query* query, tf_frame_fn fn,
+				 void* context)
+{
+	struct tf_block_header block;
+	size_t header_size = tf__block_header_size(file->version);
+	uint64_t offset = entry->offset;
+
+	if (offset > file->size || header_size > file->size - offset) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memcpy(&block, file->data + offset, header_size);
+	tf__block_header_byteorder(&block);
+	tf__fix_block_header(&block, file->version);
+
+	if (tf__check_block_header(&block) < 0)
+		return -1;
+
+	offset += header_size;
+
+	if (block.stored_size > file->size - offset) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return tf__process_block(&block, file->data + offset, raw, query, fn,
+				 context);
+}
+
+static const struct tf_index_entry* tf__find_index(const struct tf_file* file,
+						   size_t* n_blocks)
+{
+	struct tf_index_trailer trailer;
+
+	if (file->version < 2 || file->size < sizeof(struct tf_file_header)
+					     + sizeof(trailer))
+		return NULL;
+
+	uint64_t end = file->size - sizeof(trailer);
+
+	memcpy(&trailer, file->data + end, sizeof(trailer));
+	tf__index_trailer_byteorder(&trailer);
+
+	/* The offset is untrusted, so it is never added to */
+	if (trailer.magic != TF_INDEX_MAGIC
+	 || trailer.offset < sizeof(struct tf_file_header)
+	 || trailer.offset > end
+	 || end - trailer.offset != (uint64_t)trailer.n_blocks
+				    * sizeof(struct tf_index_entry))
+		return NULL;
+
+	*n_blocks = trailer.n_blocks;
+	return (const struct tf_index_entry*)(file->data + trailer.offset);
+}
+
+/* Copy the index in the file into host byte order */
+static int tf__load_index(struct tf_file* file,
+			  const struct tf_index_entry* index)
+{
+	if (file->n_blocks == 0)
+		return 0;
+
+	file->built_index = malloc(file->n_blocks * sizeof(*index));
+	if (!file->built_index)
+		return -1;
+
+	memcpy(file->built_index, index, file->n_blocks * sizeof(*index));
+
+	for (size_t i = 0; i < file->n_blocks; ++i)
+		tf__index_entry_byteorder(&file->built_index[i]);
+
+	file->index = file->built_index;
+	return 0;
+}
+
+/* Build an index for a file that has none by walking the block headers */
+static int tf__build_index(struct tf_file* file)
+{
+	size_t header_size = tf__block_header_size(file->version);
+	uint64_t offset = sizeof(struct tf_file_header);
+	size_t capacity = 0;
+
+	while (offset <= file->size && header_size <= file->size - offset) {
+		struct tf_block_header block;
+		memcpy(&block, file->data + offset, header_size);
+		tf__block_header_byteorder(&block);
+		tf__fix_block_header(&block, file->version);
+
+		if (block.n_frames == 0)
+			break;
+
+		if (file->n_blocks == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			void* index = realloc(file->built_index,
+					      capacity * sizeof(*file->index));
+			if (!index)
+				return -1;
+
+			file->built_index = index;
+		}
+
+		struct tf_index_entry* entry =
+			&file->built_index[file->n_blocks++];
+		entry->offset = offset;
+		entry->first_timestamp = block.first_timestamp;
+		entry->last_timestamp = block.last_timestamp;
+		memcpy(entry->nodes, block.nodes, sizeof(entry->nodes));
+
+		offset += header_size + block.stored_size;
+	}
+
+	file->index = file->built_index;
+	return 0;
+}
+
+static int tf__index_is_sorted(const struct tf_file* file)
+{
+	for (size_t i = 1; i < file->n_blocks; ++i)
+		if (file->index[i].last_timestamp
+		    < file->index[i - 1].last_timestamp)
+			return 0;
+
+	return 1;
+}
+
+int tf_file_open(struct tf_file* self, const char* path)
+{
+	struct tf_file_header header;
+	struct stat st;
+
+	memset(self, 0, sizeof(*self));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto failure;
+
+	if ((size_t)st.st_size < sizeof(header)) {
+		errno = EINVAL;
+		goto failure;
+	}
+
+	self->size = st.st_size;
+	self->data = mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (self->data == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+	fd = -1;
+
+	memcpy(&header, self->data, sizeof(header));
+	tf__file_header_byteorder(&header);
+	if (tf__check_file_header(&header) < 0)
+		goto failure;
+
+	self->version = header.version;
+
+	const struct tf_index_entry* index =
+		tf__find_index(self, &self->n_blocks);
+	if (index) {
+		madvise((void*)self->data, self->size, MADV_RANDOM);
+		if (tf__load_index(self, index) < 0)
+			goto failure;
+	} else {
+		madvise((void*)self->data, self->size, MADV_SEQUENTIAL);
+		if (tf__build_index(self) < 0)
+			goto failure;
+	}
+
+	self->is_sorted = tf__index_is_sorted(self);
+	return 0;
+
+failure:
+	if (self->data && self->data != MAP_FAILED)
+		munmap((void*)self->data, self->size);
+	free(self->built_index);
+	if (fd >= 0)
+		close(fd);
+	memset(self, 0, sizeof(*self));
+	return -1;
+}
+
+void tf_file_close(struct tf_file* self)
+{
+	free(self->built_index);
+	munmap((void*)self->data, self->size);
+}
+
+size_t tf_file_find(const struct tf_file* self, uint64_t from)
+{
+	size_t low = 0, high = self->n_blocks;
+
+	if (!self->is_sorted) {
+		while (low < high && self->index[low].last_timestamp < from)
+			++low;
+
+		return low;
+	}
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (self->index[mid].last_timestamp < from)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+int tf_file_read(const struct tf_file* self, size_t first, size_t last,
+		 const struct tf_query* query, tf_frame_fn fn, void* context)
+{
+	int rc = 0;
+
+	uint8_t* raw = malloc(TF_BLOCK_SIZE);
+	if (!raw)
+		return -1;
+
+	for (size_t i = first; i < last && i < self->n_blocks; ++i) {
+		struct tf_index_entry entry;
+		memcpy(&entry, &self->index[i], sizeof(entry));
+
+		if (!tf__block_may_match(query, entry.first_timestamp,
+					 entry.last_timestamp, entry.nodes))
+			continue;
+
+		rc = tf__read_mapped_block(self, raw, &entry, query, fn,
+					   context);
+		if (rc < 0)
+			break;
+	}
+
+	free(raw);
+	return rc;
+}
+
+int tf_read_file(const char* path, const struct tf_query* query,
+		 tf_frame_fn fn, void* context)
+{
+	struct tf_file file;
+
+	if (tf_file_open(&file, path) < 0)
+		return -1;
+
+	/* Blocks written by different threads may overlap slightly in time,
+	 * so every remaining entry is checked rather than stopping at the
+	 * first block that starts after query->to. The index is small.
+	 */
+	size_t first = query ? tf_file_find(&file, query->from) : 0;
+	int rc = tf_file_read(&file, first, file.n_blocks, query, fn, context);
+
+	tf_file_close(&file);
+	return rc;
+}
@@ -0,0 +1,258 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "trace-replay.h"
+#include "trace-capture.h"
+#include "pcapng.h"
+#include "time-utils.h"
+#include "net-util.h"
+
+#define TR_POLL_TIMEOUT 1000 /* ms */
+
+__attribute__((visibility("default")))
+void tr_options_init(struct tr_options* options)
+{
+	options->speed = 1.0;
+	tf_query_init(&options->query);
+}
+
+__attribute__((visibility("default")))
+void tr_init(struct trace_replay* self, const struct sock* sock,
+	     const struct tr_options* options)
+{
+	memset(self, 0, sizeof(*self));
+	self->sock = sock;
+
+	if (options)
+		self->options = *options;
+	else
+		tr_options_init(&self->options);
+}
+
+/* A CAN interface reports ENOBUFS when its transmit queue is full, and a
+ * socket that has been made non-blocking may report EAGAIN. In either case
+ * the rest of the batch is sent once the socket becomes writable again.
+ */
+static int tr__wait_writable(const struct trace_replay* self)
+{
+	struct pollfd pfd = { .fd = self->sock->fd, .events = POLLOUT };
+
+	int rc = poll(&pfd, 1, TR_POLL_TIMEOUT);
+	if (rc < 0 && errno != EINTR)
+		return -1;
+
+	if (rc == 0) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	/* The socket may be writable while the interface queue is still full
+	 */
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+	nanosleep(&pause, NULL);
+	return 0;
+}
+
+static int tr__flush(struct trace_replay* self)
+{
+	size_t sent = 0;
+
+	while (sent < self->batch_size) {
+		ssize_t rc = sock_send_batch(self->sock, &self->batch[sent],
+					     self->batch_size - sent);
+		if (rc > 0) {
+			sent += rc;
+			continue;
+		}
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc < 0 && errno != ENOBUFS && errno != EAGAIN)
+			goto failure;
+
+		if (tr__wait_writable(self) < 0)
+			goto failure;
+	}
+
+	if (self->batch_size > 0)
+		self->stats.n_batches++;
+
+	self->batch_size = 0;
+	return 0;
+
+failure:
+	self->rc = -1;
+	return -1;
+}
+
+static void tr__sleep_until(uint64_t deadline)
+{
+	struct timespec ts = ns_to_timespec(deadline);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR);
+}
+
+static uint64_t tr__get_deadline(struct trace_replay* self,
+				 const struct tb_frame* frame)
+{
+	/* Clock steps in the recording must not make the replay go backwards
+	 */
+	if (frame->timestamp > self->last_timestamp)
+		self->last_timestamp = frame->timestamp;
+
+	double offset = (self->last_timestamp - self->first_timestamp) * 1e3;
+	return self->start + (uint64_t)(offset / self->options.speed);
+}
+
+/* Frames that are already due are held back and sent in one batch when a frame
+ * is found that is not yet due. Reading the next frame is fast compared to the
+ * time between frames on the bus, so the held frames go out promptly.
+ */
+__attribute__((visibility("default")))
+int tr_frame(struct trace_replay* self, const struct tb_frame* frame)
+{
+	if (self->rc < 0)
+		return -1;
+
+	if (!tf_query_match(&self->options.query, frame))
+		return 0;
+
+	if (!self->is_started) {
+		self->start = gettime_ns(CLOCK_MONOTONIC);
+		self->first_timestamp = frame->timestamp;
+		self->last_timestamp = frame->timestamp;
+		self->is_started = 1;
+	}
+
+	if (self->options.speed > 0.0) {
+		uint64_t deadline = tr__get_deadline(self, frame);
+		uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+
+		if (deadline > now) {
+			if (tr__flush(self) < 0)
+				return -1;
+
+			tr__sleep_until(deadline);
+			now = gettime_ns(CLOCK_MONOTONIC);
+		}
+
+		uint64_t lag = now > deadline ? now - deadline : 0;
+		if (lag > self->stats.max_lag)
+			self->stats.max_lag = lag;
+	}
+
+	self->batch[self->batch_size++] = frame->cf;
+	self->stats.n_frames++;
+
+	if (self->batch_size == SOCK_BATCH_MAX)
+		return tr__flush(self);
+
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int tr_finish(struct trace_replay* self, struct tr_stats* stats)
+{
+	tr__flush(self);
+
+	if (self->is_started)
+		self->stats.duration = gettime_ns(CLOCK_MONOTONIC)
+				     - self->start;
+
+	if (stats)
+		*stats = self->stats;
+
+	return self->rc;
+}
+
+static void tr__on_frame(const struct tb_frame* frame, void* context)
+{
+	tr_frame(context, frame);
+}
+
+static int tr__read_file(struct trace_replay* self, const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return tb_capture_read(path, tr__on_frame, self);
+
+	FILE* stream = fopen(path, "r");
+	if (!stream)
+		return -1;
+
+	int rc = 0;
+
+	if (tf_is_compact(stream)) {
+		fclose(stream);
+		return tf_read_file(path, &self->options.query, tr__on_frame,
+				    self);
+	}
+
+	if (pcapng_is_pcapng(stream)) {
+		rc = pcapng_read(stream, tr__on_frame, self);
+	} else {
+		struct tb_frame frame;
+		while (self->rc == 0 && fread(&frame, sizeof(frame), 1, stream))
+			tr_frame(self, &frame);
+	}
+
+	fclose(stream);
+	return rc;
+}
+
+__attribute__((visibility("default")))
+int tr_replay_file(const struct sock* sock, const char* path,
+		   const struct tr_options* options, struct tr_stats* stats)
+{
+	struct trace_replay replay;
+	tr_init(&replay, sock, options);
+
+	int read_rc = tr__read_file(&replay, path);
+	int rc = tr_finish(&replay, stats);
+
+	return read_rc < 0 ? read_rc : rc;
+}
+
+__attribute__((visibility("default")))
+int tr_replay(const char* path, enum sock_type type, const char* addr,
+	      const struct tr_options* options, struct tr_stats* stats)
+{
+	struct sock sock;
+	if (sock_open(&sock, type, addr, NULL) < 0)
+		return -1;
+
+	/* Makes the socket block while the interface queue is full instead of
+	 * failing with ENOBUFS.
+	 */
+	if (type == SOCK_TYPE_CAN)
+		net_fix_sndbuf(sock.fd);
+
+	int rc = tr_replay_file(&sock, path, options, stats);
+
+	int errsv = errno;
+	sock_close(&sock);
+	errno = errsv;
+
+	return rc;
+}
@@ -0,0 +1,745 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+#include "socketcan.h"
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/heartbeat.h"
+#include "trace-stats.h"
+
+#define CAN_CRC15_POLY 0x4599
+
+/* CRC delimiter, ACK slot, ACK delimiter, end of frame and inter-frame space.
+ * None of these are stuffed.
+ */
+#define TS_FRAME_TAIL_BITS (1 + 1 + 1 + 7 + 3)
+
+struct ts__bitstream {
+	uint8_t bits[160];
+	unsigned int length;
+	uint16_t crc;
+};
+
+static void ts__put_bits(struct ts__bitstream* stream, uint32_t value,
+			 int n)
+{
+	for (int i = n - 1; i >= 0; --i) {
+		int bit = (value >> i) & 1;
+		stream->bits[stream->length++] = bit;
+
+		int next = bit ^ ((stream->crc >> 14) & 1);
+		stream->crc = (stream->crc << 1) & 0x7fff;
+		if (next)
+			stream->crc ^= CAN_CRC15_POLY;
+	}
+}
+
+static unsigned int ts__count_stuff_bits(const struct ts__bitstream* stream)
+{
+	unsigned int n_stuffed = 0;
+	int last = stream->bits[0];
+	int run = 1;
+
+	for (unsigned int i = 1; i < stream->length; ++i) {
+		if (stream->bits[i] == last) {
+			++run;
+		} else {
+			last = stream->bits[i];
+			run = 1;
+		}
+
+		/* The stuff bit is the complement and starts a new run */
+		if (run == 5) {
+			++n_stuffed;
+			last = !last;
+			run = 1;
+		}
+	}
+
+	return n_stuffed;
+}
+
+unsigned int ts_frame_bits(const struct can_frame* cf)
+{
+	struct ts__bitstream stream = { .length = 0 };
+	int is_rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	int dlc = cf->can_dlc > 15 ? 15 : cf->can_dlc;
+	int size = is_rtr ? 0 : (dlc > 8 ? 8 : dlc);
+
+	if (cf->can_id & CAN_ERR_FLAG)
+		return 0;
+
+	ts__put_bits(&stream, 0, 1); /* SOF */
+
+	if (cf->can_id & CAN_EFF_FLAG) {
+		uint32_t id = cf->can_id & CAN_EFF_MASK;
+		ts__put_bits(&stream, id >> 18, 11);
+		ts__put_bits(&stream, 1, 1); /* SRR */
+		ts__put_bits(&stream, 1, 1); /* IDE */
+		ts__put_bits(&stream, id & 0x3ffff, 18);
+		ts__put_bits(&stream, is_rtr, 1);
+		ts__put_bits(&stream, 0, 2); /* r1, r0 */
+	} else {
+		ts__put_bits(&stream, cf->can_id & CAN_SFF_MASK, 11);
+		ts__put_bits(&stream, is_rtr, 1);
+		ts__put_bits(&stream, 0, 2); /* IDE, r0 */
+	}
+
+	ts__put_bits(&stream, dlc, 4);
+
+	for (int i = 0; i < size; ++i)
+		ts__put_bits(&stream, cf->data[i], 8);
+
+	ts__put_bits(&stream, stream.crc, 15);
+
+	return stream.length + ts__count_stuff_bits(&stream)
+	     + TS_FRAME_TAIL_BITS;
+}
+
+static void ts__interval_add_delta(struct ts_interval* self, uint64_t delta)
+{
+	if (self->n_intervals == 0 || delta < self->min)
+		self->min = delta;
+
+	if (delta > self->max)
+		self->max = delta;
+
+	self->n_intervals++;
+
+	double d = (double)delta - self->mean;
+	self->mean += d / self->n_intervals;
+	self->m2 += d * ((double)delta - self->mean);
+}
+
+void ts_interval_add(struct ts_interval* self, uint64_t timestamp)
+{
+	if (self->count++ == 0) {
+		self->first = timestamp;
+		self->last = timestamp;
+		return;
+	}
+
+	/* Timestamps from different threads are not strictly ordered */
+	ts__interval_add_delta(self, timestamp > self->last
+				     ? timestamp - self->last : 0);
+
+	if (timestamp > self->last)
+		self->last = timestamp;
+}
+
+void ts_interval_merge(struct ts_interval* self,
+		       const struct ts_interval* other)
+{
+	if (other->count == 0)
+		return;
+
+	if (self->count == 0) {
+		*self = *other;
+		return;
+	}
+
+	uint64_t last = self->last;
+
+	if (other->n_intervals > 0) {
+		double n_self = self->n_intervals;
+		double n_other = other->n_intervals;
+		double n = n_self + n_other;
+		double d = other->mean - self->mean;
+
+		if (self->n_intervals == 0 || other->min < self->min)
+			self->min = other->min;
+
+		if (other->max > self->max)
+			self->max = other->max;
+
+		self->mean += d * n_other / n;
+		self->m2 += other->m2 + d * d * n_self * n_other / n;
+		self->n_intervals += other->n_intervals;
+	}
+
+	/* The interval between the two parts */
+	ts__interval_add_delta(self, other->first > last
+				     ? other->first - last : 0);
+
+	self->count += other->count;
+	if (other->last > self->last)
+		self->last = other->last;
+}
+
+double ts_interval_stddev(const struct ts_interval* self)
+{
+	return self->n_intervals > 1 ? sqrt(self->m2 / (self->n_intervals - 1))
+				     : 0.0;
+}
+
+static int ts__load_add(struct trace_stats* self, uint64_t second,
+			uint64_t bits)
+{
+	if (self->load_length == 0)
+		self->load_start = second;
+
+	if (second < self->load_start)
+		second = self->load_start;
+
+	/* A corrupt timestamp must not make the load huge */
+	if (second - self->load_start >= TS_LOAD_SECONDS_MAX) {
+		self->load_skipped += bits;
+		return 0;
+	}
+
+	size_t index = second - self->load_start;
+
+	if (index >= self->load_length) {
+		size_t length = index + 1;
+		uint64_t* load = realloc(self->load, length * sizeof(*load));
+		if (!load)
+			return -1;
+
+		memset(load + self->load_length, 0,
+		       (length - self->load_length) * sizeof(*load));
+
+		self->load = load;
+		self->load_length = length;
+	}
+
+	self->load[index] += bits;
+	return 0;
+}
+
+static inline int ts__latency_bucket(uint64_t latency)
+{
+	int bucket = 0;
+
+	while (latency > 1 && bucket < TS_LATENCY_BUCKETS - 1) {
+		latency >>= 1;
+		++bucket;
+	}
+
+	return bucket;
+}
+
+static void ts__sdo_complete(struct ts_sdo* sdo, uint64_t timestamp)
+{
+	uint64_t latency = timestamp > sdo->start ? timestamp - sdo->start : 0;
+
+	sdo->count++;
+	sdo->sum += latency;
+	if (latency > sdo->max)
+		sdo->max = latency;
+
+	sdo->histogram[ts__latency_bucket(latency)]++;
+}
+
+static void ts__sdo_finish(struct ts_sdo* sdo, int outcome,
+			   uint64_t timestamp)
+{
+	switch (outcome) {
+	case TS_SDO_COMPLETED:
+		ts__sdo_complete(sdo, timestamp);
+		break;
+	case TS_SDO_ABORTED:
+		sdo->aborts++;
+		break;
+	}
+}
+
+static int ts__sdo_abort(int* state)
+{
+	int outcome = *state != TS_SDO_IDLE ? TS_SDO_ABORTED : TS_SDO_NONE;
+	*state = TS_SDO_IDLE;
+	return outcome;
+}
+
+static int ts__sdo_done(int* state)
+{
+	*state = TS_SDO_IDLE;
+	return TS_SDO_COMPLETED;
+}
+
+static int ts__sdo_step_request(int* state, const struct can_frame* cf)
+{
+	switch (sdo_get_cs(cf)) {
+	case SDO_CCS_DL_INIT_REQ:
+		*state = sdo_is_expediated(cf) ? TS_SDO_DL_EXPEDIATED
+					       : TS_SDO_DL_SEGMENT;
+		break;
+	case SDO_CCS_UL_INIT_REQ:
+		*state = TS_SDO_UPLOAD;
+		break;
+	case SDO_CCS_DL_SEG_REQ:
+		if (*state == TS_SDO_DL_SEGMENT && sdo_is_end_segment(cf))
+			*state = TS_SDO_DL_LAST;
+		break;
+	case SDO_CCS_ABORT:
+		return ts__sdo_abort(state);
+	}
+
+	return TS_SDO_NONE;
+}
+
+static int ts__sdo_step_response(int* state, const struct can_frame* cf)
+{
+	switch (sdo_get_cs(cf)) {
+	case SDO_SCS_DL_INIT_RES:
+		if (*state == TS_SDO_DL_EXPEDIATED)
+			return ts__sdo_done(state);
+		break;
+	case SDO_SCS_DL_SEG_RES:
+		if (*state == TS_SDO_DL_LAST)
+			return ts__sdo_done(state);
+		break;
+	case SDO_SCS_UL_INIT_RES:
+		if (*state == TS_SDO_UPLOAD && sdo_is_expediated(cf))
+			return ts__sdo_done(state);
+		break;
+	case SDO_SCS_UL_SEG_RES:
+		if (*state == TS_SDO_UPLOAD && sdo_is_end_segment(cf))
+			return ts__sdo_done(state);
+		break;
+	case SDO_SCS_ABORT:
+		return ts__sdo_abort(state);
+	}
+
+	return TS_SDO_NONE;
+}
+
+/* Advance the state machine by one frame and return how it ended the current
+ * transaction, if it did.
+ */
+static int ts__sdo_step(int* state, const struct ts_sdo_event* event)
+{
+	struct can_frame cf = { .can_dlc = 1, .data = { event->cs } };
+
+	return event->is_response ? ts__sdo_step_response(state, &cf)
+				  : ts__sdo_step_request(state, &cf);
+}
+
+static inline int ts__is_sdo_init_request(const struct ts_sdo_event* event)
+{
+	int cs = event->cs >> 5;
+	return !event->is_response
+	    && (cs == SDO_CCS_DL_INIT_REQ || cs == SDO_CCS_UL_INIT_REQ);
+}
+
+static void ts__sdo_init_prefix(struct ts_sdo* sdo)
+{
+	if (sdo->has_prefix)
+		return;
+
+	for (int i = 0; i < TS_SDO_N_STATES; ++i)
+		sdo->prefix[i] = (struct ts_sdo_path){ .state = i };
+
+	sdo->has_prefix = 1;
+}
+
+static void ts__sdo_add_prefix(struct ts_sdo* sdo,
+			       const struct ts_sdo_event* event)
+{
+	ts__sdo_init_prefix(sdo);
+
+	for (int i = 0; i < TS_SDO_N_STATES; ++i) {
+		struct ts_sdo_path* path = &sdo->prefix[i];
+
+		/* An ended transaction stays idle until the next initiate */
+		if (path->outcome != TS_SDO_NONE)
+			continue;
+
+		path->outcome = ts__sdo_step(&path->state, event);
+		path->timestamp = event->timestamp;
+	}
+}
+
+static void ts__sdo_add(struct ts_sdo* sdo, const struct ts_sdo_event* event)
+{
+	int is_init = ts__is_sdo_init_request(event);
+
+	if (!sdo->has_started && !is_init) {
+		ts__sdo_add_prefix(sdo, event);
+		return;
+	}
+
+	sdo->has_started = 1;
+
+	if (is_init)
+		sdo->start = event->timestamp;
+
+	ts__sdo_finish(sdo, ts__sdo_step(&sdo->state, event),
+		       event->timestamp);
+}
+
+struct trace_stats* ts_new(void)
+{
+	return calloc(1, sizeof(struct trace_stats));
+}
+
+void ts_free(struct trace_stats* self)
+{
+	if (!self)
+		return;
+
+	free(self->load);
+	free(self);
+}
+
+static void ts__add_canopen(struct trace_stats* self,
+			    const struct tb_frame* frame)
+{
+	const struct can_frame* cf = &frame->cf;
+	struct canopen_msg msg;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return;
+
+	if (msg.id <= 0 || msg.id >= TS_N_NODES)
+		return;
+
+	struct ts_node* node = &self->node[msg.id];
+	struct ts_sdo_event event = {
+		.timestamp = frame->timestamp,
+		.cs = cf->data[0],
+	};
+
+	switch (msg.object) {
+	case CANOPEN_HEARTBEAT:
+		ts_interval_add(&node->heartbeat, frame->timestamp);
+		if (cf->can_dlc > 0 && heartbeat_is_bootup(cf))
+			node->bootups++;
+		break;
+	case CANOPEN_EMCY:
+		node->emcy++;
+		break;
+	case CANOPEN_RSDO:
+	case CANOPEN_TSDO:
+		if (cf->can_dlc == 0 || (cf->can_id & CAN_RTR_FLAG))
+			break;
+
+		event.is_response = msg.object == CANOPEN_TSDO;
+		ts__sdo_add(&node->sdo, &event);
+		break;
+	default:
+		break;
+	}
+}
+
+int ts_add(struct trace_stats* self, const struct tb_frame* frame)
+{
+	const struct can_frame* cf = &frame->cf;
+
+	if (self->n_frames++ == 0)
+		self->first_timestamp = frame->timestamp;
+
+	if (frame->timestamp > self->last_timestamp)
+		self->last_timestamp = frame->timestamp;
+
+	if (cf->can_id & CAN_ERR_FLAG) {
+		self->n_errors++;
+		return 0;
+	}
+
+	unsigned int bits = ts_frame_bits(cf);
+	self->n_bits += bits;
+
+	if (ts__load_add(self, frame->timestamp / 1000000ULL, bits) < 0)
+		return -1;
+
+	if (cf->can_id & CAN_EFF_FLAG) {
+		self->n_extended++;
+		return 0;
+	}
+
+	ts_interval_add(&self->cob[cf->can_id & CAN_SFF_MASK],
+			frame->timestamp);
+
+	ts__add_canopen(self, frame);
+	return 0;
+}
+
+static int ts__load_merge(struct trace_stats* self,
+			  const struct trace_stats* other)
+{
+	if (other->load_length == 0)
+		return 0;
+
+	self->load_skipped += other->load_skipped;
+
+	if (self->load_length == 0) {
+		size_t size = other->load_length * sizeof(*other->load);
+
+		self->load = malloc(size);
+		if (!self->load)
+			return -1;
+
+		memcpy(self->load, other->load, size);
+		self->load_start = other->load_start;
+		self->load_length = other->load_length;
+		return 0;
+	}
+
+	uint64_t end = other->load_start + other->load_length - 1;
+	if (end >= self->load_start + TS_LOAD_SECONDS_MAX)
+		end = self->load_start + TS_LOAD_SECONDS_MAX - 1;
+
+	/* Grow to cover the end of other before adding */
+	if (ts__load_add(self, end, 0) < 0)
+		return -1;
+
+	for (size_t i = 0; i < other->load_length; ++i)
+		ts__load_add(self, other->load_start + i, other->load[i]);
+
+	return 0;
+}
+
+/* Run the prefix of other after the prefix of self */
+static void ts__sdo_merge_prefix(struct ts_sdo* self,
+				 const struct ts_sdo* other)
+{
+	ts__sdo_init_prefix(self);
+
+	for (int i = 0; i < TS_SDO_N_STATES; ++i) {
+		struct ts_sdo_path* path = &self->prefix[i];
+
+		if (path->outcome == TS_SDO_NONE)
+			*path = other->prefix[path->state];
+	}
+}
+
+static void ts__sdo_merge(struct ts_sdo* self, const struct ts_sdo* other)
+{
+	if (other->has_prefix && !self->has_started) {
+		ts__sdo_merge_prefix(self, other);
+	} else if (other->has_prefix) {
+		/* End the transaction that was open at the end of self */
+		const struct ts_sdo_path* path = &other->prefix[self->state];
+		ts__sdo_finish(self, path->outcome, path->timestamp);
+		self->state = path->state;
+	}
+
+	if (other->has_started) {
+		self->has_started = 1;
+		self->state = other->state;
+		self->start = other->start;
+	}
+
+	self->count += other->count;
+	self->aborts += other->aborts;
+	self->sum += other->sum;
+	if (other->max > self->max)
+		self->max = other->max;
+
+	for (int i = 0; i < TS_LATENCY_BUCKETS; ++i)
+		self->histogram[i] += other->histogram[i];
+}
+
+int ts_merge(struct trace_stats* self, const struct trace_stats* other)
+{
+	if (other->n_frames == 0)
+		return 0;
+
+	if (ts__load_merge(self, other) < 0)
+		return -1;
+
+	if (self->n_frames == 0)
+		self->first_timestamp = other->first_timestamp;
+
+	if (other->last_timestamp > self->last_timestamp)
+		self->last_timestamp = other->last_timestamp;
+
+	self->n_frames += other->n_frames;
+	self->n_extended += other->n_extended;
+	self->n_errors += other->n_errors;
+	self->n_bits += other->n_bits;
+
+	for (int i = 0; i < TS_N_COBS; ++i)
+		ts_interval_merge(&self->cob[i], &other->cob[i]);
+
+	for (int i = 0; i < TS_N_NODES; ++i) {
+		struct ts_node* node = &self->node[i];
+		const struct ts_node* other_node = &other->node[i];
+
+		ts_interval_merge(&node->heartbeat, &other_node->heartbeat);
+		node->bootups += other_node->bootups;
+		node->emcy += other_node->emcy;
+		ts__sdo_merge(&node->sdo, &other_node->sdo);
+	}
+
+	return 0;
+}
+
+static const char* ts__format_time(char* buffer, size_t size, uint64_t t)
+{
+	time_t seconds = t / 1000000ULL;
+	struct tm tm = { 0 };
+
+	strftime(buffer, size, "%FT%T", localtime_r(&seconds, &tm));
+	return buffer;
+}
+
+static void ts__print_load(const struct trace_stats* self, FILE* stream,
+			   unsigned int bitrate)
+{
+	/* Group the seconds so that a long trace fits on a screen */
+	const size_t max_rows = 60;
+	size_t width = (self->load_length + max_rows - 1) / max_rows;
+	uint64_t peak = 0;
+	size_t peak_index = 0;
+	char buffer[64];
+
+	for (size_t i = 0; i < self->load_length; ++i)
+		if (self->load[i] > peak) {
+			peak = self->load[i];
+			peak_index = i;
+		}
+
+	for (size_t i = 0; i < self->load_length; i += width) {
+		size_t n = self->load_length - i < width
+			 ? self->load_length - i : width;
+		uint64_t bits = 0;
+
+		for (size_t j = 0; j < n; ++j)
+			bits += self->load[i + j];
+
+		double rate = (double)bits / n;
+
+		fprintf(stream, "LOAD time=%s,seconds=%zu,bits-per-second=%.0f",
+			ts__format_time(buffer, sizeof(buffer),
+					(self->load_start + i) * 1000000ULL),
+			n, rate);
+		if (bitrate)
+			fprintf(stream, ",load=%.2f%%", 100.0 * rate / bitrate);
+		fprintf(stream, "\n");
+	}
+
+	if (self->load_skipped > 0)
+		fprintf(stream, "LOAD skipped bits=%"PRIu64"\n",
+			self->load_skipped);
+
+	if (self->load_length > 0) {
+		fprintf(stream, "LOAD peak time=%s,bits-per-second=%"PRIu64,
+			ts__format_time(buffer, sizeof(buffer),
+					(self->load_start + peak_index)
+					* 1000000ULL),
+			peak);
+		if (bitrate)
+			fprintf(stream, ",load=%.2f%%",
+				100.0 * peak / bitrate);
+		fprintf(stream, "\n");
+	}
+}
+
+static void ts__print_interval(const struct ts_interval* interval,
+			       FILE* stream)
+{
+	fprintf(stream, "count=%"PRIu64, interval->count);
+
+	if (interval->n_intervals == 0)
+		return;
+
+	double duration = interval->last - interval->first;
+
+	fprintf(stream, ",rate=%.3fHz,period=%.0fus,jitter=%.0fus"
+		",min=%"PRIu64"us,max=%"PRIu64"us",
+		duration > 0 ? 1e6 * interval->n_intervals / duration : 0.0,
+		interval->mean, ts_interval_stddev(interval), interval->min,
+		interval->max);
+}
+
+static void ts__print_sdo(const struct ts_sdo* sdo, int nodeid, FILE* stream)
+{
+	if (sdo->count == 0 && sdo->aborts == 0)
+		return;
+
+	fprintf(stream, "SDO %d count=%"PRIu64",aborts=%"PRIu64, nodeid,
+		sdo->count, sdo->aborts);
+
+	if (sdo->count > 0) {
+		fprintf(stream, ",mean=%"PRIu64"us,max=%"PRIu64"us,histogram=",
+			sdo->sum / sdo->count, sdo->max);
+
+		const char* separator = "";
+		for (int i = 0; i < TS_LATENCY_BUCKETS; ++i) {
+			if (sdo->histogram[i] == 0)
+				continue;
+
+			fprintf(stream, "%s<%" PRIu64 "us:%" PRIu64, separator,
+				(uint64_t)2 << i, sdo->histogram[i]);
+			separator = ";";
+		}
+	}
+
+	fprintf(stream, "\n");
+}
+
+void ts_print(const struct trace_stats* self, FILE* stream,
+	      unsigned int bitrate)
+{
+	double duration = (self->last_timestamp - self->first_timestamp) / 1e6;
+	char from[64], to[64];
+
+	fprintf(stream, "SUMMARY frames=%"PRIu64",extended=%"PRIu64
+		",errors=%"PRIu64",bits=%"PRIu64",duration=%.3fs",
+		self->n_frames, self->n_extended, self->n_errors, self->n_bits,
+		duration);
+
+	if (self->n_frames > 0)
+		fprintf(stream, ",from=%s,to=%s",
+			ts__format_time(from, sizeof(from),
+					self->first_timestamp),
+			ts__format_time(to, sizeof(to), self->last_timestamp));
+
+	if (bitrate && duration > 0)
+		fprintf(stream, ",load=%.2f%%",
+			100.0 * self->n_bits / (duration * bitrate));
+
+	fprintf(stream, "\n");
+
+	ts__print_load(self, stream, bitrate);
+
+	if (self->cob[R_SYNC].count > 0) {
+		fprintf(stream, "SYNC ");
+		ts__print_interval(&self->cob[R_SYNC], stream);
+		fprintf(stream, "\n");
+	}
+
+	for (int i = 0; i < TS_N_COBS; ++i) {
+		if (self->cob[i].count == 0)
+			continue;
+
+		fprintf(stream, "COB %x ", i);
+		ts__print_interval(&self->cob[i], stream);
+		fprintf(stream, "\n");
+	}
+
+	for (int i = 1; i < TS_N_NODES; ++i) {
+		const struct ts_node* node = &self->node[i];
+
+		if (node->heartbeat.count > 0) {
+			fprintf(stream, "HEARTBEAT %d ", i);
+			ts__print_interval(&node->heartbeat, stream);
+			fprintf(stream, ",bootups=%"PRIu64"\n", node->bootups);
+		}
+
+		if (node->emcy > 0)
+			fprintf(stream, "EMCY %d count=%"PRIu64"\n", i,
+				node->emcy);
+
+		ts__print_sdo(&node->sdo, i, stream);
+	}
+}
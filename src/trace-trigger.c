@@ -0,0 +1,335 @@
+/* Copyright (c) 2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace-trigger.h"
+#include "canopen.h"
+#include "canopen/emcy.h"
+#include "canopen/sdo.h"
+
+size_t strlcpy(char* dst, const char* src, size_t size);
+
+const char* tt_type_to_string(enum tt_type type)
+{
+	switch (type) {
+	case TT_COB:		return "cob";
+	case TT_EMCY:		return "emcy";
+	case TT_SDO_ABORT:	return "sdo-abort";
+	case TT_HEARTBEAT_LOSS:	return "heartbeat-loss";
+	case TT_RATE:		return "rate";
+	}
+
+	return "unknown";
+}
+
+static int tt__parse_uint(uint32_t* dst, const char* str, int base)
+{
+	char* end = NULL;
+
+	if (!str || !*str)
+		return -1;
+
+	unsigned long value = strtoul(str, &end, base);
+	if (*end != '\0')
+		return -1;
+
+	*dst = value;
+	return 0;
+}
+
+static int tt__parse_type(struct tt_trigger* trigger, const char* key,
+			  const char* value)
+{
+	if (strcmp(key, "cob") == 0) {
+		trigger->type = TT_COB;
+		if (tt__parse_uint(&trigger->value, value, 16) < 0
+		 || trigger->value > CAN_SFF_MASK)
+			return -1;
+	} else if (strcmp(key, "emcy") == 0) {
+		trigger->type = TT_EMCY;
+	} else if (strcmp(key, "sdo-abort") == 0) {
+		trigger->type = TT_SDO_ABORT;
+	} else if (strcmp(key, "heartbeat-loss") == 0) {
+		trigger->type = TT_HEARTBEAT_LOSS;
+		return value ? -1 : 0;
+	} else if (strcmp(key, "rate") == 0) {
+		trigger->type = TT_RATE;
+		if (tt__parse_uint(&trigger->value, value, 10) < 0
+		 || trigger->value * TT_RATE_PERIOD / 1000000000ULL == 0)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	if (value && trigger->type != TT_COB && trigger->type != TT_RATE
+	 && tt__parse_uint(&trigger->value, value, 16) < 0)
+		return -1;
+
+	trigger->has_value = !!value;
+	return 0;
+}
+
+static int tt__parse_option(struct tt_trigger* trigger, const char* key,
+			    const char* value)
+{
+	uint32_t number;
+
+	if (tt__parse_uint(&number, value, 10) < 0)
+		return -1;
+
+	if (strcmp(key, "node") == 0) {
+		if (number < 1 || number > 127)
+			return -1;
+		trigger->nodeid = number;
+	} else if (strcmp(key, "pre") == 0) {
+		trigger->pre = number;
+	} else if (strcmp(key, "post") == 0) {
+		trigger->post = number;
+	} else if (strcmp(key, "holdoff") == 0) {
+		trigger->holdoff = number;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int tt__parse_trigger(struct tt_trigger* trigger, char* spec)
+{
+	char* state = NULL;
+	int is_first = 1;
+
+	trigger->pre = TT_DEFAULT_PRE;
+	trigger->post = TT_DEFAULT_POST;
+	trigger->holdoff = TT_DEFAULT_HOLDOFF;
+
+	for (char* token = strtok_r(spec, " ,", &state); token;
+	     token = strtok_r(NULL, " ,", &state)) {
+		char* value = strchr(token, '=');
+		if (value)
+			*value++ = '\0';
+
+		int rc = is_first ? tt__parse_type(trigger, token, value)
+				  : tt__parse_option(trigger, token, value);
+		if (rc < 0)
+			return -1;
+
+		is_first = 0;
+	}
+
+	return is_first ? 1 : 0;
+}
+
+static void tt__set_cob(struct trace_trigger* self, uint32_t cob)
+{
+	self->cob_mask[cob / 8] |= 1 << (cob % 8);
+}
+
+static void tt__set_node_range(struct trace_trigger* self, uint32_t base,
+			       int nodeid)
+{
+	if (nodeid) {
+		tt__set_cob(self, base + nodeid);
+		return;
+	}
+
+	for (int i = 1; i <= 127; ++i)
+		tt__set_cob(self, base + i);
+}
+
+static inline uint32_t tt__rate_threshold(const struct tt_trigger* trigger)
+{
+	return trigger->value * TT_RATE_PERIOD / 1000000000ULL;
+}
+
+static void tt__enable(struct trace_trigger* self,
+		       const struct tt_trigger* trigger)
+{
+	switch (trigger->type) {
+	case TT_COB:
+		tt__set_cob(self, trigger->value);
+		break;
+	case TT_EMCY:
+		tt__set_node_range(self, R_EMCY, trigger->nodeid);
+		break;
+	case TT_SDO_ABORT:
+		tt__set_node_range(self, R_TSDO, trigger->nodeid);
+		tt__set_node_range(self, R_RSDO, trigger->nodeid);
+		break;
+	case TT_RATE:
+		if (!self->rate_limit
+		 || tt__rate_threshold(trigger) < self->rate_limit)
+			self->rate_limit = tt__rate_threshold(trigger);
+		break;
+	case TT_HEARTBEAT_LOSS:
+		break;
+	}
+}
+
+int tt_init(struct trace_trigger* self, const char* spec, tt_fire_fn fn,
+	    void* context)
+{
+	char buffer[TT_SPEC_MAX];
+	char* state = NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->fn = fn;
+	self->context = context;
+
+	if (!spec || !*spec)
+		return 0;
+
+	if (strlcpy(buffer, spec, sizeof(buffer)) >= sizeof(buffer))
+		goto failure;
+
+	for (char* str = strtok_r(buffer, ";", &state); str;
+	     str = strtok_r(NULL, ";", &state)) {
+		if (self->n_triggers >= TT_TRIGGERS_MAX)
+			goto failure;
+
+		struct tt_trigger* trigger = &self->trigger[self->n_triggers];
+
+		int rc = tt__parse_trigger(trigger, str);
+		if (rc < 0)
+			goto failure;
+
+		/* Empty */
+		if (rc > 0)
+			continue;
+
+		tt__enable(self, trigger);
+		self->n_triggers++;
+	}
+
+	return 0;
+
+failure:
+	memset(self, 0, sizeof(*self));
+	return -1;
+}
+
+static void tt__fire(struct trace_trigger* self, struct tt_trigger* trigger,
+		     int nodeid, uint64_t now)
+{
+	if (trigger->has_fired
+	 && now - trigger->last_fired < trigger->holdoff * 1000000ULL)
+		return;
+
+	trigger->has_fired = 1;
+	trigger->last_fired = now;
+	trigger->n_fired++;
+
+	if (self->fn)
+		self->fn(self, trigger, nodeid, self->context);
+}
+
+static int tt__is_match(const struct tt_trigger* trigger,
+			const struct can_frame* cf,
+			const struct canopen_msg* msg)
+{
+	if (trigger->nodeid && trigger->nodeid != msg->id)
+		return 0;
+
+	switch (trigger->type) {
+	case TT_COB:
+		return (cf->can_id & CAN_SFF_MASK) == trigger->value;
+	case TT_EMCY:
+		if (msg->object != CANOPEN_EMCY || cf->can_dlc < 2)
+			return 0;
+
+		return trigger->has_value
+		     ? emcy_get_code(cf) == trigger->value
+		     : emcy_get_code(cf) != 0;
+	case TT_SDO_ABORT:
+		if (!(msg->object & (CANOPEN_TSDO | CANOPEN_RSDO))
+		 || cf->can_dlc < CAN_MAX_DLC
+		 || sdo_get_cs(cf) != SDO_SCS_ABORT)
+			return 0;
+
+		return !trigger->has_value
+		     || (uint32_t)sdo_get_abort_code(cf) == trigger->value;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void tt__check_frame(struct trace_trigger* self,
+			    const struct can_frame* cf, uint64_t now)
+{
+	struct canopen_msg msg = { 0 };
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		memset(&msg, 0, sizeof(msg));
+
+	for (unsigned int i = 0; i < self->n_triggers; ++i) {
+		struct tt_trigger* trigger = &self->trigger[i];
+
+		if (tt__is_match(trigger, cf, &msg))
+			tt__fire(self, trigger, msg.id, now);
+	}
+}
+
+static void tt__check_rate(struct trace_trigger* self, uint64_t now)
+{
+	for (unsigned int i = 0; i < self->n_triggers; ++i) {
+		struct tt_trigger* trigger = &self->trigger[i];
+
+		if (trigger->type == TT_RATE
+		 && self->rate_count == tt__rate_threshold(trigger) + 1)
+			tt__fire(self, trigger, 0, now);
+	}
+}
+
+void tt_check(struct trace_trigger* self, const struct can_frame* cf,
+	      uint64_t now)
+{
+	if (self->rate_limit) {
+		uint64_t period = now / TT_RATE_PERIOD;
+		if (period != self->rate_period) {
+			self->rate_period = period;
+			self->rate_count = 0;
+		}
+
+		if (++self->rate_count > self->rate_limit)
+			tt__check_rate(self, now);
+	}
+
+	if (cf->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG | CAN_RTR_FLAG))
+		return;
+
+	uint32_t cob = cf->can_id & CAN_SFF_MASK;
+	if (self->cob_mask[cob / 8] & (1 << (cob % 8)))
+		tt__check_frame(self, cf, now);
+}
+
+void tt_event(struct trace_trigger* self, enum tt_type type, int nodeid,
+	      uint64_t now)
+{
+	for (unsigned int i = 0; i < self->n_triggers; ++i) {
+		struct tt_trigger* trigger = &self->trigger[i];
+
+		if (trigger->type != type)
+			continue;
+
+		if (trigger->nodeid && trigger->nodeid != nodeid)
+			continue;
+
+		tt__fire(self, trigger, nodeid, now);
+	}
+}
@@ -178,3 +178,10 @@ void userdata_reload(struct userdata* self)
 {
 	userdata__load_required(self);
 }
+
+void userdata_get_required(const struct userdata* self, char* nodes)
+{
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i)
+		if (self->required[i / 64] & (1ULL << (i % 64)))
+			nodes[i] = 1;
+}
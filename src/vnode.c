@@ -27,6 +27,7 @@
 #include "canopen/heartbeat.h"
 #include "canopen/byteorder.h"
 #include "canopen/types.h"
+#include "canopen/lss.h"
 #include "net-util.h"
 #include "sock.h"
 #include "ini_parser.h"
@@ -37,6 +38,8 @@
 #define SDO_MUX(index, subindex) ((index << 16) | subindex)
 #define HEARTBEAT_PERIOD SDO_MUX(0x1017, 0)
 
+#define VNODE_LSS_MAX 127
+
 enum vnode__bootup_method {
 	VNODE_BOOT_UNSPEC = 0,
 	VNODE_BOOT_STANDARD = 1,
@@ -56,6 +59,7 @@ struct vnode {
 	int have_node_guarding;
 	int have_guard_status_bug;
 	enum vnode__bootup_method bootup_method;
+	struct lss_slave lss;
 };
 
 struct sock vnode__sock;
@@ -63,11 +67,53 @@ static struct mloop_socket* vnode__socket = NULL;
 
 struct vnode vnode__node[127] = { 0 };
 
+/* Nodes that start without a node id and get one assigned via LSS */
+struct vnode vnode__lss_node[VNODE_LSS_MAX] = { 0 };
+
 static inline struct vnode* vnode__get_node(int nodeid)
 {
 	return &vnode__node[nodeid - 1];
 }
 
+static struct vnode* vnode__find_node(int nodeid)
+{
+	if (!(CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX))
+		return NULL;
+
+	struct vnode* self = vnode__get_node(nodeid);
+	if (self->is_running && self->nodeid == nodeid)
+		return self;
+
+	for (int i = 0; i < VNODE_LSS_MAX; ++i) {
+		self = &vnode__lss_node[i];
+		if (self->is_running && self->nodeid == nodeid)
+			return self;
+	}
+
+	return NULL;
+}
+
+static struct vnode* vnode__get_free_lss_node(void)
+{
+	for (int i = 0; i < VNODE_LSS_MAX; ++i)
+		if (!vnode__lss_node[i].is_running)
+			return &vnode__lss_node[i];
+
+	return NULL;
+}
+
+static void vnode__broadcast(const struct can_frame* cf,
+			     void (*fn)(struct vnode*, const struct can_frame*))
+{
+	for (int i = 0; i < 127; ++i)
+		if (vnode__node[i].is_running)
+			fn(&vnode__node[i], cf);
+
+	for (int i = 0; i < VNODE_LSS_MAX; ++i)
+		if (vnode__lss_node[i].is_running)
+			fn(&vnode__lss_node[i], cf);
+}
+
 static void vnode__init(struct vnode* self)
 {
 	memset(self, 0, sizeof(*self));
@@ -109,6 +155,26 @@ static void vnode__load_device_info(struct vnode* self)
 	self->bootup_method = vnode__get_bootup_method(s);
 }
 
+static uint32_t vnode__config_u32(const struct ini_section* s,
+				  const char* key)
+{
+	const char* value = ini_find_key(s, key);
+	return value ? strtoul(value, NULL, 0) : 0;
+}
+
+static void vnode__load_lss_info(struct vnode* self)
+{
+	const struct ini_section* s;
+	s = ini_find_section(&self->config, "lss");
+	if (!s)
+		return;
+
+	self->lss.identity.vendor = vnode__config_u32(s, "vendor");
+	self->lss.identity.product = vnode__config_u32(s, "product");
+	self->lss.identity.revision = vnode__config_u32(s, "revision");
+	self->lss.identity.serial = vnode__config_u32(s, "serial");
+}
+
 static int vnode__load_config(struct vnode* self, const char* path)
 {
 	FILE* stream = fopen(path, "r");
@@ -124,6 +190,7 @@ static int vnode__load_config(struct vnode* self, const char* path)
 	fclose(stream);
 
 	vnode__load_device_info(self);
+	vnode__load_lss_info(self);
 
 	return rc;
 }
@@ -200,6 +267,9 @@ static int vnode__restart_heartbeat_timer(struct vnode* self)
 
 static void vnode__nmt(struct vnode* self, const struct can_frame* cf)
 {
+	if (self->nodeid < 0)
+		return;
+
 	int nodeid = nmt_get_nodeid(cf);
 	if (nodeid != self->nodeid && nodeid != 0)
 		return;
@@ -367,38 +437,47 @@ static void vnode__rsdo(struct vnode* self, const struct can_frame* cf)
 	sdo_srv_feed(&self->sdo_srv, cf);
 }
 
+static void vnode__lss(struct vnode* self, const struct can_frame* cf)
+{
+	struct can_frame reply;
+
+	if (lss_slave_feed(&self->lss, cf, &reply))
+		sock_send(&vnode__sock, &reply, 0);
+
+	if (self->nodeid < 0 && self->lss.nodeid != LSS_NODEID_UNCONFIGURED) {
+		self->nodeid = self->lss.nodeid;
+		self->sdo_srv.nodeid = self->nodeid;
+		vnode__reset_communication(self);
+	}
+}
+
 static void vnode__on_frame(const struct can_frame* cf)
 {
 	struct vnode* self;
 	struct canopen_msg msg;
 
+	if ((cf->can_id & CAN_SFF_MASK) == LSS_COB_MASTER) {
+		vnode__broadcast(cf, vnode__lss);
+		return;
+	}
+
 	if (canopen_get_object_type(&msg, cf) < 0)
 		return;
 
 	if (msg.object != CANOPEN_NMT) {
-		if (!(CANOPEN_NODEID_MIN <= msg.id
-		      && msg.id <= CANOPEN_NODEID_MAX))
-			return;
-
-		self = vnode__get_node(msg.id);
-		if (!self)
-			return;
-
-		if (msg.id != self->nodeid)
-			return;
+		self = vnode__find_node(msg.id);
 	} else {
 		if (nmt_get_nodeid(cf) == 0) {
-			for (int i = 1; i < 128; ++i) {
-				self = vnode__get_node(i);
-				if (self->is_running)
-					vnode__nmt(self, cf);
-				return;
-			}
-		} else {
-			self = vnode__get_node(nmt_get_nodeid(cf));
+			vnode__broadcast(cf, vnode__nmt);
+			return;
 		}
+
+		self = vnode__find_node(nmt_get_nodeid(cf));
 	}
 
+	if (!self)
+		return;
+
 	switch (msg.object) {
 	case CANOPEN_HEARTBEAT:
 		vnode__heartbeat(self, cf);
@@ -481,18 +560,13 @@ failure:
 	return -1;
 }
 
-__attribute__((visibility("default")))
-struct vnode* co_vnode_new(enum sock_type type, const char* iface,
-			   const char* config_path, int nodeid)
+static int vnode__start(struct vnode* self, enum sock_type type,
+			const char* iface, const char* config_path, int nodeid)
 {
-	struct vnode* self = vnode__get_node(nodeid);
-	if (!self)
-		return NULL;
-
 	vnode__init(self);
 
 	if (vnode__init_socket(self, type, iface) < 0)
-		return NULL;
+		return -1;
 
 	if (config_path)
 		if (vnode__load_config(self, config_path) < 0)
@@ -507,23 +581,63 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 
 	if (self->have_heartbeat)
 		if (vnode__setup_heartbeat_timer(self) < 0)
-			goto srv_failure;
-
-	if (self->bootup_method & VNODE_BOOT_LEGACY)
-		vnode__send_legacy_bootup(self);
+			goto timer_failure;
 
-	vnode__reset_communication(self);
+	struct lss_identity identity = self->lss.identity;
+	lss_slave_init(&self->lss, &identity,
+		       nodeid > 0 ? nodeid : LSS_NODEID_UNCONFIGURED);
 
-	self->is_running = 1;
-	return self;
+	return 0;
 
+timer_failure:
 	sdo_srv_destroy(&self->sdo_srv);
 srv_failure:
 	if (config_path)
 		ini_destroy(&self->config);
 config_failure:
 	vnode__cleanup_mloop();
-	return NULL;
+	return -1;
+}
+
+__attribute__((visibility("default")))
+struct vnode* co_vnode_new(enum sock_type type, const char* iface,
+			   const char* config_path, int nodeid)
+{
+	struct vnode* self = vnode__get_node(nodeid);
+	if (!self)
+		return NULL;
+
+	if (vnode__start(self, type, iface, config_path, nodeid) < 0)
+		return NULL;
+
+	if (self->bootup_method & VNODE_BOOT_LEGACY)
+		vnode__send_legacy_bootup(self);
+
+	vnode__reset_communication(self);
+
+	self->is_running = 1;
+	return self;
+}
+
+__attribute__((visibility("default")))
+struct vnode* co_vnode_new_unconfigured(enum sock_type type, const char* iface,
+					const char* config_path,
+					uint32_t serial)
+{
+	struct vnode* self = vnode__get_free_lss_node();
+	if (!self)
+		return NULL;
+
+	if (vnode__start(self, type, iface, config_path, -1) < 0)
+		return NULL;
+
+	self->lss.identity.serial = serial;
+
+	if (self->bootup_method == VNODE_BOOT_UNSPEC)
+		self->bootup_method = VNODE_BOOT_STANDARD;
+
+	self->is_running = 1;
+	return self;
 }
 
 __attribute__((visibility("default")))
@@ -0,0 +1,191 @@
+/* Compares the cost of looking up the per-node dispatch state for received
+ * PDOs with the node table laid out as one interleaved array (the layout used
+ * before co_master_node_hot was introduced) and with the hot/cold split.
+ *
+ * In the polluted runs, a few cache lines of a large buffer are touched between
+ * frames to emulate the cache pressure from the rest of the main loop (epoll,
+ * recv, timers). The cost of the pollution alone is printed for reference.
+ *
+ * Build: cc -O2 -std=gnu99 -D_GNU_SOURCE -Iinc -Iinc/compat test/bench_dispatch.c
+ */
+#include "canopen/master.h"
+#include "time-utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define N_FRAMES (1 << 22)
+#define POLLUTION_SIZE (1024 * 1024)
+#define POLLUTION_LINES 8
+
+struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
+struct co_master_node_hot co_master_node_hot_[CANOPEN_NODEID_MAX + 1];
+
+struct old_drv {
+	void* dso;
+	void* init_fn;
+	void* sdo_queue;
+	void* context;
+	void* free_fn;
+	co_pdo_fn pdo1_fn, pdo2_fn, pdo3_fn, pdo4_fn;
+	void* emcy_fn;
+	void* start_fn;
+	enum co_options options;
+	char iface[256];
+};
+
+struct old_node {
+	enum co_master_driver_type driver_type;
+	void* driver;
+	void* master_iface;
+	struct old_drv ndrv;
+	uint32_t device_type;
+	int is_heartbeat_supported;
+	uint32_t vendor_id, product_code, revision_number;
+	void* heartbeat_timer;
+	void* ping_timer;
+	char name[64];
+	char hw_version[64];
+	char sw_version[64];
+	int is_loading;
+	int is_initialized;
+	uint32_t ntimeouts;
+	struct pdo_filter pdo_filter[4];
+};
+
+static struct old_node old_node_[CANOPEN_NODEID_MAX + 1];
+
+static uint64_t n_calls = 0;
+static volatile uint8_t pollution[POLLUTION_SIZE];
+
+static void on_pdo(struct co_drv* drv, const void* data, size_t size)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+	++n_calls;
+}
+
+static void on_old_pdo(struct old_drv* drv, const unsigned char* data,
+		       size_t size)
+{
+	(void)drv;
+	(void)data;
+	(void)size;
+	++n_calls;
+}
+
+static inline void pollute(uint64_t i)
+{
+	size_t offset = (i * POLLUTION_LINES * 64) % POLLUTION_SIZE;
+
+	for (size_t k = 0; k < POLLUTION_LINES; ++k)
+		pollution[offset + k * 64]++;
+}
+
+static inline void dispatch_old(int nodeid, int n, const unsigned char* data)
+{
+	struct old_node* node = &old_node_[nodeid];
+	if (!node->is_initialized || node->driver_type != CO_MASTER_DRIVER_NEW)
+		return;
+
+	struct old_drv* drv = &node->ndrv;
+	void (*fn)(struct old_drv*, const unsigned char*, size_t) = NULL;
+
+	switch (n) {
+	case 1: fn = (void*)drv->pdo1_fn; break;
+	case 2: fn = (void*)drv->pdo2_fn; break;
+	case 3: fn = (void*)drv->pdo3_fn; break;
+	case 4: fn = (void*)drv->pdo4_fn; break;
+	}
+
+	if (fn && !node->pdo_filter[n - 1].is_enabled)
+		fn(drv, data, 8);
+}
+
+static inline void dispatch_new(int nodeid, int n, const unsigned char* data)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	const struct co_master_node_hot* hot = co_master_get_node_hot(nodeid);
+	if (!hot->is_initialized || hot->driver_type != CO_MASTER_DRIVER_NEW)
+		return;
+
+	co_pdo_fn fn = hot->pdo_fn[n - 1];
+	if (fn && !(hot->pdo_filter_mask & (1 << (n - 1))))
+		fn(&node->ndrv, data, 8);
+}
+
+static uint64_t run(void (*dispatch)(int, int, const unsigned char*),
+		    const uint8_t* ids, int is_polluted)
+{
+	unsigned char data[8] = { 0 };
+
+	uint64_t t0 = gettime_ns(CLOCK_MONOTONIC);
+
+	for (uint64_t i = 0; i < N_FRAMES; ++i) {
+		dispatch(ids[i], 1 + (i & 3), data);
+		if (is_polluted)
+			pollute(i);
+	}
+
+	return gettime_ns(CLOCK_MONOTONIC) - t0;
+}
+
+static uint64_t run_pollution_only(void)
+{
+	uint64_t t0 = gettime_ns(CLOCK_MONOTONIC);
+	for (uint64_t i = 0; i < N_FRAMES; ++i)
+		pollute(i);
+	return gettime_ns(CLOCK_MONOTONIC) - t0;
+}
+
+int main()
+{
+	uint8_t* ids = malloc(N_FRAMES);
+	if (!ids)
+		return 1;
+
+	srand(42);
+	for (uint64_t i = 0; i < N_FRAMES; ++i)
+		ids[i] = 1 + rand() % CANOPEN_NODEID_MAX;
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		old_node_[i].driver_type = CO_MASTER_DRIVER_NEW;
+		old_node_[i].is_initialized = 1;
+		old_node_[i].ndrv.pdo1_fn = (co_pdo_fn)on_old_pdo;
+		old_node_[i].ndrv.pdo2_fn = (co_pdo_fn)on_old_pdo;
+		old_node_[i].ndrv.pdo3_fn = (co_pdo_fn)on_old_pdo;
+		old_node_[i].ndrv.pdo4_fn = (co_pdo_fn)on_old_pdo;
+
+		struct co_master_node_hot* hot = co_master_get_node_hot(i);
+		hot->driver_type = CO_MASTER_DRIVER_NEW;
+		hot->is_initialized = 1;
+		for (int n = 0; n < 4; ++n)
+			hot->pdo_fn[n] = on_pdo;
+	}
+
+	printf("sizeof(old_node) = %zu, table = %zu bytes\n",
+	       sizeof(struct old_node), sizeof(old_node_));
+	printf("sizeof(co_master_node_hot) = %zu, table = %zu bytes\n",
+	       sizeof(struct co_master_node_hot), sizeof(co_master_node_hot_));
+
+	printf("pollution only: %.2f ns/frame\n",
+	       (double)run_pollution_only() / N_FRAMES);
+
+	for (int polluted = 0; polluted <= 1; ++polluted) {
+		uint64_t t_old = run(dispatch_old, ids, polluted);
+		uint64_t t_new = run(dispatch_new, ids, polluted);
+
+		printf("%s: interleaved %.2f ns/frame, hot/cold %.2f ns/frame\n",
+		       polluted ? "polluted" : "warm    ",
+		       (double)t_old / N_FRAMES, (double)t_new / N_FRAMES);
+	}
+
+	if (n_calls != 4ULL * N_FRAMES)
+		return 1;
+
+	free(ids);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/* Measures HTTP request head parsing throughput.
+ *
+ * A typical SDO request is parsed either in one go or as it would arrive in
+ * small segments, in which case the parser is called after each segment.
+ *
+ * Build: cc -O2 -std=gnu99 -D_GNU_SOURCE -Iinc test/bench_http.c src/http.c
+ */
+#include "http.h"
+#include "time-utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define N_REQUESTS 1000000
+
+static const char request_[] =
+	"PUT /sdo/3/1017/0?type=u16 HTTP/1.1\r\n"
+	"Host: localhost:9191\r\n"
+	"User-Agent: curl/7.88.1\r\n"
+	"Accept: */*\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 4\r\n"
+	"\r\n"
+	"1000";
+
+static int run(size_t segment)
+{
+	char buffer[sizeof(request_)];
+	struct http_parser parser;
+	struct http_req req;
+
+	for (int i = 0; i < N_REQUESTS; ++i) {
+		memcpy(buffer, request_, sizeof(request_));
+		http_parser_init(&parser);
+
+		int rc = HTTP_PARSE_INCOMPLETE;
+		size_t size = 0;
+
+		while (rc == HTTP_PARSE_INCOMPLETE) {
+			size += segment;
+			if (size > sizeof(request_) - 1)
+				size = sizeof(request_) - 1;
+
+			rc = http_parser_feed(&parser, &req, buffer, size);
+		}
+
+		if (rc != HTTP_PARSE_DONE || req.content_length != 4)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void report(const char* name, uint64_t t0)
+{
+	double elapsed = (gettime_ns(CLOCK_MONOTONIC) - t0) / 1e9;
+	printf("%s: %.0f requests/s, %.0f MB/s\n", name, N_REQUESTS / elapsed,
+	       N_REQUESTS * (sizeof(request_) - 1) / elapsed / 1e6);
+}
+
+int main()
+{
+	uint64_t t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run(sizeof(request_)) < 0)
+		return 1;
+	report("whole", t0);
+
+	t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run(16) < 0)
+		return 1;
+	report("16 byte segments", t0);
+
+	return 0;
+}
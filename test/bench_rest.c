@@ -0,0 +1,227 @@
+/* Measures REST request throughput on the loopback interface.
+ *
+ * The default main loop runs on its own thread with a single trivial service.
+ * Requests are made either on a new connection each (the only mode that was
+ * possible before persistent connections), sequentially on one persistent
+ * connection, or pipelined on one persistent connection. With -t, connections
+ * are handled on a separate REST thread as with rest_init_threaded().
+ *
+ * Build: cc -O2 -std=gnu99 -D_GNU_SOURCE -Iinc -Iinc/compat test/bench_rest.c \
+ *	src/rest.c src/http.c src/net-util.c src/mloop.c src/prioq.c -lpthread
+ */
+#include "rest.h"
+#include "net-util.h"
+#include "time-utils.h"
+
+#include <mloop.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PORT 19191
+#define N_REQUESTS 20000
+#define PIPELINE_DEPTH 16
+
+static const char request_close_[] =
+	"GET /ping HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+static const char request_[] =
+	"GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static void ping_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "text/plain",
+		.content_length = 6,
+		.content = "pong\r\n"
+	};
+
+	rest_reply(client, &reply);
+	rest_client_done(client);
+}
+
+static void* run_server(void* arg)
+{
+	(void)arg;
+	mloop_run(mloop_default());
+	return NULL;
+}
+
+static int connect_server(void)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(PORT),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+	};
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	net_dont_delay(fd);
+	return fd;
+}
+
+struct response_reader {
+	char buffer[65536];
+	size_t index;
+};
+
+/* Returns the number of complete responses consumed from the buffer.
+ */
+static int consume_responses(struct response_reader* reader)
+{
+	int n = 0;
+	size_t pos = 0;
+
+	while (1) {
+		reader->buffer[reader->index] = '\0';
+		char* head = reader->buffer + pos;
+		char* end = strstr(head, "\r\n\r\n");
+		if (!end)
+			break;
+
+		char* length = strstr(head, "Content-Length: ");
+		if (!length || length > end)
+			return -1;
+
+		size_t size = end + 4 - head + atoi(length + 16);
+		if (pos + size > reader->index)
+			break;
+
+		pos += size;
+		++n;
+	}
+
+	memmove(reader->buffer, reader->buffer + pos, reader->index - pos);
+	reader->index -= pos;
+	return n;
+}
+
+static int read_responses(int fd, struct response_reader* reader)
+{
+	ssize_t size = read(fd, reader->buffer + reader->index,
+			    sizeof(reader->buffer) - reader->index - 1);
+	if (size <= 0)
+		return -1;
+
+	reader->index += size;
+	return consume_responses(reader);
+}
+
+static int run_close(int n_requests)
+{
+	struct response_reader reader;
+
+	for (int i = 0; i < n_requests; ++i) {
+		int fd = connect_server();
+		if (fd < 0)
+			return -1;
+
+		reader.index = 0;
+
+		if (write(fd, request_close_, sizeof(request_close_) - 1) < 0)
+			return -1;
+
+		int n = 0;
+		while (n == 0)
+			n = read_responses(fd, &reader);
+
+		close(fd);
+		if (n < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int run_pipelined(int n_requests, int depth)
+{
+	static struct response_reader reader;
+	reader.index = 0;
+
+	int fd = connect_server();
+	if (fd < 0)
+		return -1;
+
+	char batch[sizeof(request_) * PIPELINE_DEPTH];
+	for (int i = 0; i < depth; ++i)
+		memcpy(batch + i * (sizeof(request_) - 1), request_,
+		       sizeof(request_) - 1);
+
+	for (int sent = 0; sent < n_requests; sent += depth) {
+		size_t size = depth * (sizeof(request_) - 1);
+		if (write(fd, batch, size) != (ssize_t)size)
+			goto failure;
+
+		int n = 0;
+		while (n < depth) {
+			int rc = read_responses(fd, &reader);
+			if (rc < 0)
+				goto failure;
+			n += rc;
+		}
+	}
+
+	close(fd);
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+static void report(const char* name, int n_requests, uint64_t t0)
+{
+	double elapsed = (gettime_ns(CLOCK_MONOTONIC) - t0) / 1e9;
+	printf("%s: %.0f requests/s\n", name, n_requests / elapsed);
+}
+
+int main(int argc, char* argv[])
+{
+	int is_threaded = argc > 1 && strcmp(argv[1], "-t") == 0;
+
+	rest_set_keepalive(5000, 0);
+
+	int rc = is_threaded ? rest_init_threaded(PORT) : rest_init(PORT);
+	if (rc < 0) {
+		perror("Could not initialize rest service");
+		return 1;
+	}
+
+	rest_register_service(HTTP_GET, "ping", ping_service);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, run_server, NULL);
+
+	uint64_t t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_close(N_REQUESTS) < 0)
+		return 1;
+	report("connection per request", N_REQUESTS, t0);
+
+	t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_pipelined(N_REQUESTS, 1) < 0)
+		return 1;
+	report("keep-alive", N_REQUESTS, t0);
+
+	t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_pipelined(N_REQUESTS, PIPELINE_DEPTH) < 0)
+		return 1;
+	report("keep-alive, pipelined", N_REQUESTS, t0);
+
+	return 0;
+}
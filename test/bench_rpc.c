@@ -0,0 +1,168 @@
+/* Measures RPC request throughput on a Unix socket for comparison with
+ * bench_rest.
+ *
+ * The default main loop runs on its own thread with the RPC server. The SDO
+ * layer is replaced with one that completes every upload at once with four
+ * bytes of data and RPDOs are not sent anywhere, so that only the cost of the
+ * protocol and the transport is measured. Requests are made sequentially,
+ * pipelined, and, for RPDOs, without replies.
+ *
+ * Build: cc -O2 -std=gnu99 -D_GNU_SOURCE -Iinc -Iinc/compat test/bench_rpc.c \
+ *	src/rpc.c src/rpc-client.c src/event-rest.c src/rest.c src/http.c \
+ *	src/canopen.c src/byteorder.c src/net-util.c src/mloop.c src/prioq.c \
+ *	-lpthread
+ */
+#include "rpc.h"
+#include "canopen-rpc.h"
+#include "canopen/sdo_req.h"
+#include "time-utils.h"
+
+#include <mloop.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define PATH "/tmp/bench_rpc.sock"
+#define N_REQUESTS 200000
+#define PIPELINE_DEPTH 16
+
+struct sdo_req* sdo_req_new(struct sdo_req_info* info)
+{
+	struct sdo_req* req = calloc(1, sizeof(*req));
+	req->ref = 1;
+	req->type = info->type;
+	req->index = info->index;
+	req->subindex = info->subindex;
+	req->on_done = info->on_done;
+	req->context = info->context;
+	vector_init(&req->data, 16);
+	return req;
+}
+
+int sdo_req_start(struct sdo_req* req, struct sdo_req_queue* queue)
+{
+	(void)queue;
+
+	uint32_t value = 0x1025;
+	vector_assign(&req->data, &value, sizeof(value));
+	req->status = SDO_REQ_OK;
+	req->on_done(req);
+	return 0;
+}
+
+int sdo_req_unref(struct sdo_req* req)
+{
+	if (--req->ref > 0)
+		return req->ref;
+
+	if (req->context_free_fn)
+		req->context_free_fn(req->context);
+
+	vector_destroy(&req->data);
+	free(req);
+	return 0;
+}
+
+struct sdo_req_queue* sdo_req_queue_get(int nodeid)
+{
+	(void)nodeid;
+	return NULL;
+}
+
+int co__rpdox(int nodeid, int type, const void* data, size_t size)
+{
+	(void)nodeid;
+	(void)type;
+	(void)data;
+	(void)size;
+	return 0;
+}
+
+static void* run_server(void* arg)
+{
+	(void)arg;
+	mloop_run(mloop_default());
+	return NULL;
+}
+
+static int run_sdo(struct co_rpc* rpc, int n_requests, int depth)
+{
+	int n_sent = 0, n_received = 0;
+
+	while (n_received < n_requests) {
+		while (n_sent < n_requests && n_sent - n_received < depth) {
+			if (co_rpc_sdo_upload(rpc, 3, 0x1000, 0) < 0)
+				return -1;
+			++n_sent;
+		}
+
+		const struct co_rpc_header* msg = co_rpc_receive(rpc, 1000);
+		if (!msg || msg->status != CO_RPC_OK)
+			return -1;
+
+		++n_received;
+	}
+
+	return 0;
+}
+
+static int run_rpdo(struct co_rpc* rpc, int n_requests)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < n_requests; ++i)
+		if (co_rpc_send_rpdo(rpc, 3, 1, &value, sizeof(value),
+				     CO_RPC_NO_REPLY) < 0)
+			return -1;
+
+	/* The reply to the last one means that all have been handled */
+	if (co_rpc_send_rpdo(rpc, 3, 1, &value, sizeof(value), 0) < 0)
+		return -1;
+
+	const struct co_rpc_header* msg = co_rpc_receive(rpc, 1000);
+	return msg && msg->status == CO_RPC_OK ? 0 : -1;
+}
+
+static void report(const char* name, int n_requests, uint64_t t0)
+{
+	double elapsed = (gettime_ns(CLOCK_MONOTONIC) - t0) / 1e9;
+	printf("%s: %.0f requests/s\n", name, n_requests / elapsed);
+}
+
+int main()
+{
+	if (rpc_init(PATH) < 0) {
+		perror("Could not initialize rpc service");
+		return 1;
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, run_server, NULL);
+
+	struct co_rpc* rpc = co_rpc_open(PATH);
+	if (!rpc) {
+		perror("Could not connect");
+		return 1;
+	}
+
+	uint64_t t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_sdo(rpc, N_REQUESTS, 1) < 0)
+		return 1;
+	report("sdo upload", N_REQUESTS, t0);
+
+	t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_sdo(rpc, N_REQUESTS, PIPELINE_DEPTH) < 0)
+		return 1;
+	report("sdo upload, pipelined", N_REQUESTS, t0);
+
+	t0 = gettime_ns(CLOCK_MONOTONIC);
+	if (run_rpdo(rpc, N_REQUESTS) < 0)
+		return 1;
+	report("rpdo without reply", N_REQUESTS, t0);
+
+	co_rpc_close(rpc);
+	unlink(PATH);
+	return 0;
+}
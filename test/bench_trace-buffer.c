@@ -0,0 +1,190 @@
+/* Measures the cost of tb_append() when several threads append to the same
+ * trace buffer while another thread keeps taking snapshots of it, and checks
+ * that no frame is lost or torn on the way.
+ *
+ * The cost of appending to a buffer that is protected by a mutex is printed
+ * for reference.
+ *
+ * Build: cc -O2 -std=gnu99 -D_GNU_SOURCE -Iinc -Iinc/compat \
+ *        test/bench_trace-buffer.c src/trace-buffer.c src/trace-capture.c \
+ *        src/trace-format.c src/lz.c src/canopen.c src/byteorder.c \
+ *        -lpthread
+ */
+#include "trace-buffer.h"
+#include "time-utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define N_FRAMES_PER_THREAD (1 << 20)
+#define MAX_THREADS 8
+
+static struct tracebuffer tb_;
+static struct tb_frame* snapshot_;
+static volatile int is_done_;
+
+static pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static struct tb_frame* locked_data_;
+static size_t locked_index_;
+
+static void make_frame(struct can_frame* cf, int thread, uint32_t seq)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = thread;
+	cf->can_dlc = 8;
+	memcpy(cf->data, &seq, sizeof(seq));
+	seq = ~seq;
+	memcpy(cf->data + 4, &seq, sizeof(seq));
+}
+
+static int is_frame_intact(const struct can_frame* cf)
+{
+	uint32_t a, b;
+	memcpy(&a, cf->data, sizeof(a));
+	memcpy(&b, cf->data + 4, sizeof(b));
+	return a == ~b && cf->can_id < MAX_THREADS;
+}
+
+static void* append_lockfree(void* arg)
+{
+	int thread = (intptr_t)arg;
+	struct can_frame cf;
+
+	for (uint32_t i = 0; i < N_FRAMES_PER_THREAD; ++i) {
+		make_frame(&cf, thread, i);
+		tb_append(&tb_, &cf);
+	}
+
+	return NULL;
+}
+
+static void* append_locked(void* arg)
+{
+	int thread = (intptr_t)arg;
+	struct can_frame cf;
+
+	for (uint32_t i = 0; i < N_FRAMES_PER_THREAD; ++i) {
+		make_frame(&cf, thread, i);
+
+		struct tb_frame frame = {
+			.timestamp = gettime_us(CLOCK_REALTIME),
+			.cf = cf,
+		};
+
+		pthread_mutex_lock(&mutex_);
+		locked_data_[locked_index_++] = frame;
+		locked_index_ &= tb_.length - 1;
+		pthread_mutex_unlock(&mutex_);
+	}
+
+	return NULL;
+}
+
+static uint64_t n_snapshots_, n_torn_;
+
+static void* take_snapshots(void* arg)
+{
+	(void)arg;
+
+	while (!is_done_) {
+		size_t n = tb_snapshot(&tb_, snapshot_);
+
+		for (size_t i = 0; i < n; ++i)
+			n_torn_ += !is_frame_intact(&snapshot_[i].cf);
+
+		++n_snapshots_;
+	}
+
+	return NULL;
+}
+
+static double run(void* (*fn)(void*), int n_threads, int with_snapshots)
+{
+	pthread_t thread[MAX_THREADS], snapshot_thread;
+
+	is_done_ = 0;
+
+	if (with_snapshots)
+		pthread_create(&snapshot_thread, NULL, take_snapshots, NULL);
+
+	uint64_t start = gettime_ns(CLOCK_MONOTONIC);
+
+	for (int i = 0; i < n_threads; ++i)
+		pthread_create(&thread[i], NULL, fn, (void*)(intptr_t)i);
+
+	for (int i = 0; i < n_threads; ++i)
+		pthread_join(thread[i], NULL);
+
+	uint64_t elapsed = gettime_ns(CLOCK_MONOTONIC) - start;
+
+	is_done_ = 1;
+
+	if (with_snapshots)
+		pthread_join(snapshot_thread, NULL);
+
+	return (double)elapsed / ((uint64_t)n_threads * N_FRAMES_PER_THREAD);
+}
+
+static int check_complete(int n_threads)
+{
+	size_t n = tb_snapshot(&tb_, snapshot_);
+	uint32_t next[MAX_THREADS] = { 0 };
+
+	if (n != (size_t)n_threads * N_FRAMES_PER_THREAD)
+		return -1;
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct can_frame* cf = &snapshot_[i].cf;
+		uint32_t seq;
+		memcpy(&seq, cf->data, sizeof(seq));
+
+		if (!is_frame_intact(cf) || seq != next[cf->can_id]++)
+			return -1;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	size_t size = MAX_THREADS * N_FRAMES_PER_THREAD * sizeof(struct tb_frame);
+
+	if (tb_init(&tb_, size) < 0)
+		return 1;
+
+	snapshot_ = malloc(tb_.length * sizeof(*snapshot_));
+	locked_data_ = malloc(tb_.length * sizeof(*locked_data_));
+	if (!snapshot_ || !locked_data_)
+		return 1;
+
+	/* Fault in all the pages up front */
+	memset(snapshot_, 0, tb_.length * sizeof(*snapshot_));
+	memset(locked_data_, 0, tb_.length * sizeof(*locked_data_));
+	memset(tb_.slots, 0, tb_.length * sizeof(*tb_.slots));
+
+	for (int n = 1; n <= MAX_THREADS; n *= 2) {
+		double t_locked = run(append_locked, n, 0);
+
+		memset(tb_.slots, 0, tb_.length * sizeof(*tb_.slots));
+		tb_.head = 0;
+		double t_lockfree = run(append_lockfree, n, 0);
+		int is_complete = check_complete(n) == 0;
+
+		n_snapshots_ = n_torn_ = 0;
+		double t_snapshots = run(append_lockfree, n, 1);
+
+		printf("%d threads: mutex %.1f ns/frame, lock-free %.1f ns/frame%s, with snapshots %.1f ns/frame (%llu snapshots, %llu torn)\n",
+		       n, t_locked, t_lockfree,
+		       is_complete ? "" : " (INCOMPLETE)", t_snapshots,
+		       (unsigned long long)n_snapshots_,
+		       (unsigned long long)n_torn_);
+	}
+
+	free(locked_data_);
+	free(snapshot_);
+	tb_destroy(&tb_);
+	return 0;
+}
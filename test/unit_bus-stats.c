@@ -0,0 +1,185 @@
+#include "tst.h"
+#include "bus-stats.h"
+#include "canopen.h"
+#include "socketcan.h"
+#include "trace-stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SEC 1000000000ULL
+
+static struct bus_stats stats_;
+
+static void make_frame(struct can_frame* cf, uint32_t id, int dlc)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = id;
+	cf->can_dlc = dlc;
+}
+
+int test_counters(void)
+{
+	struct can_frame cf;
+	struct bs_counter total;
+
+	bs_init(&stats_, 125000);
+
+	make_frame(&cf, 0x185, 8);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	make_frame(&cf, 0x605, 8);
+	bs_count(&stats_, BS_TX, &cf, NULL, SEC);
+
+	make_frame(&cf, 0x705, 1);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	make_frame(&cf, 0x80, 0);
+	bs_count(&stats_, BS_TX, &cf, NULL, SEC);
+
+	ASSERT_INT_EQ(2, bs_get_value(&stats_.node[BS_RX][5][5].frames));
+	ASSERT_INT_EQ(16, bs_get_value(&stats_.node[BS_RX][5][5].bytes));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.node[BS_RX][5][15].frames));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.node[BS_TX][5][14].frames));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.node[BS_TX][0][2].frames));
+
+	bs_get_node_total(&stats_, BS_RX, 5, &total);
+	ASSERT_INT_EQ(3, total.frames);
+	ASSERT_INT_EQ(17, total.bytes);
+
+	bs_get_total(&stats_, BS_TX, &total);
+	ASSERT_INT_EQ(2, total.frames);
+	ASSERT_INT_EQ(8, total.bytes);
+
+	return 0;
+}
+
+int test_unknown_and_errors(void)
+{
+	struct can_frame cf;
+
+	bs_init(&stats_, 125000);
+
+	make_frame(&cf, 0x12345 | CAN_EFF_FLAG, 4);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	make_frame(&cf, CAN_ERR_FLAG, 8);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	bs_count_error(&stats_, BS_TX);
+	bs_count_dropped(&stats_);
+
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.n_unknown));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.node[BS_RX][0][0].frames));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.n_errors[BS_RX]));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.n_errors[BS_TX]));
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.n_dropped));
+	return 0;
+}
+
+int test_classified(void)
+{
+	struct can_frame cf;
+	struct canopen_msg msg = { .id = 7, .object = CANOPEN_HEARTBEAT };
+
+	bs_init(&stats_, 125000);
+
+	make_frame(&cf, 0x707, 1);
+	bs_count(&stats_, BS_RX, &cf, &msg, SEC);
+
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.node[BS_RX][7][15].frames));
+	return 0;
+}
+
+int test_load(void)
+{
+	struct can_frame cf;
+
+	bs_init(&stats_, 125000);
+	make_frame(&cf, 0x185, 8);
+
+	unsigned int bits = ts_frame_bits(&cf);
+
+	/* 1000 frames spread over 10 s starting at t = 100 s */
+	for (int i = 0; i < 1000; ++i)
+		bs_count(&stats_, BS_RX, &cf, NULL, 100 * SEC + i * SEC / 100);
+
+	double expected = 100.0 * bits / 125000.0;
+
+	/* The period that t = 110 s falls in is left out */
+	ASSERT_DOUBLE_EQ(expected, bs_get_load(&stats_, SEC, 110 * SEC));
+	ASSERT_DOUBLE_EQ(expected, bs_get_load(&stats_, 10 * SEC, 110 * SEC));
+
+	/* Half of the window is empty */
+	ASSERT_DOUBLE_EQ(expected / 2.0,
+			 bs_get_load(&stats_, 10 * SEC, 115 * SEC));
+
+	/* Long after, the buckets are stale */
+	ASSERT_DOUBLE_EQ(0.0, bs_get_load(&stats_, 10 * SEC, 1000 * SEC));
+
+	/* Old buckets are reused */
+	bs_count(&stats_, BS_RX, &cf, NULL, 1000 * SEC);
+	ASSERT_DOUBLE_EQ(bits / 12500.0,
+			 bs_get_load(&stats_, SEC / 10, 1000 * SEC + SEC / 10));
+	return 0;
+}
+
+int test_counter_wraps_around(void)
+{
+	struct can_frame cf;
+	struct bs_counter total;
+
+	bs_init(&stats_, 125000);
+	make_frame(&cf, 0x185, 8);
+
+	/* Pretend that the counters are about to wrap around */
+	struct bs_cell* cell = &stats_.node[BS_RX][5][5];
+	cell->frames.raw = cell->frames.last_raw = UINT32_MAX;
+	cell->bytes.raw = cell->bytes.last_raw = UINT32_MAX - 4;
+
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	bs_get_node_total(&stats_, BS_RX, 5, &total);
+	ASSERT_INT_EQ(2, total.frames);
+	ASSERT_INT_EQ(16, total.bytes);
+
+	bs_update(&stats_, SEC);
+	bs_count(&stats_, BS_RX, &cf, NULL, SEC);
+
+	bs_get_node_total(&stats_, BS_RX, 5, &total);
+	ASSERT_INT_EQ(3, total.frames);
+	ASSERT_INT_EQ(24, total.bytes);
+	return 0;
+}
+
+int test_stale_buckets_are_retired(void)
+{
+	struct can_frame cf;
+	uint64_t n_periods = 1ULL << (32 - BS_EPOCH_SHIFT);
+
+	bs_init(&stats_, 125000);
+	make_frame(&cf, 0x185, 8);
+
+	bs_count(&stats_, BS_RX, &cf, NULL, 100 * SEC);
+
+	/* Without an update, the period numbers would come around again */
+	uint64_t later = 100 * SEC + n_periods * BS_BUCKET_LENGTH + SEC / 10;
+	ASSERT_TRUE(bs_get_load(&stats_, SEC / 10, later) > 0.0);
+
+	bs_update(&stats_, 200 * SEC);
+	ASSERT_DOUBLE_EQ(0.0, bs_get_load(&stats_, SEC / 10, later));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_counters);
+	RUN_TEST(test_unknown_and_errors);
+	RUN_TEST(test_classified);
+	RUN_TEST(test_load);
+	RUN_TEST(test_counter_wraps_around);
+	RUN_TEST(test_stale_buckets_are_retired);
+	return r;
+}
@@ -0,0 +1,256 @@
+#include "tst.h"
+#include "event-rest.h"
+#include "http.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static struct can_frame make_frame(int cob, int size, uint32_t value)
+{
+	struct can_frame cf = { .can_id = cob, .can_dlc = size };
+	memcpy(cf.data, &value, sizeof(value));
+	return cf;
+}
+
+static int key_of(int cob, int size, enum event_rest_topic* topic)
+{
+	struct can_frame cf = make_frame(cob, size, 0);
+	struct canopen_msg msg;
+
+	if (canopen_get_object_type(&msg, &cf) < 0)
+		return -1;
+
+	return event_rest__key(&msg, &cf, topic);
+}
+
+int test_key(void)
+{
+	enum event_rest_topic topic;
+
+	ASSERT_INT_EQ(3 * 8 + 0, key_of(0x183, 8, &topic));
+	ASSERT_INT_EQ(EVENT_REST_PDO, topic);
+	ASSERT_INT_EQ(3 * 8 + 3, key_of(0x483, 8, &topic));
+	ASSERT_INT_EQ(127 * 8 + 4, key_of(0xff, 8, &topic));
+	ASSERT_INT_EQ(EVENT_REST_EMCY, topic);
+	ASSERT_INT_EQ(5 * 8 + 5, key_of(0x705, 1, &topic));
+	ASSERT_INT_EQ(EVENT_REST_NMT, topic);
+
+	/* Legacy boot-up, malformed heartbeat, RPDO and SDO */
+	ASSERT_INT_EQ(-1, key_of(0x83, 0, &topic));
+	ASSERT_INT_EQ(-1, key_of(0x705, 2, &topic));
+	ASSERT_INT_EQ(-1, key_of(0x203, 8, &topic));
+	ASSERT_INT_EQ(-1, key_of(0x583, 8, &topic));
+
+	return 0;
+}
+
+int test_coalesce(void)
+{
+	struct event_rest_sub* sub = event_rest__sub_new(NULL);
+	struct event_rest_event ev;
+
+	struct can_frame a = make_frame(0x183, 4, 1);
+	struct can_frame b = make_frame(0x183, 4, 2);
+	struct can_frame c = make_frame(0x283, 2, 3);
+
+	ASSERT_INT_EQ(1, event_rest__push(sub, 24, &a));
+	ASSERT_INT_EQ(0, event_rest__push(sub, 24, &b));
+	ASSERT_INT_EQ(1, event_rest__push(sub, 25, &c));
+
+	ASSERT_INT_EQ(1, event_rest__pop(sub, &ev));
+	ASSERT_INT_EQ(24, ev.key);
+	ASSERT_INT_EQ(4, ev.size);
+	ASSERT_INT_EQ(2, ev.data[0]);
+	ASSERT_UINT_EQ(1, ev.n_coalesced);
+
+	ASSERT_INT_EQ(1, event_rest__pop(sub, &ev));
+	ASSERT_INT_EQ(25, ev.key);
+	ASSERT_INT_EQ(3, ev.data[0]);
+	ASSERT_UINT_EQ(0, ev.n_coalesced);
+
+	ASSERT_INT_EQ(0, event_rest__pop(sub, &ev));
+
+	/* The slot is free again once it has been taken */
+	ASSERT_INT_EQ(1, event_rest__push(sub, 24, &a));
+	ASSERT_INT_EQ(1, event_rest__pop(sub, &ev));
+	ASSERT_UINT_EQ(0, ev.n_coalesced);
+
+	event_rest__sub_unref(sub);
+	return 0;
+}
+
+int test_ring_never_overflows(void)
+{
+	struct event_rest_sub* sub = event_rest__sub_new(NULL);
+	struct event_rest_event ev;
+	struct can_frame cf = make_frame(0x183, 8, 0);
+
+	for (int round = 0; round < 3; ++round)
+		for (int key = 0; key < EVENT_REST_KEYS; ++key)
+			event_rest__push(sub, key, &cf);
+
+	for (int key = 0; key < EVENT_REST_KEYS; ++key) {
+		ASSERT_INT_EQ(1, event_rest__pop(sub, &ev));
+		ASSERT_INT_EQ(key, ev.key);
+		ASSERT_UINT_EQ(2, ev.n_coalesced);
+	}
+
+	ASSERT_INT_EQ(0, event_rest__pop(sub, &ev));
+
+	event_rest__sub_unref(sub);
+	return 0;
+}
+
+static int parse(struct event_rest_sub* sub, const char* url)
+{
+	char text[256];
+	struct http_req req;
+
+	snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n\r\n", url);
+
+	if (http_req_parse(&req, text, strlen(text)) < 0)
+		return -2;
+
+	return event_rest__parse_query(sub, &req);
+}
+
+int test_parse_query(void)
+{
+	struct event_rest_sub* sub = event_rest__sub_new(NULL);
+
+	event_rest_set_interval(100);
+
+	ASSERT_INT_EQ(0, parse(sub, "/events"));
+	ASSERT_UINT_EQ(EVENT_REST_ALL, sub->topics);
+	ASSERT_TRUE(sub->nodes[1] && sub->nodes[127]);
+
+	ASSERT_INT_EQ(0, parse(sub, "/events?node=3,0x10&topics=pdo,nmt"));
+	ASSERT_UINT_EQ(EVENT_REST_PDO | EVENT_REST_NMT, sub->topics);
+	ASSERT_TRUE(sub->nodes[3] && sub->nodes[16]);
+	ASSERT_FALSE(sub->nodes[1] || sub->nodes[4]);
+
+	ASSERT_INT_EQ(0, parse(sub, "/events?interval=500"));
+	ASSERT_INT_EQ(500, sub->interval);
+	ASSERT_INT_EQ(0, parse(sub, "/events?interval=10"));
+	ASSERT_INT_EQ(100, sub->interval);
+
+	ASSERT_INT_EQ(-1, parse(sub, "/events?node=0"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?node=128"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?node=3;4"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?node"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?topics=sdo"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?topics="));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?interval=x"));
+	ASSERT_INT_EQ(-1, parse(sub, "/events?colour=red"));
+
+	event_rest__sub_unref(sub);
+	return 0;
+}
+
+static char* print(const struct event_rest_event* ev)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* output = open_memstream(&buffer, &size);
+	event_rest__print(output, ev);
+	fclose(output);
+
+	return buffer;
+}
+
+int test_print(void)
+{
+	struct event_rest_event pdo = {
+		.key = 3 * 8 + 1, .size = 3, .data = { 0xab, 0x01, 0x00 },
+		.n_coalesced = 4
+	};
+
+	struct event_rest_event nmt = {
+		.key = 3 * 8 + 5, .size = 1, .data = { 0x05 }
+	};
+
+	struct event_rest_event emcy = {
+		.key = 3 * 8 + 4, .size = 8,
+		.data = { 0x10, 0x23, 0x01, 0x02, 0, 0, 0, 0 }
+	};
+
+	char* text = print(&pdo);
+	ASSERT_STR_EQ("event: pdo\ndata: {\"node\": 3, \"pdo\": 2, \"data\": \"ab0100\", \"coalesced\": 4}\n\n", text);
+	free(text);
+
+	text = print(&nmt);
+	ASSERT_STR_EQ("event: nmt\ndata: {\"node\": 3, \"state\": \"operational\", \"coalesced\": 0}\n\n", text);
+	free(text);
+
+	text = print(&emcy);
+	ASSERT_STR_EQ("event: emcy\ndata: {\"node\": 3, \"code\": 8976, \"register\": 1, \"manufacturer-error\": 2, \"coalesced\": 0}\n\n", text);
+	free(text);
+
+	return 0;
+}
+
+#define N_FRAMES 200000
+
+static void* produce(void* arg)
+{
+	struct event_rest_sub* sub = arg;
+
+	for (uint32_t i = 1; i <= N_FRAMES; ++i) {
+		struct can_frame cf = make_frame(0x183, 8, i);
+		memcpy(&cf.data[4], &i, sizeof(i));
+		event_rest__push(sub, 24, &cf);
+	}
+
+	return NULL;
+}
+
+/* Values must never go backwards or be torn, the last one must arrive and all
+ * frames must be accounted for either as events or as coalesced.
+ */
+int test_concurrent(void)
+{
+	struct event_rest_sub* sub = event_rest__sub_new(NULL);
+	struct event_rest_event ev;
+	uint32_t last = 0, hi, lo;
+	uint64_t n_accounted = 0;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, produce, sub);
+
+	while (last != N_FRAMES) {
+		if (!event_rest__pop(sub, &ev))
+			continue;
+
+		memcpy(&lo, ev.data, sizeof(lo));
+		memcpy(&hi, &ev.data[4], sizeof(hi));
+		ASSERT_UINT_EQ(lo, hi);
+		ASSERT_UINT_GE(last, lo);
+
+		n_accounted += 1 + ev.n_coalesced;
+		last = lo;
+	}
+
+	pthread_join(thread, NULL);
+
+	while (event_rest__pop(sub, &ev))
+		n_accounted += 1 + ev.n_coalesced;
+
+	ASSERT_UINT_EQ(N_FRAMES, n_accounted);
+
+	event_rest__sub_unref(sub);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_key);
+	RUN_TEST(test_coalesce);
+	RUN_TEST(test_ring_never_overflows);
+	RUN_TEST(test_parse_query);
+	RUN_TEST(test_print);
+	RUN_TEST(test_concurrent);
+	return r;
+}
@@ -1,138 +1,248 @@
 #include "tst.h"
 #include "http.h"
 
+#include <stdlib.h>
+
 int test_get_empty_path()
 {
-	const char* text = "GET / HTTP/1.1\r\n\r\nasdf";
+	char text[] = "GET / HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_get_one_elem_path()
 {
-	const char* text = "GET /foo HTTP/1.1\r\n\r\nasdf";
+	char text[] = "GET /foo HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
 	ASSERT_STR_EQ("foo", req.url[0]);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_get_two_elem_path()
 {
-	const char* text = "GET /foo/bar HTTP/1.1\r\n\r\nasdf";
+	char text[] = "GET /foo/bar HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(2, req.url_index);
 	ASSERT_STR_EQ("foo", req.url[0]);
 	ASSERT_STR_EQ("bar", req.url[1]);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_put_empty_path()
 {
-	const char* text = "PUT / HTTP/1.1\r\n\r\nasdf";
+	char text[] = "PUT / HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_PUT, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_put_with_content_length()
 {
-	const char* text =
+	char text[] =
 	"PUT / HTTP/1.1\r\n"
 	"Content-Length: 42\r\n"
 	"\r\n";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_PUT, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
 	ASSERT_UINT_EQ(42, req.content_length);
-	ASSERT_UINT_EQ(strlen(text), req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 1, req.header_length);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_get_with_content_type()
 {
-	const char* text =
+	char text[] =
 	"GET / HTTP/1.1\r\n"
 	"Content-Type: foo/bar\r\n"
 	"\r\n";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(0, req.url_index);
 	ASSERT_STR_EQ("foo/bar", req.content_type);
-	ASSERT_UINT_EQ(strlen(text), req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 1, req.header_length);
+
+	return 0;
+}
+
+int test_get_with_connection_close()
+{
+	char text[] =
+	"GET / HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Connection: TE, Close\r\n"
+	"\r\n"
+	"GET / HTTP/1.1\r\n\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
+
+	ASSERT_INT_EQ(HTTP_GET, req.method);
+	ASSERT_TRUE(req.has_connection_close);
+	ASSERT_UINT_EQ(sizeof(text) - 19, req.header_length);
+
+	return 0;
+}
+
+int test_get_with_connection_keep_alive()
+{
+	char text[] =
+	"GET / HTTP/1.1\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
+
+	ASSERT_FALSE(req.has_connection_close);
+	ASSERT_UINT_EQ(sizeof(text) - 1, req.header_length);
+
+	return 0;
+}
+
+int test_get_with_if_none_match()
+{
+	char text[] =
+	"GET / HTTP/1.1\r\n"
+	"If-None-Match: \"abc\", W/\"def\"\r\n"
+	"\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
+
+	ASSERT_STR_EQ("\"abc\", W/\"def\"", req.if_none_match);
+	ASSERT_TRUE(http_req_etag_matches(&req, "\"abc\""));
+	ASSERT_TRUE(http_req_etag_matches(&req, "\"def\""));
+	ASSERT_FALSE(http_req_etag_matches(&req, "\"ab\""));
+	ASSERT_FALSE(http_req_etag_matches(&req, "\"abc-gz\""));
+
+	char any[] = "GET / HTTP/1.1\r\nIf-None-Match: *\r\n\r\n";
+	ASSERT_INT_EQ(0, http_req_parse(&req, any, sizeof(any) - 1));
+	ASSERT_TRUE(http_req_etag_matches(&req, "\"abc\""));
+
+	char none[] = "GET / HTTP/1.1\r\n\r\n";
+	ASSERT_INT_EQ(0, http_req_parse(&req, none, sizeof(none) - 1));
+	ASSERT_PTR_EQ(NULL, req.if_none_match);
+	ASSERT_FALSE(http_req_etag_matches(&req, "\"abc\""));
+
+	return 0;
+}
+
+static int accepts_gzip(const char* value)
+{
+	char text[256];
+	struct http_req req;
+
+	snprintf(text, sizeof(text),
+		 "GET / HTTP/1.1\r\nAccept-Encoding: %s\r\n\r\n", value);
+
+	if (http_req_parse(&req, text, strlen(text)) < 0)
+		return -1;
+
+	return req.accepts_gzip;
+}
+
+int test_get_with_accept_encoding()
+{
+	ASSERT_INT_EQ(1, accepts_gzip("gzip"));
+	ASSERT_INT_EQ(1, accepts_gzip("deflate, GZIP, br"));
+	ASSERT_INT_EQ(1, accepts_gzip("br;q=1.0, gzip;q=0.5"));
+	ASSERT_INT_EQ(0, accepts_gzip("gzip;q=0, deflate"));
+	ASSERT_INT_EQ(0, accepts_gzip("deflate, br;q=0.5"));
+	ASSERT_INT_EQ(0, accepts_gzip("x-gzipped"));
+	ASSERT_INT_EQ(0, accepts_gzip(""));
+
+	return 0;
+}
+
+static int accepts_octet_stream(const char* value)
+{
+	char text[256];
+	struct http_req req;
+
+	snprintf(text, sizeof(text),
+		 "GET / HTTP/1.1\r\nAccept: %s\r\n\r\n", value);
+
+	if (http_req_parse(&req, text, strlen(text)) < 0)
+		return -1;
+
+	return req.accepts_octet_stream;
+}
+
+int test_get_with_accept()
+{
+	ASSERT_INT_EQ(1, accepts_octet_stream("application/octet-stream"));
+	ASSERT_INT_EQ(1, accepts_octet_stream("application/json, application/octet-stream;q=0.9"));
+	ASSERT_INT_EQ(0, accepts_octet_stream("application/octet-stream;q=0"));
+	ASSERT_INT_EQ(0, accepts_octet_stream("application/json"));
+	ASSERT_INT_EQ(0, accepts_octet_stream("*/*"));
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_get_with_single_query()
 {
-	const char* text = "GET /path?key=value HTTP/1.1\r\n\r\nasdf";
+	char text[] = "GET /path?key=value HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
 	ASSERT_STR_EQ("path", req.url[0]);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
 	ASSERT_INT_EQ(1, req.url_query_index);
 	ASSERT_STR_EQ("key", req.url_query[0].key);
 	ASSERT_STR_EQ("value", req.url_query[0].value);
 
-	http_req_free(&req);
 	return 0;
 }
 
 int test_get_with_two_query_pairs()
 {
-	const char* text = "GET /path?foo=bar&asdf=xyz HTTP/1.1\r\n\r\nasdf";
+	char text[] = "GET /path?foo=bar&asdf=xyz HTTP/1.1\r\n\r\nasdf";
 
 	struct http_req req;
-	ASSERT_INT_EQ(0, http_req_parse(&req, text));
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
 
 	ASSERT_INT_EQ(HTTP_GET, req.method);
 	ASSERT_INT_EQ(1, req.url_index);
 	ASSERT_STR_EQ("path", req.url[0]);
-	ASSERT_UINT_EQ(strlen(text)-4, req.header_length);
+	ASSERT_UINT_EQ(sizeof(text) - 5, req.header_length);
 
 	ASSERT_INT_EQ(2, req.url_query_index);
 	ASSERT_STR_EQ("foo", req.url_query[0].key);
@@ -141,7 +251,224 @@ int test_get_with_two_query_pairs()
 	ASSERT_STR_EQ("asdf", req.url_query[1].key);
 	ASSERT_STR_EQ("xyz", req.url_query[1].value);
 
-	http_req_free(&req);
+	return 0;
+}
+
+int test_get_with_query_key_only()
+{
+	char text[] = "GET /path?foo&bar= HTTP/1.1\r\n\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
+
+	ASSERT_INT_EQ(2, req.url_query_index);
+	ASSERT_STR_EQ("foo", req.url_query[0].key);
+	ASSERT_STR_EQ("", req.url_query[0].value);
+	ASSERT_STR_EQ("bar", req.url_query[1].key);
+	ASSERT_STR_EQ("", req.url_query[1].value);
+	ASSERT_STR_EQ("", http_req_query(&req, "bar"));
+	ASSERT_FALSE(http_req_query(&req, "baz"));
+
+	return 0;
+}
+
+int test_get_with_repeated_solidus()
+{
+	char text[] = "GET //foo//bar/ HTTP/1.1\r\n\r\n";
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, text, sizeof(text) - 1));
+
+	ASSERT_INT_EQ(2, req.url_index);
+	ASSERT_STR_EQ("foo", req.url[0]);
+	ASSERT_STR_EQ("bar", req.url[1]);
+
+	return 0;
+}
+
+int test_reject_malformed()
+{
+	static const char* bad[] = {
+		"POST / HTTP/1.1\r\n\r\n",
+		"GET foo HTTP/1.1\r\n\r\n",
+		"GET / HTTP/1.0\r\n\r\n",
+		"GET / HTTP/1.1\n\n",
+		"GET / HTTP/1.1\r\nFoo\r\n\r\n",
+		"GET / HTTP/1.1\r\nContent-Length: 4x\r\n\r\n",
+		"GET / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+		"GET /a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t/u/v/w/x/y/z"
+		"/a/b/c/d/e/f/g HTTP/1.1\r\n\r\n",
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		char text[256];
+		strcpy(text, bad[i]);
+
+		struct http_req req;
+		ASSERT_INT_EQ(-1, http_req_parse(&req, text, strlen(bad[i])));
+	}
+
+	return 0;
+}
+
+int test_incremental()
+{
+	const char* text =
+	"PUT /sdo/3/1017/0?type=u16 HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Content-Type: text/plain \r\n"
+	"Content-Length: 4\r\n"
+	"\r\n"
+	"1000";
+	size_t length = strlen(text);
+
+	struct http_parser parser;
+	http_parser_init(&parser);
+
+	struct http_req req;
+	char* buffer = NULL;
+	size_t i;
+
+	/* The buffer is moved on every call */
+	for (i = 0; i < length; ++i) {
+		buffer = realloc(buffer, i + 1);
+		buffer[i] = text[i];
+
+		int rc = http_parser_feed(&parser, &req, buffer, i + 1);
+		if (rc == HTTP_PARSE_DONE)
+			break;
+
+		ASSERT_INT_EQ(HTTP_PARSE_INCOMPLETE, rc);
+	}
+
+	ASSERT_UINT_EQ(length - 5, i);
+	ASSERT_UINT_EQ(length - 4, req.header_length);
+	ASSERT_INT_EQ(HTTP_PUT, req.method);
+	ASSERT_UINT_EQ(4, req.content_length);
+	ASSERT_STR_EQ("text/plain", req.content_type);
+	ASSERT_INT_EQ(4, req.url_index);
+	ASSERT_STR_EQ("sdo", req.url[0]);
+	ASSERT_STR_EQ("0", req.url[3]);
+	ASSERT_STR_EQ("u16", http_req_query(&req, "type"));
+
+	/* Moving the buffer once the head is done */
+	buffer = realloc(buffer, 4096);
+	ASSERT_INT_EQ(HTTP_PARSE_DONE,
+		      http_parser_feed(&parser, &req, buffer, length));
+	ASSERT_STR_EQ("sdo", req.url[0]);
+	ASSERT_STR_EQ("text/plain", req.content_type);
+	ASSERT_STR_EQ("u16", http_req_query(&req, "type"));
+
+	free(buffer);
+	return 0;
+}
+
+int test_head_too_large()
+{
+	size_t size = HTTP_HEAD_MAX + 64;
+	char* text = malloc(size);
+	strcpy(text, "GET / HTTP/1.1\r\n");
+
+	for (size_t i = strlen(text); i < size; i += 16)
+		memcpy(text + i, "X-Pad: 1234567\r\n", 16);
+
+	struct http_parser parser;
+	http_parser_init(&parser);
+
+	struct http_req req;
+	ASSERT_INT_EQ(HTTP_PARSE_INCOMPLETE,
+		      http_parser_feed(&parser, &req, text, 4096));
+	ASSERT_INT_EQ(HTTP_PARSE_TOO_LARGE,
+		      http_parser_feed(&parser, &req, text, size));
+
+	free(text);
+	return 0;
+}
+
+static int compare_req(const struct http_req* a, const struct http_req* b)
+{
+	ASSERT_INT_EQ(a->method, b->method);
+	ASSERT_UINT_EQ(a->header_length, b->header_length);
+	ASSERT_UINT_EQ(a->content_length, b->content_length);
+	ASSERT_INT_EQ(a->has_connection_close, b->has_connection_close);
+	ASSERT_UINT_EQ(a->url_index, b->url_index);
+
+	for (size_t i = 0; i < a->url_index; ++i)
+		ASSERT_STR_EQ(a->url[i], b->url[i]);
+
+	ASSERT_UINT_EQ(a->url_query_index, b->url_query_index);
+
+	for (size_t i = 0; i < a->url_query_index; ++i) {
+		ASSERT_STR_EQ(a->url_query[i].key, b->url_query[i].key);
+		ASSERT_STR_EQ(a->url_query[i].value, b->url_query[i].value);
+	}
+
+	return 0;
+}
+
+/* Corrupt valid requests at random and check that feeding them in random
+ * chunks gives the same result as parsing them in one go. Any out of bounds
+ * access is caught when this is built with -fsanitize=address.
+ */
+int test_fuzz()
+{
+	static const char* seeds[] = {
+		"GET /sdo/3/1017/0?type=u16&x=y HTTP/1.1\r\n"
+		"Host: localhost\r\nConnection: close\r\n\r\n",
+		"PUT /sdo/3/1017/0 HTTP/1.1\r\n"
+		"Content-Type: text/plain\r\nContent-Length: 4\r\n\r\n",
+		"OPTIONS * HTTP/1.1\r\n\r\n",
+	};
+
+	srand(42);
+
+	for (int n = 0; n < 20000; ++n) {
+		const char* seed = seeds[n % 3];
+		size_t length = strlen(seed);
+
+		char* text = malloc(length);
+		memcpy(text, seed, length);
+
+		for (int k = rand() % 4; k > 0; --k)
+			text[rand() % length] = rand();
+
+		char* whole = malloc(length);
+		memcpy(whole, text, length);
+
+		struct http_req expected;
+		struct http_parser parser;
+		http_parser_init(&parser);
+		int expected_rc = http_parser_feed(&parser, &expected, whole,
+						   length);
+
+		struct http_req req;
+		http_parser_init(&parser);
+		char* buffer = NULL;
+		size_t size = 0;
+		int rc = HTTP_PARSE_INCOMPLETE;
+
+		while (size < length && rc == HTTP_PARSE_INCOMPLETE) {
+			size_t chunk = 1 + rand() % 8;
+			if (chunk > length - size)
+				chunk = length - size;
+
+			buffer = realloc(buffer, size + chunk);
+			memcpy(buffer + size, text + size, chunk);
+			size += chunk;
+
+			rc = http_parser_feed(&parser, &req, buffer, size);
+		}
+
+		ASSERT_INT_EQ(expected_rc, rc);
+
+		if (rc == HTTP_PARSE_DONE && compare_req(&expected, &req) != 0)
+			return 1;
+
+		free(buffer);
+		free(whole);
+		free(text);
+	}
+
 	return 0;
 }
 
@@ -154,7 +481,18 @@ int main()
 	RUN_TEST(test_put_empty_path);
 	RUN_TEST(test_put_with_content_length);
 	RUN_TEST(test_get_with_content_type);
+	RUN_TEST(test_get_with_connection_close);
+	RUN_TEST(test_get_with_connection_keep_alive);
+	RUN_TEST(test_get_with_if_none_match);
+	RUN_TEST(test_get_with_accept_encoding);
+	RUN_TEST(test_get_with_accept);
 	RUN_TEST(test_get_with_single_query);
 	RUN_TEST(test_get_with_two_query_pairs);
+	RUN_TEST(test_get_with_query_key_only);
+	RUN_TEST(test_get_with_repeated_solidus);
+	RUN_TEST(test_reject_malformed);
+	RUN_TEST(test_incremental);
+	RUN_TEST(test_head_too_large);
+	RUN_TEST(test_fuzz);
 	return r;
 }
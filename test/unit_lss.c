@@ -0,0 +1,266 @@
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "tst.h"
+#include "fff.h"
+#include "canopen.h"
+#include "canopen/lss.h"
+#include "canopen/network.h"
+#include "sock.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(int, poll, struct pollfd*, nfds_t, int);
+FAKE_VALUE_FUNC(ssize_t, read, int, void*, size_t);
+FAKE_VALUE_FUNC(ssize_t, send, int, const void*, size_t, int);
+
+#define N_SLAVES 3
+
+static struct lss_slave slave_[N_SLAVES];
+
+static struct can_frame queue_[64];
+static int queue_head_, queue_tail_;
+static int n_sent_;
+
+static const struct lss_identity identity_[N_SLAVES] = {
+	{ 0x0000029a, 0x00010001, 0x00000003, 0xdeadbeef },
+	{ 0x0000029a, 0x00010001, 0x00000003, 0xdeadbee0 },
+	{ 0x0000029a, 0x00010002, 0x00000001, 0x00000042 },
+};
+
+static int bus_poll(struct pollfd* fds, nfds_t n, int timeout)
+{
+	(void)n;
+	(void)timeout;
+
+	if (fds->events & POLLOUT)
+		return 1;
+
+	return queue_head_ != queue_tail_;
+}
+
+static ssize_t bus_read(int fd, void* dst, size_t size)
+{
+	(void)fd;
+
+	if (queue_head_ == queue_tail_)
+		return -1;
+
+	memcpy(dst, &queue_[queue_tail_++ % 64], size);
+	return size;
+}
+
+static ssize_t bus_send(int fd, const void* src, size_t size, int flags)
+{
+	(void)fd;
+	(void)flags;
+
+	struct can_frame reply;
+
+	++n_sent_;
+
+	for (int i = 0; i < N_SLAVES; ++i)
+		if (lss_slave_feed(&slave_[i], src, &reply))
+			queue_[queue_head_++ % 64] = reply;
+
+	return size;
+}
+
+static void setup_bus(int n_slaves)
+{
+	RESET_FAKE(poll);
+	RESET_FAKE(read);
+	RESET_FAKE(send);
+
+	poll_fake.custom_fake = bus_poll;
+	read_fake.custom_fake = bus_read;
+	send_fake.custom_fake = bus_send;
+
+	queue_head_ = queue_tail_ = 0;
+	n_sent_ = 0;
+
+	for (int i = 0; i < N_SLAVES; ++i)
+		lss_slave_init(&slave_[i], &identity_[i],
+			       i < n_slaves ? LSS_NODEID_UNCONFIGURED : 1);
+}
+
+static void make_request(struct can_frame* cf, enum lss_cs cs, uint32_t value)
+{
+	lss_clear_frame(cf, LSS_COB_MASTER);
+	lss_set_cs(cf, cs);
+	lss_set_u32(cf, value);
+}
+
+int test_switch_selective(void)
+{
+	struct lss_slave slave;
+	struct can_frame cf, reply;
+
+	lss_slave_init(&slave, &identity_[0], 5);
+
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_VENDOR, identity_[0].vendor);
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_PRODUCT, identity_[0].product);
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_REVISION,
+		     identity_[0].revision);
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_SERIAL, identity_[1].serial);
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+	ASSERT_INT_EQ(LSS_SLAVE_WAITING, slave.state);
+
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_VENDOR, identity_[0].vendor);
+	lss_slave_feed(&slave, &cf, &reply);
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_PRODUCT, identity_[0].product);
+	lss_slave_feed(&slave, &cf, &reply);
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_REVISION,
+		     identity_[0].revision);
+	lss_slave_feed(&slave, &cf, &reply);
+	make_request(&cf, LSS_CS_SWITCH_SELECTIVE_SERIAL, identity_[0].serial);
+	ASSERT_INT_EQ(1, lss_slave_feed(&slave, &cf, &reply));
+
+	ASSERT_INT_EQ(LSS_COB_SLAVE, reply.can_id);
+	ASSERT_INT_EQ(LSS_CS_SWITCH_SELECTIVE_RESPONSE, lss_get_cs(&reply));
+	ASSERT_INT_EQ(LSS_SLAVE_CONFIGURATION, slave.state);
+
+	make_request(&cf, LSS_CS_INQUIRE_SERIAL, 0);
+	ASSERT_INT_EQ(1, lss_slave_feed(&slave, &cf, &reply));
+	ASSERT_UINT_EQ(identity_[0].serial, lss_get_u32(&reply));
+
+	return 0;
+}
+
+int test_configure_nodeid(void)
+{
+	struct lss_slave slave;
+	struct can_frame cf, reply;
+
+	lss_slave_init(&slave, &identity_[0], LSS_NODEID_UNCONFIGURED);
+
+	make_request(&cf, LSS_CS_CONFIGURE_NODEID, 0);
+	cf.data[1] = 42;
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+
+	make_request(&cf, LSS_CS_SWITCH_GLOBAL, 0);
+	cf.data[1] = LSS_MODE_CONFIGURATION;
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+
+	make_request(&cf, LSS_CS_CONFIGURE_NODEID, 0);
+	cf.data[1] = 128;
+	ASSERT_INT_EQ(1, lss_slave_feed(&slave, &cf, &reply));
+	ASSERT_INT_EQ(1, reply.data[1]);
+
+	cf.data[1] = 42;
+	ASSERT_INT_EQ(1, lss_slave_feed(&slave, &cf, &reply));
+	ASSERT_INT_EQ(0, reply.data[1]);
+	ASSERT_INT_EQ(LSS_NODEID_UNCONFIGURED, slave.nodeid);
+
+	make_request(&cf, LSS_CS_SWITCH_GLOBAL, 0);
+	cf.data[1] = LSS_MODE_WAITING;
+	ASSERT_INT_EQ(0, lss_slave_feed(&slave, &cf, &reply));
+	ASSERT_INT_EQ(42, slave.nodeid);
+
+	return 0;
+}
+
+int test_fastscan_none(void)
+{
+	setup_bus(0);
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct lss_identity id = { 0 };
+
+	ASSERT_INT_EQ(0, co_net_lss_fastscan(&sock, &id, 0, 10));
+	ASSERT_INT_EQ(1, n_sent_);
+
+	return 0;
+}
+
+int test_fastscan_one(void)
+{
+	setup_bus(1);
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct lss_identity id = { 0 };
+
+	ASSERT_INT_EQ(1, co_net_lss_fastscan(&sock, &id, 0, 10));
+	ASSERT_INT_EQ(1 + 4 * 33, n_sent_);
+
+	ASSERT_UINT_EQ(identity_[0].vendor, id.vendor);
+	ASSERT_UINT_EQ(identity_[0].product, id.product);
+	ASSERT_UINT_EQ(identity_[0].revision, id.revision);
+	ASSERT_UINT_EQ(identity_[0].serial, id.serial);
+	ASSERT_INT_EQ(LSS_SLAVE_CONFIGURATION, slave_[0].state);
+
+	return 0;
+}
+
+int test_fastscan_known(void)
+{
+	setup_bus(1);
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct lss_identity id = {
+		.vendor = identity_[0].vendor,
+		.product = identity_[0].product,
+	};
+
+	ASSERT_INT_EQ(1, co_net_lss_fastscan(&sock, &id, 3, 10));
+	ASSERT_INT_EQ(1 + 2 + 2 * 33, n_sent_);
+	ASSERT_UINT_EQ(identity_[0].serial, id.serial);
+
+	return 0;
+}
+
+static int n_assigned_;
+
+static void on_assigned(int nodeid, const struct lss_identity* id,
+			void* context)
+{
+	(void)id;
+	(void)context;
+	(void)nodeid;
+	++n_assigned_;
+}
+
+int test_commission(void)
+{
+	setup_bus(N_SLAVES);
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+
+	char nodes_seen[128];
+	memset(nodes_seen, 0, sizeof(nodes_seen));
+	nodes_seen[1] = 1;
+	nodes_seen[3] = 1;
+
+	n_assigned_ = 0;
+	ASSERT_INT_EQ(3, co_net_lss_commission(&sock, nodes_seen, 1, 127, 10,
+					       on_assigned, NULL));
+	ASSERT_INT_EQ(3, n_assigned_);
+
+	ASSERT_TRUE(nodes_seen[2]);
+	ASSERT_TRUE(nodes_seen[4]);
+	ASSERT_TRUE(nodes_seen[5]);
+	ASSERT_FALSE(nodes_seen[6]);
+
+	/* Lowest identity is found first */
+	ASSERT_INT_EQ(2, slave_[1].nodeid);
+	ASSERT_INT_EQ(4, slave_[0].nodeid);
+	ASSERT_INT_EQ(5, slave_[2].nodeid);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_switch_selective);
+	RUN_TEST(test_configure_nodeid);
+	RUN_TEST(test_fastscan_none);
+	RUN_TEST(test_fastscan_one);
+	RUN_TEST(test_fastscan_known);
+	RUN_TEST(test_commission);
+	return r;
+}
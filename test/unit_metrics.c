@@ -0,0 +1,90 @@
+#include "tst.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static char* print_histogram(const char* labels,
+			     const struct metrics_histogram* hist)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* output = open_memstream(&buffer, &size);
+	metrics_print_histogram(output, "x_seconds", labels, hist);
+	fclose(output);
+
+	return buffer;
+}
+
+int test_histogram_buckets(void)
+{
+	struct metrics_histogram hist;
+	memset(&hist, 0, sizeof(hist));
+
+	metrics_histogram_observe(&hist, 0);
+	metrics_histogram_observe(&hist, 1000000);
+	metrics_histogram_observe(&hist, 1000001);
+	metrics_histogram_observe(&hist, 2000000000);
+	metrics_histogram_observe(&hist, 2000000001);
+
+	ASSERT_UINT_EQ(2, hist.bucket[0]);
+	ASSERT_UINT_EQ(1, hist.bucket[1]);
+	ASSERT_UINT_EQ(1, hist.bucket[METRICS_N_BUCKETS - 2]);
+	ASSERT_UINT_EQ(1, hist.bucket[METRICS_N_BUCKETS - 1]);
+
+	return 0;
+}
+
+int test_histogram_print(void)
+{
+	struct metrics_histogram hist;
+	memset(&hist, 0, sizeof(hist));
+
+	metrics_histogram_observe(&hist, 1500000);
+	metrics_histogram_observe(&hist, 3000000000);
+
+	char* text = print_histogram("node=\"3\"", &hist);
+	ASSERT_TRUE(strstr(text, "x_seconds_bucket{node=\"3\",le=\"0.001\"} 0\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_bucket{node=\"3\",le=\"0.002\"} 1\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_bucket{node=\"3\",le=\"2\"} 1\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_bucket{node=\"3\",le=\"+Inf\"} 2\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_sum{node=\"3\"} 3.0015\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_count{node=\"3\"} 2\n"));
+	free(text);
+
+	text = print_histogram(NULL, &hist);
+	ASSERT_TRUE(strstr(text, "x_seconds_bucket{le=\"+Inf\"} 2\n"));
+	ASSERT_TRUE(strstr(text, "x_seconds_count 2\n"));
+	free(text);
+
+	return 0;
+}
+
+int test_print(void)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* output = open_memstream(&buffer, &size);
+	metrics_print_type(output, "x_total", "counter", "Things.");
+	metrics_print(output, "x_total", NULL, 42);
+	metrics_print(output, "x_total", "a=\"b\"", 7);
+	metrics_print_seconds(output, "y_seconds", NULL, 250000000);
+	fclose(output);
+
+	ASSERT_STR_EQ("# HELP x_total Things.\n# TYPE x_total counter\n"
+		      "x_total 42\nx_total{a=\"b\"} 7\ny_seconds 0.25\n", buffer);
+	free(buffer);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_histogram_buckets);
+	RUN_TEST(test_histogram_print);
+	RUN_TEST(test_print);
+	return r;
+}
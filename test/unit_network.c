@@ -19,6 +19,7 @@ FAKE_VALUE_FUNC(int, poll, struct pollfd*, nfds_t, int);
 FAKE_VALUE_FUNC(ssize_t, read, int, void*, size_t);
 FAKE_VALUE_FUNC(ssize_t, write, int, const void*, size_t);
 FAKE_VALUE_FUNC(int, clock_gettime, clockid_t, struct timespec*);
+FAKE_VALUE_FUNC(ssize_t, send, int, const void*, size_t, int);
 
 int test_net_write()
 {
@@ -171,6 +172,108 @@ int test_net__wait_for_bootup()
 	return 0;
 }
 
+int test_net__wait_for_nodes_returns_early()
+{
+	RESET_FAKE(poll);
+	RESET_FAKE(read);
+	RESET_FAKE(clock_gettime);
+
+	read_fake.custom_fake = read_bootup;
+	clock_gettime_fake.custom_fake = custom_gettime;
+	poll_fake.return_val = 1;
+
+	memset(enabled_nodes, 0, sizeof(enabled_nodes));
+	enabled_nodes_index = 0;
+
+	enabled_nodes[1] = 1;
+	enabled_nodes[7] = 1;
+	enabled_nodes[127] = 1;
+
+	char expected[128];
+	memset(expected, 0, sizeof(expected));
+	expected[1] = 1;
+	expected[7] = 1;
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+
+	char nodes_seen[128];
+	memset(nodes_seen, 0, sizeof(nodes_seen));
+	ASSERT_INT_EQ(0, co_net__wait_for_nodes(&sock, nodes_seen, expected,
+						1, 127, 100, 1000));
+
+	ASSERT_INT_EQ(2, read_fake.call_count);
+
+	ASSERT_TRUE(nodes_seen[1]);
+	ASSERT_TRUE(nodes_seen[7]);
+	ASSERT_FALSE(nodes_seen[127]);
+
+	return 0;
+}
+
+int test_net__wait_for_nodes_reports_missing()
+{
+	RESET_FAKE(poll);
+	RESET_FAKE(read);
+	RESET_FAKE(clock_gettime);
+
+	read_fake.custom_fake = read_bootup;
+	clock_gettime_fake.custom_fake = custom_gettime;
+	poll_fake.return_val = 1;
+
+	memset(enabled_nodes, 0, sizeof(enabled_nodes));
+	enabled_nodes_index = 0;
+
+	enabled_nodes[1] = 1;
+
+	char expected[128];
+	memset(expected, 0, sizeof(expected));
+	expected[1] = 1;
+	expected[2] = 1;
+	expected[3] = 1;
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+
+	char nodes_seen[128];
+	memset(nodes_seen, 0, sizeof(nodes_seen));
+	nodes_seen[3] = 1;
+
+	ASSERT_INT_EQ(1, co_net__wait_for_nodes(&sock, nodes_seen, expected,
+						1, 127, 100, 1000));
+
+	ASSERT_TRUE(nodes_seen[1]);
+	ASSERT_FALSE(nodes_seen[2]);
+
+	return 0;
+}
+
+int test_net_probe_parallel_only_probes_expected()
+{
+	RESET_FAKE(send);
+
+	send_fake.return_val = sizeof(struct can_frame);
+
+	char expected[128];
+	memset(expected, 0, sizeof(expected));
+	expected[2] = 1;
+	expected[3] = 1;
+	expected[5] = 1;
+
+	char nodes_seen[128];
+	memset(nodes_seen, 0, sizeof(nodes_seen));
+	nodes_seen[3] = 1;
+	nodes_seen[4] = 1;
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+
+	ASSERT_INT_EQ(2, co_net_probe_parallel(&sock, nodes_seen, expected,
+					       1, 127));
+
+	/* A heartbeat and an SDO request to each of nodes 2 and 5 */
+	ASSERT_INT_EQ(4, send_fake.call_count);
+
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -178,6 +281,9 @@ int main()
 	RUN_TEST(test_net_read);
 //	RUN_TEST(test_net__send_nmt);
 //	RUN_TEST(test_net__wait_for_bootup);
+	RUN_TEST(test_net__wait_for_nodes_returns_early);
+	RUN_TEST(test_net__wait_for_nodes_reports_missing);
+	RUN_TEST(test_net_probe_parallel_only_probes_expected);
 	return r;
 }
 
@@ -0,0 +1,158 @@
+#include "tst.h"
+#include "tst-frames.h"
+#include "pcapng.h"
+#include "socketcan.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#define N_FRAMES 100
+
+static void make_frame(struct can_frame* cf, int i)
+{
+	memset(cf, 0, sizeof(*cf));
+
+	cf->can_id = i % 3 == 0 ? (0x1234567 + i) | CAN_EFF_FLAG : 0x181u + i;
+	if (i % 7 == 0)
+		cf->can_id |= CAN_RTR_FLAG;
+
+	cf->can_dlc = i % 9;
+	for (int j = 0; j < cf->can_dlc; ++j)
+		cf->data[j] = i + j;
+}
+
+int test_round_trip(void)
+{
+	struct pcapng_writer writer;
+	struct tst_frame_list list;
+	char* buffer = NULL;
+	size_t size = 0;
+
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, N_FRAMES));
+
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, pcapng_writer_init(&writer, stream));
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		struct can_frame cf;
+		make_frame(&cf, i);
+		ASSERT_INT_EQ(0, pcapng_write_frame(&writer,
+				1476633600000000000ULL + i * 1234567ULL, &cf));
+	}
+
+	fclose(stream);
+
+	stream = fmemopen(buffer, size, "r");
+	ASSERT_TRUE(pcapng_is_pcapng(stream));
+	ASSERT_INT_EQ(0, pcapng_read(stream, tst_collect_frame, &list));
+	fclose(stream);
+
+	ASSERT_INT_EQ(N_FRAMES, list.n);
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		struct can_frame cf;
+		make_frame(&cf, i);
+
+		ASSERT_TRUE(list.frames[i].timestamp
+			    == 1476633600000000ULL + i * 1234567ULL / 1000);
+		ASSERT_INT_EQ(0, memcmp(&cf, &list.frames[i].cf, sizeof(cf)));
+	}
+
+	free(buffer);
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+/* A big endian section as written on another machine, with microsecond
+ * timestamps and a non-CAN interface that must be skipped.
+ */
+int test_read_big_endian(void)
+{
+	static const uint8_t file[] = {
+		/* SHB */
+		0x0a, 0x0d, 0x0d, 0x0a, 0, 0, 0, 28,
+		0x1a, 0x2b, 0x3c, 0x4d, 0, 1, 0, 0,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0, 0, 0, 28,
+		/* IDB, ethernet */
+		0, 0, 0, 1, 0, 0, 0, 20,
+		0, 1, 0, 0, 0, 0, 0xff, 0xff,
+		0, 0, 0, 20,
+		/* IDB, SocketCAN, default resolution */
+		0, 0, 0, 1, 0, 0, 0, 20,
+		0, 227, 0, 0, 0, 0, 0, 16,
+		0, 0, 0, 20,
+		/* EPB on the ethernet interface */
+		0, 0, 0, 6, 0, 0, 0, 48,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+		0, 0, 0, 16, 0, 0, 0, 16,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 48,
+		/* EPB on the CAN interface */
+		0, 0, 0, 6, 0, 0, 0, 48,
+		0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 2,
+		0, 0, 0, 16, 0, 0, 0, 16,
+		0, 0, 0x07, 0x05, 1, 0, 0, 0, 0x7f, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 48,
+	};
+
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, N_FRAMES));
+
+	FILE* stream = fmemopen((void*)file, sizeof(file), "r");
+	ASSERT_TRUE(pcapng_is_pcapng(stream));
+	ASSERT_INT_EQ(0, pcapng_read(stream, tst_collect_frame, &list));
+	fclose(stream);
+
+	ASSERT_INT_EQ(1, list.n);
+	ASSERT_TRUE(list.frames[0].timestamp == (1ULL << 32) + 2);
+	ASSERT_UINT_EQ(0x705, list.frames[0].cf.can_id);
+	ASSERT_INT_EQ(1, list.frames[0].cf.can_dlc);
+	ASSERT_INT_EQ(0x7f, list.frames[0].cf.data[0]);
+
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_truncated(void)
+{
+	struct pcapng_writer writer;
+	struct tst_frame_list list;
+	struct can_frame cf = { .can_id = 0x80 };
+	char* buffer = NULL;
+	size_t size = 0;
+
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, N_FRAMES));
+
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, pcapng_writer_init(&writer, stream));
+	ASSERT_INT_EQ(0, pcapng_write_frame(&writer, 1000, &cf));
+	fclose(stream);
+
+	stream = fmemopen(buffer, size - 10, "r");
+	ASSERT_INT_EQ(-1, pcapng_read(stream, tst_collect_frame, &list));
+	fclose(stream);
+
+	free(buffer);
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_not_pcapng(void)
+{
+	struct tb_frame frame = { 0 };
+	FILE* stream = fmemopen(&frame, sizeof(frame), "r");
+	ASSERT_FALSE(pcapng_is_pcapng(stream));
+	fclose(stream);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_read_big_endian);
+	RUN_TEST(test_truncated);
+	RUN_TEST(test_not_pcapng);
+	return r;
+}
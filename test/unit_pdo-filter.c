@@ -0,0 +1,124 @@
+#include "tst.h"
+#include "pdo-filter.h"
+
+#include <stdint.h>
+
+int test_disabled_by_default(void)
+{
+	struct pdo_filter filter;
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, ""));
+	ASSERT_FALSE(filter.is_enabled);
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, NULL));
+	ASSERT_FALSE(filter.is_enabled);
+
+	return 0;
+}
+
+int test_bad_spec(void)
+{
+	struct pdo_filter filter;
+
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "mask=f"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "mask=ffffffffffffffffff"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "u12@0:1"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "u32@6:1"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "x16@0:1"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter, "u16@0"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter,
+					  "u8@18446744073709551615:1"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter,
+					  "u8@99999999999999999999999:1"));
+	ASSERT_INT_EQ(-1, pdo_filter_init(&filter,
+					  "u8@0:99999999999999999999999"));
+	ASSERT_FALSE(filter.is_enabled);
+
+	return 0;
+}
+
+int test_changed(void)
+{
+	struct pdo_filter filter;
+	uint8_t a[] = { 1, 2, 3, 4 };
+	uint8_t b[] = { 1, 2, 3, 5 };
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, "changed"));
+	ASSERT_TRUE(filter.is_enabled);
+
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, a, sizeof(a)));
+	ASSERT_INT_EQ(0, pdo_filter_check(&filter, a, sizeof(a)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, b, sizeof(b)));
+	ASSERT_INT_EQ(0, pdo_filter_check(&filter, b, sizeof(b)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, b, 3));
+
+	ASSERT_INT_EQ(3, filter.n_delivered);
+	ASSERT_INT_EQ(2, filter.n_suppressed);
+
+	pdo_filter_reset(&filter);
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, b, 3));
+
+	return 0;
+}
+
+int test_mask(void)
+{
+	struct pdo_filter filter;
+	uint8_t a[] = { 0x10, 0xaa, 3 };
+	uint8_t b[] = { 0x1f, 0xbb, 3 };
+	uint8_t c[] = { 0x20, 0xbb, 3 };
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, "mask=f000ff"));
+
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, a, sizeof(a)));
+	ASSERT_INT_EQ(0, pdo_filter_check(&filter, b, sizeof(b)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, c, sizeof(c)));
+
+	return 0;
+}
+
+int test_unsigned_deadband(void)
+{
+	struct pdo_filter filter;
+	uint8_t a[] = { 0xff, 100, 0 };
+	uint8_t b[] = { 0xff, 105, 0 };
+	uint8_t c[] = { 0xff, 111, 0 };
+	uint8_t d[] = { 0xfe, 111, 0 };
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, "u16@1:10"));
+
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, a, sizeof(a)));
+	ASSERT_INT_EQ(0, pdo_filter_check(&filter, b, sizeof(b)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, c, sizeof(c)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, d, sizeof(d)));
+
+	return 0;
+}
+
+int test_signed_deadband(void)
+{
+	struct pdo_filter filter;
+	uint8_t a[] = { 0xfe, 0xff }; /* -2 */
+	uint8_t b[] = { 0x02, 0x00 }; /* 2 */
+	uint8_t c[] = { 0x03, 0x00 }; /* 3 */
+
+	ASSERT_INT_EQ(0, pdo_filter_init(&filter, "changed, s16@0:4"));
+
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, a, sizeof(a)));
+	ASSERT_INT_EQ(0, pdo_filter_check(&filter, b, sizeof(b)));
+	ASSERT_INT_EQ(1, pdo_filter_check(&filter, c, sizeof(c)));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled_by_default);
+	RUN_TEST(test_bad_spec);
+	RUN_TEST(test_changed);
+	RUN_TEST(test_mask);
+	RUN_TEST(test_unsigned_deadband);
+	RUN_TEST(test_signed_deadband);
+	return r;
+}
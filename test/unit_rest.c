@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -223,7 +225,9 @@ static int test_read__empty(void)
 	read_fake.return_val = -1;
 	errno = EAGAIN;
 	struct vector vec;
+	vector_init(&vec, 16);
 	ASSERT_INT_LT(0, rest__read(&vec, 42));
+	vector_destroy(&vec);
 	return 0;
 }
 
@@ -232,7 +236,9 @@ static int test_read__closed(void)
 	reset_fakes();
 	read_fake.return_val = 0;
 	struct vector vec;
+	vector_init(&vec, 16);
 	ASSERT_INT_EQ(-1, rest__read(&vec, 42));
+	vector_destroy(&vec);
 	return 0;
 }
 
@@ -261,6 +267,58 @@ static int test_read__twice(void)
 	return 0;
 }
 
+static int test_consume_pipelined(void)
+{
+	const char* input = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+
+	struct vector vec;
+	vector_init(&vec, 16);
+	vector_assign(&vec, input, strlen(input));
+
+	rest__consume(&vec, 19);
+	ASSERT_UINT_EQ(19, vec.index);
+	ASSERT_INT_EQ(0, memcmp("GET /b HTTP/1.1\r\n\r\n", vec.data, 19));
+
+	struct http_req req;
+	ASSERT_INT_EQ(0, http_req_parse(&req, vec.data, vec.index));
+	ASSERT_STR_EQ("b", req.url[0]);
+
+	rest__consume(&vec, 19);
+	ASSERT_UINT_EQ(0, vec.index);
+
+	vector_destroy(&vec);
+	return 0;
+}
+
+static int test_reply_without_content_length(void)
+{
+	struct rest_client client = { 0 };
+	char* text = NULL;
+	size_t size = 0;
+
+	client.output = open_memstream(&text, &size);
+	ASSERT_TRUE(client.output);
+
+	struct rest_reply_data reply = {
+		.status_code = "304 Not Modified",
+		.content_length = REST_NO_CONTENT_LENGTH,
+		.etag = "\"abc\"",
+	};
+
+	rest_reply(&client, &reply);
+	fclose(client.output);
+
+	const char* status_line = "HTTP/1.1 304 Not Modified\r\n";
+	ASSERT_INT_EQ(0, strncmp(text, status_line, strlen(status_line)));
+	ASSERT_TRUE(strstr(text, "ETag: \"abc\"\r\n"));
+	ASSERT_FALSE(strstr(text, "Content-Length"));
+	ASSERT_FALSE(strstr(text, "Transfer-Encoding"));
+	ASSERT_INT_EQ(0, strcmp(text + size - 4, "\r\n\r\n"));
+
+	free(text);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -274,5 +332,7 @@ int main()
 	RUN_TEST(test_read__empty);
 	RUN_TEST(test_read__closed);
 	RUN_TEST(test_read__twice);
+	RUN_TEST(test_consume_pipelined);
+	RUN_TEST(test_reply_without_content_length);
 	return r;
 }
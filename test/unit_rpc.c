@@ -0,0 +1,279 @@
+#include "tst.h"
+#include "rpc.h"
+#include "canopen-rpc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static int fds_[2];
+
+static struct co_rpc* client_new(void)
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds_) < 0)
+		return NULL;
+
+	return co_rpc__new(fds_[0]);
+}
+
+static void client_free(struct co_rpc* client)
+{
+	co_rpc_close(client);
+	close(fds_[1]);
+}
+
+static void send_reply(uint32_t id, int status, uint32_t abort_code,
+		       const void* data, uint32_t size)
+{
+	char buffer[256];
+	struct co_rpc_sdo_reply* reply = (void*)buffer;
+
+	memset(buffer, 0, sizeof(buffer));
+	reply->header.size = co_rpc_align(sizeof(*reply) + size);
+	reply->header.type = CO_RPC_SDO_UPLOAD;
+	reply->header.id = id;
+	reply->header.status = status;
+	reply->abort_code = abort_code;
+	reply->size = size;
+	memcpy(reply->data, data, size);
+
+	write(fds_[1], buffer, reply->header.size);
+}
+
+int test_message_size(void)
+{
+	struct co_rpc_header header = { .size = 24, .type = CO_RPC_RPDO };
+
+	ASSERT_INT_EQ(0, rpc__message_size(&header, sizeof(header) - 1));
+	ASSERT_INT_EQ(0, rpc__message_size(&header, 23));
+	ASSERT_INT_EQ(24, rpc__message_size(&header, 24));
+	ASSERT_INT_EQ(24, rpc__message_size(&header, 100));
+
+	header.size = 8;
+	ASSERT_INT_EQ(-1, rpc__message_size(&header, 100));
+	header.size = 20;
+	ASSERT_INT_EQ(-1, rpc__message_size(&header, 100));
+	header.size = CO_RPC_MESSAGE_MAX + CO_RPC_ALIGN;
+	ASSERT_INT_EQ(-1, rpc__message_size(&header, 100));
+
+	return 0;
+}
+
+int test_requests_are_padded_and_numbered(void)
+{
+	struct co_rpc* client = client_new();
+	ASSERT_TRUE(client);
+
+	ASSERT_INT_EQ(0, co_rpc_sdo_download(client, 3, 0x2000, 1, "abc", 3));
+	ASSERT_INT_EQ(1, co_rpc_sdo_upload(client, 3, 0x1018, 4));
+	ASSERT_INT_EQ(2, co_rpc_send_rpdo(client, 5, 2, "\x01\x02", 2,
+					  CO_RPC_NO_REPLY));
+	ASSERT_INT_EQ(0, co_rpc_flush(client));
+
+	char buffer[256];
+	ssize_t size = read(fds_[1], buffer, sizeof(buffer));
+	ASSERT_INT_EQ(32 + 24 + sizeof(struct co_rpc_rpdo), size);
+
+	struct co_rpc_sdo_req* dl = (void*)buffer;
+	ASSERT_UINT_EQ(32, dl->header.size);
+	ASSERT_UINT_EQ(CO_RPC_SDO_DOWNLOAD, dl->header.type);
+	ASSERT_UINT_EQ(3, dl->nodeid);
+	ASSERT_UINT_EQ(0x2000, dl->index);
+	ASSERT_UINT_EQ(1, dl->subindex);
+	ASSERT_UINT_EQ(3, dl->size);
+	ASSERT_STR_EQ("abc", (char*)dl->data);
+
+	struct co_rpc_sdo_req* ul = (void*)(buffer + 32);
+	ASSERT_UINT_EQ(24, ul->header.size);
+	ASSERT_UINT_EQ(1, ul->header.id);
+	ASSERT_UINT_EQ(0x1018, ul->index);
+
+	struct co_rpc_rpdo* pdo = (void*)(buffer + 56);
+	ASSERT_UINT_EQ(CO_RPC_NO_REPLY, pdo->header.flags);
+	ASSERT_UINT_EQ(2, pdo->n);
+	ASSERT_UINT_EQ(2, pdo->size);
+	ASSERT_UINT_EQ(2, pdo->data[1]);
+
+	client_free(client);
+	return 0;
+}
+
+int test_invalid_requests(void)
+{
+	struct co_rpc* client = client_new();
+	char data[9] = { 0 };
+	int node = 128;
+
+	ASSERT_INT_EQ(-1, co_rpc_send_rpdo(client, 5, 1, data, 9, 0));
+	ASSERT_INT_EQ(EINVAL, errno);
+	ASSERT_INT_EQ(-1, co_rpc_subscribe(client, CO_RPC_ALL, &node, 1));
+	ASSERT_INT_EQ(EINVAL, errno);
+	ASSERT_INT_EQ(-1, co_rpc_sdo_download(client, 3, 0x2000, 0, NULL,
+					      CO_RPC_MESSAGE_MAX));
+	ASSERT_INT_EQ(EMSGSIZE, errno);
+
+	client_free(client);
+	return 0;
+}
+
+int test_subscribe_sets_node_bits(void)
+{
+	struct co_rpc* client = client_new();
+	int nodes[] = { 1, 9, 127 };
+
+	ASSERT_INT_EQ(0, co_rpc_subscribe(client, CO_RPC_PDO | CO_RPC_NMT,
+					  nodes, 3));
+	ASSERT_INT_EQ(0, co_rpc_flush(client));
+
+	struct co_rpc_subscribe msg;
+	ASSERT_INT_EQ(sizeof(msg), read(fds_[1], &msg, sizeof(msg)));
+	ASSERT_UINT_EQ(CO_RPC_PDO | CO_RPC_NMT, msg.topics);
+	ASSERT_UINT_EQ(0x02, msg.nodes[0]);
+	ASSERT_UINT_EQ(0x02, msg.nodes[1]);
+	ASSERT_UINT_EQ(0x80, msg.nodes[15]);
+
+	client_free(client);
+	return 0;
+}
+
+int test_receive_split_messages(void)
+{
+	struct co_rpc* client = client_new();
+	struct co_rpc_header a = { .size = 16, .type = CO_RPC_RPDO, .id = 7 };
+	struct co_rpc_header b = { .size = 16, .type = CO_RPC_RPDO, .id = 8 };
+
+	write(fds_[1], &a, sizeof(a));
+	write(fds_[1], &b, 10);
+
+	const struct co_rpc_header* msg = co_rpc_receive(client, 0);
+	ASSERT_TRUE(msg);
+	ASSERT_UINT_EQ(7, msg->id);
+
+	ASSERT_PTR_EQ(NULL, (void*)co_rpc_receive(client, 0));
+	ASSERT_INT_EQ(ETIMEDOUT, errno);
+
+	write(fds_[1], (char*)&b + 10, 6);
+
+	msg = co_rpc_receive(client, 0);
+	ASSERT_TRUE(msg);
+	ASSERT_UINT_EQ(8, msg->id);
+
+	client_free(client);
+	return 0;
+}
+
+int test_receive_malformed(void)
+{
+	struct co_rpc* client = client_new();
+	struct co_rpc_header header = { .size = 12 };
+
+	write(fds_[1], &header, sizeof(header));
+
+	ASSERT_PTR_EQ(NULL, (void*)co_rpc_receive(client, 0));
+	ASSERT_INT_EQ(EPROTO, errno);
+
+	client_free(client);
+	return 0;
+}
+
+int test_message_survives_flush(void)
+{
+	struct co_rpc* client = client_new();
+
+	send_reply(0, CO_RPC_OK, 0, "abcde", 5);
+
+	const struct co_rpc_sdo_reply* msg = (void*)co_rpc_receive(client, 0);
+	ASSERT_TRUE(msg);
+
+	/* More replies arrive while the requests below are being flushed */
+	send_reply(1, CO_RPC_OK, 0, NULL, 0);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char buffer[4096];
+		close(fds_[0]);
+		usleep(100000);
+		while (read(fds_[1], buffer, sizeof(buffer)) > 0);
+		_exit(0);
+	}
+
+	for (int i = 0; i < 8000; ++i)
+		ASSERT_TRUE(co_rpc_sdo_download(client, 3, 0x2000, 0, msg->data,
+						msg->size) >= 0);
+	ASSERT_INT_EQ(0, co_rpc_flush(client));
+	ASSERT_INT_EQ(0, memcmp("abcde", msg->data, 5));
+
+	msg = (void*)co_rpc_receive(client, 0);
+	ASSERT_TRUE(msg);
+	ASSERT_UINT_EQ(1, msg->header.id);
+
+	client_free(client);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
+
+int test_sdo_read(void)
+{
+	struct co_rpc* client = client_new();
+	uint32_t abort_code = 1;
+	char data[16];
+
+	/* The replies are waiting before the requests are even sent */
+	send_reply(0, CO_RPC_OK, 0, "\x11\x22\x33\x44\x55", 5);
+	send_reply(1, CO_RPC_SDO_REMOTE_ABORT, 0x06020000, NULL, 0);
+	send_reply(2, CO_RPC_OK, 0, "\x11\x22\x33\x44\x55", 5);
+
+	ASSERT_INT_EQ(5, co_rpc_sdo_read(client, 3, 0x1008, 0, data,
+					 sizeof(data), &abort_code));
+	ASSERT_UINT_EQ(0, abort_code);
+	ASSERT_UINT_EQ(0x55, (uint8_t)data[4]);
+
+	ASSERT_INT_EQ(-1, co_rpc_sdo_read(client, 3, 0x1008, 0, data,
+					  sizeof(data), &abort_code));
+	ASSERT_INT_EQ(EIO, errno);
+	ASSERT_UINT_EQ(0x06020000, abort_code);
+
+	ASSERT_INT_EQ(-1, co_rpc_sdo_read(client, 3, 0x1008, 0, data, 4,
+					  NULL));
+	ASSERT_INT_EQ(EMSGSIZE, errno);
+
+	client_free(client);
+	return 0;
+}
+
+int test_sdo_write_busy(void)
+{
+	struct co_rpc* client = client_new();
+	struct co_rpc_header busy = {
+		.size = 16, .type = CO_RPC_SDO_DOWNLOAD, .status = CO_RPC_BUSY
+	};
+
+	write(fds_[1], &busy, sizeof(busy));
+
+	uint32_t abort_code = 1;
+	ASSERT_INT_EQ(-1, co_rpc_sdo_write(client, 3, 0x2000, 0, "x", 1,
+					   &abort_code));
+	ASSERT_INT_EQ(EBUSY, errno);
+	ASSERT_UINT_EQ(0, abort_code);
+
+	client_free(client);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_message_size);
+	RUN_TEST(test_requests_are_padded_and_numbered);
+	RUN_TEST(test_invalid_requests);
+	RUN_TEST(test_subscribe_sets_node_bits);
+	RUN_TEST(test_receive_split_messages);
+	RUN_TEST(test_receive_malformed);
+	RUN_TEST(test_message_survives_flush);
+	RUN_TEST(test_sdo_read);
+	RUN_TEST(test_sdo_write_busy);
+	return r;
+}
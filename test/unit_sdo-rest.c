@@ -0,0 +1,306 @@
+#include "tst.h"
+#include "sdo-rest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int parse(const char* text, struct sdo_rest_bulk* bulk)
+{
+	char* copy = strdup(text);
+	memset(bulk, 0, sizeof(*bulk));
+	int rc = sdo_rest__bulk_parse(bulk, copy);
+	bulk->body = copy;
+	return rc;
+}
+
+static void bulk_free(struct sdo_rest_bulk* bulk)
+{
+	free(bulk->ops);
+	free(bulk->body);
+}
+
+static int parse_fails(const char* text)
+{
+	struct sdo_rest_bulk bulk;
+	int rc = parse(text, &bulk);
+	bulk_free(&bulk);
+	return rc < 0;
+}
+
+int test_json_string()
+{
+	char text[] = "\"a\\\"b\\\\c\\/d\\ne\\tf\\rg\", 1";
+	const char* value = NULL;
+
+	char* end = sdo_rest__json_string(text, &value);
+	ASSERT_TRUE(end);
+	ASSERT_STR_EQ("a\"b\\c/d\ne\tf\rg", value);
+	ASSERT_STR_EQ(", 1", end);
+
+	return 0;
+}
+
+int test_json_string_bad_escape()
+{
+	char text[] = "\"a\\qb\"";
+	const char* value;
+
+	ASSERT_FALSE(sdo_rest__json_string(text, &value));
+
+	return 0;
+}
+
+int test_json_string_truncated()
+{
+	char unterminated[] = "\"abc";
+	char trailing_escape[] = "\"abc\\";
+	char unquoted[] = "abc\"";
+	const char* value;
+
+	ASSERT_FALSE(sdo_rest__json_string(unterminated, &value));
+	ASSERT_FALSE(sdo_rest__json_string(trailing_escape, &value));
+	ASSERT_FALSE(sdo_rest__json_string(unquoted, &value));
+
+	return 0;
+}
+
+int test_json_literal()
+{
+	char number[] = "-12.5}";
+	char hex[] = "0x1017,";
+	char buffer[32];
+
+	ASSERT_STR_EQ("}", sdo_rest__json_literal(number, buffer,
+						  sizeof(buffer)));
+	ASSERT_STR_EQ("-12.5", buffer);
+
+	ASSERT_STR_EQ(",", sdo_rest__json_literal(hex, buffer, sizeof(buffer)));
+	ASSERT_STR_EQ("0x1017", buffer);
+
+	return 0;
+}
+
+int test_json_literal_too_long()
+{
+	char text[] = "12345678";
+	char buffer[8];
+
+	ASSERT_FALSE(sdo_rest__json_literal(text, buffer, sizeof(buffer)));
+
+	return 0;
+}
+
+int test_json_int()
+{
+	char quoted[] = "\"0x1017\"";
+	char plain[] = "42";
+	char negative[] = "-1";
+	char too_large[] = "65536";
+	char not_a_number[] = "\"abc\"";
+	char empty[] = "\"\"";
+	int value = -1;
+
+	ASSERT_TRUE(sdo_rest__json_int(quoted, &value));
+	ASSERT_INT_EQ(0x1017, value);
+
+	ASSERT_TRUE(sdo_rest__json_int(plain, &value));
+	ASSERT_INT_EQ(42, value);
+
+	ASSERT_FALSE(sdo_rest__json_int(negative, &value));
+	ASSERT_FALSE(sdo_rest__json_int(too_large, &value));
+	ASSERT_FALSE(sdo_rest__json_int(not_a_number, &value));
+	ASSERT_FALSE(sdo_rest__json_int(empty, &value));
+
+	return 0;
+}
+
+int test_json_value_rejects_keywords()
+{
+	char null_[] = "null";
+	char true_[] = "true";
+	char false_[] = "false";
+	struct sdo_rest_bulk_op op = { 0 };
+
+	ASSERT_FALSE(sdo_rest__json_value(null_, &op));
+	ASSERT_FALSE(sdo_rest__json_value(true_, &op));
+	ASSERT_FALSE(sdo_rest__json_value(false_, &op));
+
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"value\": null}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"value\": true}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"value\": false}]"));
+
+	return 0;
+}
+
+int test_bulk_parse()
+{
+	struct sdo_rest_bulk bulk;
+
+	ASSERT_INT_EQ(0, parse(" [ {\"node\": 3, \"index\": \"0x1017\", "
+			       "\"subindex\": 0},\n"
+			       "{\"node\": \"4\", \"index\": 4119, "
+			       "\"subindex\": 0, \"value\": 1000, "
+			       "\"type\": \"UNSIGNED16\"} ] ", &bulk));
+
+	ASSERT_UINT_EQ(2, bulk.n_ops);
+
+	ASSERT_INT_EQ(3, bulk.ops[0].nodeid);
+	ASSERT_INT_EQ(0x1017, bulk.ops[0].index);
+	ASSERT_INT_EQ(0, bulk.ops[0].subindex);
+	ASSERT_PTR_EQ(NULL, bulk.ops[0].value);
+	ASSERT_PTR_EQ(NULL, bulk.ops[0].type);
+
+	ASSERT_INT_EQ(4, bulk.ops[1].nodeid);
+	ASSERT_INT_EQ(4119, bulk.ops[1].index);
+	ASSERT_STR_EQ("1000", bulk.ops[1].value);
+	ASSERT_STR_EQ("UNSIGNED16", bulk.ops[1].type);
+
+	bulk_free(&bulk);
+	return 0;
+}
+
+int test_bulk_parse_empty()
+{
+	struct sdo_rest_bulk bulk;
+
+	ASSERT_INT_EQ(0, parse("[]", &bulk));
+	ASSERT_UINT_EQ(0, bulk.n_ops);
+
+	bulk_free(&bulk);
+	return 0;
+}
+
+int test_bulk_parse_truncated()
+{
+	static const char* valid =
+		"[{\"node\": 3, \"index\": \"0x1017\", \"subindex\": 0, "
+		"\"value\": \"a\\\"b\"}]";
+	size_t length = strlen(valid);
+
+	ASSERT_FALSE(parse_fails(valid));
+
+	for (size_t i = 0; i < length; ++i) {
+		char* text = strndup(valid, i);
+		ASSERT_TRUE(parse_fails(text));
+		free(text);
+	}
+
+	return 0;
+}
+
+int test_bulk_parse_bad_escape()
+{
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"value\": \"\\x\"}]"));
+	ASSERT_TRUE(parse_fails("[{\"no\\de\": 3, \"index\": 4119, "
+				"\"subindex\": 0}]"));
+
+	return 0;
+}
+
+int test_bulk_parse_duplicate_key()
+{
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"node\": 4, \"index\": 4119, "
+				"\"subindex\": 0}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"value\": 1, "
+				"\"value\": 2}]"));
+
+	return 0;
+}
+
+int test_bulk_parse_bad_node()
+{
+	ASSERT_TRUE(parse_fails("[{\"node\": \"three\", \"index\": 4119, "
+				"\"subindex\": 0}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": true, \"index\": 4119, "
+				"\"subindex\": 0}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 0, \"index\": 4119, "
+				"\"subindex\": 0}]"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 128, \"index\": 4119, "
+				"\"subindex\": 0}]"));
+	ASSERT_TRUE(parse_fails("[{\"index\": 4119, \"subindex\": 0}]"));
+
+	return 0;
+}
+
+int test_bulk_parse_unknown_key()
+{
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0, \"foo\": 1}]"));
+
+	return 0;
+}
+
+int test_bulk_parse_trailing_garbage()
+{
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0}] x"));
+	ASSERT_TRUE(parse_fails("[{\"node\": 3, \"index\": 4119, "
+				"\"subindex\": 0},]"));
+
+	return 0;
+}
+
+static char* make_ops(size_t n)
+{
+	static const char* op =
+		"{\"node\": 3, \"index\": 4119, \"subindex\": 0},";
+	size_t op_length = strlen(op);
+
+	char* text = malloc(2 + n * op_length + 1);
+	char* p = text;
+
+	*p++ = '[';
+	for (size_t i = 0; i < n; ++i) {
+		memcpy(p, op, op_length);
+		p += op_length;
+	}
+	p[-1] = ']';
+	*p = '\0';
+
+	return text;
+}
+
+int test_bulk_parse_max_ops()
+{
+	struct sdo_rest_bulk bulk;
+
+	char* text = make_ops(SDO_REST_BULK_MAX_OPS);
+	ASSERT_INT_EQ(0, parse(text, &bulk));
+	ASSERT_UINT_EQ(SDO_REST_BULK_MAX_OPS, bulk.n_ops);
+	bulk_free(&bulk);
+	free(text);
+
+	text = make_ops(SDO_REST_BULK_MAX_OPS + 1);
+	ASSERT_TRUE(parse_fails(text));
+	free(text);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_json_string);
+	RUN_TEST(test_json_string_bad_escape);
+	RUN_TEST(test_json_string_truncated);
+	RUN_TEST(test_json_literal);
+	RUN_TEST(test_json_literal_too_long);
+	RUN_TEST(test_json_int);
+	RUN_TEST(test_json_value_rejects_keywords);
+	RUN_TEST(test_bulk_parse);
+	RUN_TEST(test_bulk_parse_empty);
+	RUN_TEST(test_bulk_parse_truncated);
+	RUN_TEST(test_bulk_parse_bad_escape);
+	RUN_TEST(test_bulk_parse_duplicate_key);
+	RUN_TEST(test_bulk_parse_bad_node);
+	RUN_TEST(test_bulk_parse_unknown_key);
+	RUN_TEST(test_bulk_parse_trailing_garbage);
+	RUN_TEST(test_bulk_parse_max_ops);
+	return r;
+}
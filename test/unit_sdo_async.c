@@ -32,6 +32,7 @@ FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
 FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
 FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
 FAKE_VOID_FUNC(on_done, struct sdo_async*);
+FAKE_VOID_FUNC(on_data, struct sdo_async*);
 
 struct mloop_timer timer;
 
@@ -263,6 +264,128 @@ static int test_upload_big()
 	return upload(loremipsum);
 }
 
+#define STREAM_SIZE 3000
+#define STREAM_PIECE 500
+
+static char stream_data[STREAM_SIZE];
+
+static int test_download_stream()
+{
+	for (size_t i = 0; i < sizeof(stream_data); ++i)
+		stream_data[i] = i * 7;
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.data = stream_data,
+		.size = 10,
+		.stream_size = sizeof(stream_data),
+		.on_done = on_done,
+		.on_data = on_data
+	};
+
+	RESET_FAKE(on_done);
+	RESET_FAKE(on_data);
+
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	ASSERT_INT_EQ(1, on_data_fake.call_count);
+	reset_srv_data();
+
+	size_t pos = info.size;
+	unsigned int n_requests = 0;
+
+	for (int i = 0; i < 100 && on_done_fake.call_count == 0; ++i) {
+		push_to_server();
+
+		/* More data is only given when it is asked for */
+		if (on_data_fake.call_count == n_requests)
+			continue;
+
+		size_t size = sizeof(stream_data) - pos;
+		if (size > STREAM_PIECE)
+			size = STREAM_PIECE;
+
+		n_requests = on_data_fake.call_count;
+		ASSERT_INT_EQ(0, sdo_async_append(&client, stream_data + pos,
+						  size));
+		pos += size;
+	}
+
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_UINT_EQ(sizeof(stream_data), srv_size);
+	ASSERT_INT_EQ(0, memcmp(stream_data, srv_data, srv_size));
+
+	/* Nothing can be added beyond the indicated size */
+	ASSERT_INT_EQ(-1, sdo_async_append(&client, stream_data, 1));
+
+	return 0;
+}
+
+static int test_download_stream_too_small()
+{
+	struct sdo_async_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.data = stream_data,
+		.stream_size = SDO_EXPEDIATED_DATA_SIZE,
+		.on_data = on_data
+	};
+
+	ASSERT_INT_EQ(-1, sdo_async_start(&client, &info));
+	return 0;
+}
+
+static char collected[STREAM_SIZE];
+static size_t n_collected;
+
+static void collect(struct sdo_async* async)
+{
+	assert(async->buffer.index >= SDO_ASYNC_STREAM_CHUNK);
+	memcpy(collected + n_collected, async->buffer.data, async->buffer.index);
+	n_collected += async->buffer.index;
+}
+
+static int test_upload_stream()
+{
+	char str[STREAM_SIZE];
+	for (size_t i = 0; i < sizeof(str) - 1; ++i)
+		str[i] = 'a' + i % 26;
+	str[sizeof(str) - 1] = '\0';
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.on_done = on_done,
+		.on_data = on_data
+	};
+
+	RESET_FAKE(on_done);
+	RESET_FAKE(on_data);
+	on_data_fake.custom_fake = collect;
+	n_collected = 0;
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_INT_EQ(sizeof(str) / SDO_ASYNC_STREAM_CHUNK,
+		      on_data_fake.call_count);
+
+	memcpy(collected + n_collected, client.buffer.data,
+	       client.buffer.index);
+	n_collected += client.buffer.index;
+
+	ASSERT_UINT_EQ(sizeof(str), n_collected);
+	ASSERT_STR_EQ(str, collected);
+
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -271,6 +394,9 @@ int main()
 	RUN_TEST(test_download_big);
 	RUN_TEST(test_upload);
 	RUN_TEST(test_upload_big);
+	RUN_TEST(test_download_stream);
+	RUN_TEST(test_download_stream_too_small);
+	RUN_TEST(test_upload_stream);
 	cleanup();
 	return r;
 }
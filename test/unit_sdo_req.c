@@ -22,6 +22,7 @@ FAKE_VALUE_FUNC(int, sdo_async_stop, struct sdo_async*);
 FAKE_VOID_FUNC(sdo_async_destroy, struct sdo_async*);
 FAKE_VALUE_FUNC(int, sdo_async_start, struct sdo_async*,
 		const struct sdo_async_info*);
+FAKE_VALUE_FUNC(int, sdo_async_append, struct sdo_async*, const void*, size_t);
 
 static int test_req_new_free()
 {
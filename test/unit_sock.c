@@ -0,0 +1,85 @@
+#include "tst.h"
+#include "sock.h"
+#include "bus-stats.h"
+#include "socketcan.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define SEC 1000000000ULL
+
+static struct bus_stats stats_;
+
+static void make_frames(struct can_frame* frames, size_t n)
+{
+	memset(frames, 0, n * sizeof(*frames));
+
+	for (size_t i = 0; i < n; ++i) {
+		frames[i].can_id = 0x185;
+		frames[i].can_dlc = 8;
+	}
+}
+
+static int open_pair(struct sock* sock, enum sock_type type, int* peer)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, type == SOCK_TYPE_CAN ? SOCK_DGRAM
+			: SOCK_STREAM, 0, fds) < 0)
+		return -1;
+
+	sock_init(sock, type, fds[0], NULL);
+	sock_set_stats(sock, &stats_);
+	*peer = fds[1];
+	return 0;
+}
+
+static int test_batch(enum sock_type type)
+{
+	struct sock sock;
+	struct can_frame frames[3];
+	struct bs_counter total;
+	int peer;
+
+	bs_init(&stats_, 125000);
+	ASSERT_INT_EQ(0, open_pair(&sock, type, &peer));
+
+	make_frames(frames, 3);
+	ASSERT_INT_EQ(3, sock_send_batch(&sock, frames, 3));
+
+	bs_get_node_total(&stats_, BS_TX, 5, &total);
+	ASSERT_INT_EQ(3, total.frames);
+	ASSERT_INT_EQ(24, total.bytes);
+	ASSERT_INT_EQ(0, bs_get_value(&stats_.n_errors[BS_TX]));
+
+	close(peer);
+
+	make_frames(frames, 3);
+	ASSERT_INT_EQ(-1, sock_send_batch(&sock, frames, 3));
+
+	bs_get_node_total(&stats_, BS_TX, 5, &total);
+	ASSERT_INT_EQ(3, total.frames);
+	ASSERT_INT_EQ(1, bs_get_value(&stats_.n_errors[BS_TX]));
+
+	sock_close(&sock);
+	return 0;
+}
+
+int test_batch_counts_can(void)
+{
+	return test_batch(SOCK_TYPE_CAN);
+}
+
+int test_batch_counts_tcp(void)
+{
+	return test_batch(SOCK_TYPE_TCP);
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_batch_counts_can);
+	RUN_TEST(test_batch_counts_tcp);
+	return r;
+}
@@ -66,10 +66,104 @@ int test_full_buffer(void)
 	return 0;
 }
 
+int test_snapshot(void)
+{
+	struct tracebuffer tb;
+
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	struct tb_frame frames[4];
+	ASSERT_INT_EQ(0, tb_snapshot(&tb, frames));
+
+	struct can_frame cf = { 0 };
+
+	for (int i = 0; i < 5; ++i) {
+		cf.can_id = i;
+		tb_append(&tb, &cf);
+	}
+
+	ASSERT_INT_EQ(4, tb_snapshot(&tb, frames));
+
+	for (int i = 0; i < 4; ++i)
+		ASSERT_INT_EQ(i + 1, frames[i].cf.can_id);
+
+	ASSERT_TRUE(frames[0].timestamp <= frames[3].timestamp);
+
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_copy_range(void)
+{
+	struct tracebuffer tb;
+	struct tb_frame frames[4];
+	struct can_frame cf = { 0 };
+
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	for (int i = 0; i < 6; ++i) {
+		cf.can_id = i;
+		tb_append(&tb, &cf);
+	}
+
+	ASSERT_INT_EQ(6, tb_get_head(&tb));
+
+	/* Frames 0 and 1 have been overwritten */
+	ASSERT_INT_EQ(2, tb_copy(&tb, 0, 4, frames));
+	ASSERT_INT_EQ(2, frames[0].cf.can_id);
+	ASSERT_INT_EQ(3, frames[1].cf.can_id);
+
+	ASSERT_INT_EQ(1, tb_copy(&tb, 5, 100, frames));
+	ASSERT_INT_EQ(5, frames[0].cf.can_id);
+
+	ASSERT_INT_EQ(0, tb_copy(&tb, 6, 100, frames));
+
+	tb_destroy(&tb);
+	return 0;
+}
+
+int test_head_wraps_around(void)
+{
+	struct tracebuffer tb;
+	struct tb_frame frames[4];
+	struct can_frame cf = { 0 };
+
+	ASSERT_INT_GE(0, tb_init(&tb, 4 * sizeof(struct tb_frame)));
+
+	/* Pretend that the buffer was filled just before head wraps */
+	tb.head = UINT32_MAX - 3;
+	for (int i = 0; i < 4; ++i) {
+		cf.can_id = i;
+		tb_append(&tb, &cf);
+	}
+
+	ASSERT_INT_EQ(0, tb_get_head(&tb));
+	ASSERT_INT_EQ(4, tb_snapshot(&tb, frames));
+
+	for (int i = 4; i < 6; ++i) {
+		cf.can_id = i;
+		tb_append(&tb, &cf);
+	}
+
+	ASSERT_INT_EQ(4, tb_snapshot(&tb, frames));
+	for (int i = 0; i < 4; ++i)
+		ASSERT_INT_EQ(i + 2, frames[i].cf.can_id);
+
+	ASSERT_INT_EQ(3, tb_copy(&tb, UINT32_MAX, 2, frames));
+	ASSERT_INT_EQ(3, frames[0].cf.can_id);
+	ASSERT_INT_EQ(5, frames[2].cf.can_id);
+
+	tb_destroy(&tb);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_incomplete_buffer);
 	RUN_TEST(test_full_buffer);
+	RUN_TEST(test_snapshot);
+	RUN_TEST(test_copy_range);
+	RUN_TEST(test_head_wraps_around);
 	return r;
 }
@@ -0,0 +1,181 @@
+#include "tst.h"
+#include "tst-frames.h"
+#include "trace-capture.h"
+
+#include "socketcan.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SEGMENT_SIZE (sizeof(struct tb_capture_header) \
+		      + 4 * sizeof(struct tb_slot))
+
+static char path_[64];
+
+static void append(struct tb_capture* capture, uint32_t first, uint32_t last)
+{
+	struct can_frame cf = { 0 };
+
+	for (uint32_t i = first; i <= last; ++i) {
+		cf.can_id = i;
+		tb_capture_append(capture, i, &cf);
+	}
+}
+
+static void cleanup(void)
+{
+	char cmd[128];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", path_);
+	system(cmd);
+}
+
+int test_append_and_read(void)
+{
+	struct tb_capture capture;
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, 64));
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+	ASSERT_INT_EQ(4, capture.n_slots);
+
+	append(&capture, 0, 9);
+
+	ASSERT_INT_EQ(0, tb_capture_read(path_, tst_collect_frame, &list));
+	ASSERT_INT_EQ(10, list.n);
+	for (int i = 0; i < 10; ++i)
+		ASSERT_INT_EQ(i, list.frames[i].cf.can_id);
+
+	tb_capture_destroy(&capture);
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_wrap_around(void)
+{
+	struct tb_capture capture;
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, 64));
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+
+	append(&capture, 0, 17);
+
+	ASSERT_INT_EQ(0, tb_capture_read(path_, tst_collect_frame, &list));
+	ASSERT_INT_EQ(14, list.n);
+	for (int i = 0; i < 14; ++i)
+		ASSERT_INT_EQ(i + 4, list.frames[i].cf.can_id);
+
+	tb_capture_destroy(&capture);
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_rotate(void)
+{
+	struct tb_capture capture;
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, 64));
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+
+	tb_capture_rotate(&capture);
+	ASSERT_INT_EQ(0, capture.head);
+
+	append(&capture, 0, 0);
+	tb_capture_rotate(&capture);
+	ASSERT_INT_EQ(4, capture.head);
+
+	tb_capture_rotate(&capture);
+	ASSERT_INT_EQ(4, capture.head);
+
+	append(&capture, 1, 1);
+
+	ASSERT_INT_EQ(0, tb_capture_read(path_, tst_collect_frame, &list));
+	ASSERT_INT_EQ(2, list.n);
+	ASSERT_INT_EQ(0, list.frames[0].cf.can_id);
+	ASSERT_INT_EQ(1, list.frames[1].cf.can_id);
+
+	tb_capture_destroy(&capture);
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_resume(void)
+{
+	struct tb_capture capture;
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, 64));
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+	append(&capture, 0, 5);
+	tb_capture_destroy(&capture);
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+	ASSERT_INT_EQ(8, capture.head);
+	append(&capture, 6, 7);
+	tb_capture_destroy(&capture);
+
+	ASSERT_INT_EQ(0, tb_capture_read(path_, tst_collect_frame, &list));
+	ASSERT_INT_EQ(8, list.n);
+	for (int i = 0; i < 8; ++i)
+		ASSERT_INT_EQ(i, list.frames[i].cf.can_id);
+
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_position_wraps_around(void)
+{
+	struct tb_capture capture;
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, 64));
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+	capture.head = UINT32_MAX - 7;
+	append(&capture, 0, 9);
+	tb_capture_destroy(&capture);
+
+	ASSERT_INT_EQ(0, tb_capture_read(path_, tst_collect_frame, &list));
+	ASSERT_INT_EQ(10, list.n);
+	for (int i = 0; i < 10; ++i)
+		ASSERT_INT_EQ(i, list.frames[i].cf.can_id);
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 4));
+	ASSERT_INT_EQ(4, capture.head);
+	tb_capture_destroy(&capture);
+
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+int test_segments_rounded_down(void)
+{
+	struct tb_capture capture;
+
+	ASSERT_INT_EQ(0, tb_capture_init(&capture, path_, SEGMENT_SIZE, 3));
+	ASSERT_INT_EQ(2, capture.n_segments);
+
+	tb_capture_destroy(&capture);
+	return 0;
+}
+
+#define RUN_CAPTURE_TEST(name) do { \
+	strcpy(path_, "/tmp/unit_trace-capture.XXXXXX"); \
+	if (!mkdtemp(path_)) \
+		return 1; \
+	RUN_TEST(name); \
+	cleanup(); \
+} while (0)
+
+int main()
+{
+	int r = 0;
+	RUN_CAPTURE_TEST(test_append_and_read);
+	RUN_CAPTURE_TEST(test_wrap_around);
+	RUN_CAPTURE_TEST(test_rotate);
+	RUN_CAPTURE_TEST(test_resume);
+	RUN_CAPTURE_TEST(test_position_wraps_around);
+	RUN_CAPTURE_TEST(test_segments_rounded_down);
+	return r;
+}
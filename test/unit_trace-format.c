@@ -0,0 +1,513 @@
+#include "tst.h"
+#include "tst-frames.h"
+#include "trace-format.h"
+#include "lz.h"
+
+#include "socketcan.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define N_FRAMES 20000
+
+static void make_frames(struct tb_frame* frames, size_t n)
+{
+	uint64_t t = 1476633600000000ULL;
+
+	srand(42);
+
+	for (size_t i = 0; i < n; ++i) {
+		struct can_frame* cf = &frames[i].cf;
+		memset(cf, 0, sizeof(*cf));
+
+		t += rand() % 1000;
+		frames[i].timestamp = t;
+
+		switch (i % 5) {
+		case 0:
+			cf->can_id = 0x80;
+			break;
+		case 1:
+			cf->can_id = 0x181 + i % 8;
+			cf->can_dlc = 8;
+			cf->data[0] = i;
+			cf->data[1] = i >> 8;
+			break;
+		case 2:
+			cf->can_id = 0x701 | CAN_RTR_FLAG;
+			cf->can_dlc = 1;
+			break;
+		case 3:
+			cf->can_id = 0x12345678 | CAN_EFF_FLAG;
+			cf->can_dlc = 3;
+			cf->data[2] = rand();
+			break;
+		case 4:
+			cf->can_id = 0x581;
+			cf->can_dlc = i % 9;
+			for (int j = 0; j < cf->can_dlc; ++j)
+				cf->data[j] = rand();
+			break;
+		}
+	}
+}
+
+static int check_round_trip(int flags, size_t* file_size)
+{
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	struct tst_frame_list list;
+	struct tf_writer writer;
+	char* buffer = NULL;
+	size_t size = 0;
+
+	ASSERT_TRUE(frames);
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, N_FRAMES));
+	make_frames(frames, N_FRAMES);
+
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, tf_writer_init(&writer, stream, flags));
+	for (size_t i = 0; i < N_FRAMES; ++i)
+		ASSERT_INT_EQ(0, tf_writer_append(&writer, &frames[i]));
+	ASSERT_INT_EQ(0, tf_writer_finish(&writer));
+	fclose(stream);
+
+	stream = fmemopen(buffer, size, "r");
+	ASSERT_TRUE(tf_is_compact(stream));
+	ASSERT_INT_EQ(0, tf_read(stream, NULL, tst_collect_frame, &list));
+	fclose(stream);
+
+	ASSERT_INT_EQ(N_FRAMES, list.n);
+
+	for (size_t i = 0; i < N_FRAMES; ++i) {
+		ASSERT_TRUE(frames[i].timestamp == list.frames[i].timestamp);
+		ASSERT_INT_EQ(0, memcmp(&frames[i].cf, &list.frames[i].cf,
+					sizeof(struct can_frame)));
+	}
+
+	*file_size = size;
+
+	free(buffer);
+	tst_frame_list_destroy(&list);
+	free(frames);
+	return 0;
+}
+
+int test_round_trip(void)
+{
+	size_t size = 0;
+	ASSERT_INT_EQ(0, check_round_trip(0, &size));
+	ASSERT_TRUE(size < N_FRAMES * sizeof(struct tb_frame) / 2);
+	return 0;
+}
+
+int test_compressed_round_trip(void)
+{
+	size_t size = 0, compressed_size = 0;
+	ASSERT_INT_EQ(0, check_round_trip(0, &size));
+	ASSERT_INT_EQ(0, check_round_trip(TF_COMPRESS, &compressed_size));
+	ASSERT_TRUE(compressed_size < size);
+	return 0;
+}
+
+int test_early_frames(void)
+{
+	struct tb_frame frames[6] = { 0 };
+	struct tb_frame decoded[6];
+	struct tst_frame_list list = { .frames = decoded, .size = 6 };
+	struct tf_writer writer;
+	char* buffer = NULL;
+	size_t size = 0;
+
+	/* The third frame is older than the second one and the fifth is older
+	 * than the first one.
+	 */
+	uint64_t timestamps[6] = { 1000, 1500, 1200, 1600, 900, 2000 };
+	for (int i = 0; i < 6; ++i) {
+		frames[i].timestamp = timestamps[i];
+		frames[i].cf.can_id = 0x181 + i;
+		frames[i].cf.can_dlc = 1;
+		frames[i].cf.data[0] = i;
+	}
+
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, tf_writer_init(&writer, stream, 0));
+	for (int i = 0; i < 6; ++i)
+		ASSERT_INT_EQ(0, tf_writer_append(&writer, &frames[i]));
+	ASSERT_INT_EQ(0, tf_writer_finish(&writer));
+	fclose(stream);
+
+	/* Integers are stored little endian */
+	ASSERT_INT_EQ(0, memcmp("COTR", buffer, 4));
+
+	stream = fmemopen(buffer, size, "r");
+	ASSERT_INT_EQ(0, tf_read(stream, NULL, tst_collect_frame, &list));
+	fclose(stream);
+
+	ASSERT_INT_EQ(6, list.n);
+	for (int i = 0; i < 6; ++i) {
+		ASSERT_TRUE(timestamps[i] == decoded[i].timestamp);
+		ASSERT_UINT_EQ(i, decoded[i].cf.data[0]);
+	}
+
+	free(buffer);
+	return 0;
+}
+
+int test_not_compact(void)
+{
+	struct tb_frame frame = { 0 };
+	FILE* stream = fmemopen(&frame, sizeof(frame), "r");
+	ASSERT_FALSE(tf_is_compact(stream));
+	fclose(stream);
+	return 0;
+}
+
+static int write_file(const char* path, const struct tb_frame* frames,
+		      size_t n, int flags)
+{
+	struct tf_writer writer;
+
+	FILE* stream = fopen(path, "w");
+	ASSERT_TRUE(stream);
+	ASSERT_INT_EQ(0, tf_writer_init(&writer, stream, flags));
+	for (size_t i = 0; i < n; ++i)
+		ASSERT_INT_EQ(0, tf_writer_append(&writer, &frames[i]));
+	ASSERT_INT_EQ(0, tf_writer_finish(&writer));
+	fclose(stream);
+	return 0;
+}
+
+/* Compare tf_read_file() against filtering every frame */
+static int check_query(const char* path, const struct tb_frame* frames,
+		       const struct tf_query* query)
+{
+	struct tst_frame_list list;
+	ASSERT_INT_EQ(0, tst_frame_list_init(&list, N_FRAMES));
+
+	ASSERT_INT_EQ(0, tf_read_file(path, query, tst_collect_frame, &list));
+
+	size_t n = 0;
+	for (size_t i = 0; i < N_FRAMES; ++i) {
+		if (!tf_query_match(query, &frames[i]))
+			continue;
+
+		ASSERT_TRUE(n < list.n);
+		ASSERT_TRUE(frames[i].timestamp == list.frames[n].timestamp);
+		ASSERT_INT_EQ(0, memcmp(&frames[i].cf, &list.frames[n].cf,
+					sizeof(struct can_frame)));
+		++n;
+	}
+
+	ASSERT_INT_EQ((int)n, (int)list.n);
+
+	tst_frame_list_destroy(&list);
+	return 0;
+}
+
+static int check_queries(const char* path, const struct tb_frame* frames)
+{
+	struct tf_query query;
+
+	tf_query_init(&query);
+	ASSERT_INT_EQ(0, check_query(path, frames, &query));
+
+	query.from = frames[N_FRAMES / 2].timestamp;
+	query.to = frames[N_FRAMES / 2 + 1000].timestamp;
+	ASSERT_INT_EQ(0, check_query(path, frames, &query));
+
+	query.nodes[0] = 1 << 3;
+	query.has_nodes = 1;
+	ASSERT_INT_EQ(0, check_query(path, frames, &query));
+
+	tf_query_init(&query);
+	query.cob = 0x581;
+	query.from = frames[N_FRAMES - 10].timestamp;
+	ASSERT_INT_EQ(0, check_query(path, frames, &query));
+
+	tf_query_init(&query);
+	query.from = frames[N_FRAMES - 1].timestamp + 1;
+	ASSERT_INT_EQ(0, check_query(path, frames, &query));
+
+	return 0;
+}
+
+int test_indexed_query(void)
+{
+	char path[] = "/tmp/unit_trace-format.XXXXXX";
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	ASSERT_TRUE(frames);
+
+	int fd = mkstemp(path);
+	ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	make_frames(frames, N_FRAMES);
+
+	ASSERT_INT_EQ(0, write_file(path, frames, N_FRAMES, TF_COMPRESS));
+	ASSERT_INT_EQ(0, check_queries(path, frames));
+
+	unlink(path);
+	free(frames);
+	return 0;
+}
+
+int test_unindexed_query(void)
+{
+	char path[] = "/tmp/unit_trace-format.XXXXXX";
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	struct stat st;
+	ASSERT_TRUE(frames);
+
+	int fd = mkstemp(path);
+	ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	make_frames(frames, N_FRAMES);
+
+	/* Strip the index as if the writer had not finished */
+	ASSERT_INT_EQ(0, write_file(path, frames, N_FRAMES, 0));
+	ASSERT_INT_EQ(0, stat(path, &st));
+
+	FILE* stream = fopen(path, "r");
+	struct tf_index_trailer trailer;
+	ASSERT_INT_EQ(0, fseek(stream, -(long)sizeof(trailer), SEEK_END));
+	ASSERT_INT_EQ(1, fread(&trailer, sizeof(trailer), 1, stream));
+	fclose(stream);
+
+	ASSERT_INT_EQ(TF_INDEX_MAGIC, trailer.magic);
+	ASSERT_TRUE(trailer.n_blocks > 1);
+	ASSERT_INT_EQ(0, truncate(path, trailer.offset
+				  - sizeof(struct tf_block_header)));
+
+	ASSERT_INT_EQ(0, check_queries(path, frames));
+
+	unlink(path);
+	free(frames);
+	return 0;
+}
+
+/* Frames that arrive late end up in blocks whose time range lies before that
+ * of the blocks preceding them, so the index is no longer sorted.
+ */
+int test_unsorted_index(void)
+{
+	char path[] = "/tmp/unit_trace-format.XXXXXX";
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	struct tb_frame* written = malloc(N_FRAMES * sizeof(*written));
+	ASSERT_TRUE(frames);
+	ASSERT_TRUE(written);
+
+	int fd = mkstemp(path);
+	ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	make_frames(frames, N_FRAMES);
+
+	size_t half = N_FRAMES / 2;
+	memcpy(written, frames + half, (N_FRAMES - half) * sizeof(*frames));
+	memcpy(written + N_FRAMES - half, frames, half * sizeof(*frames));
+
+	ASSERT_INT_EQ(0, write_file(path, written, N_FRAMES, TF_COMPRESS));
+
+	ASSERT_INT_EQ(0, check_queries(path, written));
+
+	unlink(path);
+	free(written);
+	free(frames);
+	return 0;
+}
+
+/* A trailer whose offset and block count only add up to the file size
+ * after wrapping around must not be trusted.
+ */
+int test_wrapping_index_trailer(void)
+{
+	char path[] = "/tmp/unit_trace-format.XXXXXX";
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	struct tf_index_trailer trailer;
+	struct stat st;
+	ASSERT_TRUE(frames);
+
+	int fd = mkstemp(path);
+	ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	make_frames(frames, N_FRAMES);
+
+	ASSERT_INT_EQ(0, write_file(path, frames, N_FRAMES, 0));
+	ASSERT_INT_EQ(0, stat(path, &st));
+
+	FILE* stream = fopen(path, "r+");
+	ASSERT_TRUE(stream);
+	ASSERT_INT_EQ(0, fseek(stream, -(long)sizeof(trailer), SEEK_END));
+	ASSERT_INT_EQ(1, fread(&trailer, sizeof(trailer), 1, stream));
+	ASSERT_INT_EQ(TF_INDEX_MAGIC, trailer.magic);
+
+	trailer.n_blocks = UINT32_MAX;
+	trailer.offset = (uint64_t)st.st_size - sizeof(trailer)
+		       - (uint64_t)trailer.n_blocks
+			 * sizeof(struct tf_index_entry);
+
+	ASSERT_INT_EQ(0, fseek(stream, -(long)sizeof(trailer), SEEK_END));
+	ASSERT_INT_EQ(1, fwrite(&trailer, sizeof(trailer), 1, stream));
+	fclose(stream);
+
+	ASSERT_INT_EQ(0, check_queries(path, frames));
+
+	unlink(path);
+	free(frames);
+	return 0;
+}
+
+int test_frame_node(void)
+{
+	struct can_frame cf = { 0 };
+
+	cf.can_id = 0x185;
+	ASSERT_INT_EQ(5, tf_frame_node(&cf));
+
+	cf.can_id = 0x77f;
+	ASSERT_INT_EQ(127, tf_frame_node(&cf));
+
+	cf.can_id = 0x80;
+	ASSERT_INT_EQ(0, tf_frame_node(&cf));
+
+	cf.can_id = 0x185 | CAN_EFF_FLAG;
+	ASSERT_INT_EQ(0, tf_frame_node(&cf));
+
+	cf.can_id = 0;
+	cf.can_dlc = 2;
+	cf.data[0] = 1;
+	cf.data[1] = 5;
+	ASSERT_INT_EQ(5, tf_frame_node(&cf));
+	return 0;
+}
+
+int test_query_matches_nmt(void)
+{
+	struct tf_query query;
+	struct tb_frame frame = { 0 };
+
+	tf_query_init(&query);
+	query.has_nodes = 1;
+	query.nodes[0] = 1 << 5;
+
+	frame.cf.can_id = 0;
+	frame.cf.can_dlc = 2;
+	frame.cf.data[0] = 1;
+
+	frame.cf.data[1] = 5;
+	ASSERT_TRUE(tf_query_match(&query, &frame));
+
+	frame.cf.data[1] = 6;
+	ASSERT_FALSE(tf_query_match(&query, &frame));
+
+	frame.cf.data[1] = 0;
+	ASSERT_TRUE(tf_query_match(&query, &frame));
+
+	/* SYNC does not belong to any node */
+	frame.cf.can_id = 0x80;
+	frame.cf.can_dlc = 0;
+	ASSERT_FALSE(tf_query_match(&query, &frame));
+	return 0;
+}
+
+int test_parse_time(void)
+{
+	uint64_t t = 0;
+
+	setenv("TZ", "UTC", 1);
+	tzset();
+
+	ASSERT_INT_EQ(0, tf_parse_time(&t, "1519905600.5"));
+	ASSERT_TRUE(t == 1519905600500000ULL);
+
+	t = 0;
+	ASSERT_INT_EQ(0, tf_parse_time(&t, "2018-03-01T12:00:00.5Z"));
+	ASSERT_TRUE(t == 1519905600500000ULL);
+
+	ASSERT_INT_EQ(-1, tf_parse_time(&t, ""));
+	ASSERT_INT_EQ(-1, tf_parse_time(&t, "12x"));
+	ASSERT_INT_EQ(-1, tf_parse_time(&t, "2018-03-01T12:00:00+01"));
+	return 0;
+}
+
+int test_parse_node_and_cob(void)
+{
+	uint8_t nodes[16] = { 0 };
+	int32_t cob = -1;
+
+	ASSERT_INT_EQ(0, tf_parse_node(nodes, "5"));
+	ASSERT_INT_EQ(0, tf_parse_node(nodes, "0x7f"));
+	ASSERT_INT_EQ(1 << 5, nodes[0]);
+	ASSERT_INT_EQ(1 << 7, nodes[15]);
+
+	ASSERT_INT_EQ(-1, tf_parse_node(nodes, "0"));
+	ASSERT_INT_EQ(-1, tf_parse_node(nodes, "128"));
+	ASSERT_INT_EQ(-1, tf_parse_node(nodes, "5x"));
+
+	ASSERT_INT_EQ(0, tf_parse_cob(&cob, "181"));
+	ASSERT_INT_EQ(0x181, cob);
+
+	ASSERT_INT_EQ(-1, tf_parse_cob(&cob, "800"));
+	ASSERT_INT_EQ(-1, tf_parse_cob(&cob, ""));
+	ASSERT_INT_EQ(0x181, cob);
+	return 0;
+}
+
+int test_lz_round_trip(void)
+{
+	uint8_t src[4096], packed[4096 + 64], dst[4096];
+
+	for (size_t i = 0; i < sizeof(src); ++i)
+		src[i] = i % 7 == 0 ? rand() : "repetitive"[i % 10];
+
+	size_t size = lz_compress(packed, sizeof(packed), src, sizeof(src));
+	ASSERT_TRUE(size > 0 && size < sizeof(src));
+
+	ASSERT_INT_EQ(sizeof(src), lz_decompress(dst, sizeof(dst), packed,
+						 size));
+	ASSERT_INT_EQ(0, memcmp(src, dst, sizeof(src)));
+
+	ASSERT_INT_EQ(-1, lz_decompress(dst, 100, packed, size));
+	return 0;
+}
+
+int test_lz_incompressible(void)
+{
+	uint8_t src[256], packed[256], dst[256];
+
+	for (size_t i = 0; i < sizeof(src); ++i)
+		src[i] = rand();
+
+	ASSERT_INT_EQ(0, lz_compress(packed, sizeof(src) - 1, src,
+				     sizeof(src)));
+
+	size_t size = lz_compress(packed, sizeof(packed), src, 10);
+	ASSERT_INT_EQ(10, lz_decompress(dst, sizeof(dst), packed, size));
+	ASSERT_INT_EQ(0, memcmp(src, dst, 10));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_compressed_round_trip);
+	RUN_TEST(test_early_frames);
+	RUN_TEST(test_not_compact);
+	RUN_TEST(test_indexed_query);
+	RUN_TEST(test_unindexed_query);
+	RUN_TEST(test_unsorted_index);
+	RUN_TEST(test_wrapping_index_trailer);
+	RUN_TEST(test_frame_node);
+	RUN_TEST(test_query_matches_nmt);
+	RUN_TEST(test_parse_time);
+	RUN_TEST(test_parse_node_and_cob);
+	RUN_TEST(test_lz_round_trip);
+	RUN_TEST(test_lz_incompressible);
+	return r;
+}
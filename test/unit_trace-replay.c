@@ -0,0 +1,231 @@
+#include "tst.h"
+#include "trace-replay.h"
+#include "socketcan.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define N_FRAMES 100
+
+static struct sock sock_;
+static int peer_;
+
+static void open_pair(void)
+{
+	int fds[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	sock_init(&sock_, SOCK_TYPE_TCP, fds[0], NULL);
+	peer_ = fds[1];
+}
+
+static void close_pair(void)
+{
+	sock_close(&sock_);
+	close(peer_);
+}
+
+static void make_frame(struct tb_frame* frame, int i, uint64_t interval)
+{
+	memset(frame, 0, sizeof(*frame));
+
+	frame->timestamp = 1476633600000000ULL + i * interval;
+	frame->cf.can_id = 0x181 + i % 2;
+	frame->cf.can_dlc = 2;
+	frame->cf.data[0] = i;
+	frame->cf.data[1] = i >> 8;
+}
+
+static int receive(int index)
+{
+	struct can_frame cf;
+
+	if (recv(peer_, &cf, sizeof(cf), MSG_WAITALL) != sizeof(cf))
+		return -1;
+
+	if (ntohl(cf.can_id) != 0x181u + index % 2)
+		return -1;
+
+	return cf.data[0] | cf.data[1] << 8;
+}
+
+int test_max_speed(void)
+{
+	struct trace_replay replay;
+	struct tr_options options;
+	struct tr_stats stats;
+
+	open_pair();
+
+	tr_options_init(&options);
+	options.speed = 0.0;
+	tr_init(&replay, &sock_, &options);
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		struct tb_frame frame;
+		make_frame(&frame, i, 1000000);
+		ASSERT_INT_EQ(0, tr_frame(&replay, &frame));
+	}
+
+	ASSERT_INT_EQ(0, tr_finish(&replay, &stats));
+	ASSERT_INT_EQ(N_FRAMES, stats.n_frames);
+	ASSERT_INT_EQ(2, stats.n_batches);
+	ASSERT_INT_LT(1000000000, stats.duration);
+
+	for (int i = 0; i < N_FRAMES; ++i)
+		ASSERT_INT_EQ(i, receive(i));
+
+	close_pair();
+	return 0;
+}
+
+int test_filter(void)
+{
+	struct trace_replay replay;
+	struct tr_options options;
+	struct tr_stats stats;
+
+	open_pair();
+
+	tr_options_init(&options);
+	options.speed = 0.0;
+	options.query.has_nodes = 1;
+	options.query.nodes[0] = 1 << 2;
+	tr_init(&replay, &sock_, &options);
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		struct tb_frame frame;
+		make_frame(&frame, i, 1000);
+		ASSERT_INT_EQ(0, tr_frame(&replay, &frame));
+	}
+
+	ASSERT_INT_EQ(0, tr_finish(&replay, &stats));
+	ASSERT_INT_EQ(N_FRAMES / 2, stats.n_frames);
+
+	for (int i = 1; i < N_FRAMES; i += 2)
+		ASSERT_INT_EQ(i, receive(i));
+
+	close_pair();
+	return 0;
+}
+
+static uint64_t replay_timed(double speed, struct tr_stats* stats)
+{
+	struct trace_replay replay;
+	struct tr_options options;
+
+	open_pair();
+
+	tr_options_init(&options);
+	options.speed = speed;
+	tr_init(&replay, &sock_, &options);
+
+	/* 5 frames, 10 ms apart */
+	for (int i = 0; i < 5; ++i) {
+		struct tb_frame frame;
+		make_frame(&frame, i, 10000);
+		tr_frame(&replay, &frame);
+	}
+
+	tr_finish(&replay, stats);
+
+	for (int i = 0; i < 5; ++i)
+		receive(i);
+
+	close_pair();
+	return stats->duration;
+}
+
+int test_original_timing(void)
+{
+	struct tr_stats stats;
+
+	ASSERT_UINT_GE(40000000, replay_timed(1.0, &stats));
+	ASSERT_INT_EQ(5, stats.n_frames);
+	ASSERT_INT_EQ(5, stats.n_batches);
+	return 0;
+}
+
+int test_scaled_timing(void)
+{
+	struct tr_stats stats;
+
+	uint64_t duration = replay_timed(4.0, &stats);
+	ASSERT_UINT_GE(10000000, duration);
+	ASSERT_UINT_LT(40000000, duration);
+	return 0;
+}
+
+int test_clock_step(void)
+{
+	struct trace_replay replay;
+	struct tr_options options;
+	struct tr_stats stats;
+	struct tb_frame frame;
+
+	open_pair();
+
+	tr_options_init(&options);
+	tr_init(&replay, &sock_, &options);
+
+	/* A recording where the clock was stepped back must not stall */
+	make_frame(&frame, 0, 0);
+	frame.timestamp = 2000000000000000ULL;
+	tr_frame(&replay, &frame);
+
+	make_frame(&frame, 1, 0);
+	frame.timestamp = 1000000000000000ULL;
+	tr_frame(&replay, &frame);
+
+	ASSERT_INT_EQ(0, tr_finish(&replay, &stats));
+	ASSERT_INT_EQ(2, stats.n_frames);
+	ASSERT_INT_LT(1000000000, stats.duration);
+
+	close_pair();
+	return 0;
+}
+
+int test_replay_file(void)
+{
+	char path[] = "/tmp/unit_trace-replay.XXXXXX";
+	struct tr_options options;
+	struct tr_stats stats;
+
+	int fd = mkstemp(path);
+	FILE* stream = fdopen(fd, "w");
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		struct tb_frame frame;
+		make_frame(&frame, i, 1000000);
+		fwrite(&frame, sizeof(frame), 1, stream);
+	}
+
+	fclose(stream);
+
+	open_pair();
+
+	tr_options_init(&options);
+	options.speed = 0.0;
+	ASSERT_INT_EQ(0, tr_replay_file(&sock_, path, &options, &stats));
+	ASSERT_INT_EQ(N_FRAMES, stats.n_frames);
+
+	for (int i = 0; i < N_FRAMES; ++i)
+		ASSERT_INT_EQ(i, receive(i));
+
+	close_pair();
+	unlink(path);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_max_speed);
+	RUN_TEST(test_filter);
+	RUN_TEST(test_original_timing);
+	RUN_TEST(test_scaled_timing);
+	RUN_TEST(test_clock_step);
+	RUN_TEST(test_replay_file);
+	return r;
+}
@@ -0,0 +1,284 @@
+#include "tst.h"
+#include "trace-stats.h"
+#include "socketcan.h"
+#include "canopen/sdo.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define N_FRAMES 20000
+#define LONG_UPLOAD_SEGMENTS 300
+
+static void make_sdo_frame(struct tb_frame* frame, uint64_t t, int cob,
+			   int cs, int flags)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame->timestamp = t;
+	frame->cf.can_id = cob;
+	frame->cf.can_dlc = 8;
+	frame->cf.data[0] = cs << 5 | flags;
+}
+
+/* A mix of PDOs, SYNC, heartbeats, EMCY and SDO transactions of varying
+ * latency, some of them segmented. The long uploads span several chunks.
+ */
+static size_t make_frames(struct tb_frame* frames)
+{
+	uint64_t t = 1476633600000000ULL;
+	size_t n = 0;
+
+	srand(42);
+
+	while (n < N_FRAMES - 2 * LONG_UPLOAD_SEGMENTS - 2) {
+		t += 100 + rand() % 900;
+
+		switch (rand() % 7) {
+		case 0:
+			memset(&frames[n], 0, sizeof(frames[n]));
+			frames[n].timestamp = t;
+			frames[n++].cf.can_id = 0x80;
+			break;
+		case 1:
+			memset(&frames[n], 0, sizeof(frames[n]));
+			frames[n].timestamp = t;
+			frames[n].cf.can_id = 0x701 + rand() % 3;
+			frames[n].cf.can_dlc = 1;
+			frames[n++].cf.data[0] = 5;
+			break;
+		case 2:
+			memset(&frames[n], 0, sizeof(frames[n]));
+			frames[n].timestamp = t;
+			frames[n].cf.can_id = 0x82;
+			frames[n++].cf.can_dlc = 8;
+			break;
+		case 3:
+			/* Expediated upload */
+			make_sdo_frame(&frames[n++], t, 0x602,
+				       SDO_CCS_UL_INIT_REQ, 0);
+			t += rand() % 5000;
+			make_sdo_frame(&frames[n++], t, 0x582,
+				       SDO_SCS_UL_INIT_RES, 2);
+			break;
+		case 4:
+			/* Segmented download */
+			make_sdo_frame(&frames[n++], t, 0x603,
+				       SDO_CCS_DL_INIT_REQ, 1);
+			make_sdo_frame(&frames[n++], t += 100, 0x583,
+				       SDO_SCS_DL_INIT_RES, 0);
+			make_sdo_frame(&frames[n++], t += 100, 0x603,
+				       SDO_CCS_DL_SEG_REQ, 1);
+			make_sdo_frame(&frames[n++], t += rand() % 1000, 0x583,
+				       SDO_SCS_DL_SEG_RES, 0);
+			break;
+		case 5:
+			if (rand() % 8)
+				break;
+
+			make_sdo_frame(&frames[n++], t, 0x604,
+				       SDO_CCS_UL_INIT_REQ, 0);
+			make_sdo_frame(&frames[n++], t += 100, 0x584,
+				       SDO_SCS_UL_INIT_RES, 1);
+
+			for (int i = 1; i <= LONG_UPLOAD_SEGMENTS; ++i) {
+				make_sdo_frame(&frames[n++], t += 100, 0x604,
+					       SDO_CCS_UL_SEG_REQ, 0);
+				make_sdo_frame(&frames[n++], t += 100, 0x584,
+					       SDO_SCS_UL_SEG_RES,
+					       i == LONG_UPLOAD_SEGMENTS);
+			}
+			break;
+		default:
+			memset(&frames[n], 0, sizeof(frames[n]));
+			frames[n].timestamp = t;
+			frames[n].cf.can_id = 0x181 + rand() % 4;
+			frames[n].cf.can_dlc = rand() % 9;
+			frames[n++].cf.data[0] = rand();
+			break;
+		}
+	}
+
+	return n;
+}
+
+static int check_interval_eq(const struct ts_interval* a,
+			     const struct ts_interval* b)
+{
+	ASSERT_TRUE(a->count == b->count);
+	ASSERT_TRUE(a->n_intervals == b->n_intervals);
+	ASSERT_TRUE(a->first == b->first);
+	ASSERT_TRUE(a->last == b->last);
+	ASSERT_TRUE(a->min == b->min);
+	ASSERT_TRUE(a->max == b->max);
+	ASSERT_TRUE(fabs(a->mean - b->mean) < 1e-6 * (1.0 + a->mean));
+	ASSERT_TRUE(fabs(ts_interval_stddev(a) - ts_interval_stddev(b))
+		    < 1e-6 * (1.0 + ts_interval_stddev(a)));
+	return 0;
+}
+
+static int check_stats_eq(const struct trace_stats* a,
+			  const struct trace_stats* b)
+{
+	ASSERT_TRUE(a->n_frames == b->n_frames);
+	ASSERT_TRUE(a->n_bits == b->n_bits);
+	ASSERT_TRUE(a->first_timestamp == b->first_timestamp);
+	ASSERT_TRUE(a->last_timestamp == b->last_timestamp);
+
+	ASSERT_TRUE(a->load_start == b->load_start);
+	ASSERT_TRUE(a->load_length == b->load_length);
+	ASSERT_INT_EQ(0, memcmp(a->load, b->load,
+				a->load_length * sizeof(*a->load)));
+
+	for (int i = 0; i < TS_N_COBS; ++i)
+		ASSERT_INT_EQ(0, check_interval_eq(&a->cob[i], &b->cob[i]));
+
+	for (int i = 0; i < TS_N_NODES; ++i) {
+		const struct ts_node* x = &a->node[i];
+		const struct ts_node* y = &b->node[i];
+
+		ASSERT_INT_EQ(0, check_interval_eq(&x->heartbeat,
+						   &y->heartbeat));
+		ASSERT_TRUE(x->emcy == y->emcy);
+		ASSERT_TRUE(x->bootups == y->bootups);
+		ASSERT_TRUE(x->sdo.count == y->sdo.count);
+		ASSERT_TRUE(x->sdo.aborts == y->sdo.aborts);
+		ASSERT_TRUE(x->sdo.sum == y->sdo.sum);
+		ASSERT_TRUE(x->sdo.max == y->sdo.max);
+		ASSERT_INT_EQ(0, memcmp(x->sdo.histogram, y->sdo.histogram,
+					sizeof(x->sdo.histogram)));
+	}
+
+	return 0;
+}
+
+int test_frame_bits(void)
+{
+	struct can_frame cf = { 0 };
+
+	/* 47 bits and a stuff bit after every 5 zeros up to the CRC
+	 * delimiter.
+	 */
+	ASSERT_INT_EQ(53, ts_frame_bits(&cf));
+
+	cf.can_id = 0x555;
+	cf.can_dlc = 8;
+	memset(cf.data, 0x55, 8);
+	unsigned int bits = ts_frame_bits(&cf);
+	ASSERT_UINT_GE(111, bits);
+	ASSERT_UINT_GE(bits, 111 + 24);
+
+	cf.can_id |= CAN_EFF_FLAG;
+	ASSERT_UINT_GT(bits + 18, ts_frame_bits(&cf));
+
+	cf.can_id = CAN_ERR_FLAG;
+	ASSERT_INT_EQ(0, ts_frame_bits(&cf));
+	return 0;
+}
+
+int test_sdo_latency(void)
+{
+	struct trace_stats* stats = ts_new();
+	struct tb_frame frame;
+	ASSERT_TRUE(stats);
+
+	make_sdo_frame(&frame, 1000, 0x605, SDO_CCS_UL_INIT_REQ, 0);
+	ts_add(stats, &frame);
+	make_sdo_frame(&frame, 1300, 0x585, SDO_SCS_UL_INIT_RES, 0);
+	ts_add(stats, &frame);
+	make_sdo_frame(&frame, 1400, 0x605, SDO_CCS_UL_SEG_REQ, 0);
+	ts_add(stats, &frame);
+	make_sdo_frame(&frame, 1500, 0x585, SDO_SCS_UL_SEG_RES, 1);
+	ts_add(stats, &frame);
+
+	make_sdo_frame(&frame, 2000, 0x605, SDO_CCS_DL_INIT_REQ, 2);
+	ts_add(stats, &frame);
+	make_sdo_frame(&frame, 2100, 0x585, SDO_SCS_ABORT, 0);
+	ts_add(stats, &frame);
+
+	const struct ts_sdo* sdo = &stats->node[5].sdo;
+	ASSERT_TRUE(sdo->count == 1);
+	ASSERT_TRUE(sdo->aborts == 1);
+	ASSERT_TRUE(sdo->max == 500);
+	ASSERT_TRUE(sdo->histogram[8] == 1);
+
+	ts_free(stats);
+	return 0;
+}
+
+static int check_merge(const struct tb_frame* frames, size_t n,
+		       const struct trace_stats* whole, size_t n_chunks)
+{
+	struct trace_stats* merged = ts_new();
+	ASSERT_TRUE(merged);
+
+	for (size_t c = 0; c < n_chunks; ++c) {
+		struct trace_stats* part = ts_new();
+		ASSERT_TRUE(part);
+
+		for (size_t i = n * c / n_chunks; i < n * (c + 1) / n_chunks;
+		     ++i)
+			ASSERT_INT_EQ(0, ts_add(part, &frames[i]));
+
+		ASSERT_INT_EQ(0, ts_merge(merged, part));
+		ts_free(part);
+	}
+
+	ASSERT_INT_EQ(0, check_stats_eq(whole, merged));
+
+	ts_free(merged);
+	return 0;
+}
+
+int test_merge_equals_single_pass(void)
+{
+	struct tb_frame* frames = malloc(N_FRAMES * sizeof(*frames));
+	ASSERT_TRUE(frames);
+
+	size_t n = make_frames(frames);
+
+	struct trace_stats* whole = ts_new();
+	ASSERT_TRUE(whole);
+	for (size_t i = 0; i < n; ++i)
+		ASSERT_INT_EQ(0, ts_add(whole, &frames[i]));
+
+	ASSERT_TRUE(whole->node[2].sdo.count > 0);
+	ASSERT_TRUE(whole->node[3].sdo.count > 0);
+	ASSERT_TRUE(whole->node[4].sdo.count > 0);
+
+	/* As with canopen-dump -j, and many small chunks so that SDO
+	 * transactions straddle the borders
+	 */
+	for (size_t n_chunks = 1; n_chunks <= 16; ++n_chunks)
+		ASSERT_INT_EQ(0, check_merge(frames, n, whole, n_chunks));
+
+	ASSERT_INT_EQ(0, check_merge(frames, n, whole, 97));
+
+	ts_free(whole);
+	free(frames);
+	return 0;
+}
+
+int test_load_span_is_capped(void)
+{
+	struct trace_stats* stats = ts_new();
+	struct tb_frame frame = { .timestamp = 1000000, .cf.can_id = 0x80 };
+	ASSERT_TRUE(stats);
+
+	ASSERT_INT_EQ(0, ts_add(stats, &frame));
+	frame.timestamp = UINT64_MAX;
+	ASSERT_INT_EQ(0, ts_add(stats, &frame));
+
+	ASSERT_INT_EQ(1, stats->load_length);
+	ASSERT_UINT_EQ(ts_frame_bits(&frame.cf), stats->load_skipped);
+
+	ts_free(stats);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_frame_bits);
+	RUN_TEST(test_sdo_latency);
+	RUN_TEST(test_merge_equals_single_pass);
+	RUN_TEST(test_load_span_is_capped);
+	return r;
+}
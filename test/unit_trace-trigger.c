@@ -0,0 +1,207 @@
+#include "tst.h"
+#include "trace-trigger.h"
+#include "canopen/sdo.h"
+#include "socketcan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MS 1000000ULL
+
+static struct trace_trigger tt_;
+static int n_fired_;
+static enum tt_type last_type_;
+static int last_nodeid_;
+
+static void on_fire(struct trace_trigger* self,
+		    const struct tt_trigger* trigger, int nodeid,
+		    void* context)
+{
+	(void)self;
+	(void)context;
+
+	n_fired_++;
+	last_type_ = trigger->type;
+	last_nodeid_ = nodeid;
+}
+
+static void init(const char* spec)
+{
+	n_fired_ = 0;
+	last_type_ = -1;
+	last_nodeid_ = -1;
+	tt_init(&tt_, spec, on_fire, NULL);
+}
+
+static struct can_frame make_frame(uint32_t id, int dlc, const char* data)
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = id;
+	cf.can_dlc = dlc;
+	memcpy(cf.data, data, dlc);
+	return cf;
+}
+
+int test_parse(void)
+{
+	ASSERT_INT_EQ(0, tt_init(&tt_, "", NULL, NULL));
+	ASSERT_INT_EQ(0, tt_.n_triggers);
+
+	ASSERT_INT_EQ(0, tt_init(&tt_, "emcy pre=5000; sdo-abort=06020000 node=5;"
+				 " rate=4000 post=2000 ; heartbeat-loss",
+				 NULL, NULL));
+	ASSERT_INT_EQ(4, tt_.n_triggers);
+
+	ASSERT_INT_EQ(TT_EMCY, tt_.trigger[0].type);
+	ASSERT_FALSE(tt_.trigger[0].has_value);
+	ASSERT_INT_EQ(5000, tt_.trigger[0].pre);
+	ASSERT_INT_EQ(TT_DEFAULT_POST, tt_.trigger[0].post);
+
+	ASSERT_INT_EQ(TT_SDO_ABORT, tt_.trigger[1].type);
+	ASSERT_INT_EQ(0x06020000, tt_.trigger[1].value);
+	ASSERT_INT_EQ(5, tt_.trigger[1].nodeid);
+
+	ASSERT_INT_EQ(TT_RATE, tt_.trigger[2].type);
+	ASSERT_INT_EQ(4000, tt_.trigger[2].value);
+	ASSERT_INT_EQ(2000, tt_.trigger[2].post);
+	ASSERT_INT_EQ(400, tt_.rate_limit);
+
+	ASSERT_INT_EQ(TT_HEARTBEAT_LOSS, tt_.trigger[3].type);
+
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "foo", NULL, NULL));
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "cob", NULL, NULL));
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "cob=800", NULL, NULL));
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "emcy node=128", NULL, NULL));
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "emcy bar=1", NULL, NULL));
+	ASSERT_INT_EQ(-1, tt_init(&tt_, "rate=5", NULL, NULL));
+	ASSERT_INT_EQ(0, tt_.n_triggers);
+
+	/* Too long to fit in TT_SPEC_MAX with the terminator */
+	char spec[TT_SPEC_MAX + 1];
+	memset(spec, ' ', sizeof(spec));
+	memcpy(spec, "emcy", 4);
+	spec[TT_SPEC_MAX] = '\0';
+	ASSERT_INT_EQ(-1, tt_init(&tt_, spec, NULL, NULL));
+	spec[TT_SPEC_MAX - 1] = '\0';
+	ASSERT_INT_EQ(0, tt_init(&tt_, spec, NULL, NULL));
+	ASSERT_INT_EQ(1, tt_.n_triggers);
+	return 0;
+}
+
+int test_cob(void)
+{
+	init("cob=181");
+
+	struct can_frame cf = make_frame(0x182, 0, "");
+	tt_check(&tt_, &cf, 0);
+	ASSERT_INT_EQ(0, n_fired_);
+
+	cf = make_frame(0x181, 0, "");
+	tt_check(&tt_, &cf, 0);
+	ASSERT_INT_EQ(1, n_fired_);
+	ASSERT_INT_EQ(TT_COB, last_type_);
+	ASSERT_INT_EQ(1, last_nodeid_);
+	return 0;
+}
+
+int test_emcy(void)
+{
+	init("emcy=8130 holdoff=0; emcy node=3");
+
+	struct can_frame reset = make_frame(0x83, 8, "\0\0\0\0\0\0\0\0");
+	tt_check(&tt_, &reset, 0);
+	ASSERT_INT_EQ(0, n_fired_);
+
+	struct can_frame other = make_frame(0x83, 8, "\x10\x81\0\0\0\0\0\0");
+	tt_check(&tt_, &other, 0);
+	ASSERT_INT_EQ(1, n_fired_);
+	ASSERT_INT_EQ(3, last_nodeid_);
+
+	struct can_frame other_node = make_frame(0x84, 8, "\x30\x81\0\0\0\0\0\0");
+	tt_check(&tt_, &other_node, 0);
+	ASSERT_INT_EQ(2, n_fired_);
+	ASSERT_INT_EQ(4, last_nodeid_);
+	return 0;
+}
+
+int test_sdo_abort(void)
+{
+	init("sdo-abort=06020000");
+
+	struct can_frame cf = make_frame(0x585, 8, "\x80\0\x10\0\0\0\x02\x06");
+	tt_check(&tt_, &cf, 0);
+	ASSERT_INT_EQ(1, n_fired_);
+	ASSERT_INT_EQ(5, last_nodeid_);
+
+	init("sdo-abort");
+
+	cf = make_frame(0x605, 8, "\x40\0\x10\0\0\0\0\0");
+	tt_check(&tt_, &cf, 0);
+	ASSERT_INT_EQ(0, n_fired_);
+
+	cf = make_frame(0x605, 8, "\x80\0\x10\0\0\0\x04\x05");
+	tt_check(&tt_, &cf, 0);
+	ASSERT_INT_EQ(1, n_fired_);
+	return 0;
+}
+
+int test_holdoff(void)
+{
+	init("cob=80 holdoff=100");
+
+	struct can_frame cf = make_frame(0x80, 0, "");
+
+	tt_check(&tt_, &cf, 1000 * MS);
+	tt_check(&tt_, &cf, 1050 * MS);
+	ASSERT_INT_EQ(1, n_fired_);
+
+	tt_check(&tt_, &cf, 1100 * MS);
+	ASSERT_INT_EQ(2, n_fired_);
+	ASSERT_INT_EQ(2, tt_.trigger[0].n_fired);
+	return 0;
+}
+
+int test_rate(void)
+{
+	init("rate=100 holdoff=0");
+
+	struct can_frame cf = make_frame(0x181, 8, "\0\0\0\0\0\0\0\0");
+
+	/* 10 frames per period is the limit */
+	for (int i = 0; i < 10; ++i)
+		tt_check(&tt_, &cf, 1000 * MS + i * MS);
+	ASSERT_INT_EQ(0, n_fired_);
+
+	/* A new period starts */
+	for (int i = 0; i < 20; ++i)
+		tt_check(&tt_, &cf, 1100 * MS + i * MS);
+	ASSERT_INT_EQ(1, n_fired_);
+	ASSERT_INT_EQ(TT_RATE, last_type_);
+	return 0;
+}
+
+int test_event(void)
+{
+	init("heartbeat-loss node=7; cob=181");
+
+	tt_event(&tt_, TT_HEARTBEAT_LOSS, 6, 0);
+	ASSERT_INT_EQ(0, n_fired_);
+
+	tt_event(&tt_, TT_HEARTBEAT_LOSS, 7, 0);
+	ASSERT_INT_EQ(1, n_fired_);
+	ASSERT_INT_EQ(7, last_nodeid_);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parse);
+	RUN_TEST(test_cob);
+	RUN_TEST(test_emcy);
+	RUN_TEST(test_sdo_abort);
+	RUN_TEST(test_holdoff);
+	RUN_TEST(test_rate);
+	RUN_TEST(test_event);
+	return r;
+}